@@ -0,0 +1,194 @@
+/** Includes *************************************************************************************/
+#include <stdlib.h>
+#include "simnetif.h"
+#include "bench.h"
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+typedef struct
+{
+    client_t *client;
+    int client_task_id;
+    bench_done_fn_t done;
+    void *done_arg;
+    bool finished;
+} Bench_t;
+
+/** Variables ************************************************************************************/
+static Bench_t Bench = {
+    .client = NULL,
+    .client_task_id = -1,
+};
+
+/** Prototypes ***********************************************************************************/
+/** Private Function Prototypes ******************************************************************/
+static int _bench_wifi_task(void *arg);
+static int _bench_client_task(void *arg);
+static int _bench_done_task(void *arg);
+static int _bench_compare(const void *a, const void *b);
+
+/** Function Definitions *************************************************************************/
+int bench_init(client_t *client, const char *server_ip)
+{
+    if (wifi_init(SSID, PASSWORD) != 0)
+    {
+        return -1;
+    }
+
+    if (client_init(client, server_ip != NULL ? server_ip : SIMNETIF_SERVER_IP) != 0)
+    {
+        return -1;
+    }
+
+    Bench.client = client;
+
+    /** Same tasks and periods as main.c, the stop condition is checked on every wake-up */
+    sched_init();
+    sched_add(_bench_wifi_task, client, WIFI_TASK_INTERVAL_MS);
+    Bench.client_task_id = sched_add(_bench_client_task, client, CLIENT_TASK_TIMEOUT_MS);
+    sched_add(_bench_done_task, NULL, 0);
+
+    return 0;
+}
+
+bool bench_run_until(bench_done_fn_t done, void *arg, uint32_t timeout_ms)
+{
+    absolute_time_t deadline = make_timeout_time_ms(timeout_ms);
+
+    Bench.done = done;
+    Bench.done_arg = arg;
+    Bench.finished = false;
+
+    while (!Bench.finished && !time_reached(deadline))
+    {
+        sched_run();
+    }
+
+    Bench.done = NULL;
+
+    return Bench.finished;
+}
+
+void bench_run_for(uint32_t ms)
+{
+    bench_run_until(NULL, NULL, ms);
+}
+
+bool bench_client_connected(void *arg)
+{
+    return ((client_t *)arg)->state == CLIENT_CONNECTED;
+}
+
+bool bench_client_disconnected(void *arg)
+{
+    return ((client_t *)arg)->state != CLIENT_CONNECTED;
+}
+
+long bench_env(const char *name, long fallback)
+{
+    const char *value = getenv(name);
+
+    return value != NULL ? strtol(value, NULL, 0) : fallback;
+}
+
+int bench_samples_init(bench_samples_t *samples, uint32_t capacity)
+{
+    samples->samples = calloc(capacity, sizeof(uint32_t));
+    samples->count = 0;
+    samples->capacity = capacity;
+
+    return samples->samples != NULL ? 0 : -1;
+}
+
+void bench_samples_add(bench_samples_t *samples, uint32_t value)
+{
+    if (samples->count < samples->capacity)
+    {
+        samples->samples[samples->count++] = value;
+    }
+}
+
+uint32_t bench_samples_percentile(bench_samples_t *samples, double percentile)
+{
+    if (samples->count == 0)
+    {
+        return 0;
+    }
+
+    qsort(samples->samples, samples->count, sizeof(uint32_t), _bench_compare);
+
+    uint32_t index = (uint32_t)(percentile / 100.0 * (samples->count - 1) + 0.5);
+
+    return samples->samples[index];
+}
+
+void bench_report(const char *bench, const char *key, double value, const char *unit)
+{
+    printf("%s %s=%.3f %s\n", bench, key, value, unit);
+    fflush(stdout);
+}
+
+/**
+ * @brief Wi-Fi task, as in main.c.
+ */
+static int _bench_wifi_task(void *arg)
+{
+    client_t *client = (client_t *)arg;
+    WifiTaskState_t previous = wifi_get_state();
+
+    wifi_task();
+    wifi_pm_update(client->stats.tx_bytes + client->stats.rx_bytes, client_tx_pending(client));
+
+    if (wifi_get_state() != WIFI_TASK_CONNECTED)
+    {
+        if (client->state == CLIENT_CONNECTED || client->connecting)
+        {
+            client_close(client);
+        }
+    }
+    else if (previous != WIFI_TASK_CONNECTED)
+    {
+        client_reconnect_reset(client);
+        sched_wake(Bench.client_task_id);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Client task, as in main.c.
+ */
+static int _bench_client_task(void *arg)
+{
+    if (wifi_get_state() != WIFI_TASK_CONNECTED)
+    {
+        return 0;
+    }
+
+    return client_task((client_t *)arg);
+}
+
+/**
+ * @brief Check the stop condition on every wake-up.
+ */
+static int _bench_done_task(void *arg)
+{
+    LWIP_UNUSED_ARG(arg);
+
+    if (Bench.done != NULL && Bench.done(Bench.done_arg))
+    {
+        Bench.finished = true;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief qsort comparison for samples.
+ */
+static int _bench_compare(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
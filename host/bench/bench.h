@@ -0,0 +1,106 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+/** Includes *************************************************************************************/
+#include <stdlib.h>
+#include "pico/stdlib.h"
+#include "client.h"
+#include "wifi.h"
+#include "wifi_pm.h"
+#include "sched.h"
+#include "pico/cyw43_arch.h"
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Callback telling bench_run_until() to stop */
+typedef bool (*bench_done_fn_t)(void *arg);
+
+/** Collected samples, e.g. latencies in microseconds */
+typedef struct
+{
+    uint32_t *samples;
+    uint32_t count;
+    uint32_t capacity;
+} bench_samples_t;
+
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Bring up the simulated radio and the client, scheduled the same way as main.c.
+ * @param client Client to run.
+ * @param server_ip Server address, NULL for the bundled server.
+ * @return int 0 on success, -1 on failure.
+ */
+int bench_init(client_t *client, const char *server_ip);
+
+/**
+ * @brief Run the scheduler until done returns true or the timeout expires.
+ * @param done Stop condition, checked on every wake-up.
+ * @param arg Argument for done.
+ * @param timeout_ms Timeout in milliseconds.
+ * @return bool true if done returned true, false on timeout.
+ */
+bool bench_run_until(bench_done_fn_t done, void *arg, uint32_t timeout_ms);
+
+/**
+ * @brief Run the scheduler for a fixed time.
+ * @param ms Time to run for in milliseconds.
+ * @return None.
+ */
+void bench_run_for(uint32_t ms);
+
+/**
+ * @brief Stop condition that waits for the client to connect.
+ * @param arg Pointer to the client structure.
+ * @return bool true once connected.
+ */
+bool bench_client_connected(void *arg);
+
+/**
+ * @brief Stop condition that waits for the client to disconnect.
+ * @param arg Pointer to the client structure.
+ * @return bool true once disconnected.
+ */
+bool bench_client_disconnected(void *arg);
+
+/**
+ * @brief Read an integer setting from the environment.
+ * @param name Variable name.
+ * @param fallback Value when the variable is not set.
+ * @return long The value.
+ */
+long bench_env(const char *name, long fallback);
+
+/**
+ * @brief Allocate storage for samples.
+ * @param samples Sample set.
+ * @param capacity Maximum number of samples.
+ * @return int 0 on success, -1 on failure.
+ */
+int bench_samples_init(bench_samples_t *samples, uint32_t capacity);
+
+/**
+ * @brief Add a sample, dropped once the set is full.
+ * @param samples Sample set.
+ * @param value Sample value.
+ * @return None.
+ */
+void bench_samples_add(bench_samples_t *samples, uint32_t value);
+
+/**
+ * @brief Get a percentile. Sorts the samples.
+ * @param samples Sample set.
+ * @param percentile Percentile from 0 to 100.
+ * @return uint32_t The value, 0 if there are no samples.
+ */
+uint32_t bench_samples_percentile(bench_samples_t *samples, double percentile);
+
+/**
+ * @brief Print one result line as name key=value.
+ * @param bench Benchmark name.
+ * @param key Metric name.
+ * @param value Metric value.
+ * @param unit Unit of the value.
+ * @return None.
+ */
+void bench_report(const char *bench, const char *key, double value, const char *unit);
+
+#endif /* _BENCH_H_ */
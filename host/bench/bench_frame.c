@@ -0,0 +1,171 @@
+/** Includes *************************************************************************************/
+#include <string.h>
+#include "sim_server.h"
+#include "bench.h"
+#include "frame.h"
+/** Defines **************************************************************************************/
+/** Message type of the frames the server sends */
+#define BENCH_FRAME_TYPE 1
+
+/** Time allowed for a frame to arrive */
+#define BENCH_FRAME_TIMEOUT_MS 10000
+
+/** Typedefs *************************************************************************************/
+typedef struct
+{
+    client_t *client;
+    frame_decoder_t decoder;
+    uint32_t frames;
+    uint32_t len;           /** Payload length of the last frame */
+    bool intact;            /** The last payload matched what was sent */
+} Frame_t;
+
+/** Variables ************************************************************************************/
+static client_t Client;
+static Frame_t Frame = {
+    .client = &Client,
+};
+
+/** Payload sent in every case, a counting pattern */
+static uint8_t Payload[FRAME_MAX_PAYLOAD];
+
+/** Private Function Prototypes ******************************************************************/
+static int _frame_measure(const char *name, uint16_t segment);
+static bool _frame_arrived(void *arg);
+static int _frame_app_task(void *arg);
+static void _frame_handler(void *arg, const frame_t *frame);
+
+/** Function Definitions *************************************************************************/
+int main(int argc, char **argv)
+{
+    LWIP_UNUSED_ARG(argc);
+    LWIP_UNUSED_ARG(argv);
+
+    for (uint32_t i = 0; i < sizeof(Payload); i++)
+    {
+        Payload[i] = (uint8_t)i;
+    }
+
+    if (bench_init(&Client, NULL) != 0 || sim_server_start(SIM_SERVER_PORT, SIM_SERVER_SINK) != 0 ||
+        frame_decoder_init(&Frame.decoder) != 0 ||
+        frame_register(&Frame.decoder, BENCH_FRAME_TYPE, _frame_handler, &Frame) != 0)
+    {
+        printf("Failed to initialise benchmark\n");
+        return 1;
+    }
+    sched_add(_frame_app_task, &Frame, 0);
+
+    if (!bench_run_until(bench_client_connected, &Client, BENCH_FRAME_TIMEOUT_MS))
+    {
+        printf("Client did not connect\n");
+        return 1;
+    }
+
+    /**
+     * The largest frame in one segment, then in more segments than the client receive queue has
+     * slots, so the queue has to chain them for the frame to ever be complete.
+     */
+    if (_frame_measure("whole", TCP_MSS) != 0 || _frame_measure("split_32", 32) != 0 ||
+        _frame_measure("split_8", 8) != 0)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Have the server send the largest frame in segments and wait for it to be decoded.
+ * @param name Name of the case in the results.
+ * @param segment Bytes per segment.
+ * @return int 0 on success, -1 if the frame did not arrive intact.
+ */
+static int _frame_measure(const char *name, uint16_t segment)
+{
+    static uint8_t msg[FRAME_HEADER_MAX + FRAME_MAX_PAYLOAD];
+    uint32_t len = 0;
+
+    /** Varint length, then the type, without a CRC */
+    uint32_t value = sizeof(Payload);
+    do
+    {
+        msg[len] = (uint8_t)(value & 0x7f);
+        value >>= 7;
+        msg[len++] |= value != 0 ? 0x80 : 0;
+    } while (value != 0);
+    msg[len++] = BENCH_FRAME_TYPE;
+
+    memcpy(msg + len, Payload, sizeof(Payload));
+    len += sizeof(Payload);
+
+    uint32_t frames = Frame.frames;
+    absolute_time_t start = get_absolute_time();
+    if (sim_server_send_split(msg, len, segment) != 0)
+    {
+        printf("%s: server did not send\n", name);
+        return -1;
+    }
+
+    if (!bench_run_until(_frame_arrived, &frames, BENCH_FRAME_TIMEOUT_MS))
+    {
+        printf("%s: frame did not arrive, %lu bytes queued\n", name, (unsigned long)client_rx_available(&Client));
+        return -1;
+    }
+
+    bench_report(name, "segments", (len + segment - 1) / segment, "");
+    bench_report(name, "delivered", absolute_time_diff_us(start, get_absolute_time()) / 1e3, "ms");
+    bench_report(name, "decoder_copies", Frame.decoder.stats.copied, "");
+
+    if (!Frame.intact || Frame.len != sizeof(Payload))
+    {
+        printf("%s: frame corrupted\n", name);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Stop condition that waits for the next frame.
+ * @param arg Frame count to wait past.
+ * @return bool true once a frame arrived.
+ */
+static bool _frame_arrived(void *arg)
+{
+    return Frame.frames != *(uint32_t *)arg;
+}
+
+/**
+ * @brief Decode the frames as soon as they are complete.
+ * @param arg Pointer to the benchmark state.
+ * @return int 0 on success, -1 on a framing error.
+ */
+static int _frame_app_task(void *arg)
+{
+    Frame_t *frame = (Frame_t *)arg;
+
+    if (frame->client->state == CLIENT_CONNECTED && frame_poll(&frame->decoder, frame->client) < 0)
+    {
+        printf("Framing error\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Check a received frame against the payload sent.
+ * @param arg Pointer to the benchmark state.
+ * @param frame The frame.
+ * @return None.
+ */
+static void _frame_handler(void *arg, const frame_t *frame)
+{
+    Frame_t *bench = (Frame_t *)arg;
+    static uint8_t payload[FRAME_MAX_PAYLOAD];
+
+    bench->len = frame->len;
+    bench->intact = frame_copy(frame, 0, payload, sizeof(payload)) == (int)frame->len &&
+                    memcmp(payload, Payload, frame->len) == 0;
+    bench->frames++;
+}
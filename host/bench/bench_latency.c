@@ -0,0 +1,116 @@
+/** Includes *************************************************************************************/
+#include "sim_server.h"
+#include "bench.h"
+/** Defines **************************************************************************************/
+/** Interval between timestamped messages */
+#define BENCH_STAMP_INTERVAL_US 1000
+
+/** Samples kept, more than enough for a minute at the default interval */
+#define BENCH_MAX_SAMPLES 100000
+
+/** Typedefs *************************************************************************************/
+typedef struct
+{
+    client_t *client;
+    bench_samples_t samples;
+    uint32_t next_seq;
+    uint32_t lost;
+} Latency_t;
+
+/** Variables ************************************************************************************/
+static client_t Client;
+static Latency_t Latency = {
+    .client = &Client,
+};
+
+/** Private Function Prototypes ******************************************************************/
+static int _latency_app_task(void *arg);
+
+/** Function Definitions *************************************************************************/
+int main(int argc, char **argv)
+{
+    uint32_t duration_ms = (uint32_t)(argc > 1 ? atol(argv[1]) : bench_env("BENCH_DURATION_MS", 5000));
+    uint32_t interval_us = (uint32_t)bench_env("BENCH_STAMP_INTERVAL_US", BENCH_STAMP_INTERVAL_US);
+    bool udp = bench_env("BENCH_UDP", 0) != 0;
+
+    /** BENCH_PM=0 leaves the radio in the driver's default power mode, for comparison */
+    wifi_pm_set_enabled(bench_env("BENCH_PM", 1) != 0);
+
+    if (bench_init(&Client, NULL) != 0 || sim_server_start(SIM_SERVER_PORT, SIM_SERVER_STAMP) != 0 ||
+        bench_samples_init(&Latency.samples, BENCH_MAX_SAMPLES) != 0)
+    {
+        printf("Failed to initialise benchmark\n");
+        return 1;
+    }
+
+    if (udp)
+    {
+        client_set_transport(&Client, CLIENT_TRANSPORT_UDP);
+    }
+
+    sim_server_set_stamp_interval(interval_us);
+    sched_add(sim_server_task, NULL, interval_us / 1000 > 0 ? interval_us / 1000 : 1);
+    sched_add(_latency_app_task, &Latency, 0);
+
+    if (!bench_run_until(bench_client_connected, &Client, 10000))
+    {
+        printf("Client did not connect\n");
+        return 1;
+    }
+
+    if (udp)
+    {
+        /** The server sends to whoever it heard from last */
+        client_write(&Client, "hello", 5);
+    }
+
+    bench_run_for(duration_ms);
+
+    /** Latency from the server writing the message to the application reading it */
+    bench_report("latency", "samples", Latency.samples.count, "");
+    bench_report("latency", "lost", Latency.lost, "");
+    bench_report("latency", "p50", bench_samples_percentile(&Latency.samples, 50), "us");
+    bench_report("latency", "p99", bench_samples_percentile(&Latency.samples, 99), "us");
+    bench_report("latency", "max", bench_samples_percentile(&Latency.samples, 100), "us");
+    if (udp)
+    {
+        bench_report("latency", "udp_lost", Client.udp_stats.rx_lost, "");
+        bench_report("latency", "udp_reordered", Client.udp_stats.rx_reordered, "");
+        bench_report("latency", "udp_dropped", Client.udp_stats.rx_dropped, "");
+    }
+
+    const wifi_pm_stats_t *pm = wifi_pm_stats();
+    bench_report("wifi_pm", "powersave", (double)pm->powersave_ms, "ms");
+    bench_report("wifi_pm", "performance", (double)pm->performance_ms, "ms");
+    bench_report("wifi_pm", "switches", pm->to_performance + pm->to_powersave, "");
+
+    return 0;
+}
+
+/**
+ * @brief Read timestamped messages as soon as they arrive and record their age.
+ * @param arg Pointer to the benchmark state.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _latency_app_task(void *arg)
+{
+    Latency_t *latency = (Latency_t *)arg;
+    uint8_t msg[SIM_SERVER_STAMP_SIZE];
+
+    while (client_peek(latency->client, msg, sizeof(msg)) == sizeof(msg))
+    {
+        uint32_t seq;
+        uint64_t sent_us = sim_server_stamp_decode(msg, &seq);
+
+        client_consume(latency->client, sizeof(msg));
+        bench_samples_add(&latency->samples, (uint32_t)(time_us_64() - sent_us));
+
+        if (seq > latency->next_seq && latency->samples.count > 1)
+        {
+            latency->lost += seq - latency->next_seq;
+        }
+        latency->next_seq = seq + 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,252 @@
+/** Includes *************************************************************************************/
+#include <string.h>
+#include "sim_server.h"
+#include "bench.h"
+#include "mqtt.h"
+/** Defines **************************************************************************************/
+/** Size of a message, a block of telemetry */
+#define BENCH_MESSAGE_SIZE 64
+
+/** Time allowed for one phase */
+#define BENCH_MQTT_TIMEOUT_MS 60000
+
+/** Topics, the loopback ones come back through the subscription */
+#define BENCH_TOPIC_DATA "bench/data"
+#define BENCH_TOPIC_LOOP "bench/loop/x"
+#define BENCH_FILTER_LOOP "bench/loop/#"
+
+/** Typedefs *************************************************************************************/
+typedef struct
+{
+    const char *topic;
+    uint32_t produce;    /** Publishes still to queue in this phase */
+    uint32_t done;       /** Publishes whose done callback ran */
+    uint32_t failed;     /** Of those, the ones reported as lost */
+    uint32_t received;   /** Loopback messages received, resent ones may come twice */
+    uint32_t expected;   /** Loopback messages published so far */
+    uint32_t mismatches;
+    absolute_time_t queued_at[MQTT_QUEUE_MAX];
+    bench_samples_t latency;
+} Mqtt_t;
+
+/** Variables ************************************************************************************/
+static client_t Client;
+static mqtt_t Mqtt;
+static Mqtt_t Bench;
+
+/** Referenced by every publish, so it never changes */
+static uint8_t Message[BENCH_MESSAGE_SIZE];
+
+/** Private Function Prototypes ******************************************************************/
+static int _mqtt_app_task(void *arg);
+static void _mqtt_done(void *arg, int status);
+static void _mqtt_message(void *arg, const char *topic, uint16_t topic_len, const uint8_t *payload, uint16_t len);
+static int _mqtt_phase(const char *topic, uint32_t messages);
+static bool _mqtt_connected(void *arg);
+static bool _mqtt_finished(void *arg);
+
+/** Function Definitions *************************************************************************/
+int main(int argc, char **argv)
+{
+    uint32_t messages = (uint32_t)(argc > 1 ? atol(argv[1]) : bench_env("BENCH_MESSAGES", 1000));
+    const char *broker = getenv("BENCH_SERVER_IP");
+
+    for (int i = 0; i < BENCH_MESSAGE_SIZE; i++)
+    {
+        Message[i] = (uint8_t)(i * 7);
+    }
+
+    /** The bundled broker by default, a real one at BENCH_SERVER_IP and BENCH_MQTT_PORT */
+    if (bench_init(&Client, broker) != 0 ||
+        (broker != NULL ? client_init_endpoint(&Client, broker, (uint16_t)bench_env("BENCH_MQTT_PORT", MQTT_PORT))
+                        : sim_server_start(SIM_SERVER_PORT, SIM_SERVER_MQTT)) != 0 ||
+        mqtt_init(&Mqtt, "pico-bench", NULL, NULL) != 0 ||
+        mqtt_subscribe(&Mqtt, BENCH_FILTER_LOOP, 1, _mqtt_message, &Bench) != 0 ||
+        bench_samples_init(&Bench.latency, messages) != 0)
+    {
+        printf("Failed to initialise benchmark\n");
+        return 1;
+    }
+
+    sched_add(_mqtt_app_task, &Bench, 0);
+
+    if (!bench_run_until(_mqtt_connected, &Mqtt, BENCH_MQTT_TIMEOUT_MS))
+    {
+        printf("MQTT session did not come up\n");
+        return 1;
+    }
+
+    /** Rate and PUBACK latency with stop and wait, a small window and the whole queue */
+    static const uint8_t windows[] = {1, 4, MQTT_QUEUE_MAX};
+    for (size_t w = 0; w < sizeof(windows); w++)
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "window_%u", windows[w]);
+        mqtt_set_window(&Mqtt, windows[w]);
+        Bench.latency.count = 0;
+
+        absolute_time_t start = get_absolute_time();
+        if (_mqtt_phase(BENCH_TOPIC_DATA, messages) != 0)
+        {
+            return 1;
+        }
+        double elapsed_us = (double)absolute_time_diff_us(start, get_absolute_time());
+
+        bench_report(name, "rate", elapsed_us > 0 ? messages * 1e6 / elapsed_us : 0, "msg/s");
+        bench_report(name, "puback_p50", bench_samples_percentile(&Bench.latency, 50), "us");
+        bench_report(name, "puback_p99", bench_samples_percentile(&Bench.latency, 99), "us");
+    }
+
+    /** Loopback through the subscription */
+    uint32_t loop = LWIP_MIN(messages, 100u);
+    uint32_t received = Bench.received;
+    Bench.expected += loop;
+    if (_mqtt_phase(BENCH_TOPIC_LOOP, loop) != 0)
+    {
+        return 1;
+    }
+    bench_report("loopback", "received", Bench.received - received, "");
+
+    /** Drop the connection halfway through, the session resumes and the unacknowledged are resent */
+    uint32_t connects = Mqtt.stats.connects;
+    Bench.produce = loop;
+    Bench.expected += loop;
+    bench_run_for(5);
+    if (broker == NULL)
+    {
+        sim_server_drop();
+    }
+    else
+    {
+        client_close(&Client);
+    }
+
+    received = Bench.received;
+    absolute_time_t start = get_absolute_time();
+    if (!bench_run_until(_mqtt_finished, &Bench, BENCH_MQTT_TIMEOUT_MS) || Mqtt.stats.connects == connects)
+    {
+        printf("Session did not resume, %lu of %lu publishes done\n", (unsigned long)Bench.done, (unsigned long)loop);
+        return 1;
+    }
+    bench_report("resume", "recover", (double)absolute_time_diff_us(start, get_absolute_time()) / 1e3, "ms");
+    bench_report("resume", "received", Bench.received - received, "");
+
+    const mqtt_stats_t *stats = &Mqtt.stats;
+    bench_report("mqtt", "connects", stats->connects, "");
+    bench_report("mqtt", "resumed", stats->resumed, "");
+    bench_report("mqtt", "resent", stats->resent, "");
+    bench_report("mqtt", "copied", stats->copied, "");
+    bench_report("mqtt", "failed", Bench.failed, "");
+    bench_report("mqtt", "mismatches", Bench.mismatches, "");
+    if (broker == NULL)
+    {
+        bench_report("server", "publishes", sim_server_stats()->mqtt_publishes, "");
+        bench_report("server", "forwarded", sim_server_stats()->mqtt_forwarded, "");
+    }
+
+    return Bench.failed > 0 || Bench.mismatches > 0 || stats->resumed == 0 ? 1 : 0;
+}
+
+/**
+ * @brief Run the session and keep the publish queue full.
+ * @param arg Pointer to the benchmark state.
+ * @return int 0.
+ */
+static int _mqtt_app_task(void *arg)
+{
+    Mqtt_t *bench = (Mqtt_t *)arg;
+
+    mqtt_task(&Mqtt, Client.state == CLIENT_CONNECTED ? &Client : NULL);
+
+    while (bench->produce > 0 && mqtt_pending(&Mqtt) < MQTT_QUEUE_MAX)
+    {
+        /** Slots are used in order, so the slot index finds the time it was queued */
+        uint32_t slot = (Mqtt.slot_head + Mqtt.slot_count) % MQTT_QUEUE_MAX;
+        bench->queued_at[slot] = get_absolute_time();
+        if (mqtt_publish(&Mqtt, bench->topic, Message, sizeof(Message), 1, false, _mqtt_done,
+                         &bench->queued_at[slot]) != 0)
+        {
+            break;
+        }
+        bench->produce--;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Done callback, records the time from queueing to the PUBACK.
+ * @param arg Time the publish was queued.
+ * @param status 0 if acknowledged.
+ * @return None.
+ */
+static void _mqtt_done(void *arg, int status)
+{
+    Bench.done++;
+    Bench.failed += status != 0 ? 1 : 0;
+    bench_samples_add(&Bench.latency, (uint32_t)absolute_time_diff_us(*(absolute_time_t *)arg, get_absolute_time()));
+}
+
+/**
+ * @brief Loopback subscription, checks the message came back whole.
+ * @param arg Pointer to the benchmark state.
+ * @param topic Topic.
+ * @param topic_len Length of the topic.
+ * @param payload Payload.
+ * @param len Length of the payload.
+ * @return None.
+ */
+static void _mqtt_message(void *arg, const char *topic, uint16_t topic_len, const uint8_t *payload, uint16_t len)
+{
+    Mqtt_t *bench = (Mqtt_t *)arg;
+
+    bench->received++;
+    if (topic_len != strlen(BENCH_TOPIC_LOOP) || memcmp(topic, BENCH_TOPIC_LOOP, topic_len) != 0 ||
+        len != sizeof(Message) || memcmp(payload, Message, len) != 0)
+    {
+        bench->mismatches++;
+    }
+}
+
+/**
+ * @brief Publish a number of messages and wait for all of them to be acknowledged, and come back on the loopback topic.
+ * @param topic Topic to publish on.
+ * @param messages Number of messages.
+ * @return int 0 on success, -1 on timeout.
+ */
+static int _mqtt_phase(const char *topic, uint32_t messages)
+{
+    uint32_t done = Bench.done;
+
+    Bench.topic = topic;
+    Bench.produce = messages;
+    if (!bench_run_until(_mqtt_finished, &Bench, BENCH_MQTT_TIMEOUT_MS))
+    {
+        printf("%lu of %lu publishes done on %s\n", (unsigned long)(Bench.done - done), (unsigned long)messages, topic);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Stop condition that waits for the session to come up.
+ * @param arg Pointer to the engine.
+ * @return bool true once connected.
+ */
+static bool _mqtt_connected(void *arg)
+{
+    return ((mqtt_t *)arg)->state == MQTT_CONNECTED;
+}
+
+/**
+ * @brief Stop condition that waits for every publish to be done, and every loopback message back.
+ * @param arg Pointer to the benchmark state.
+ * @return bool true once the queue is empty.
+ */
+static bool _mqtt_finished(void *arg)
+{
+    Mqtt_t *bench = (Mqtt_t *)arg;
+
+    return bench->produce == 0 && mqtt_pending(&Mqtt) == 0 && bench->received >= bench->expected;
+}
@@ -0,0 +1,244 @@
+/** Includes *************************************************************************************/
+#include <string.h>
+#include "sim_server.h"
+#include "bench.h"
+#include "frame.h"
+#include "outbox.h"
+/** Defines **************************************************************************************/
+/** Size of a message, a block of telemetry as main.c stores it */
+#define BENCH_MESSAGE_SIZE 128
+
+/** Time allowed for one phase */
+#define BENCH_OUTBOX_TIMEOUT_MS 60000
+
+/** Typedefs *************************************************************************************/
+typedef struct
+{
+    client_t *client;
+    uint32_t produce;   /** Messages still to send in the online phase */
+    uint32_t produced;  /** Messages sent or stored so far, numbers the next one */
+    uint32_t target;    /** Records the server end waits for */
+    uint32_t expected;  /** Next seq the server end wants, 0 before the first record */
+    uint32_t received;  /** Records that arrived in order */
+    uint32_t duplicates;
+    uint32_t gaps;
+    uint32_t mismatches;
+} Outbox_t;
+
+/** Variables ************************************************************************************/
+static client_t Client;
+static frame_decoder_t Decoder;
+static Outbox_t Bench = {
+    .client = &Client,
+};
+
+/** Private Function Prototypes ******************************************************************/
+static int _outbox_app_task(void *arg);
+static void _outbox_record_handler(void *arg, const frame_t *frame);
+static void _outbox_message(uint32_t n, uint8_t *data);
+static bool _outbox_wifi_down(void *arg);
+static bool _outbox_drained(void *arg);
+
+/** Function Definitions *************************************************************************/
+int main(int argc, char **argv)
+{
+    uint32_t messages = (uint32_t)(argc > 1 ? atol(argv[1]) : bench_env("BENCH_MESSAGES", 300));
+    uint8_t data[BENCH_MESSAGE_SIZE];
+
+    /** The echo server sends the records and the acks back, the acks reach the outbox that way */
+    if (bench_init(&Client, NULL) != 0 || sim_server_start(SIM_SERVER_PORT, SIM_SERVER_ECHO) != 0 ||
+        frame_decoder_init(&Decoder) != 0 || outbox_init(&Decoder) != 0 ||
+        frame_register(&Decoder, OUTBOX_FRAME_RECORD, _outbox_record_handler, &Bench) != 0)
+    {
+        printf("Failed to initialise benchmark\n");
+        return 1;
+    }
+
+    sched_add(_outbox_app_task, &Bench, 0);
+
+    if (!bench_run_until(bench_client_connected, &Client, BENCH_OUTBOX_TIMEOUT_MS))
+    {
+        printf("Client did not connect\n");
+        return 1;
+    }
+
+    /** Offline, every message goes to flash */
+    cyw43_shim_set_ap_available(false);
+    bench_run_until(_outbox_wifi_down, NULL, BENCH_OUTBOX_TIMEOUT_MS);
+
+    absolute_time_t start = get_absolute_time();
+    for (uint32_t i = 0; i < messages; i++)
+    {
+        _outbox_message(Bench.produced++, data);
+        if (outbox_send(NULL, data, sizeof(data)) != 0)
+        {
+            printf("Message %lu not stored\n", (unsigned long)i);
+            return 1;
+        }
+    }
+    outbox_flush();
+    bench_report("store", "per_message", (double)absolute_time_diff_us(start, get_absolute_time()) / messages, "us");
+    bench_report("store", "backlog", outbox_backlog(), "B");
+
+    /** Back online, time from connected to the last record acknowledged */
+    const outbox_stats_t *stats = outbox_stats();
+    uint32_t writes = stats->replay_writes;
+    uint32_t replayed = stats->replayed;
+    uint64_t bytes = stats->replayed_bytes;
+    cyw43_shim_set_ap_available(true);
+    if (!bench_run_until(bench_client_connected, &Client, BENCH_OUTBOX_TIMEOUT_MS))
+    {
+        printf("Client did not reconnect\n");
+        return 1;
+    }
+
+    start = get_absolute_time();
+    Bench.target = messages;
+    if (!bench_run_until(_outbox_drained, &Bench, BENCH_OUTBOX_TIMEOUT_MS))
+    {
+        printf("%lu of %lu records came back\n", (unsigned long)Bench.received, (unsigned long)messages);
+        return 1;
+    }
+    double drain_us = (double)absolute_time_diff_us(start, get_absolute_time());
+    writes = stats->replay_writes - writes;
+    replayed = stats->replayed - replayed;
+    bytes = stats->replayed_bytes - bytes;
+    bench_report("replay", "drain", drain_us / 1e3, "ms");
+    bench_report("replay", "rate", drain_us > 0 ? bytes * 1e3 / drain_us : 0, "KB/s");
+    bench_report("replay", "per_write", writes > 0 ? (double)replayed / writes : 0, "records");
+
+    /** Online, messages go straight out */
+    Bench.produce = messages;
+    Bench.target = 2 * messages;
+    if (!bench_run_until(_outbox_drained, &Bench, BENCH_OUTBOX_TIMEOUT_MS))
+    {
+        printf("%lu of %lu direct messages came back\n", (unsigned long)(Bench.received - messages),
+               (unsigned long)messages);
+        return 1;
+    }
+
+    bench_report("outbox", "direct", stats->direct, "");
+    bench_report("outbox", "programs", stats->programs, "");
+    bench_report("outbox", "erases", stats->erases, "");
+    bench_report("outbox", "dropped", stats->dropped, "");
+    bench_report("server", "received", Bench.received, "");
+    bench_report("server", "duplicates", Bench.duplicates, "");
+    bench_report("server", "gaps", Bench.gaps, "");
+    bench_report("server", "mismatches", Bench.mismatches, "");
+
+    return Bench.gaps > 0 || Bench.mismatches > 0 || Bench.received != 2 * messages ? 1 : 0;
+}
+
+/**
+ * @brief Dispatch the echoed frames, run the outbox and send the online messages.
+ * @param arg Pointer to the benchmark state.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _outbox_app_task(void *arg)
+{
+    Outbox_t *bench = (Outbox_t *)arg;
+    uint8_t data[BENCH_MESSAGE_SIZE];
+
+    if (bench->client->state == CLIENT_CONNECTED && frame_poll(&Decoder, bench->client) < 0)
+    {
+        printf("Framing error\n");
+        client_close(bench->client);
+        return -1;
+    }
+
+    outbox_task(bench->client);
+
+    /** Once the replay has caught up, one message per wake-up, like a fast sensor */
+    if (bench->produce > 0 && outbox_backlog() == 0 && bench->client->state == CLIENT_CONNECTED)
+    {
+        _outbox_message(bench->produced, data);
+        if (outbox_send(bench->client, data, sizeof(data)) == 0)
+        {
+            bench->produced++;
+            bench->produce--;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Check an echoed record as the server would and acknowledge it.
+ * @param arg Pointer to the benchmark state.
+ * @param frame The frame.
+ * @return None.
+ */
+static void _outbox_record_handler(void *arg, const frame_t *frame)
+{
+    Outbox_t *bench = (Outbox_t *)arg;
+    uint8_t in[4 + BENCH_MESSAGE_SIZE];
+    uint8_t data[BENCH_MESSAGE_SIZE];
+
+    if (frame_copy(frame, 0, in, sizeof(in)) != (int)sizeof(in))
+    {
+        bench->mismatches++;
+        return;
+    }
+
+    uint32_t seq = in[0] | in[1] << 8 | in[2] << 16 | (uint32_t)in[3] << 24;
+    if (bench->expected != 0 && seq < bench->expected)
+    {
+        /** Sent again after a reconnect, acknowledged once more in case the first ack was lost */
+        bench->duplicates++;
+        frame_send(bench->client, OUTBOX_FRAME_ACK, in, 4, false);
+        return;
+    }
+    if (bench->expected != 0 && seq > bench->expected)
+    {
+        bench->gaps++;
+    }
+
+    /** Messages are numbered in the order they were produced, offline and online alike */
+    _outbox_message(bench->received, data);
+    if (memcmp(&in[4], data, sizeof(data)) != 0)
+    {
+        bench->mismatches++;
+    }
+    bench->expected = seq + 1;
+    bench->received++;
+
+    frame_send(bench->client, OUTBOX_FRAME_ACK, in, 4, false);
+}
+
+/**
+ * @brief Fill a message with a pattern that depends on its number.
+ * @param n Message number.
+ * @param data BENCH_MESSAGE_SIZE bytes.
+ * @return None.
+ */
+static void _outbox_message(uint32_t n, uint8_t *data)
+{
+    for (int i = 0; i < BENCH_MESSAGE_SIZE; i++)
+    {
+        data[i] = (uint8_t)(n * 31 + i);
+    }
+}
+
+/**
+ * @brief Stop condition that waits for Wi-Fi to go down.
+ * @param arg Unused.
+ * @return bool true once Wi-Fi is not connected.
+ */
+static bool _outbox_wifi_down(void *arg)
+{
+    LWIP_UNUSED_ARG(arg);
+
+    return wifi_get_state() != WIFI_TASK_CONNECTED;
+}
+
+/**
+ * @brief Stop condition that waits for the server end to have every record of the phase.
+ * @param arg Pointer to the benchmark state.
+ * @return bool true once the records are in.
+ */
+static bool _outbox_drained(void *arg)
+{
+    Outbox_t *bench = (Outbox_t *)arg;
+
+    return bench->received >= bench->target && outbox_backlog() == 0;
+}
@@ -0,0 +1,245 @@
+/** Includes *************************************************************************************/
+#include "sim_server.h"
+#include "bench.h"
+#include "nvstore.h"
+#include "boot.h"
+#include "tls.h"
+#include "frame.h"
+#include "heartbeat.h"
+/** Defines **************************************************************************************/
+/** Time allowed for a single reconnect */
+#define BENCH_RECONNECT_TIMEOUT_MS 30000
+
+/** Variables ************************************************************************************/
+static client_t Client;
+static frame_decoder_t Decoder;
+static heartbeat_t Heartbeat;
+
+/** Private Function Prototypes ******************************************************************/
+static int _reconnect_measure(bench_samples_t *samples);
+static bool _reconnect_wifi_down(void *arg);
+static int _reconnect_app_task(void *arg);
+static void _reconnect_ping_handler(void *arg, const frame_t *frame);
+
+/** Function Definitions *************************************************************************/
+int main(int argc, char **argv)
+{
+    uint32_t runs = (uint32_t)(argc > 1 ? atol(argv[1]) : bench_env("BENCH_RUNS", 20));
+    bench_samples_t server_drop;
+    bench_samples_t link_loss;
+
+    /** A join that has to scan every channel first takes much longer than one straight to the AP */
+    cyw43_shim_set_join_delay_ms((uint32_t)bench_env("BENCH_JOIN_DELAY_MS", 100));
+    cyw43_shim_set_scan_delay_ms((uint32_t)bench_env("BENCH_SCAN_DELAY_MS", 1500));
+
+    /** Over TLS every reconnect is a handshake, resumed from the last session when the server allows */
+    bool tls = bench_env("BENCH_TLS", 0) != 0;
+    int started = tls ? sim_server_start_tls(SIM_SERVER_PORT, SIM_SERVER_ECHO)
+                      : sim_server_start(SIM_SERVER_PORT, SIM_SERVER_ECHO);
+
+    /** The echo server sends the pings back, they are taken as the pongs */
+    uint32_t interval_ms = (uint32_t)bench_env("BENCH_HEARTBEAT_MS", 1000);
+    if (frame_decoder_init(&Decoder) != 0 || heartbeat_init(&Heartbeat, &Decoder, interval_ms, 0) != 0 ||
+        frame_register(&Decoder, HEARTBEAT_FRAME_PING, _reconnect_ping_handler, &Heartbeat) != 0)
+    {
+        printf("Failed to initialise heartbeat\n");
+        return 1;
+    }
+
+    if (bench_init(&Client, NULL) != 0 || started != 0 ||
+        (tls && client_set_transport(&Client, CLIENT_TRANSPORT_TLS) != 0) ||
+        bench_samples_init(&server_drop, runs) != 0 || bench_samples_init(&link_loss, runs) != 0)
+    {
+        printf("Failed to initialise benchmark\n");
+        return 1;
+    }
+    sched_add(_reconnect_app_task, &Client, CLIENT_TASK_TIMEOUT_MS);
+
+    /** Cold start, radio join and TCP connect */
+    absolute_time_t start = get_absolute_time();
+    if (!bench_run_until(bench_client_connected, &Client, BENCH_RECONNECT_TIMEOUT_MS))
+    {
+        printf("Client did not connect\n");
+        return 1;
+    }
+    bench_report("cold", "connect", absolute_time_diff_us(start, get_absolute_time()) / 1e3, "ms");
+    bench_report("boot", "wifi_init", boot_time_ms(BOOT_PHASE_WIFI_INIT), "ms");
+    bench_report("boot", "wifi_up", boot_time_ms(BOOT_PHASE_WIFI_UP), "ms");
+    bench_report("boot", "connected", boot_time_ms(BOOT_PHASE_CONNECTED), "ms");
+
+    /** The server resets the connection, Wi-Fi stays up */
+    for (uint32_t i = 0; i < runs; i++)
+    {
+        sim_server_drop();
+        if (_reconnect_measure(&server_drop) != 0)
+        {
+            return 1;
+        }
+    }
+    bench_report("server_drop", "p50", bench_samples_percentile(&server_drop, 50) / 1e3, "ms");
+    bench_report("server_drop", "p99", bench_samples_percentile(&server_drop, 99) / 1e3, "ms");
+
+    /** The access point goes away and comes back, Wi-Fi has to rejoin first */
+    for (uint32_t i = 0; i < runs; i++)
+    {
+        cyw43_shim_set_ap_available(false);
+        bench_run_until(_reconnect_wifi_down, NULL, BENCH_RECONNECT_TIMEOUT_MS);
+        cyw43_shim_set_ap_available(true);
+        if (_reconnect_measure(&link_loss) != 0)
+        {
+            return 1;
+        }
+    }
+    bench_report("link_loss", "p50", bench_samples_percentile(&link_loss, 50) / 1e3, "ms");
+    bench_report("link_loss", "p99", bench_samples_percentile(&link_loss, 99) / 1e3, "ms");
+
+    /** The access point comes back on another channel, the cached one misses and a scan finds it */
+    bench_samples_t channel_change;
+    if (bench_samples_init(&channel_change, 1) != 0)
+    {
+        return 1;
+    }
+    cyw43_shim_set_ap_available(false);
+    bench_run_until(_reconnect_wifi_down, NULL, BENCH_RECONNECT_TIMEOUT_MS);
+    cyw43_shim_set_ap_channel(11);
+    cyw43_shim_set_ap_available(true);
+    if (_reconnect_measure(&channel_change) != 0)
+    {
+        return 1;
+    }
+    bench_report("channel_change", "reconnect", bench_samples_percentile(&channel_change, 50) / 1e3, "ms");
+
+    /** The server stops answering but the connection stays up, only the heartbeat notices */
+    bench_samples_t dead_peer;
+    if (bench_samples_init(&dead_peer, runs) != 0)
+    {
+        return 1;
+    }
+    for (uint32_t i = 0; i < runs; i++)
+    {
+        absolute_time_t silent = get_absolute_time();
+        sim_server_set_mode(SIM_SERVER_SINK);
+        if (!bench_run_until(bench_client_disconnected, &Client, BENCH_RECONNECT_TIMEOUT_MS))
+        {
+            printf("Dead peer not noticed\n");
+            return 1;
+        }
+        bench_samples_add(&dead_peer, (uint32_t)absolute_time_diff_us(silent, get_absolute_time()));
+
+        sim_server_set_mode(SIM_SERVER_ECHO);
+        if (!bench_run_until(bench_client_connected, &Client, BENCH_RECONNECT_TIMEOUT_MS))
+        {
+            printf("Client did not reconnect\n");
+            return 1;
+        }
+    }
+    bench_report("dead_peer", "p50", bench_samples_percentile(&dead_peer, 50) / 1e3, "ms");
+    bench_report("dead_peer", "p99", bench_samples_percentile(&dead_peer, 99) / 1e3, "ms");
+    bench_report("dead_peer", "bound", interval_ms + Heartbeat.misses * HEARTBEAT_TIMEOUT_MAX_MS, "ms");
+
+    const heartbeat_stats_t *beats = &Heartbeat.stats;
+    bench_report("heartbeat", "rtt_mean", beats->pongs > 0 ? (double)beats->rtt_total_us / beats->pongs : 0, "us");
+    bench_report("heartbeat", "rtt_min", beats->rtt_min_us, "us");
+    bench_report("heartbeat", "rtt_max", beats->rtt_max_us, "us");
+    bench_report("heartbeat", "pings", beats->pings, "");
+    bench_report("heartbeat", "missed", beats->missed, "");
+    bench_report("heartbeat", "dead", beats->dead, "");
+
+    /** How the joins went, and what they cost in flash writes */
+    const wifi_stats_t *wifi = wifi_stats();
+    const nvstore_stats_t *nvstore = nvstore_stats();
+    bench_report("wifi", "fast_joins", wifi->fast_joins, "");
+    bench_report("wifi", "scan_joins", wifi->scan_joins, "");
+    bench_report("wifi", "fast_join_failures", wifi->fast_join_failures, "");
+    bench_report("nvstore", "writes", nvstore->writes, "");
+    bench_report("nvstore", "skipped", nvstore->skipped, "");
+
+    if (tls)
+    {
+        const tls_stats_t *stats = tls_stats();
+        uint32_t full = stats->handshakes - stats->resumed;
+        bench_report("tls", "handshakes", stats->handshakes, "");
+        bench_report("tls", "resumed", stats->resumed, "");
+        bench_report("tls", "hit_rate", stats->offered > 0 ? 100.0 * stats->resumed / stats->offered : 0, "%");
+        bench_report("tls", "full_mean", full > 0 ? (double)stats->total_full_ms / full : 0, "ms");
+        bench_report("tls", "resumed_mean", stats->resumed > 0 ? (double)stats->total_resumed_ms / stats->resumed : 0, "ms");
+        bench_report("tls", "failures", stats->failures, "");
+    }
+
+    /** The client's own counters, as reported from the field */
+    bench_report("client", "attempts", Client.stats.connect_attempts, "");
+    bench_report("client", "successes", Client.stats.connect_successes, "");
+    bench_report("client", "failures", Client.stats.connect_failures, "");
+    bench_report("client", "mean", (double)Client.stats.total_connect_ms / Client.stats.connect_successes, "ms");
+    bench_report("client", "max", Client.stats.max_connect_ms, "ms");
+
+    return 0;
+}
+
+/**
+ * @brief Wait for the client to notice the disconnect, then time how long it takes to recover.
+ * @param samples Where to record the time to connected, in microseconds.
+ * @return int 0 on success, -1 on timeout.
+ */
+static int _reconnect_measure(bench_samples_t *samples)
+{
+    absolute_time_t start = get_absolute_time();
+
+    bench_run_until(bench_client_disconnected, &Client, BENCH_RECONNECT_TIMEOUT_MS);
+    if (!bench_run_until(bench_client_connected, &Client, BENCH_RECONNECT_TIMEOUT_MS))
+    {
+        printf("Client did not reconnect\n");
+        return -1;
+    }
+
+    bench_samples_add(samples, (uint32_t)absolute_time_diff_us(start, get_absolute_time()));
+
+    return 0;
+}
+
+/**
+ * @brief Stop condition that waits for Wi-Fi to go down.
+ * @param arg Unused.
+ * @return bool true once Wi-Fi is not connected.
+ */
+static bool _reconnect_wifi_down(void *arg)
+{
+    LWIP_UNUSED_ARG(arg);
+
+    return wifi_get_state() != WIFI_TASK_CONNECTED;
+}
+
+/**
+ * @brief Dispatch the echoed frames and run the heartbeat.
+ * @param arg Pointer to the client structure.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _reconnect_app_task(void *arg)
+{
+    client_t *client = (client_t *)arg;
+
+    if (client->state == CLIENT_CONNECTED && frame_poll(&Decoder, client) < 0)
+    {
+        client_close(client);
+        return -1;
+    }
+
+    return heartbeat_task(&Heartbeat, client);
+}
+
+/**
+ * @brief Take an echoed ping as its pong, the way a server would answer it.
+ * @param arg Pointer to the heartbeat.
+ * @param frame The frame.
+ * @return None.
+ */
+static void _reconnect_ping_handler(void *arg, const frame_t *frame)
+{
+    uint8_t ping[8];
+
+    if (frame_copy(frame, 0, ping, sizeof(ping)) == sizeof(ping))
+    {
+        heartbeat_pong((heartbeat_t *)arg, ping[0] | ping[1] << 8 | ping[2] << 16 | (uint32_t)ping[3] << 24,
+                       ping[4] | ping[5] << 8 | ping[6] << 16 | (uint32_t)ping[7] << 24);
+    }
+}
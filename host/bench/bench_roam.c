@@ -0,0 +1,166 @@
+/** Includes *************************************************************************************/
+#include "sim_server.h"
+#include "bench.h"
+/** Defines **************************************************************************************/
+/** Interval between timestamped messages, the stream that has to survive the roams */
+#define BENCH_STAMP_INTERVAL_US 10000
+
+/** Samples kept */
+#define BENCH_MAX_SAMPLES 100000
+
+/** Time allowed for a roam to happen once the link got weak */
+#define BENCH_ROAM_TIMEOUT_MS 60000
+
+/** Time the stream runs after a roam, for the retransmissions to catch up */
+#define BENCH_ROAM_SETTLE_MS 3000
+
+/** Access points, the station starts on the first one */
+#define BENCH_AP_FIRST 0
+#define BENCH_AP_SECOND 1
+#define BENCH_AP_THIRD 2
+
+/** Typedefs *************************************************************************************/
+typedef struct
+{
+    client_t *client;
+    bench_samples_t samples;
+    uint32_t next_seq;
+    uint32_t lost;
+} Roam_t;
+
+/** Variables ************************************************************************************/
+static client_t Client;
+static Roam_t Roam = {
+    .client = &Client,
+};
+
+/** Private Function Prototypes ******************************************************************/
+static int _roam_measure(const char *name);
+static bool _roam_done(void *arg);
+static int _roam_app_task(void *arg);
+
+/** Function Definitions *************************************************************************/
+int main(int argc, char **argv)
+{
+    uint32_t steady_ms = (uint32_t)(argc > 1 ? atol(argv[1]) : bench_env("BENCH_STEADY_MS", 10000));
+
+    /** A roam is a join straight to a known BSSID and channel, the background scans take this long */
+    cyw43_shim_set_join_delay_ms((uint32_t)bench_env("BENCH_JOIN_DELAY_MS", 50));
+    cyw43_shim_set_scan_delay_ms((uint32_t)bench_env("BENCH_SCAN_DELAY_MS", 100));
+
+    if (bench_init(&Client, NULL) != 0 || sim_server_start(SIM_SERVER_PORT, SIM_SERVER_STAMP) != 0 ||
+        bench_samples_init(&Roam.samples, BENCH_MAX_SAMPLES) != 0)
+    {
+        printf("Failed to initialise benchmark\n");
+        return 1;
+    }
+
+    sim_server_set_stamp_interval(BENCH_STAMP_INTERVAL_US);
+    sched_add(sim_server_task, NULL, BENCH_STAMP_INTERVAL_US / 1000);
+    sched_add(_roam_app_task, &Roam, 0);
+
+    if (!bench_run_until(bench_client_connected, &Client, 10000))
+    {
+        printf("Client did not connect\n");
+        return 1;
+    }
+
+    /** A second access point that is weaker, the station stays where it is */
+    cyw43_shim_set_ap_rssi(BENCH_AP_SECOND, -75);
+    bench_run_for(steady_ms);
+    bench_report("steady", "roams", wifi_stats()->roams, "");
+
+    /** Walking away from the first access point towards the second one */
+    cyw43_shim_set_ap_rssi(BENCH_AP_FIRST, -82);
+    cyw43_shim_set_ap_rssi(BENCH_AP_SECOND, -48);
+    if (_roam_measure("signal") != 0)
+    {
+        return 1;
+    }
+
+    /** Interference on the second access point, frames fail although the signal is fine */
+    cyw43_shim_set_ap_rssi(BENCH_AP_THIRD, -38);
+    cyw43_shim_set_ap_tx_failures(BENCH_AP_SECOND, 30);
+    if (_roam_measure("retries") != 0)
+    {
+        return 1;
+    }
+
+    const wifi_stats_t *wifi = wifi_stats();
+    bench_report("wifi", "scans", wifi->scans, "");
+    bench_report("wifi", "roams", wifi->roams, "");
+    bench_report("wifi", "roam_failures", wifi->roam_failures, "");
+    bench_report("wifi", "roam_mean", wifi->roams > 0 ? (double)wifi->total_roam_ms / wifi->roams : 0, "ms");
+    bench_report("wifi", "roam_max", wifi->max_roam_ms, "ms");
+    bench_report("wifi", "address_changes", wifi->roam_address_changes, "");
+    bench_report("client", "successes", Client.stats.connect_successes, "");
+    bench_report("stream", "lost", Roam.lost, "");
+
+    return wifi->roam_failures > 0 || Client.stats.connect_successes != 1 || Roam.lost > 0 ? 1 : 0;
+}
+
+/**
+ * @brief Wait for the roam the link quality calls for, then let the stream catch up.
+ * @param name Name of the scenario in the results.
+ * @return int 0 on success, -1 if the station did not roam.
+ */
+static int _roam_measure(const char *name)
+{
+    uint32_t roams = wifi_stats()->roams;
+    uint32_t connects = Client.stats.connect_successes;
+    absolute_time_t start = get_absolute_time();
+
+    Roam.samples.count = 0;
+    if (!bench_run_until(_roam_done, &roams, BENCH_ROAM_TIMEOUT_MS))
+    {
+        printf("%s: did not roam\n", name);
+        return -1;
+    }
+    bench_report(name, "time_to_roam", absolute_time_diff_us(start, get_absolute_time()) / 1e3, "ms");
+    bench_report(name, "roam", wifi_stats()->last_roam_ms, "ms");
+
+    /** The longest a message waited, the stall the roam caused */
+    bench_run_for(BENCH_ROAM_SETTLE_MS);
+    bench_report(name, "stall", bench_samples_percentile(&Roam.samples, 100) / 1e3, "ms");
+    bench_report(name, "reconnects", Client.stats.connect_successes - connects, "");
+
+    return 0;
+}
+
+/**
+ * @brief Stop condition that waits for the next roam.
+ * @param arg Roam count to wait past.
+ * @return bool true once the station roamed.
+ */
+static bool _roam_done(void *arg)
+{
+    return wifi_stats()->roams != *(uint32_t *)arg;
+}
+
+/**
+ * @brief Read timestamped messages as soon as they arrive and record their age.
+ * @param arg Pointer to the benchmark state.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _roam_app_task(void *arg)
+{
+    Roam_t *roam = (Roam_t *)arg;
+    uint8_t msg[SIM_SERVER_STAMP_SIZE];
+
+    while (client_peek(roam->client, msg, sizeof(msg)) == sizeof(msg))
+    {
+        uint32_t seq;
+        uint64_t sent_us = sim_server_stamp_decode(msg, &seq);
+
+        client_consume(roam->client, sizeof(msg));
+        bench_samples_add(&roam->samples, (uint32_t)(time_us_64() - sent_us));
+
+        if (seq > roam->next_seq && roam->next_seq > 0)
+        {
+            roam->lost += seq - roam->next_seq;
+        }
+        roam->next_seq = seq + 1;
+    }
+
+    return 0;
+}
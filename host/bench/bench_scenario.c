@@ -0,0 +1,515 @@
+/** Includes *************************************************************************************/
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include "sim_server.h"
+#include "netem.h"
+#include "bench.h"
+/** Defines **************************************************************************************/
+/**
+ * Runs scenario files against the client, one after the other, each on a clean wire with the
+ * client connected. A scenario is a list of timed events:
+ *
+ *   # comment
+ *   name     outage             name in the results, the file name by default
+ *   seed     7                  srand() seed, 1 by default
+ *   traffic  upload             upload to a sink (default) or download from a pushing server
+ *   0        impair both delay=20 jitter=10 loss=1.5
+ *   5000     link down          the access point goes away, wifi_task() drops to disconnected
+ *   8000     link up
+ *   9000     drop               the server resets the connection
+ *   12000    clear              clean wire in both directions
+ *   20000    end
+ *
+ * impair takes up, down or both, then any of delay=ms jitter=ms loss=% burst=packets
+ * reorder=% duplicate=% rate=kbit/s queue=ms, see netem_params_t. Keys left out are 0.
+ */
+
+/** Size of the messages written in upload scenarios */
+#define SCENARIO_MSG_SIZE 64
+
+/** Events in one scenario */
+#define SCENARIO_EVENTS_MAX 64
+
+/** Longest line in a scenario file */
+#define SCENARIO_LINE_MAX 256
+
+/** Recoveries recorded in one scenario */
+#define SCENARIO_RECOVERIES_MAX 64
+
+/** Time allowed to connect before a scenario, and to deliver what is queued after it */
+#define SCENARIO_CONNECT_TIMEOUT_MS 30000
+#define SCENARIO_DRAIN_TIMEOUT_MS 60000
+
+/** Typedefs *************************************************************************************/
+typedef enum
+{
+    SCENARIO_IMPAIR = 0,
+    SCENARIO_CLEAR,
+    SCENARIO_LINK_DOWN,
+    SCENARIO_LINK_UP,
+    SCENARIO_DROP,
+    SCENARIO_END,
+} ScenarioOp_t;
+
+typedef struct
+{
+    uint32_t at_ms;
+    ScenarioOp_t op;
+    bool up;                 /** impair: applies to the station's packets */
+    bool down;               /** impair: applies to the server's packets */
+    netem_params_t params;
+} ScenarioEvent_t;
+
+typedef struct
+{
+    char name[64];
+    unsigned seed;
+    bool download;
+    ScenarioEvent_t events[SCENARIO_EVENTS_MAX];
+    uint32_t count;
+} Scenario_t;
+
+/** A netem_params_t field as it is written in a scenario */
+typedef struct
+{
+    const char *key;
+    size_t offset;
+    bool percent;            /** Written in percent, kept in thousandths */
+} ScenarioKey_t;
+
+/** Traffic and progress while a scenario runs */
+typedef struct
+{
+    client_t *client;
+    bool active;             /** Keep writing, off while draining */
+    bool download;
+    uint64_t written;        /** Bytes client_write() took */
+    uint64_t received;       /** Bytes read from the client */
+    uint64_t progress;       /** Bytes that made it across, in the direction of the traffic */
+    absolute_time_t last_progress;
+    uint32_t longest_stall_us;
+    bool recovering;         /** Waiting for the first progress after an outage ended */
+    absolute_time_t recover_from;
+    bench_samples_t recoveries;
+} Traffic_t;
+
+/** Variables ************************************************************************************/
+static client_t Client;
+static Traffic_t Traffic = {
+    .client = &Client,
+};
+
+static const ScenarioKey_t ScenarioKeys[] = {
+    {"delay", offsetof(netem_params_t, delay_ms), false},
+    {"jitter", offsetof(netem_params_t, jitter_ms), false},
+    {"loss", offsetof(netem_params_t, loss_permille), true},
+    {"burst", offsetof(netem_params_t, loss_burst), false},
+    {"reorder", offsetof(netem_params_t, reorder_permille), true},
+    {"duplicate", offsetof(netem_params_t, duplicate_permille), true},
+    {"rate", offsetof(netem_params_t, rate_kbps), false},
+    {"queue", offsetof(netem_params_t, queue_ms), false},
+};
+
+/** Private Function Prototypes ******************************************************************/
+static int _scenario_load(const char *path, Scenario_t *scenario);
+static int _scenario_parse_event(char *op, ScenarioEvent_t *event);
+static int _scenario_run(const Scenario_t *scenario);
+static void _scenario_apply(const ScenarioEvent_t *event);
+static uint64_t _scenario_progress(void);
+static void _scenario_track(Traffic_t *traffic);
+static bool _scenario_drained(void *arg);
+static int _scenario_app_task(void *arg);
+
+/** Function Definitions *************************************************************************/
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s scenario...\n", argv[0]);
+        return 1;
+    }
+
+    if (bench_init(&Client, NULL) != 0 || sim_server_start(SIM_SERVER_PORT, SIM_SERVER_SINK) != 0 ||
+        bench_samples_init(&Traffic.recoveries, SCENARIO_RECOVERIES_MAX) != 0)
+    {
+        printf("Failed to initialise benchmark\n");
+        return 1;
+    }
+    sched_add(_scenario_app_task, &Traffic, 0);
+
+    static Scenario_t scenario;
+    int failed = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (_scenario_load(argv[i], &scenario) != 0 || _scenario_run(&scenario) != 0)
+        {
+            failed++;
+        }
+    }
+
+    return failed > 0 ? 1 : 0;
+}
+
+/**
+ * @brief Read a scenario file.
+ * @param path Path of the file.
+ * @param scenario Where to put the scenario.
+ * @return int 0 on success, -1 if the file cannot be read or has an error, which is printed.
+ */
+static int _scenario_load(const char *path, Scenario_t *scenario)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        printf("%s: cannot open\n", path);
+        return -1;
+    }
+
+    /** The file name without directory and extension, unless the file names itself */
+    const char *base = strrchr(path, '/') != NULL ? strrchr(path, '/') + 1 : path;
+    snprintf(scenario->name, sizeof(scenario->name), "%.*s", (int)strcspn(base, "."), base);
+    scenario->seed = 1;
+    scenario->download = false;
+    scenario->count = 0;
+
+    char line[SCENARIO_LINE_MAX];
+    uint32_t number = 0;
+    int rc = 0;
+    while (rc == 0 && fgets(line, sizeof(line), file) != NULL)
+    {
+        number++;
+        line[strcspn(line, "#")] = '\0';
+
+        char *first = strtok(line, " \t\r\n");
+        char *value = first != NULL ? strtok(NULL, " \t\r\n") : NULL;
+        if (first == NULL)
+        {
+            continue;
+        }
+
+        if (strcmp(first, "name") == 0 && value != NULL)
+        {
+            snprintf(scenario->name, sizeof(scenario->name), "%s", value);
+        }
+        else if (strcmp(first, "seed") == 0 && value != NULL)
+        {
+            scenario->seed = (unsigned)strtoul(value, NULL, 10);
+        }
+        else if (strcmp(first, "traffic") == 0 && value != NULL &&
+                 (strcmp(value, "upload") == 0 || strcmp(value, "download") == 0))
+        {
+            scenario->download = strcmp(value, "download") == 0;
+        }
+        else
+        {
+            /** A timed event, in order and with room for it */
+            char *end;
+            ScenarioEvent_t *event = &scenario->events[scenario->count];
+            event->at_ms = (uint32_t)strtoul(first, &end, 10);
+            if (*end != '\0' || value == NULL || scenario->count >= SCENARIO_EVENTS_MAX ||
+                (scenario->count > 0 && event->at_ms < scenario->events[scenario->count - 1].at_ms) ||
+                _scenario_parse_event(value, event) != 0)
+            {
+                rc = -1;
+            }
+            scenario->count++;
+        }
+
+        if (rc != 0)
+        {
+            printf("%s:%lu: cannot parse\n", path, (unsigned long)number);
+        }
+    }
+    fclose(file);
+
+    if (rc == 0 && (scenario->count == 0 || scenario->events[scenario->count - 1].op != SCENARIO_END))
+    {
+        printf("%s: does not end with end\n", path);
+        rc = -1;
+    }
+
+    return rc;
+}
+
+/**
+ * @brief Parse the operation of a timed event and its arguments, the rest of the line.
+ * @param op The operation, strtok() is positioned after it.
+ * @param event Event to fill in.
+ * @return int 0 on success, -1 on an unknown operation or argument.
+ */
+static int _scenario_parse_event(char *op, ScenarioEvent_t *event)
+{
+    char *arg = strtok(NULL, " \t\r\n");
+
+    event->up = false;
+    event->down = false;
+    event->params = (netem_params_t){0};
+
+    if (strcmp(op, "clear") == 0)
+    {
+        event->op = SCENARIO_CLEAR;
+    }
+    else if (strcmp(op, "drop") == 0)
+    {
+        event->op = SCENARIO_DROP;
+    }
+    else if (strcmp(op, "end") == 0)
+    {
+        event->op = SCENARIO_END;
+    }
+    else if (strcmp(op, "link") == 0 && arg != NULL && (strcmp(arg, "up") == 0 || strcmp(arg, "down") == 0))
+    {
+        event->op = strcmp(arg, "up") == 0 ? SCENARIO_LINK_UP : SCENARIO_LINK_DOWN;
+    }
+    else if (strcmp(op, "impair") == 0 && arg != NULL)
+    {
+        event->op = SCENARIO_IMPAIR;
+        event->up = strcmp(arg, "up") == 0 || strcmp(arg, "both") == 0;
+        event->down = strcmp(arg, "down") == 0 || strcmp(arg, "both") == 0;
+        if (!event->up && !event->down)
+        {
+            return -1;
+        }
+
+        /** key=value pairs, each one a field of the impairment */
+        while ((arg = strtok(NULL, " \t\r\n")) != NULL)
+        {
+            char *value = strchr(arg, '=');
+            size_t i = 0;
+            while (value != NULL && i < count_of(ScenarioKeys) &&
+                   (strlen(ScenarioKeys[i].key) != (size_t)(value - arg) ||
+                    strncmp(arg, ScenarioKeys[i].key, (size_t)(value - arg)) != 0))
+            {
+                i++;
+            }
+            if (value == NULL || i == count_of(ScenarioKeys))
+            {
+                return -1;
+            }
+
+            double number = strtod(value + 1, NULL);
+            uint32_t *field = (uint32_t *)((uint8_t *)&event->params + ScenarioKeys[i].offset);
+            *field = (uint32_t)(ScenarioKeys[i].percent ? number * 10 + 0.5 : number);
+        }
+        return 0;
+    }
+    else
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Run a scenario and report how the client coped.
+ * @param scenario The scenario.
+ * @return int 0 on success, -1 if the client did not connect or deliver the queued data.
+ */
+static int _scenario_run(const Scenario_t *scenario)
+{
+    const char *name = scenario->name;
+
+    /** Clean wire, connected, and the traffic flowing */
+    netem_set(SIMNETIF_UP, NULL);
+    netem_set(SIMNETIF_DOWN, NULL);
+    cyw43_shim_set_ap_available(true);
+    sim_server_set_mode(scenario->download ? SIM_SERVER_PUSH : SIM_SERVER_SINK);
+    Traffic.download = scenario->download;
+    Traffic.active = true;
+    if (!bench_run_until(bench_client_connected, &Client, SCENARIO_CONNECT_TIMEOUT_MS))
+    {
+        printf("%s: client did not connect\n", name);
+        return -1;
+    }
+
+    srand(scenario->seed);
+    uint64_t server_rx = sim_server_stats()->rx_bytes;
+    uint32_t connects = Client.stats.connect_successes;
+    netem_stats_t up = *netem_stats(SIMNETIF_UP);
+    netem_stats_t down = *netem_stats(SIMNETIF_DOWN);
+    Traffic.written = 0;
+    Traffic.received = 0;
+    Traffic.progress = _scenario_progress();
+    Traffic.last_progress = get_absolute_time();
+    Traffic.longest_stall_us = 0;
+    Traffic.recovering = false;
+    Traffic.recoveries.count = 0;
+    uint64_t progress = Traffic.progress;
+
+    absolute_time_t start = get_absolute_time();
+    for (uint32_t i = 0; i < scenario->count; i++)
+    {
+        const ScenarioEvent_t *event = &scenario->events[i];
+        int64_t wait_us = (int64_t)event->at_ms * 1000 - absolute_time_diff_us(start, get_absolute_time());
+        if (wait_us > 0)
+        {
+            bench_run_for((uint32_t)(wait_us / 1000));
+        }
+        _scenario_apply(event);
+    }
+    double seconds = absolute_time_diff_us(start, get_absolute_time()) / 1e6;
+    uint64_t moved = _scenario_progress() - progress;
+
+    /** Stop writing and let everything queued get across on a clean wire */
+    Traffic.active = false;
+    netem_set(SIMNETIF_UP, NULL);
+    netem_set(SIMNETIF_DOWN, NULL);
+    cyw43_shim_set_ap_available(true);
+    bool drained = bench_run_until(_scenario_drained, &Traffic, SCENARIO_DRAIN_TIMEOUT_MS);
+
+    const netem_stats_t *up_now = netem_stats(SIMNETIF_UP);
+    const netem_stats_t *down_now = netem_stats(SIMNETIF_DOWN);
+    bench_report(name, "throughput", seconds > 0 ? moved * 8 / seconds / 1e3 : 0, "kbit/s");
+    bench_report(name, "recoveries", Traffic.recoveries.count, "");
+    bench_report(name, "recover_p50", bench_samples_percentile(&Traffic.recoveries, 50) / 1e3, "ms");
+    bench_report(name, "recover_max", bench_samples_percentile(&Traffic.recoveries, 100) / 1e3, "ms");
+    bench_report(name, "stall_max", Traffic.longest_stall_us / 1e3, "ms");
+    bench_report(name, "reconnects", Client.stats.connect_successes - connects, "");
+    if (!scenario->download)
+    {
+        /** Written but never received, dropped from the transmit queue with a connection */
+        uint64_t received = sim_server_stats()->rx_bytes - server_rx;
+        bench_report(name, "bytes_lost", Traffic.written > received ? (double)(Traffic.written - received) : 0, "B");
+    }
+    bench_report(name, "lost", (up_now->lost - up.lost) + (down_now->lost - down.lost), "pkts");
+    bench_report(name, "queue_drops", (up_now->queue_drops - up.queue_drops) + (down_now->queue_drops - down.queue_drops), "pkts");
+    bench_report(name, "reordered", (up_now->reordered - up.reordered) + (down_now->reordered - down.reordered), "pkts");
+    bench_report(name, "duplicated", (up_now->duplicated - up.duplicated) + (down_now->duplicated - down.duplicated), "pkts");
+
+    if (!drained)
+    {
+        printf("%s: queued data not delivered\n", name);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Carry out one event, outages that end start the recovery clock.
+ * @param event The event.
+ * @return None.
+ */
+static void _scenario_apply(const ScenarioEvent_t *event)
+{
+    switch (event->op)
+    {
+    case SCENARIO_IMPAIR:
+        if (event->up)
+        {
+            netem_set(SIMNETIF_UP, &event->params);
+        }
+        if (event->down)
+        {
+            netem_set(SIMNETIF_DOWN, &event->params);
+        }
+        return;
+
+    case SCENARIO_CLEAR:
+        netem_set(SIMNETIF_UP, NULL);
+        netem_set(SIMNETIF_DOWN, NULL);
+        break;
+
+    case SCENARIO_LINK_DOWN:
+        cyw43_shim_set_ap_available(false);
+        return;
+
+    case SCENARIO_LINK_UP:
+        cyw43_shim_set_ap_available(true);
+        break;
+
+    case SCENARIO_DROP:
+        sim_server_drop();
+        break;
+
+    default:
+        return;
+    }
+
+    /** Progress made before the event does not count towards the recovery */
+    _scenario_track(&Traffic);
+    Traffic.recovering = true;
+    Traffic.recover_from = get_absolute_time();
+}
+
+/**
+ * @brief Get the bytes that made it across in the direction of the traffic.
+ * @return uint64_t Bytes the server received when uploading, the client read when downloading.
+ */
+static uint64_t _scenario_progress(void)
+{
+    return Traffic.download ? Traffic.received : sim_server_stats()->rx_bytes;
+}
+
+/**
+ * @brief Stop condition that waits for the queued data to be acked.
+ * @param arg Pointer to the traffic state.
+ * @return bool true once connected with nothing left to send.
+ */
+static bool _scenario_drained(void *arg)
+{
+    Traffic_t *traffic = (Traffic_t *)arg;
+
+    return traffic->client->state == CLIENT_CONNECTED && client_tx_pending(traffic->client) == 0;
+}
+
+/**
+ * @brief Keep the traffic going and track its progress, the stalls and the recoveries.
+ * @param arg Pointer to the traffic state.
+ * @return int 0.
+ */
+static int _scenario_app_task(void *arg)
+{
+    Traffic_t *traffic = (Traffic_t *)arg;
+    client_segment_t segs[4];
+    int count;
+
+    while ((count = client_rx_segments(traffic->client, 0, segs, count_of(segs))) > 0)
+    {
+        uint32_t len = 0;
+        for (int i = 0; i < count; i++)
+        {
+            len += segs[i].len;
+        }
+        client_consume(traffic->client, len);
+        traffic->received += len;
+    }
+
+    static const uint8_t msg[SCENARIO_MSG_SIZE] = {0};
+    while (traffic->active && !traffic->download && client_write(traffic->client, msg, sizeof(msg)) == 0)
+    {
+        traffic->written += sizeof(msg);
+    }
+
+    _scenario_track(traffic);
+
+    return 0;
+}
+
+/**
+ * @brief Note progress since the last call, the gap before it and the end of a recovery.
+ * @param traffic The traffic state.
+ * @return None.
+ */
+static void _scenario_track(Traffic_t *traffic)
+{
+    uint64_t progress = _scenario_progress();
+    if (progress == traffic->progress)
+    {
+        return;
+    }
+
+    absolute_time_t now = get_absolute_time();
+    uint32_t stall_us = (uint32_t)absolute_time_diff_us(traffic->last_progress, now);
+    traffic->longest_stall_us = stall_us > traffic->longest_stall_us ? stall_us : traffic->longest_stall_us;
+    traffic->last_progress = now;
+    traffic->progress = progress;
+
+    if (traffic->recovering)
+    {
+        bench_samples_add(&traffic->recoveries, (uint32_t)absolute_time_diff_us(traffic->recover_from, now));
+        traffic->recovering = false;
+    }
+}
@@ -0,0 +1,83 @@
+/** Includes *************************************************************************************/
+#include <string.h>
+#include "simnetif.h"
+#include "bench.h"
+#include "selftest.h"
+/** Defines **************************************************************************************/
+/** Time allowed for the whole run, TCP up and down and UDP up */
+#define BENCH_SELFTEST_TIMEOUT_MS 90000
+
+/** Variables ************************************************************************************/
+static client_t Client;
+
+/** Private Function Prototypes ******************************************************************/
+static bool _selftest_wifi_up(void *arg);
+static bool _selftest_done(void *arg);
+
+/** Function Definitions *************************************************************************/
+int main(int argc, char **argv)
+{
+    const char *server = getenv("BENCH_SERVER_IP");
+
+    /**
+     * Without a server the far end is the server netif, running the same self-test servers, so
+     * every test is printed from both ends. The client has no server of its own and stays idle.
+     */
+    if (bench_init(&Client, server) != 0 ||
+        (server == NULL && selftest_serve(&simnetif_server()->ip_addr) != 0))
+    {
+        printf("Failed to initialise benchmark\n");
+        return 1;
+    }
+
+    if (!bench_run_until(_selftest_wifi_up, NULL, BENCH_SELFTEST_TIMEOUT_MS) ||
+        selftest_run(server != NULL ? server : SIMNETIF_SERVER_IP) != 0)
+    {
+        printf("Self-test did not start\n");
+        return 1;
+    }
+
+    if (!bench_run_until(_selftest_done, NULL, BENCH_SELFTEST_TIMEOUT_MS))
+    {
+        printf("Self-test did not finish\n");
+        return 1;
+    }
+
+    selftest_print();
+
+    uint32_t count;
+    const selftest_result_t *results = selftest_results(&count);
+    int failed = 0;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        bench_report(results[i].test, "rate", results[i].kbps, "kbit/s");
+        bench_report(results[i].test, "cpu", results[i].cpu, "%");
+        failed += results[i].status != 0 ? 1 : 0;
+    }
+
+    return failed > 0 ? 1 : 0;
+}
+
+/**
+ * @brief Stop condition that waits for Wi-Fi to come up.
+ * @param arg Unused.
+ * @return bool true once Wi-Fi is connected.
+ */
+static bool _selftest_wifi_up(void *arg)
+{
+    LWIP_UNUSED_ARG(arg);
+
+    return wifi_get_state() == WIFI_TASK_CONNECTED;
+}
+
+/**
+ * @brief Stop condition that waits for the self-test run to finish.
+ * @param arg Unused.
+ * @return bool true once the last test has reported.
+ */
+static bool _selftest_done(void *arg)
+{
+    LWIP_UNUSED_ARG(arg);
+
+    return !selftest_busy();
+}
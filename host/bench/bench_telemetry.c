@@ -0,0 +1,369 @@
+/** Includes *************************************************************************************/
+#include <math.h>
+#include <string.h>
+#include "sim_server.h"
+#include "bench.h"
+#include "frame.h"
+#include "telemetry.h"
+/** Defines **************************************************************************************/
+/** Values per sample of the synthetic telemetry */
+#define BENCH_CHANNELS 4
+
+/** Samples per block, a full block of plain values */
+#define BENCH_BLOCK_SAMPLES (TELEMETRY_BLOCK_MAX / (BENCH_CHANNELS * 4))
+
+/** Blocks sent but not yet echoed back */
+#define BENCH_INFLIGHT 4
+
+/** Time allowed for all blocks of one codec set */
+#define BENCH_TELEMETRY_TIMEOUT_MS 30000
+
+/** Typedefs *************************************************************************************/
+/** Decoder state of the server end, written from the wire format alone */
+typedef struct
+{
+    int32_t last[BENCH_CHANNELS];
+    uint8_t buf[TELEMETRY_LZ_WINDOW + TELEMETRY_BLOCK_MAX];
+    uint16_t history;
+} Reference_t;
+
+typedef struct
+{
+    client_t *client;
+    uint32_t blocks;
+    uint32_t sent;
+    uint32_t received;
+    uint32_t mismatches;
+    uint32_t next_sample;
+    int32_t inflight[BENCH_INFLIGHT][BENCH_BLOCK_SAMPLES * BENCH_CHANNELS];
+    Reference_t reference;
+} Telemetry_t;
+
+/** Variables ************************************************************************************/
+static client_t Client;
+static frame_decoder_t Decoder;
+static telemetry_t Encoder;
+static Telemetry_t Telemetry = {
+    .client = &Client,
+};
+
+static const struct
+{
+    const char *name;
+    uint8_t codecs;
+} CodecSets[] = {
+    {"plain", 0},
+    {"delta", TELEMETRY_CODEC_DELTA},
+    {"lz", TELEMETRY_CODEC_LZ},
+    {"delta_lz", TELEMETRY_CODEC_DELTA | TELEMETRY_CODEC_LZ},
+};
+
+/** Private Function Prototypes ******************************************************************/
+static int _telemetry_app_task(void *arg);
+static void _telemetry_data_handler(void *arg, const frame_t *frame);
+static void _telemetry_sample(uint32_t n, int32_t *sample);
+static int _reference_decode(Reference_t *reference, const uint8_t *in, int len, int32_t *samples);
+static int _reference_varint(const uint8_t *in, int len, int *pos, uint32_t *value);
+static uint32_t _reference_bits(const uint8_t *in, uint32_t *bit, int count);
+static bool _telemetry_done(void *arg);
+
+/** Function Definitions *************************************************************************/
+int main(int argc, char **argv)
+{
+    Telemetry.blocks = (uint32_t)(argc > 1 ? atol(argv[1]) : bench_env("BENCH_BLOCKS", 500));
+
+    if (bench_init(&Client, NULL) != 0 || sim_server_start(SIM_SERVER_PORT, SIM_SERVER_ECHO) != 0)
+    {
+        printf("Failed to initialise benchmark\n");
+        return 1;
+    }
+
+    sched_add(_telemetry_app_task, &Telemetry, 0);
+
+    for (size_t i = 0; i < count_of(CodecSets); i++)
+    {
+        /** The echoed hello accepts every offered codec, the echoed blocks are checked on return */
+        frame_decoder_init(&Decoder);
+        frame_register(&Decoder, TELEMETRY_FRAME_DATA, _telemetry_data_handler, &Telemetry);
+        telemetry_init(&Encoder, &Decoder, BENCH_CHANNELS, CodecSets[i].codecs);
+
+        memset(&Telemetry.reference, 0, sizeof(Telemetry.reference));
+        Telemetry.sent = 0;
+        Telemetry.received = 0;
+        Telemetry.mismatches = 0;
+        Telemetry.next_sample = 0;
+
+        /** Codecs are agreed per connection, every set starts on a new one */
+        if (i > 0)
+        {
+            sim_server_drop();
+            bench_run_until(bench_client_disconnected, &Client, BENCH_TELEMETRY_TIMEOUT_MS);
+        }
+        if (!bench_run_until(bench_client_connected, &Client, BENCH_TELEMETRY_TIMEOUT_MS))
+        {
+            printf("Client did not connect\n");
+            return 1;
+        }
+
+        if (!bench_run_until(_telemetry_done, &Telemetry, BENCH_TELEMETRY_TIMEOUT_MS))
+        {
+            printf("%s: %lu of %lu blocks came back\n", CodecSets[i].name, (unsigned long)Telemetry.received,
+                   (unsigned long)Telemetry.blocks);
+            return 1;
+        }
+
+        const telemetry_stats_t *stats = &Encoder.stats;
+        bench_report(CodecSets[i].name, "ratio", 100.0 * stats->wire_bytes / stats->raw_bytes, "%");
+        bench_report(CodecSets[i].name, "encode", (double)stats->encode_ticks * 1024 / stats->raw_bytes, "us/KB");
+        bench_report(CodecSets[i].name, "lz_skipped", stats->lz_skipped, "");
+        bench_report(CodecSets[i].name, "mismatches", Telemetry.mismatches, "");
+
+        if (Telemetry.mismatches > 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Dispatch the echoed frames and keep up to BENCH_INFLIGHT blocks on the way.
+ * @param arg Pointer to the benchmark state.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _telemetry_app_task(void *arg)
+{
+    Telemetry_t *telemetry = (Telemetry_t *)arg;
+
+    if (frame_poll(&Decoder, telemetry->client) < 0)
+    {
+        printf("Framing error\n");
+        client_close(telemetry->client);
+        return -1;
+    }
+
+    while (telemetry->sent < telemetry->blocks && telemetry->sent - telemetry->received < BENCH_INFLIGHT)
+    {
+        int32_t *samples = telemetry->inflight[telemetry->sent % BENCH_INFLIGHT];
+        for (int i = 0; i < BENCH_BLOCK_SAMPLES; i++)
+        {
+            _telemetry_sample(telemetry->next_sample + i, &samples[i * BENCH_CHANNELS]);
+        }
+
+        if (telemetry_send(&Encoder, telemetry->client, samples, BENCH_BLOCK_SAMPLES) != 0)
+        {
+            break;
+        }
+        telemetry->next_sample += BENCH_BLOCK_SAMPLES;
+        telemetry->sent++;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Decode an echoed data block and compare it with what was sent.
+ * @param arg Pointer to the benchmark state.
+ * @param frame The frame.
+ * @return None.
+ */
+static void _telemetry_data_handler(void *arg, const frame_t *frame)
+{
+    Telemetry_t *telemetry = (Telemetry_t *)arg;
+    uint8_t in[TELEMETRY_HEADER_MAX + TELEMETRY_BLOCK_MAX];
+    int32_t samples[BENCH_BLOCK_SAMPLES * BENCH_CHANNELS];
+
+    int len = frame_copy(frame, 0, in, sizeof(in));
+    int count = _reference_decode(&telemetry->reference, in, len, samples);
+    const int32_t *sent = telemetry->inflight[telemetry->received % BENCH_INFLIGHT];
+
+    if (count != BENCH_BLOCK_SAMPLES || memcmp(samples, sent, sizeof(samples)) != 0)
+    {
+        telemetry->mismatches++;
+    }
+    telemetry->received++;
+}
+
+/**
+ * @brief Synthetic telemetry, slow drift with noise, a steady value, a counter and a step.
+ * @param n Sample number.
+ * @param sample BENCH_CHANNELS values.
+ * @return None.
+ */
+static void _telemetry_sample(uint32_t n, int32_t *sample)
+{
+    static uint32_t seed = 1;
+    seed = seed * 1103515245u + 12345u;
+    int32_t noise = (int32_t)((seed >> 16) % 41) - 20;
+
+    sample[0] = 25000 + (int32_t)(2000 * sin(n / 100.0)) + noise;
+    sample[1] = -55 + noise / 8;
+    sample[2] = (int32_t)n;
+    sample[3] = 180000 - (int32_t)(n / 256) * 4096;
+}
+
+/**
+ * @brief Decode a data block as the server would, from the format in telemetry.h.
+ * @param reference Decoder state, carried from block to block.
+ * @param in Data frame payload.
+ * @param len Payload length.
+ * @param samples Destination, BENCH_BLOCK_SAMPLES * BENCH_CHANNELS values.
+ * @return int Number of samples, -1 if the block does not decode.
+ */
+static int _reference_decode(Reference_t *reference, const uint8_t *in, int len, int32_t *samples)
+{
+    int pos = 1;
+    uint32_t count;
+    uint32_t plain_len;
+
+    if (len < 1 || _reference_varint(in, len, &pos, &count) != 0 || count > BENCH_BLOCK_SAMPLES)
+    {
+        return -1;
+    }
+
+    uint8_t codecs = in[0];
+    if (codecs & TELEMETRY_CODEC_KEY)
+    {
+        memset(reference->last, 0, sizeof(reference->last));
+        reference->history = 0;
+    }
+
+    uint8_t *plain = reference->buf + reference->history;
+    if (codecs & TELEMETRY_CODEC_LZ)
+    {
+        if (_reference_varint(in, len, &pos, &plain_len) != 0 || plain_len > TELEMETRY_BLOCK_MAX)
+        {
+            return -1;
+        }
+
+        uint32_t bit = (uint32_t)pos * 8;
+        uint32_t end_bit = (uint32_t)len * 8;
+        uint32_t out = 0;
+        while (out < plain_len)
+        {
+            if (bit + 9 > end_bit)
+            {
+                return -1;
+            }
+
+            if (_reference_bits(in, &bit, 1))
+            {
+                plain[out++] = (uint8_t)_reference_bits(in, &bit, 8);
+                continue;
+            }
+
+            if (bit + 12 > end_bit)
+            {
+                return -1;
+            }
+            uint32_t dist = _reference_bits(in, &bit, 8) + 1;
+            uint32_t copy = _reference_bits(in, &bit, 4) + TELEMETRY_LZ_MIN_MATCH;
+            if (dist > reference->history + out || out + copy > plain_len)
+            {
+                return -1;
+            }
+            for (uint32_t i = 0; i < copy; i++, out++)
+            {
+                plain[out] = plain[(int32_t)out - (int32_t)dist];
+            }
+        }
+    }
+    else
+    {
+        plain_len = (uint32_t)(len - pos);
+        if (plain_len > TELEMETRY_BLOCK_MAX)
+        {
+            return -1;
+        }
+        memcpy(plain, &in[pos], plain_len);
+    }
+
+    int at = 0;
+    for (uint32_t i = 0; i < count * BENCH_CHANNELS; i++)
+    {
+        int32_t *last = &reference->last[i % BENCH_CHANNELS];
+        if (codecs & TELEMETRY_CODEC_DELTA)
+        {
+            uint32_t zz;
+            if (_reference_varint(plain, (int)plain_len, &at, &zz) != 0)
+            {
+                return -1;
+            }
+            *last += (int32_t)((zz >> 1) ^ (0u - (zz & 1)));
+        }
+        else
+        {
+            if (at + 4 > (int)plain_len)
+            {
+                return -1;
+            }
+            *last = (int32_t)(plain[at] | plain[at + 1] << 8 | plain[at + 2] << 16 | (uint32_t)plain[at + 3] << 24);
+            at += 4;
+        }
+        samples[i] = *last;
+    }
+
+    /** The window takes every block, compressed or not */
+    uint32_t total = reference->history + plain_len;
+    uint32_t keep = total < TELEMETRY_LZ_WINDOW ? total : TELEMETRY_LZ_WINDOW;
+    memmove(reference->buf, reference->buf + total - keep, keep);
+    reference->history = (uint16_t)keep;
+
+    return at == (int)plain_len ? (int)count : -1;
+}
+
+/**
+ * @brief Read a varint.
+ * @param in Buffer.
+ * @param len Buffer length.
+ * @param pos Position, moved past the varint.
+ * @param value The value.
+ * @return int 0 on success, -1 if the buffer ends first.
+ */
+static int _reference_varint(const uint8_t *in, int len, int *pos, uint32_t *value)
+{
+    *value = 0;
+    for (int shift = 0; shift < 35 && *pos < len; shift += 7)
+    {
+        uint8_t byte = in[(*pos)++];
+        *value |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Read bits, most significant first.
+ * @param in Buffer.
+ * @param bit Position in bits, moved past the bits read.
+ * @param count Number of bits.
+ * @return uint32_t The bits, right aligned.
+ */
+static uint32_t _reference_bits(const uint8_t *in, uint32_t *bit, int count)
+{
+    uint32_t value = 0;
+
+    for (int i = 0; i < count; i++, (*bit)++)
+    {
+        value = (value << 1) | ((in[*bit / 8] >> (7 - *bit % 8)) & 1);
+    }
+
+    return value;
+}
+
+/**
+ * @brief Stop condition that waits for every block to come back.
+ * @param arg Pointer to the benchmark state.
+ * @return bool true once done.
+ */
+static bool _telemetry_done(void *arg)
+{
+    Telemetry_t *telemetry = (Telemetry_t *)arg;
+
+    return telemetry->received >= telemetry->blocks;
+}
@@ -0,0 +1,101 @@
+/** Includes *************************************************************************************/
+#include "sim_server.h"
+#include "bench.h"
+/** Defines **************************************************************************************/
+/** Size of the messages written in the upload phase */
+#define BENCH_MSG_SIZE 64
+
+/** Typedefs *************************************************************************************/
+typedef struct
+{
+    client_t *client;
+    bool upload;
+    uint64_t rx_bytes;
+    uint64_t tx_bytes;
+    uint32_t tx_msgs;
+} Throughput_t;
+
+/** Variables ************************************************************************************/
+static client_t Client;
+static Throughput_t Throughput = {
+    .client = &Client,
+};
+
+/** Private Function Prototypes ******************************************************************/
+static int _throughput_app_task(void *arg);
+
+/** Function Definitions *************************************************************************/
+int main(int argc, char **argv)
+{
+    uint32_t duration_ms = (uint32_t)(argc > 1 ? atol(argv[1]) : bench_env("BENCH_DURATION_MS", 5000));
+
+    if (bench_init(&Client, NULL) != 0 || sim_server_start(SIM_SERVER_PORT, SIM_SERVER_PUSH) != 0)
+    {
+        printf("Failed to initialise benchmark\n");
+        return 1;
+    }
+
+    sched_add(_throughput_app_task, &Throughput, 0);
+
+    if (!bench_run_until(bench_client_connected, &Client, 10000))
+    {
+        printf("Client did not connect\n");
+        return 1;
+    }
+
+    /** Download, the server keeps its send buffer full and the client consumes in place */
+    absolute_time_t start = get_absolute_time();
+    bench_run_for(duration_ms);
+    double seconds = absolute_time_diff_us(start, get_absolute_time()) / 1e6;
+    bench_report("download", "throughput", Throughput.rx_bytes / seconds / 1e6, "MB/s");
+
+    /** Upload, small messages coalesced by client_write() */
+    sim_server_set_mode(SIM_SERVER_SINK);
+    Throughput.upload = true;
+    uint64_t server_rx = sim_server_stats()->rx_bytes;
+    start = get_absolute_time();
+    bench_run_for(duration_ms);
+    seconds = absolute_time_diff_us(start, get_absolute_time()) / 1e6;
+    bench_report("upload", "throughput", (sim_server_stats()->rx_bytes - server_rx) / seconds / 1e6, "MB/s");
+    bench_report("upload", "messages", Throughput.tx_msgs / seconds, "msg/s");
+
+    return 0;
+}
+
+/**
+ * @brief Consume received data in the download phase, keep the transmit queue full in the
+ *        upload phase.
+ * @param arg Pointer to the benchmark state.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _throughput_app_task(void *arg)
+{
+    Throughput_t *throughput = (Throughput_t *)arg;
+    client_segment_t segs[4];
+    int count;
+
+    while ((count = client_rx_segments(throughput->client, 0, segs, count_of(segs))) > 0)
+    {
+        uint32_t len = 0;
+        for (int i = 0; i < count; i++)
+        {
+            len += segs[i].len;
+        }
+        client_consume(throughput->client, len);
+        throughput->rx_bytes += len;
+    }
+
+    if (!throughput->upload)
+    {
+        return 0;
+    }
+
+    static const uint8_t msg[BENCH_MSG_SIZE] = {0};
+    while (client_write(throughput->client, msg, sizeof(msg)) == 0)
+    {
+        throughput->tx_bytes += sizeof(msg);
+        throughput->tx_msgs++;
+    }
+
+    return 0;
+}
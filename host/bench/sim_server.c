@@ -0,0 +1,811 @@
+/** Includes *************************************************************************************/
+#include <string.h>
+#include "lwip/altcp.h"
+#include "lwip/udp.h"
+#if LWIP_ALTCP_TLS
+#include "lwip/altcp_tls.h"
+#include "sim_server_cert.h"
+#endif
+#include "simnetif.h"
+#include "sim_server.h"
+#include "client.h"
+/** Defines **************************************************************************************/
+/** Size of the pattern block written in push mode */
+#define SIM_SERVER_PUSH_CHUNK 1024
+
+/** Typedefs *************************************************************************************/
+/** What the MQTT mode keeps of a client between connections */
+typedef struct
+{
+    bool used;
+    char client_id[24];
+    char filters[SIM_SERVER_MQTT_FILTERS][SIM_SERVER_MQTT_FILTER_MAX];
+    uint8_t filter_count;
+} SimMqttSession_t;
+
+/** Bytes of an MQTT connection not yet making up a whole packet */
+typedef struct
+{
+    uint8_t buf[SIM_SERVER_MQTT_PACKET_MAX];
+    uint32_t len;
+    int8_t session;  /** -1 before the CONNECT */
+} SimMqttConn_t;
+
+typedef struct
+{
+    struct altcp_pcb *listen_pcb;
+    struct altcp_pcb *conns[SIM_SERVER_MAX_CONNS];
+    sim_server_mode_t mode;
+    uint32_t stamp_interval_us;
+    absolute_time_t next_stamp;
+    uint32_t stamp_seq;
+    sim_server_stats_t stats;
+    /** Message sent in small segments, see sim_server_send_split() */
+    struct altcp_pcb *split_pcb;
+    uint8_t split[SIM_SERVER_SPLIT_MAX];
+    uint32_t split_len;
+    uint32_t split_off;
+    uint16_t split_segment;
+    /** UDP side, on the same port, talks to whoever sent the last datagram */
+    struct udp_pcb *udp_pcb;
+    ip_addr_t udp_peer;
+    u16_t udp_peer_port;
+    uint32_t udp_seq;
+    /** MQTT mode, one entry per connection slot */
+    SimMqttConn_t mqtt[SIM_SERVER_MAX_CONNS];
+    SimMqttSession_t sessions[SIM_SERVER_MAX_CONNS];
+} SimServer_t;
+
+/** Variables ************************************************************************************/
+static SimServer_t SimServer = {
+    .listen_pcb = NULL,
+    .mode = SIM_SERVER_ECHO,
+    .stamp_interval_us = 1000,
+};
+
+/** Pattern sent in push mode, referenced rather than copied */
+static uint8_t PushChunk[SIM_SERVER_PUSH_CHUNK];
+
+/** Prototypes ***********************************************************************************/
+/** Private Function Prototypes ******************************************************************/
+static err_t _sim_server_accept(void *arg, struct altcp_pcb *pcb, err_t err);
+static err_t _sim_server_recv(void *arg, struct altcp_pcb *pcb, struct pbuf *p, err_t err);
+static err_t _sim_server_sent(void *arg, struct altcp_pcb *pcb, u16_t len);
+static void _sim_server_err(void *arg, err_t err);
+static void _sim_server_push(struct altcp_pcb *pcb);
+static void _sim_server_split(struct altcp_pcb *pcb);
+static void _sim_server_forget(struct altcp_pcb *pcb);
+static void _sim_server_udp_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port);
+static void _sim_server_udp_send(const void *data, u16_t len);
+static int _sim_server_listen(uint16_t port, sim_server_mode_t mode, altcp_allocator_t *allocator);
+static void _sim_server_mqtt_recv(int conn, struct altcp_pcb *pcb, struct pbuf *p);
+static void _sim_server_mqtt_packet(int conn, struct altcp_pcb *pcb, uint8_t type, const uint8_t *body, uint32_t len);
+static void _sim_server_mqtt_connect(int conn, struct altcp_pcb *pcb, const uint8_t *body, uint32_t len);
+static void _sim_server_mqtt_forward(const uint8_t *topic, uint16_t topic_len, const uint8_t *payload, uint32_t len);
+static bool _sim_server_mqtt_match(const char *filter, const uint8_t *topic, uint16_t len);
+static void _sim_server_mqtt_write(struct altcp_pcb *pcb, const uint8_t *packet, uint16_t len);
+
+/** Function Definitions *************************************************************************/
+int sim_server_start(uint16_t port, sim_server_mode_t mode)
+{
+    return _sim_server_listen(port, mode, NULL);
+}
+
+int sim_server_start_tls(uint16_t port, sim_server_mode_t mode)
+{
+#if LWIP_ALTCP_TLS
+    /** Sessions are resumed from tickets and from the session cache, see the host lwipopts.h */
+    static altcp_allocator_t allocator = {altcp_tls_alloc, NULL};
+    if (allocator.arg == NULL)
+    {
+        allocator.arg = altcp_tls_create_config_server_privkey_cert(
+            (const u8_t *)SIM_SERVER_KEY, sizeof(SIM_SERVER_KEY), NULL, 0,
+            (const u8_t *)SIM_SERVER_CERT, sizeof(SIM_SERVER_CERT));
+        if (allocator.arg == NULL)
+        {
+            return -1;
+        }
+    }
+
+    return _sim_server_listen(port, mode, &allocator);
+#else
+    LWIP_UNUSED_ARG(port);
+    LWIP_UNUSED_ARG(mode);
+    return -1;
+#endif
+}
+
+
+void sim_server_set_mode(sim_server_mode_t mode)
+{
+    SimServer.mode = mode;
+
+    for (int i = 0; i < SIM_SERVER_MAX_CONNS; i++)
+    {
+        if (SimServer.conns[i] != NULL && mode == SIM_SERVER_PUSH)
+        {
+            _sim_server_push(SimServer.conns[i]);
+        }
+    }
+}
+
+void sim_server_set_stamp_interval(uint32_t interval_us)
+{
+    SimServer.stamp_interval_us = interval_us;
+}
+
+int sim_server_task(void *arg)
+{
+    LWIP_UNUSED_ARG(arg);
+
+    if (SimServer.mode != SIM_SERVER_STAMP || !time_reached(SimServer.next_stamp))
+    {
+        return 0;
+    }
+
+    SimServer.next_stamp = make_timeout_time_us(SimServer.stamp_interval_us);
+
+    uint8_t msg[SIM_SERVER_STAMP_SIZE] = {0};
+    uint64_t now = time_us_64();
+    uint32_t seq = SimServer.stamp_seq++;
+    memcpy(msg, &now, sizeof(now));
+    memcpy(msg + sizeof(now), &seq, sizeof(seq));
+
+    for (int i = 0; i < SIM_SERVER_MAX_CONNS; i++)
+    {
+        struct altcp_pcb *pcb = SimServer.conns[i];
+        if (pcb != NULL && altcp_sndbuf(pcb) >= sizeof(msg) && altcp_write(pcb, msg, sizeof(msg), TCP_WRITE_FLAG_COPY) == ERR_OK)
+        {
+            altcp_output(pcb);
+            SimServer.stats.tx_bytes += sizeof(msg);
+            SimServer.stats.stamps_sent++;
+        }
+    }
+
+    if (SimServer.udp_peer_port != 0)
+    {
+        _sim_server_udp_send(msg, sizeof(msg));
+        SimServer.stats.stamps_sent++;
+    }
+
+    return 0;
+}
+
+int sim_server_send_split(const void *data, uint32_t len, uint16_t segment)
+{
+    struct altcp_pcb *pcb = NULL;
+    for (int i = 0; i < SIM_SERVER_MAX_CONNS && pcb == NULL; i++)
+    {
+        pcb = SimServer.conns[i];
+    }
+
+    if (pcb == NULL || data == NULL || len > SIM_SERVER_SPLIT_MAX || segment == 0 ||
+        (SimServer.split_pcb != NULL && SimServer.split_off < SimServer.split_len))
+    {
+        return -1;
+    }
+
+    memcpy(SimServer.split, data, len);
+    SimServer.split_pcb = pcb;
+    SimServer.split_len = len;
+    SimServer.split_off = 0;
+    SimServer.split_segment = segment;
+    _sim_server_split(pcb);
+
+    return 0;
+}
+
+void sim_server_drop(void)
+{
+    SimServer.split_pcb = NULL;
+    for (int i = 0; i < SIM_SERVER_MAX_CONNS; i++)
+    {
+        struct altcp_pcb *pcb = SimServer.conns[i];
+        if (pcb != NULL)
+        {
+            SimServer.conns[i] = NULL;
+            altcp_arg(pcb, NULL);
+            altcp_err(pcb, NULL);
+            altcp_abort(pcb);
+        }
+    }
+}
+
+const sim_server_stats_t *sim_server_stats(void)
+{
+    return &SimServer.stats;
+}
+
+uint64_t sim_server_stamp_decode(const uint8_t *msg, uint32_t *seq)
+{
+    uint64_t sent_us;
+    memcpy(&sent_us, msg, sizeof(sent_us));
+    if (seq != NULL)
+    {
+        memcpy(seq, msg + sizeof(sent_us), sizeof(*seq));
+    }
+
+    return sent_us;
+}
+
+/**
+ * @brief Accept callback, remembers the connection and starts pushing if asked to.
+ */
+static err_t _sim_server_accept(void *arg, struct altcp_pcb *pcb, err_t err)
+{
+    LWIP_UNUSED_ARG(arg);
+
+    if (err != ERR_OK || pcb == NULL)
+    {
+        return ERR_VAL;
+    }
+
+    int slot = -1;
+    for (int i = 0; i < SIM_SERVER_MAX_CONNS && slot < 0; i++)
+    {
+        slot = SimServer.conns[i] == NULL ? i : -1;
+    }
+    if (slot < 0)
+    {
+        altcp_abort(pcb);
+        return ERR_ABRT;
+    }
+
+    SimServer.conns[slot] = pcb;
+    SimServer.mqtt[slot].len = 0;
+    SimServer.mqtt[slot].session = -1;
+    SimServer.stats.accepts++;
+    SimServer.stats.last_accept = get_absolute_time();
+
+    /** The slot is the callback argument, so the error callback can clear it */
+    altcp_arg(pcb, &SimServer.conns[slot]);
+    altcp_recv(pcb, _sim_server_recv);
+    altcp_sent(pcb, _sim_server_sent);
+    altcp_err(pcb, _sim_server_err);
+    altcp_nagle_disable(pcb);
+
+    if (SimServer.mode == SIM_SERVER_PUSH)
+    {
+        _sim_server_push(pcb);
+    }
+
+    return ERR_OK;
+}
+
+/**
+ * @brief Receive callback, echoes or discards depending on the mode.
+ */
+static err_t _sim_server_recv(void *arg, struct altcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+    LWIP_UNUSED_ARG(arg);
+
+    if (p == NULL)
+    {
+        _sim_server_forget(pcb);
+        altcp_close(pcb);
+        return ERR_OK;
+    }
+
+    SimServer.stats.rx_bytes += p->tot_len;
+
+    if (SimServer.mode == SIM_SERVER_ECHO)
+    {
+        for (struct pbuf *q = p; q != NULL; q = q->next)
+        {
+            if (altcp_write(pcb, q->payload, q->len, TCP_WRITE_FLAG_COPY) == ERR_OK)
+            {
+                SimServer.stats.tx_bytes += q->len;
+            }
+        }
+        altcp_output(pcb);
+    }
+    else if (SimServer.mode == SIM_SERVER_MQTT && arg != NULL)
+    {
+        _sim_server_mqtt_recv((int)((struct altcp_pcb **)arg - SimServer.conns), pcb, p);
+    }
+
+    altcp_recved(pcb, p->tot_len);
+    pbuf_free(p);
+
+    return ERR_OK;
+}
+
+/**
+ * @brief Sent callback, refills the send buffer in push mode.
+ */
+static err_t _sim_server_sent(void *arg, struct altcp_pcb *pcb, u16_t len)
+{
+    LWIP_UNUSED_ARG(arg);
+    LWIP_UNUSED_ARG(len);
+
+    if (SimServer.mode == SIM_SERVER_PUSH)
+    {
+        _sim_server_push(pcb);
+    }
+    if (pcb == SimServer.split_pcb)
+    {
+        _sim_server_split(pcb);
+    }
+
+    return ERR_OK;
+}
+
+/**
+ * @brief Error callback, the pcb is already gone.
+ */
+static void _sim_server_err(void *arg, err_t err)
+{
+    LWIP_UNUSED_ARG(err);
+
+    struct altcp_pcb **slot = (struct altcp_pcb **)arg;
+    if (slot != NULL)
+    {
+        if (*slot == SimServer.split_pcb)
+        {
+            SimServer.split_pcb = NULL;
+        }
+        *slot = NULL;
+    }
+}
+
+/**
+ * @brief Fill the send buffer with the push pattern.
+ * @param pcb Connection to push on.
+ * @return None.
+ */
+static void _sim_server_push(struct altcp_pcb *pcb)
+{
+    bool wrote = false;
+
+    while (altcp_sndbuf(pcb) >= SIM_SERVER_PUSH_CHUNK && altcp_sndqueuelen(pcb) < TCP_SND_QUEUELEN)
+    {
+        if (altcp_write(pcb, PushChunk, SIM_SERVER_PUSH_CHUNK, TCP_WRITE_FLAG_MORE) != ERR_OK)
+        {
+            break;
+        }
+        SimServer.stats.tx_bytes += SIM_SERVER_PUSH_CHUNK;
+        wrote = true;
+    }
+
+    if (wrote)
+    {
+        altcp_output(pcb);
+    }
+}
+
+/**
+ * @brief Send what is left of the split message, each segment pushed out on its own.
+ * @param pcb Connection the message goes to.
+ * @return None.
+ * @note Nagle is off, so every write leaves as a segment of its own while the congestion window
+ *       has room. The rest follows from the sent callback once the queue drains.
+ */
+static void _sim_server_split(struct altcp_pcb *pcb)
+{
+    while (SimServer.split_off < SimServer.split_len && altcp_sndqueuelen(pcb) < TCP_SND_QUEUELEN)
+    {
+        u16_t len = (u16_t)LWIP_MIN(SimServer.split_segment, SimServer.split_len - SimServer.split_off);
+        if (altcp_sndbuf(pcb) < len ||
+            altcp_write(pcb, SimServer.split + SimServer.split_off, len, TCP_WRITE_FLAG_COPY) != ERR_OK)
+        {
+            break;
+        }
+        altcp_output(pcb);
+        SimServer.split_off += len;
+        SimServer.stats.tx_bytes += len;
+    }
+}
+
+/**
+ * @brief Remove a connection from the table.
+ * @param pcb Connection to remove.
+ * @return None.
+ */
+static void _sim_server_forget(struct altcp_pcb *pcb)
+{
+    for (int i = 0; i < SIM_SERVER_MAX_CONNS; i++)
+    {
+        if (SimServer.conns[i] == pcb)
+        {
+            SimServer.conns[i] = NULL;
+        }
+    }
+    if (SimServer.split_pcb == pcb)
+    {
+        SimServer.split_pcb = NULL;
+    }
+}
+
+/**
+ * @brief UDP receive callback, remembers the sender and echoes or discards depending on the mode.
+ */
+static void _sim_server_udp_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+{
+    LWIP_UNUSED_ARG(arg);
+
+    ip_addr_copy(SimServer.udp_peer, *addr);
+    SimServer.udp_peer_port = port;
+    SimServer.stats.rx_bytes += p->tot_len;
+
+    if (SimServer.mode == SIM_SERVER_ECHO && udp_sendto(pcb, p, addr, port) == ERR_OK)
+    {
+        /** Sequence number included, the client sees its own sequence come back */
+        SimServer.stats.tx_bytes += p->tot_len;
+    }
+
+    pbuf_free(p);
+}
+
+/**
+ * @brief Send a datagram to the last UDP sender with the client's sequence header in front.
+ * @param data Payload.
+ * @param len Length of the payload.
+ * @return None.
+ */
+static void _sim_server_udp_send(const void *data, u16_t len)
+{
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, CLIENT_UDP_HEADER_SIZE + len, PBUF_RAM);
+    if (p == NULL)
+    {
+        return;
+    }
+
+    uint32_t seq = lwip_htonl(SimServer.udp_seq++);
+    pbuf_take_at(p, &seq, sizeof(seq), 0);
+    pbuf_take_at(p, data, len, CLIENT_UDP_HEADER_SIZE);
+
+    if (udp_sendto(SimServer.udp_pcb, p, &SimServer.udp_peer, SimServer.udp_peer_port) == ERR_OK)
+    {
+        SimServer.stats.tx_bytes += len;
+    }
+    pbuf_free(p);
+}
+
+/**
+ * @brief Listen for TCP or TLS connections and UDP datagrams on a port.
+ * @param port Port to listen on.
+ * @param mode What to do with connections.
+ * @param allocator altcp allocator for TLS, NULL for plain TCP.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _sim_server_listen(uint16_t port, sim_server_mode_t mode, altcp_allocator_t *allocator)
+{
+    for (size_t i = 0; i < sizeof(PushChunk); i++)
+    {
+        PushChunk[i] = (uint8_t)('a' + i % 26);
+    }
+
+    struct altcp_pcb *pcb = altcp_new_ip_type(allocator, IPADDR_TYPE_V4);
+    if (pcb == NULL)
+    {
+        return -1;
+    }
+
+    if (altcp_bind(pcb, &simnetif_server()->ip_addr, port) != ERR_OK)
+    {
+        altcp_abort(pcb);
+        return -1;
+    }
+
+    SimServer.listen_pcb = altcp_listen(pcb);
+    if (SimServer.listen_pcb == NULL)
+    {
+        return -1;
+    }
+
+    SimServer.mode = mode;
+    altcp_accept(SimServer.listen_pcb, _sim_server_accept);
+
+    SimServer.udp_pcb = udp_new_ip_type(IPADDR_TYPE_V4);
+    if (SimServer.udp_pcb == NULL || udp_bind(SimServer.udp_pcb, &simnetif_server()->ip_addr, port) != ERR_OK)
+    {
+        return -1;
+    }
+    udp_recv(SimServer.udp_pcb, _sim_server_udp_recv, NULL);
+
+    return 0;
+}
+
+/**
+ * @brief Add received bytes to an MQTT connection and handle every whole packet.
+ * @param conn Connection slot.
+ * @param pcb The connection.
+ * @param p Received data.
+ * @return None.
+ */
+static void _sim_server_mqtt_recv(int conn, struct altcp_pcb *pcb, struct pbuf *p)
+{
+    SimMqttConn_t *mqtt = &SimServer.mqtt[conn];
+
+    if (mqtt->len + p->tot_len > sizeof(mqtt->buf))
+    {
+        /** Not a stream this broker can follow any more */
+        mqtt->len = 0;
+        return;
+    }
+    mqtt->len += pbuf_copy_partial(p, &mqtt->buf[mqtt->len], p->tot_len, 0);
+
+    uint32_t used = 0;
+    while (mqtt->len - used >= 2)
+    {
+        const uint8_t *packet = &mqtt->buf[used];
+        uint32_t avail = mqtt->len - used;
+        uint32_t len = 0;
+        uint32_t i = 1;
+        for (; i < avail && i <= 4; i++)
+        {
+            len |= (uint32_t)(packet[i] & 0x7f) << (7 * (i - 1));
+            if ((packet[i] & 0x80) == 0)
+            {
+                break;
+            }
+        }
+        if (i >= avail || i + 1 + len > avail)
+        {
+            break;
+        }
+
+        _sim_server_mqtt_packet(conn, pcb, packet[0], &packet[i + 1], len);
+        used += i + 1 + len;
+    }
+
+    memmove(mqtt->buf, &mqtt->buf[used], mqtt->len - used);
+    mqtt->len -= used;
+}
+
+/**
+ * @brief Answer one MQTT packet.
+ * @param conn Connection slot.
+ * @param pcb The connection.
+ * @param type First byte, packet type and flags.
+ * @param body Variable header and payload.
+ * @param len Length of the body.
+ * @return None.
+ */
+static void _sim_server_mqtt_packet(int conn, struct altcp_pcb *pcb, uint8_t type, const uint8_t *body, uint32_t len)
+{
+    SimMqttConn_t *mqtt = &SimServer.mqtt[conn];
+
+    switch (type & 0xF0)
+    {
+    case 0x10:
+        _sim_server_mqtt_connect(conn, pcb, body, len);
+        return;
+
+    case 0x30:
+    {
+        uint8_t qos = (type >> 1) & 0x03;
+        uint16_t topic_len = len >= 2 ? (uint16_t)(body[0] << 8 | body[1]) : 0;
+        uint32_t header = 2u + topic_len + (qos > 0 ? 2u : 0u);
+        if (len < header)
+        {
+            return;
+        }
+
+        SimServer.stats.mqtt_publishes++;
+        _sim_server_mqtt_forward(&body[2], topic_len, &body[header], len - header);
+
+        if (qos > 0)
+        {
+            uint8_t puback[4] = {0x40, 2, body[header - 2], body[header - 1]};
+            _sim_server_mqtt_write(pcb, puback, sizeof(puback));
+        }
+        return;
+    }
+
+    case 0x80:
+    {
+        if (len < 2 || mqtt->session < 0)
+        {
+            return;
+        }
+
+        SimMqttSession_t *session = &SimServer.sessions[mqtt->session];
+        uint8_t suback[4 + SIM_SERVER_MQTT_FILTERS] = {0x90, 2, body[0], body[1]};
+        uint32_t pos = 2;
+        while (pos + 2 < len && suback[1] < 2 + SIM_SERVER_MQTT_FILTERS)
+        {
+            uint16_t filter_len = (uint16_t)(body[pos] << 8 | body[pos + 1]);
+            if (pos + 2 + filter_len + 1 > len)
+            {
+                break;
+            }
+
+            /** Granted at QoS 0, the only one messages are sent on with */
+            int found = -1;
+            for (int i = 0; i < session->filter_count && found < 0; i++)
+            {
+                found = strlen(session->filters[i]) == filter_len &&
+                        memcmp(session->filters[i], &body[pos + 2], filter_len) == 0 ? i : -1;
+            }
+            if (found < 0 && session->filter_count < SIM_SERVER_MQTT_FILTERS && filter_len < SIM_SERVER_MQTT_FILTER_MAX)
+            {
+                found = session->filter_count++;
+                memcpy(session->filters[found], &body[pos + 2], filter_len);
+                session->filters[found][filter_len] = '\0';
+            }
+            suback[2 + suback[1]++] = found >= 0 ? 0x00 : 0x80;
+            pos += 2u + filter_len + 1u;
+        }
+        _sim_server_mqtt_write(pcb, suback, (uint16_t)(2 + suback[1]));
+        return;
+    }
+
+    case 0xC0:
+    {
+        uint8_t pingresp[2] = {0xD0, 0};
+        _sim_server_mqtt_write(pcb, pingresp, sizeof(pingresp));
+        return;
+    }
+
+    default:
+        return;
+    }
+}
+
+/**
+ * @brief Take a CONNECT, resuming the session of the same client identifier unless asked not to.
+ * @param conn Connection slot.
+ * @param pcb The connection.
+ * @param body Variable header and payload.
+ * @param len Length of the body.
+ * @return None.
+ */
+static void _sim_server_mqtt_connect(int conn, struct altcp_pcb *pcb, const uint8_t *body, uint32_t len)
+{
+    /** Protocol name MQTT, level, flags, keepalive and the identifier */
+    if (len < 12 || len < 12u + (uint32_t)(body[10] << 8 | body[11]))
+    {
+        return;
+    }
+
+    bool clean = (body[7] & 0x02) != 0;
+    uint16_t id_len = (uint16_t)LWIP_MIN((uint32_t)(body[10] << 8 | body[11]), sizeof(SimServer.sessions[0].client_id) - 1);
+    char client_id[sizeof(SimServer.sessions[0].client_id)] = {0};
+    memcpy(client_id, &body[12], id_len);
+
+    int found = -1;
+    int unused = -1;
+    for (int i = 0; i < SIM_SERVER_MAX_CONNS; i++)
+    {
+        SimMqttSession_t *session = &SimServer.sessions[i];
+        if (session->used && strcmp(session->client_id, client_id) == 0)
+        {
+            found = i;
+        }
+        unused = !session->used && unused < 0 ? i : unused;
+    }
+
+    bool present = found >= 0 && !clean;
+    int index = found >= 0 ? found : LWIP_MAX(unused, 0);
+    if (!present)
+    {
+        SimServer.sessions[index] = (SimMqttSession_t){.used = true};
+        strcpy(SimServer.sessions[index].client_id, client_id);
+    }
+    SimServer.mqtt[conn].session = (int8_t)index;
+
+    uint8_t connack[4] = {0x20, 2, present ? 1 : 0, 0};
+    _sim_server_mqtt_write(pcb, connack, sizeof(connack));
+}
+
+/**
+ * @brief Send a message on to every connection subscribed to its topic.
+ * @param topic Topic, not NUL terminated.
+ * @param topic_len Length of the topic.
+ * @param payload Payload.
+ * @param len Length of the payload.
+ * @return None.
+ */
+static void _sim_server_mqtt_forward(const uint8_t *topic, uint16_t topic_len, const uint8_t *payload, uint32_t len)
+{
+    for (int i = 0; i < SIM_SERVER_MAX_CONNS; i++)
+    {
+        struct altcp_pcb *pcb = SimServer.conns[i];
+        int8_t index = SimServer.mqtt[i].session;
+        if (pcb == NULL || index < 0)
+        {
+            continue;
+        }
+
+        const SimMqttSession_t *session = &SimServer.sessions[index];
+        bool match = false;
+        for (int f = 0; f < session->filter_count && !match; f++)
+        {
+            match = _sim_server_mqtt_match(session->filters[f], topic, topic_len);
+        }
+        if (!match)
+        {
+            continue;
+        }
+
+        uint32_t remaining = 2u + topic_len + len;
+        uint8_t head[1 + 4 + 2] = {0x30};
+        uint16_t head_len = 1;
+        do
+        {
+            head[head_len] = (uint8_t)(remaining & 0x7f);
+            remaining >>= 7;
+            head[head_len++] |= remaining > 0 ? 0x80 : 0;
+        } while (remaining > 0);
+        head[head_len++] = (uint8_t)(topic_len >> 8);
+        head[head_len++] = (uint8_t)topic_len;
+
+        if (altcp_sndbuf(pcb) >= head_len + topic_len + len &&
+            altcp_write(pcb, head, head_len, TCP_WRITE_FLAG_COPY | TCP_WRITE_FLAG_MORE) == ERR_OK &&
+            altcp_write(pcb, topic, topic_len, TCP_WRITE_FLAG_COPY | (len > 0 ? TCP_WRITE_FLAG_MORE : 0)) == ERR_OK &&
+            (len == 0 || altcp_write(pcb, payload, (u16_t)len, TCP_WRITE_FLAG_COPY) == ERR_OK))
+        {
+            altcp_output(pcb);
+            SimServer.stats.tx_bytes += head_len + topic_len + len;
+            SimServer.stats.mqtt_forwarded++;
+        }
+    }
+}
+
+/**
+ * @brief Match a topic against a filter, + for one level and # for the rest.
+ * @param filter Filter, NUL terminated.
+ * @param topic Topic, not NUL terminated.
+ * @param len Length of the topic.
+ * @return bool true if the filter matches.
+ */
+static bool _sim_server_mqtt_match(const char *filter, const uint8_t *topic, uint16_t len)
+{
+    const char *f = filter;
+    uint16_t t = 0;
+
+    while (true)
+    {
+        if (*f == '#')
+        {
+            return true;
+        }
+
+        if (*f == '+')
+        {
+            f++;
+            while (t < len && topic[t] != '/')
+            {
+                t++;
+            }
+        }
+        else
+        {
+            while (*f != '\0' && *f != '/' && t < len && topic[t] == (uint8_t)*f)
+            {
+                f++;
+                t++;
+            }
+        }
+
+        if (*f == '\0' || t >= len)
+        {
+            /** a/# matches a as well */
+            return (*f == '\0' && t >= len) || (t >= len && strcmp(f, "/#") == 0);
+        }
+
+        if (*f != '/' || topic[t] != '/')
+        {
+            return false;
+        }
+        f++;
+        t++;
+    }
+}
+
+/**
+ * @brief Write a short MQTT packet and send it.
+ * @param pcb The connection.
+ * @param packet The packet.
+ * @param len Length of the packet.
+ * @return None.
+ */
+static void _sim_server_mqtt_write(struct altcp_pcb *pcb, const uint8_t *packet, uint16_t len)
+{
+    if (altcp_write(pcb, packet, len, TCP_WRITE_FLAG_COPY) == ERR_OK)
+    {
+        altcp_output(pcb);
+        SimServer.stats.tx_bytes += len;
+    }
+}
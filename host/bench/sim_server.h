@@ -0,0 +1,129 @@
+#ifndef _SIM_SERVER_H_
+#define _SIM_SERVER_H_
+/** Includes *************************************************************************************/
+#include "pico/stdlib.h"
+/** Defines **************************************************************************************/
+/** Port the client connects to */
+#define SIM_SERVER_PORT 4242
+
+/** Connections the server keeps at once */
+#define SIM_SERVER_MAX_CONNS 4
+
+/** Size of a timestamped message, see SIM_SERVER_STAMP */
+#define SIM_SERVER_STAMP_SIZE 16
+
+/** Largest MQTT packet the broker mode reassembles, and filters it keeps per session */
+#define SIM_SERVER_MQTT_PACKET_MAX 2048
+#define SIM_SERVER_MQTT_FILTERS 4
+#define SIM_SERVER_MQTT_FILTER_MAX 64
+
+/** Largest message sim_server_send_split() takes */
+#define SIM_SERVER_SPLIT_MAX 2048
+
+/** Typedefs *************************************************************************************/
+typedef enum
+{
+    SIM_SERVER_ECHO = 0, /** Send back whatever is received */
+    SIM_SERVER_PUSH,     /** Keep the send buffer full, for download throughput */
+    SIM_SERVER_SINK,     /** Discard whatever is received, for upload throughput */
+    SIM_SERVER_STAMP,    /** Send a timestamped message at a fixed interval, for latency */
+    SIM_SERVER_MQTT,     /** A minimal MQTT 3.1.1 broker, sessions kept by client identifier, see below */
+} sim_server_mode_t;
+
+typedef struct
+{
+    uint64_t rx_bytes;
+    uint64_t tx_bytes;
+    uint32_t accepts;
+    uint32_t stamps_sent;
+    uint32_t mqtt_publishes;  /** PUBLISH packets received in MQTT mode */
+    uint32_t mqtt_forwarded;  /** Messages sent on to subscribers, always at QoS 0 */
+    absolute_time_t last_accept;
+} sim_server_stats_t;
+
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Start listening on the simulated server netif, for TCP and UDP on the same port.
+ *
+ * Over UDP the server answers whoever sent it the last datagram, with the sequence header of
+ * the client's UDP mode in front of every datagram it sends.
+ *
+ * In SIM_SERVER_MQTT mode TCP connections speak MQTT: PUBLISH at QoS 1 is acknowledged and
+ * sent on at QoS 0 to every connection with a matching subscription, the sender included. A
+ * client that connects again under the same identifier without the clean session flag gets its
+ * subscriptions back, nothing else of the session is kept.
+ *
+ * @param port Port to listen on.
+ * @param mode What to do with connections.
+ * @return int 0 on success, -1 on failure.
+ */
+int sim_server_start(uint16_t port, sim_server_mode_t mode);
+
+/**
+ * @brief Like sim_server_start(), but TCP connections are TLS with a built-in test certificate.
+ *
+ * A stand-in for a TLS server, it issues session tickets and keeps a session cache, so the
+ * client's resumption can be measured. Needs a host build with PICO_CLIENT_TLS.
+ *
+ * @param port Port to listen on.
+ * @param mode What to do with connections.
+ * @return int 0 on success, -1 on failure or without TLS support.
+ */
+int sim_server_start_tls(uint16_t port, sim_server_mode_t mode);
+
+/**
+ * @brief Change what the server does, also for connections that are already open.
+ * @param mode New mode.
+ * @return None.
+ */
+void sim_server_set_mode(sim_server_mode_t mode);
+
+/**
+ * @brief Set the interval of the timestamped messages sent in SIM_SERVER_STAMP mode.
+ * @param interval_us Interval in microseconds.
+ * @return None.
+ */
+void sim_server_set_stamp_interval(uint32_t interval_us);
+
+/**
+ * @brief Send timestamped messages that are due, run it at least as often as the interval.
+ * @param arg Unused, the signature matches a scheduler task.
+ * @return int 0.
+ */
+int sim_server_task(void *arg);
+
+/**
+ * @brief Send a message on the first open TCP connection in segments of a few bytes each.
+ *
+ * For the client's receive queue, a frame that arrives in more segments than it has slots.
+ * The message is copied, the rest of it follows as the client acknowledges.
+ *
+ * @param data Message, up to SIM_SERVER_SPLIT_MAX bytes.
+ * @param len Length of the message.
+ * @param segment Bytes per segment.
+ * @return int 0 on success, -1 without a connection or while a message is still being sent.
+ */
+int sim_server_send_split(const void *data, uint32_t len, uint16_t segment);
+
+/**
+ * @brief Abort every open connection, the client sees a reset.
+ * @return None.
+ */
+void sim_server_drop(void);
+
+/**
+ * @brief Get the server counters.
+ * @return const sim_server_stats_t* The counters.
+ */
+const sim_server_stats_t *sim_server_stats(void);
+
+/**
+ * @brief Decode a timestamped message.
+ * @param msg SIM_SERVER_STAMP_SIZE bytes of message.
+ * @param seq Sequence number of the message, may be NULL.
+ * @return uint64_t Time the server sent it, in microseconds since start.
+ */
+uint64_t sim_server_stamp_decode(const uint8_t *msg, uint32_t *seq);
+
+#endif /* _SIM_SERVER_H_ */
@@ -0,0 +1,521 @@
+/** Includes *************************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include "pico/cyw43_arch.h"
+#include "lwip/init.h"
+#include "lwip/timeouts.h"
+#include "simnetif.h"
+#if PICO_CLIENT_HOST_TAP
+#include "netif/tapif.h"
+#endif
+/** Defines **************************************************************************************/
+/** Longest sleep in TAP mode, the TAP file descriptor is polled rather than waited on */
+#define CYW43_SHIM_TAP_POLL_US 1000
+
+/** Beacon interval of the simulated access point */
+#define CYW43_SHIM_BEACON_MS 100
+
+/** Access points of the simulated network, the first one in range with a good signal */
+#define CYW43_SHIM_AP_BSSID(n) {0x02, 0x00, 0x00, 0x00, 0x00, (n)}
+#define CYW43_SHIM_AP_CHANNEL 6
+#define CYW43_SHIM_AP_RSSI -50
+
+/** Packet counters, WLC_GET_PKTCNTS as the driver passes it on */
+#define CYW43_SHIM_IOCTL_GET_PKTCNTS 0x13a
+
+/** Typedefs *************************************************************************************/
+typedef struct
+{
+    uint8_t bssid[6];
+    uint32_t channel;
+    int32_t rssi;
+    uint32_t tx_failures;          /** Percentage of the station's frames that fail */
+} Cyw43ShimAp_t;
+
+typedef struct
+{
+    bool initialised;
+    bool sta_enabled;
+    bool ap_available;
+    int link;
+    Cyw43ShimAp_t aps[CYW43_SHIM_APS];
+    int ap;                        /** Access point joined or being joined, -1 if none was found */
+    uint32_t join_delay_ms;
+    uint32_t scan_delay_ms;
+    absolute_time_t join_done_at;
+    bool scanning;
+    absolute_time_t scan_done_at;
+    uint8_t scan_ssid_len;         /** Every access point is on the network scanned for */
+    uint8_t scan_ssid[32];
+    void *scan_env;
+    int (*scan_cb)(void *, const cyw43_ev_scan_result_t *);
+} Cyw43Shim_t;
+
+/** Variables ************************************************************************************/
+cyw43_t cyw43_state;
+
+static Cyw43Shim_t Cyw43Shim = {
+    .initialised = false,
+    .sta_enabled = false,
+    .ap_available = true,
+    .link = CYW43_LINK_DOWN,
+    .aps = {
+        {.bssid = CYW43_SHIM_AP_BSSID(1), .channel = CYW43_SHIM_AP_CHANNEL, .rssi = CYW43_SHIM_AP_RSSI},
+        {.bssid = CYW43_SHIM_AP_BSSID(2), .channel = 1, .rssi = CYW43_SHIM_RSSI_NONE},
+        {.bssid = CYW43_SHIM_AP_BSSID(3), .channel = 11, .rssi = CYW43_SHIM_RSSI_NONE},
+        {.bssid = CYW43_SHIM_AP_BSSID(4), .channel = 6, .rssi = CYW43_SHIM_RSSI_NONE},
+    },
+    .ap = -1,
+    .join_delay_ms = 0,
+    .scan_delay_ms = 0,
+    .join_done_at = 0,
+    .scanning = false,
+    .scan_done_at = 0,
+    .scan_ssid_len = 0,
+    .scan_ssid = {0},
+    .scan_env = NULL,
+    .scan_cb = NULL,
+};
+
+/** Prototypes ***********************************************************************************/
+/** Private Function Prototypes ******************************************************************/
+static void _cyw43_shim_set_link(int link);
+static bool _cyw43_shim_in_range(int ap);
+static int _cyw43_shim_netif_init(struct netif *sta);
+
+/** Function Definitions *************************************************************************/
+int cyw43_arch_init(void)
+{
+    if (Cyw43Shim.initialised)
+    {
+        return 0;
+    }
+
+    lwip_init();
+    if (_cyw43_shim_netif_init(&cyw43_state.netif[CYW43_ITF_STA]) != 0)
+    {
+        return -1;
+    }
+
+    Cyw43Shim.initialised = true;
+
+    return 0;
+}
+
+void cyw43_arch_deinit(void)
+{
+    _cyw43_shim_set_link(CYW43_LINK_DOWN);
+    Cyw43Shim.sta_enabled = false;
+}
+
+void cyw43_arch_enable_sta_mode(void)
+{
+    /** The driver puts a newly enabled station in its default power mode */
+    if (!Cyw43Shim.sta_enabled)
+    {
+        cyw43_wifi_pm(&cyw43_state, CYW43_DEFAULT_PM);
+    }
+    Cyw43Shim.sta_enabled = true;
+}
+
+void cyw43_arch_disable_sta_mode(void)
+{
+    Cyw43Shim.sta_enabled = false;
+    _cyw43_shim_set_link(CYW43_LINK_DOWN);
+}
+
+int cyw43_arch_wifi_connect_bssid_async(const char *ssid, const uint8_t *bssid, const char *pw, uint32_t auth)
+{
+    return cyw43_wifi_join(&cyw43_state, strlen(ssid), (const uint8_t *)ssid, pw != NULL ? strlen(pw) : 0,
+                           (const uint8_t *)pw, auth, bssid, CYW43_CHANNEL_NONE);
+}
+
+int cyw43_arch_wifi_connect_async(const char *ssid, const char *pw, uint32_t auth)
+{
+    return cyw43_arch_wifi_connect_bssid_async(ssid, NULL, pw, auth);
+}
+
+int cyw43_wifi_join(cyw43_t *self, size_t ssid_len, const uint8_t *ssid, size_t key_len, const uint8_t *key,
+                    uint32_t auth_type, const uint8_t *bssid, uint32_t channel)
+{
+    LWIP_UNUSED_ARG(self);
+    LWIP_UNUSED_ARG(ssid_len);
+    LWIP_UNUSED_ARG(ssid);
+    LWIP_UNUSED_ARG(key_len);
+    LWIP_UNUSED_ARG(key);
+    LWIP_UNUSED_ARG(auth_type);
+
+    if (!Cyw43Shim.sta_enabled)
+    {
+        return PICO_ERROR_GENERIC;
+    }
+
+    /** Without a channel every channel is scanned first, a wrong BSSID or channel finds nothing */
+    uint32_t delay_ms = Cyw43Shim.join_delay_ms;
+    if (channel == CYW43_CHANNEL_NONE)
+    {
+        delay_ms += Cyw43Shim.scan_delay_ms;
+    }
+
+    /** The strongest access point that fits, joining while associated moves to it */
+    Cyw43Shim.ap = -1;
+    for (int i = 0; i < CYW43_SHIM_APS; i++)
+    {
+        Cyw43ShimAp_t *ap = &Cyw43Shim.aps[i];
+        if (_cyw43_shim_in_range(i) && (channel == CYW43_CHANNEL_NONE || channel == ap->channel) &&
+            (bssid == NULL || memcmp(bssid, ap->bssid, sizeof(ap->bssid)) == 0) &&
+            (Cyw43Shim.ap < 0 || ap->rssi > Cyw43Shim.aps[Cyw43Shim.ap].rssi))
+        {
+            Cyw43Shim.ap = i;
+        }
+    }
+
+    _cyw43_shim_set_link(CYW43_LINK_JOIN);
+    Cyw43Shim.join_done_at = make_timeout_time_ms(delay_ms);
+
+    return 0;
+}
+
+int cyw43_wifi_get_bssid(cyw43_t *self, uint8_t bssid[6])
+{
+    LWIP_UNUSED_ARG(self);
+
+    if (Cyw43Shim.link != CYW43_LINK_UP)
+    {
+        return PICO_ERROR_GENERIC;
+    }
+
+    memcpy(bssid, Cyw43Shim.aps[Cyw43Shim.ap].bssid, sizeof(Cyw43Shim.aps[0].bssid));
+
+    return 0;
+}
+
+int cyw43_wifi_get_rssi(cyw43_t *self, int32_t *rssi)
+{
+    LWIP_UNUSED_ARG(self);
+
+    if (Cyw43Shim.link != CYW43_LINK_UP)
+    {
+        return PICO_ERROR_GENERIC;
+    }
+
+    *rssi = Cyw43Shim.aps[Cyw43Shim.ap].rssi;
+
+    return 0;
+}
+
+int cyw43_wifi_scan(cyw43_t *self, cyw43_wifi_scan_options_t *opts, void *env,
+                    int (*result_cb)(void *, const cyw43_ev_scan_result_t *))
+{
+    LWIP_UNUSED_ARG(self);
+
+    if (!Cyw43Shim.sta_enabled || Cyw43Shim.scanning)
+    {
+        return PICO_ERROR_GENERIC;
+    }
+
+    Cyw43Shim.scan_ssid_len = (uint8_t)LWIP_MIN(opts->ssid_len, sizeof(Cyw43Shim.scan_ssid));
+    memcpy(Cyw43Shim.scan_ssid, opts->ssid, Cyw43Shim.scan_ssid_len);
+
+    Cyw43Shim.scanning = true;
+    Cyw43Shim.scan_done_at = make_timeout_time_ms(Cyw43Shim.scan_delay_ms);
+    Cyw43Shim.scan_env = env;
+    Cyw43Shim.scan_cb = result_cb;
+
+    return 0;
+}
+
+bool cyw43_wifi_scan_active(cyw43_t *self)
+{
+    LWIP_UNUSED_ARG(self);
+
+    return Cyw43Shim.scanning;
+}
+
+int cyw43_ioctl(cyw43_t *self, uint32_t cmd, size_t len, uint8_t *buf, uint32_t iface)
+{
+    LWIP_UNUSED_ARG(self);
+    LWIP_UNUSED_ARG(iface);
+
+    if (Cyw43Shim.link != CYW43_LINK_UP)
+    {
+        return PICO_ERROR_GENERIC;
+    }
+
+    /** Only the channel and the packet counters are simulated */
+    if (cmd == CYW43_IOCTL_GET_CHANNEL && len >= sizeof(uint32_t))
+    {
+        memcpy(buf, &Cyw43Shim.aps[Cyw43Shim.ap].channel, sizeof(uint32_t));
+        return 0;
+    }
+
+#if !PICO_CLIENT_HOST_TAP
+    if (cmd == CYW43_SHIM_IOCTL_GET_PKTCNTS && len >= 5 * sizeof(uint32_t))
+    {
+        /** rx good, rx bad, tx good, tx bad, rx other cast */
+        uint32_t counts[5] = {0};
+        uint32_t sent;
+        uint32_t lost;
+        simnetif_counters(&sent, &lost);
+        counts[2] = sent - lost;
+        counts[3] = lost;
+        memcpy(buf, counts, sizeof(counts));
+        return 0;
+    }
+#endif
+
+    return PICO_ERROR_GENERIC;
+}
+
+int cyw43_wifi_pm(cyw43_t *self, uint32_t pm)
+{
+    LWIP_UNUSED_ARG(self);
+
+#if PICO_CLIENT_HOST_TAP
+    LWIP_UNUSED_ARG(pm);
+#else
+    uint32_t mode = pm & 0xf;
+    uint32_t sleep_ret_ms = ((pm >> 4) & 0xff) * 10;
+    uint32_t dtim_period = (pm >> 16) & 0xf;
+
+    /** PM1 dozes straight after every packet, PM2 after the sleep return time */
+    simnetif_set_power_save(mode != CYW43_NO_POWERSAVE_MODE, mode == CYW43_PM1_POWERSAVE_MODE ? 0 : sleep_ret_ms,
+                            CYW43_SHIM_BEACON_MS * (dtim_period > 0 ? dtim_period : 1));
+#endif
+
+    return 0;
+}
+
+void cyw43_arch_poll(void)
+{
+    if (!Cyw43Shim.initialised)
+    {
+        return;
+    }
+
+    /** Finish a join once the join time is up */
+    if (Cyw43Shim.link == CYW43_LINK_JOIN && time_reached(Cyw43Shim.join_done_at))
+    {
+        _cyw43_shim_set_link(_cyw43_shim_in_range(Cyw43Shim.ap) ? CYW43_LINK_UP : CYW43_LINK_NONET);
+    }
+
+    /** The access point went out of range */
+    if (Cyw43Shim.link == CYW43_LINK_UP && !_cyw43_shim_in_range(Cyw43Shim.ap))
+    {
+        _cyw43_shim_set_link(CYW43_LINK_DOWN);
+    }
+
+    /** Report every access point in range once the scan is over */
+    if (Cyw43Shim.scanning && time_reached(Cyw43Shim.scan_done_at))
+    {
+        Cyw43Shim.scanning = false;
+        for (int i = 0; i < CYW43_SHIM_APS; i++)
+        {
+            if (!_cyw43_shim_in_range(i))
+            {
+                continue;
+            }
+
+            cyw43_ev_scan_result_t result = {
+                .ssid_len = Cyw43Shim.scan_ssid_len,
+                .channel = (uint16_t)Cyw43Shim.aps[i].channel,
+                .rssi = (int16_t)Cyw43Shim.aps[i].rssi,
+            };
+            memcpy(result.bssid, Cyw43Shim.aps[i].bssid, sizeof(result.bssid));
+            memcpy(result.ssid, Cyw43Shim.scan_ssid, Cyw43Shim.scan_ssid_len);
+            Cyw43Shim.scan_cb(Cyw43Shim.scan_env, &result);
+        }
+    }
+
+    sys_check_timeouts();
+#if PICO_CLIENT_HOST_TAP
+    tapif_poll(&cyw43_state.netif[CYW43_ITF_STA]);
+#else
+    simnetif_poll();
+#endif
+}
+
+void cyw43_arch_wait_for_work_until(absolute_time_t until)
+{
+    int64_t sleep = absolute_time_diff_us(get_absolute_time(), until);
+
+    /** Wake for lwIP timers, packets due on the wire and the end of a join like the driver would */
+    u32_t timers_ms = sys_timeouts_sleeptime();
+    if (timers_ms != SYS_TIMEOUTS_SLEEPTIME_INFINITE && (int64_t)timers_ms * 1000 < sleep)
+    {
+        sleep = (int64_t)timers_ms * 1000;
+    }
+
+#if PICO_CLIENT_HOST_TAP
+    if (sleep > CYW43_SHIM_TAP_POLL_US)
+    {
+        sleep = CYW43_SHIM_TAP_POLL_US;
+    }
+#else
+    int64_t packet_us = simnetif_next_event_us();
+    if (packet_us >= 0 && packet_us < sleep)
+    {
+        sleep = packet_us;
+    }
+#endif
+
+    if (Cyw43Shim.link == CYW43_LINK_JOIN)
+    {
+        int64_t join_us = absolute_time_diff_us(get_absolute_time(), Cyw43Shim.join_done_at);
+        if (join_us < sleep)
+        {
+            sleep = join_us;
+        }
+    }
+
+    if (Cyw43Shim.scanning)
+    {
+        int64_t scan_us = absolute_time_diff_us(get_absolute_time(), Cyw43Shim.scan_done_at);
+        if (scan_us < sleep)
+        {
+            sleep = scan_us;
+        }
+    }
+
+    if (sleep > 0)
+    {
+        sleep_us((uint64_t)sleep);
+    }
+}
+
+void cyw43_arch_gpio_put(uint wl_gpio, bool value)
+{
+    LWIP_UNUSED_ARG(wl_gpio);
+    LWIP_UNUSED_ARG(value);
+}
+
+int cyw43_tcpip_link_status(cyw43_t *self, int itf)
+{
+    LWIP_UNUSED_ARG(self);
+
+    if (itf != CYW43_ITF_STA || !Cyw43Shim.sta_enabled)
+    {
+        return CYW43_LINK_DOWN;
+    }
+
+    return Cyw43Shim.link;
+}
+
+void cyw43_shim_set_join_delay_ms(uint32_t ms)
+{
+    Cyw43Shim.join_delay_ms = ms;
+}
+
+void cyw43_shim_set_scan_delay_ms(uint32_t ms)
+{
+    Cyw43Shim.scan_delay_ms = ms;
+}
+
+void cyw43_shim_set_ap_available(bool available)
+{
+    Cyw43Shim.ap_available = available;
+}
+
+void cyw43_shim_set_ap_channel(uint32_t channel)
+{
+    Cyw43Shim.aps[0].channel = channel;
+}
+
+void cyw43_shim_set_ap_rssi(uint32_t ap, int32_t rssi)
+{
+    if (ap < CYW43_SHIM_APS)
+    {
+        Cyw43Shim.aps[ap].rssi = rssi;
+    }
+}
+
+void cyw43_shim_set_ap_tx_failures(uint32_t ap, uint32_t percent)
+{
+    if (ap >= CYW43_SHIM_APS)
+    {
+        return;
+    }
+
+    Cyw43Shim.aps[ap].tx_failures = percent;
+#if !PICO_CLIENT_HOST_TAP
+    if (Cyw43Shim.link == CYW43_LINK_UP && Cyw43Shim.ap == (int)ap)
+    {
+        simnetif_set_loss(percent);
+    }
+#endif
+}
+
+/**
+ * @brief Move the simulated link to a new state and mirror it on the netif.
+ * @param link New CYW43_LINK_* state.
+ * @return None.
+ */
+static void _cyw43_shim_set_link(int link)
+{
+    struct netif *sta = &cyw43_state.netif[CYW43_ITF_STA];
+    bool was_up = Cyw43Shim.link == CYW43_LINK_UP;
+
+    Cyw43Shim.link = link;
+
+    if (!Cyw43Shim.initialised || was_up == (link == CYW43_LINK_UP))
+    {
+        return;
+    }
+
+    if (link == CYW43_LINK_UP)
+    {
+        netif_set_link_up(sta);
+#if !PICO_CLIENT_HOST_TAP
+        simnetif_set_loss(Cyw43Shim.aps[Cyw43Shim.ap].tx_failures);
+        simnetif_set_link(true);
+#endif
+    }
+    else
+    {
+        netif_set_link_down(sta);
+#if !PICO_CLIENT_HOST_TAP
+        simnetif_set_link(false);
+#endif
+    }
+}
+
+/**
+ * @brief Check whether an access point can be heard.
+ * @param ap Index of the access point, -1 for none.
+ * @return bool true if it is in range.
+ */
+static bool _cyw43_shim_in_range(int ap)
+{
+    return ap >= 0 && Cyw43Shim.ap_available && Cyw43Shim.aps[ap].rssi > CYW43_SHIM_RSSI_NONE;
+}
+
+/**
+ * @brief Create the station netif, statically addressed since there is no DHCP server.
+ * @param sta Netif to initialise.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _cyw43_shim_netif_init(struct netif *sta)
+{
+#if PICO_CLIENT_HOST_TAP
+    /** Address the TAP side from the environment, e.g. HOST_TAP_IP=192.168.7.2 */
+    const char *ip_str = getenv("HOST_TAP_IP");
+    const char *mask_str = getenv("HOST_TAP_NETMASK");
+    const char *gw_str = getenv("HOST_TAP_GW");
+    ip4_addr_t ip, mask, gw;
+
+    ip4addr_aton(ip_str != NULL ? ip_str : "192.168.7.2", &ip);
+    ip4addr_aton(mask_str != NULL ? mask_str : "255.255.255.0", &mask);
+    ip4addr_aton(gw_str != NULL ? gw_str : "192.168.7.1", &gw);
+
+    if (netif_add(sta, &ip, &mask, &gw, NULL, tapif_init, netif_input) == NULL)
+    {
+        return -1;
+    }
+    netif_set_default(sta);
+    netif_set_up(sta);
+
+    return 0;
+#else
+    return simnetif_init(sta);
+#endif
+}
@@ -0,0 +1,45 @@
+/** Includes *************************************************************************************/
+#include <string.h>
+#include "pico/flash.h"
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+uint8_t flash_shim_image[PICO_FLASH_SIZE_BYTES] = {[0 ... PICO_FLASH_SIZE_BYTES - 1] = 0xff};
+
+/** Prototypes ***********************************************************************************/
+/** Private Function Prototypes ******************************************************************/
+/** Function Definitions *************************************************************************/
+void flash_range_erase(uint32_t flash_offs, size_t count)
+{
+    if (flash_offs % FLASH_SECTOR_SIZE != 0 || count % FLASH_SECTOR_SIZE != 0 ||
+        flash_offs + count > PICO_FLASH_SIZE_BYTES)
+    {
+        return;
+    }
+
+    memset(&flash_shim_image[flash_offs], 0xff, count);
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count)
+{
+    if (flash_offs % FLASH_PAGE_SIZE != 0 || count % FLASH_PAGE_SIZE != 0 ||
+        flash_offs + count > PICO_FLASH_SIZE_BYTES)
+    {
+        return;
+    }
+
+    /** Programming can only clear bits, like NOR flash */
+    for (size_t i = 0; i < count; i++)
+    {
+        flash_shim_image[flash_offs + i] &= data[i];
+    }
+}
+
+int flash_safe_execute(void (*func)(void *), void *param, uint32_t enter_exit_timeout_ms)
+{
+    (void)enter_exit_timeout_ms;
+
+    func(param);
+
+    return PICO_OK;
+}
@@ -0,0 +1,17 @@
+#ifndef _HARDWARE_FLASH_H
+#define _HARDWARE_FLASH_H
+#include <stddef.h>
+#include <stdint.h>
+
+/** A small flash image in RAM, read through XIP_BASE like the real one, starts erased */
+#define FLASH_PAGE_SIZE 256
+#define FLASH_SECTOR_SIZE 4096
+#define PICO_FLASH_SIZE_BYTES (64 * 1024)
+
+extern uint8_t flash_shim_image[PICO_FLASH_SIZE_BYTES];
+#define XIP_BASE ((uintptr_t)flash_shim_image)
+
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+
+#endif /* _HARDWARE_FLASH_H */
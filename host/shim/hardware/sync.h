@@ -0,0 +1,13 @@
+#ifndef _HARDWARE_SYNC_H
+#define _HARDWARE_SYNC_H
+#include <stdint.h>
+
+/** The host build is single threaded, events and barriers reduce to compiler barriers */
+static inline void __sev(void) { __atomic_signal_fence(__ATOMIC_SEQ_CST); }
+static inline void __wfe(void) { __atomic_signal_fence(__ATOMIC_SEQ_CST); }
+static inline void __dmb(void) { __atomic_thread_fence(__ATOMIC_SEQ_CST); }
+static inline void __compiler_memory_barrier(void) { __atomic_signal_fence(__ATOMIC_SEQ_CST); }
+static inline uint32_t save_and_disable_interrupts(void) { return 0; }
+static inline void restore_interrupts(uint32_t status) { (void)status; }
+
+#endif /* _HARDWARE_SYNC_H */
@@ -0,0 +1,19 @@
+#ifndef __HOST_LWIPOPTS_H__
+#define __HOST_LWIPOPTS_H__
+
+// Host build: use exactly the firmware's lwIP tuning so measurements carry over to the board
+#include "../../inc/lwipopts.h"
+
+// Route between the station netif and the in-process server netif by source address
+#if !PICO_CLIENT_HOST_TAP
+#define LWIP_HOOK_FILENAME              "simnetif.h"
+#define LWIP_HOOK_IP4_ROUTE_SRC(src, dest) simnetif_route(src, dest)
+#endif
+
+// The stand-in TLS server resumes sessions from tickets and from its session cache
+#if PICO_CLIENT_TLS
+#define ALTCP_MBEDTLS_USE_SESSION_TICKETS   1
+#define ALTCP_MBEDTLS_USE_SESSION_CACHE     1
+#endif
+
+#endif /* __HOST_LWIPOPTS_H__ */
@@ -0,0 +1,12 @@
+#ifndef __HOST_MBEDTLS_CONFIG_H__
+#define __HOST_MBEDTLS_CONFIG_H__
+
+// Host build: the firmware's client configuration, so handshakes match the board's
+#include "../../inc/mbedtls_config.h"
+
+// The stand-in server of the benchmarks, with session tickets and a session cache to resume from
+#define MBEDTLS_SSL_SRV_C
+#define MBEDTLS_SSL_TICKET_C
+#define MBEDTLS_SSL_CACHE_C
+
+#endif /* __HOST_MBEDTLS_CONFIG_H__ */
@@ -0,0 +1,29 @@
+/** Includes *************************************************************************************/
+#include <sys/random.h>
+#include <stddef.h>
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+int mbedtls_hardware_poll(void *data, unsigned char *output, size_t len, size_t *olen);
+
+/** Private Function Prototypes ******************************************************************/
+/** Function Definitions *************************************************************************/
+/**
+ * @brief Entropy source for MBEDTLS_ENTROPY_HARDWARE_ALT, pico_mbedtls has it on the board.
+ * @return int 0 on success, -1 on failure.
+ */
+int mbedtls_hardware_poll(void *data, unsigned char *output, size_t len, size_t *olen)
+{
+    (void)data;
+
+    ssize_t got = getrandom(output, len, 0);
+    if (got < 0)
+    {
+        return -1;
+    }
+
+    *olen = (size_t)got;
+
+    return 0;
+}
@@ -0,0 +1,129 @@
+/** Includes *************************************************************************************/
+#include "pico/rand.h"
+#include "netem.h"
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** One direction of the wire */
+typedef struct
+{
+    bool enabled;
+    netem_params_t params;
+    bool in_burst;                /** The last packet was lost */
+    absolute_time_t busy_until;   /** The bandwidth is taken by queued packets until then */
+    netem_stats_t stats;
+} NetemDir_t;
+
+typedef struct
+{
+    bool installed;
+    NetemDir_t dirs[2];
+} Netem_t;
+
+/** Variables ************************************************************************************/
+static Netem_t Netem = {0};
+
+/** Prototypes ***********************************************************************************/
+/** Private Function Prototypes ******************************************************************/
+static uint32_t _netem_filter(void *arg, simnetif_dir_t dir, uint32_t len, absolute_time_t now,
+                              absolute_time_t deliver_at[SIMNETIF_FILTER_COPIES]);
+static bool _netem_chance(uint32_t permille);
+
+/** Function Definitions *************************************************************************/
+void netem_set(simnetif_dir_t dir, const netem_params_t *params)
+{
+    NetemDir_t *d = &Netem.dirs[dir];
+
+    if (!Netem.installed)
+    {
+        simnetif_set_filter(_netem_filter, &Netem);
+        Netem.installed = true;
+    }
+
+    d->enabled = params != NULL;
+    d->params = params != NULL ? *params : (netem_params_t){0};
+    d->in_burst = false;
+}
+
+const netem_stats_t *netem_stats(simnetif_dir_t dir)
+{
+    return &Netem.dirs[dir].stats;
+}
+
+/**
+ * @brief simnetif filter, loses, queues, delays and duplicates packets.
+ * @param arg Pointer to the filter state.
+ * @param dir Direction of the packet.
+ * @param len Length of the packet.
+ * @param now Time the packet was sent.
+ * @param deliver_at Time each copy arrives.
+ * @return uint32_t Number of copies to deliver.
+ */
+static uint32_t _netem_filter(void *arg, simnetif_dir_t dir, uint32_t len, absolute_time_t now,
+                              absolute_time_t deliver_at[SIMNETIF_FILTER_COPIES])
+{
+    NetemDir_t *d = &((Netem_t *)arg)->dirs[dir];
+    const netem_params_t *params = &d->params;
+
+    d->stats.packets++;
+    if (!d->enabled)
+    {
+        return 1;
+    }
+
+    /** Once in a burst, each next packet is lost too with a chance of 1 - 1 / loss_burst */
+    bool lost = d->in_burst && params->loss_burst > 1 ? _netem_chance(1000 - 1000 / params->loss_burst)
+                                                      : _netem_chance(params->loss_permille);
+    d->in_burst = lost;
+    if (lost)
+    {
+        d->stats.lost++;
+        return 0;
+    }
+
+    /** Serialised behind the packets still queued for the bandwidth */
+    absolute_time_t at = now;
+    if (params->rate_kbps > 0)
+    {
+        absolute_time_t start = d->busy_until > now ? d->busy_until : now;
+        if (params->queue_ms > 0 && start - now > (uint64_t)params->queue_ms * 1000)
+        {
+            d->stats.queue_drops++;
+            return 0;
+        }
+        d->busy_until = start + (uint64_t)len * 8000 / params->rate_kbps;
+        at = d->busy_until;
+    }
+
+    if (_netem_chance(params->reorder_permille))
+    {
+        d->stats.reordered++;
+    }
+    else
+    {
+        at += (uint64_t)params->delay_ms * 1000;
+        if (params->jitter_ms > 0)
+        {
+            at += get_rand_32() % ((uint64_t)params->jitter_ms * 1000 + 1);
+        }
+    }
+    deliver_at[0] = at;
+
+    if (_netem_chance(params->duplicate_permille))
+    {
+        d->stats.duplicated++;
+        deliver_at[1] = at;
+        return 2;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Roll the dice.
+ * @param permille Chance in thousandths.
+ * @return bool true with the given chance.
+ */
+static bool _netem_chance(uint32_t permille)
+{
+    return permille > 0 && get_rand_32() % 1000 < permille;
+}
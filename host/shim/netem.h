@@ -0,0 +1,53 @@
+#ifndef _NETEM_H_
+#define _NETEM_H_
+/** Includes *************************************************************************************/
+#include "simnetif.h"
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Impairment of one direction of the wire, all zero for a clean wire */
+typedef struct
+{
+    uint32_t delay_ms;            /** Latency added to every packet */
+    uint32_t jitter_ms;           /** Up to this much more, uniformly, packets may overtake each other */
+    uint32_t loss_permille;       /** Chance of a packet being lost, or of a loss burst starting */
+    uint32_t loss_burst;          /** Mean length of a loss burst in packets, 0 or 1 for single losses */
+    uint32_t reorder_permille;    /** Chance of a packet skipping the delay, ahead of those in flight */
+    uint32_t duplicate_permille;  /** Chance of a packet arriving twice */
+    uint32_t rate_kbps;           /** Bandwidth, packets queue behind each other, 0 for no cap */
+    uint32_t queue_ms;            /** Drop packets that would queue longer than this for the bandwidth, 0 for no limit */
+} netem_params_t;
+
+/** What the filter did to the packets of one direction */
+typedef struct
+{
+    uint32_t packets;
+    uint32_t lost;
+    uint32_t queue_drops;
+    uint32_t reordered;
+    uint32_t duplicated;
+} netem_stats_t;
+
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Impair one direction of the simulated wire, like Linux netem on a link.
+ *
+ * Installs the filter with simnetif_set_filter() the first time. Packets are first lost, then
+ * queued behind each other for the bandwidth, then delayed, so jitter and reordering act on
+ * what the bandwidth lets through. The randomness comes from rand(), srand() makes a run
+ * repeatable as far as the timing allows.
+ *
+ * @param dir Direction to impair.
+ * @param params The impairment, NULL for a clean wire.
+ * @return None.
+ */
+void netem_set(simnetif_dir_t dir, const netem_params_t *params);
+
+/**
+ * @brief Get what the filter did to the packets of one direction since the start.
+ * @param dir Direction.
+ * @return const netem_stats_t* The counters.
+ */
+const netem_stats_t *netem_stats(simnetif_dir_t dir);
+
+#endif /* _NETEM_H_ */
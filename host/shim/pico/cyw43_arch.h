@@ -0,0 +1,169 @@
+#ifndef _PICO_CYW43_ARCH_H
+#define _PICO_CYW43_ARCH_H
+/** Includes *************************************************************************************/
+#include "pico/stdlib.h"
+#include "lwip/netif.h"
+#include "lwip/ip_addr.h"
+/** Defines **************************************************************************************/
+#define CYW43_ITF_STA 0
+#define CYW43_ITF_AP 1
+
+#define CYW43_LINK_DOWN 0
+#define CYW43_LINK_JOIN 1
+#define CYW43_LINK_NOIP 2
+#define CYW43_LINK_UP 3
+#define CYW43_LINK_FAIL -1
+#define CYW43_LINK_NONET -2
+#define CYW43_LINK_BADAUTH -3
+
+#define CYW43_AUTH_OPEN 0
+#define CYW43_AUTH_WPA_TKIP_PSK 0x00200002
+#define CYW43_AUTH_WPA2_AES_PSK 0x00400004
+#define CYW43_AUTH_WPA2_MIXED_PSK 0x00400006
+#define CYW43_AUTH_WPA3_SAE_AES_PSK 0x01000004
+#define CYW43_AUTH_WPA3_WPA2_AES_PSK 0x01400004
+
+#define CYW43_CHANNEL_NONE 0xffffffff
+
+#define CYW43_IOCTL_GET_CHANNEL 0x3a
+
+#define CYW43_NO_POWERSAVE_MODE 0
+#define CYW43_PM1_POWERSAVE_MODE 1
+#define CYW43_PM2_POWERSAVE_MODE 2
+
+#define cyw43_pm_value(pm_mode, pm2_sleep_ret_ms, li_beacon_period, li_dtim_period, li_assoc)         \
+    ((uint32_t)(li_assoc) << 20 | (uint32_t)(li_dtim_period) << 16 | (uint32_t)(li_beacon_period) << 12 | \
+     (uint32_t)((pm2_sleep_ret_ms) / 10) << 4 | (uint32_t)(pm_mode))
+#define CYW43_DEFAULT_PM cyw43_pm_value(CYW43_PM2_POWERSAVE_MODE, 200, 1, 1, 10)
+#define CYW43_AGGRESSIVE_PM cyw43_pm_value(CYW43_PM2_POWERSAVE_MODE, 2000, 1, 1, 10)
+#define CYW43_PERFORMANCE_PM cyw43_pm_value(CYW43_PM2_POWERSAVE_MODE, 20, 1, 1, 1)
+#define CYW43_NONE_PM cyw43_pm_value(CYW43_NO_POWERSAVE_MODE, 10, 0, 0, 0)
+
+#define CYW43_WL_GPIO_LED_PIN 0
+
+/** Host only: access points of the simulated network, and the signal of one out of range */
+#define CYW43_SHIM_APS 4
+#define CYW43_SHIM_RSSI_NONE -100
+
+/** Typedefs *************************************************************************************/
+/** Only the parts of the driver state the client modules look at */
+typedef struct
+{
+    struct netif netif[2];
+} cyw43_t;
+
+/** Scan options and results, laid out as in the driver */
+typedef struct
+{
+    uint32_t version;
+    uint16_t action;
+    uint16_t _;
+    uint32_t ssid_len;
+    uint8_t ssid[32];
+    uint8_t bssid[6];
+    int8_t bss_type;
+    int8_t scan_type;
+    int32_t nprobes;
+    int32_t active_time;
+    int32_t passive_time;
+    int32_t home_time;
+    int32_t channel_num;
+    uint16_t channel_list[1];
+} cyw43_wifi_scan_options_t;
+
+typedef struct
+{
+    uint32_t _0[5];
+    uint8_t bssid[6];
+    uint16_t _1[2];
+    uint8_t ssid_len;
+    uint8_t ssid[32];
+    uint32_t _2[5];
+    uint16_t channel;
+    uint16_t _3;
+    uint8_t auth_mode;
+    int16_t rssi;
+} cyw43_ev_scan_result_t;
+
+/** Variables ************************************************************************************/
+extern cyw43_t cyw43_state;
+
+/** Functions ************************************************************************************/
+int cyw43_arch_init(void);
+void cyw43_arch_deinit(void);
+void cyw43_arch_enable_sta_mode(void);
+void cyw43_arch_disable_sta_mode(void);
+int cyw43_arch_wifi_connect_bssid_async(const char *ssid, const uint8_t *bssid, const char *pw, uint32_t auth);
+int cyw43_arch_wifi_connect_async(const char *ssid, const char *pw, uint32_t auth);
+void cyw43_arch_poll(void);
+void cyw43_arch_wait_for_work_until(absolute_time_t until);
+void cyw43_arch_gpio_put(uint wl_gpio, bool value);
+int cyw43_tcpip_link_status(cyw43_t *self, int itf);
+int cyw43_wifi_join(cyw43_t *self, size_t ssid_len, const uint8_t *ssid, size_t key_len, const uint8_t *key,
+                    uint32_t auth_type, const uint8_t *bssid, uint32_t channel);
+int cyw43_wifi_get_bssid(cyw43_t *self, uint8_t bssid[6]);
+int cyw43_ioctl(cyw43_t *self, uint32_t cmd, size_t len, uint8_t *buf, uint32_t iface);
+int cyw43_wifi_pm(cyw43_t *self, uint32_t pm);
+int cyw43_wifi_get_rssi(cyw43_t *self, int32_t *rssi);
+int cyw43_wifi_scan(cyw43_t *self, cyw43_wifi_scan_options_t *opts, void *env,
+                    int (*result_cb)(void *, const cyw43_ev_scan_result_t *));
+bool cyw43_wifi_scan_active(cyw43_t *self);
+
+/** lwIP calls need no locking in the single threaded host build */
+static inline void cyw43_arch_lwip_begin(void) {}
+static inline void cyw43_arch_lwip_end(void) {}
+
+/** Host only: control over the simulated radio *************************************************/
+
+/**
+ * @brief Set how long a join takes before the link comes up.
+ * @param ms Join time in milliseconds.
+ * @return None.
+ */
+void cyw43_shim_set_join_delay_ms(uint32_t ms);
+
+/**
+ * @brief Set how long the scan of all channels takes, added to joins that give no channel.
+ * @param ms Scan time in milliseconds.
+ * @return None.
+ */
+void cyw43_shim_set_scan_delay_ms(uint32_t ms);
+
+/**
+ * @brief Make the access points reachable or not. Taking them away drops an up link and makes
+ *        joins fail, like walking out of range.
+ * @param available true if the access points are in range.
+ * @return None.
+ */
+void cyw43_shim_set_ap_available(bool available);
+
+/**
+ * @brief Move the first access point to another channel, joins to the old one find nothing.
+ * @param channel The new channel.
+ * @return None.
+ */
+void cyw43_shim_set_ap_channel(uint32_t channel);
+
+/**
+ * @brief Set the signal of an access point of the same network as the station hears it.
+ *
+ * Only the first one is in range to begin with. The others come into range, with BSSID
+ * 02:00:00:00:00:0n and channels 1, 11 and 6, once given a signal above CYW43_SHIM_RSSI_NONE.
+ * Dropping the one the station is on to CYW43_SHIM_RSSI_NONE drops the link.
+ *
+ * @param ap Index of the access point, 0 to CYW43_SHIM_APS - 1.
+ * @param rssi Signal in dBm.
+ * @return None.
+ */
+void cyw43_shim_set_ap_rssi(uint32_t ap, int32_t rssi);
+
+/**
+ * @brief Make a share of the frames the station sends through an access point fail after all
+ *        retries. They are lost on the wire and counted as failed in the packet counters.
+ * @param ap Index of the access point.
+ * @param percent Share of the frames that fail.
+ * @return None.
+ */
+void cyw43_shim_set_ap_tx_failures(uint32_t ap, uint32_t percent);
+
+#endif /* _PICO_CYW43_ARCH_H */
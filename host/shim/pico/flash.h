@@ -0,0 +1,10 @@
+#ifndef _PICO_FLASH_H
+#define _PICO_FLASH_H
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+
+/** Nothing else runs in the host build, the operation is run straight away */
+int flash_safe_execute(void (*func)(void *), void *param, uint32_t enter_exit_timeout_ms);
+static inline bool flash_safe_execute_core_init(void) { return true; }
+
+#endif /* _PICO_FLASH_H */
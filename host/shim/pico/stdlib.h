@@ -0,0 +1,36 @@
+#ifndef _PICO_STDLIB_H
+#define _PICO_STDLIB_H
+/** Includes *************************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "pico/time.h"
+/** Defines **************************************************************************************/
+#define PICO_OK 0
+#define PICO_ERROR_GENERIC -1
+#define PICO_ERROR_TIMEOUT -2
+
+#ifndef count_of
+#define count_of(a) (sizeof(a) / sizeof((a)[0]))
+#endif
+
+#define __not_in_flash_func(func_name) func_name
+#define __time_critical_func(func_name) func_name
+#define __packed __attribute__((packed))
+#define __aligned(x) __attribute__((aligned(x)))
+
+typedef unsigned int uint;
+
+/** Functions ************************************************************************************/
+static inline void tight_loop_contents(void) {}
+
+/** Everything runs on one thread on the host */
+static inline uint get_core_num(void) { return 0; }
+
+/** stdio always goes to the terminal on the host */
+static inline bool stdio_init_all(void) { return true; }
+
+#endif /* _PICO_STDLIB_H */
@@ -0,0 +1,32 @@
+#ifndef _PICO_TIME_H
+#define _PICO_TIME_H
+/** Includes *************************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+/** Typedefs *************************************************************************************/
+/** Microseconds since the process started, like time since boot on the board */
+typedef uint64_t absolute_time_t;
+
+/** Variables ************************************************************************************/
+extern const absolute_time_t at_the_end_of_time;
+extern const absolute_time_t nil_time;
+
+/** Functions ************************************************************************************/
+uint64_t time_us_64(void);
+void sleep_us(uint64_t us);
+
+static inline uint32_t time_us_32(void) { return (uint32_t)time_us_64(); }
+static inline absolute_time_t get_absolute_time(void) { return time_us_64(); }
+static inline uint64_t to_us_since_boot(absolute_time_t t) { return t; }
+static inline uint32_t to_ms_since_boot(absolute_time_t t) { return (uint32_t)(t / 1000); }
+static inline absolute_time_t from_us_since_boot(uint64_t us) { return us; }
+static inline absolute_time_t delayed_by_us(absolute_time_t t, uint64_t us) { return t + us; }
+static inline absolute_time_t delayed_by_ms(absolute_time_t t, uint32_t ms) { return t + (uint64_t)ms * 1000; }
+static inline absolute_time_t make_timeout_time_us(uint64_t us) { return delayed_by_us(get_absolute_time(), us); }
+static inline absolute_time_t make_timeout_time_ms(uint32_t ms) { return delayed_by_ms(get_absolute_time(), ms); }
+static inline int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to) { return (int64_t)(to - from); }
+static inline absolute_time_t absolute_time_min(absolute_time_t a, absolute_time_t b) { return a < b ? a : b; }
+static inline bool time_reached(absolute_time_t t) { return get_absolute_time() >= t; }
+static inline void sleep_ms(uint32_t ms) { sleep_us((uint64_t)ms * 1000); }
+
+#endif /* _PICO_TIME_H */
@@ -0,0 +1,339 @@
+/** Includes *************************************************************************************/
+#include "pico/stdlib.h"
+#include "pico/rand.h"
+#include "lwip/ip.h"
+#include "lwip/pbuf.h"
+#include "simnetif.h"
+/** Defines **************************************************************************************/
+#define SIMNETIF_MTU 1500
+
+/** Typedefs *************************************************************************************/
+/** A packet on the wire */
+typedef struct
+{
+    struct pbuf *p;
+    absolute_time_t deliver_at;
+} SimPacket_t;
+
+/** One direction of the wire, a FIFO of packets waiting for delivery */
+typedef struct
+{
+    SimPacket_t packets[SIMNETIF_QUEUE_LEN];
+    uint16_t head;
+    uint16_t count;
+    struct netif *to;
+} SimWire_t;
+
+typedef struct
+{
+    struct netif *sta;
+    struct netif server;
+    bool link_up;
+    SimWire_t up;    /** Station to server */
+    SimWire_t down;  /** Server to station */
+    bool ps;                         /** Station radio dozes when idle */
+    uint32_t ps_sleep_after_ms;      /** Idle time before it dozes */
+    uint32_t ps_wake_ms;             /** It wakes for buffered packets at multiples of this */
+    absolute_time_t ps_last_active;  /** Last time the station sent or received */
+    simnetif_filter_fn_t filter;
+    void *filter_arg;
+    uint32_t loss;                   /** Percentage of the station's packets lost */
+    uint32_t sent;                   /** Packets the station sent */
+    uint32_t lost;                   /** Of those, the ones lost */
+} SimNetif_t;
+
+/** Variables ************************************************************************************/
+static SimNetif_t SimNetif = {0};
+
+/** Prototypes ***********************************************************************************/
+/** Private Function Prototypes ******************************************************************/
+static err_t _simnetif_init_netif(struct netif *netif);
+static err_t _simnetif_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr);
+static void _simnetif_wire_insert(SimWire_t *wire, struct pbuf *p, absolute_time_t deliver_at);
+static void _simnetif_wire_flush(SimWire_t *wire);
+static int _simnetif_wire_poll(SimWire_t *wire, absolute_time_t now);
+
+/** Function Definitions *************************************************************************/
+int simnetif_init(struct netif *sta)
+{
+    ip4_addr_t ip, mask, gw;
+
+    SimNetif.sta = sta;
+    SimNetif.up.to = &SimNetif.server;
+    SimNetif.down.to = sta;
+
+    /** Station, link comes up when the simulated radio joins */
+    ip4addr_aton(SIMNETIF_STA_IP, &ip);
+    ip4addr_aton("255.255.255.0", &mask);
+    ip4addr_aton("10.0.0.1", &gw);
+    if (netif_add(sta, &ip, &mask, &gw, NULL, _simnetif_init_netif, ip_input) == NULL)
+    {
+        return -1;
+    }
+    sta->name[0] = 's';
+    sta->name[1] = 't';
+    netif_set_default(sta);
+    netif_set_up(sta);
+
+    /** Server, always up */
+    ip4addr_aton(SIMNETIF_SERVER_IP, &ip);
+    ip4addr_aton("10.0.1.254", &gw);
+    if (netif_add(&SimNetif.server, &ip, &mask, &gw, NULL, _simnetif_init_netif, ip_input) == NULL)
+    {
+        return -1;
+    }
+    SimNetif.server.name[0] = 's';
+    SimNetif.server.name[1] = 'v';
+    netif_set_up(&SimNetif.server);
+    netif_set_link_up(&SimNetif.server);
+
+    return 0;
+}
+
+void simnetif_set_link(bool up)
+{
+    SimNetif.link_up = up;
+
+    if (!up)
+    {
+        /** Whatever was in the air is lost */
+        _simnetif_wire_flush(&SimNetif.up);
+        _simnetif_wire_flush(&SimNetif.down);
+    }
+}
+
+void simnetif_set_power_save(bool enabled, uint32_t sleep_after_ms, uint32_t wake_ms)
+{
+    SimNetif.ps = enabled && wake_ms > 0;
+    SimNetif.ps_sleep_after_ms = sleep_after_ms;
+    SimNetif.ps_wake_ms = wake_ms;
+}
+
+void simnetif_set_filter(simnetif_filter_fn_t filter, void *arg)
+{
+    SimNetif.filter = filter;
+    SimNetif.filter_arg = arg;
+}
+
+void simnetif_set_loss(uint32_t percent)
+{
+    SimNetif.loss = percent;
+}
+
+void simnetif_counters(uint32_t *sent, uint32_t *lost)
+{
+    *sent = SimNetif.sent;
+    *lost = SimNetif.lost;
+}
+
+int simnetif_poll(void)
+{
+    absolute_time_t now = get_absolute_time();
+
+    return _simnetif_wire_poll(&SimNetif.up, now) + _simnetif_wire_poll(&SimNetif.down, now);
+}
+
+int64_t simnetif_next_event_us(void)
+{
+    int64_t next = -1;
+    SimWire_t *wires[] = {&SimNetif.up, &SimNetif.down};
+
+    for (size_t i = 0; i < count_of(wires); i++)
+    {
+        if (wires[i]->count == 0)
+        {
+            continue;
+        }
+
+        int64_t due = absolute_time_diff_us(get_absolute_time(), wires[i]->packets[wires[i]->head].deliver_at);
+        due = due < 0 ? 0 : due;
+        if (next < 0 || due < next)
+        {
+            next = due;
+        }
+    }
+
+    return next;
+}
+
+struct netif *simnetif_server(void)
+{
+    return &SimNetif.server;
+}
+
+struct netif *simnetif_route(const ip4_addr_t *src, const ip4_addr_t *dest)
+{
+    if (SimNetif.sta == NULL)
+    {
+        return NULL;
+    }
+
+    /** Replies from the server side leave through the server netif */
+    if (src != NULL && ip4_addr_cmp(src, netif_ip4_addr(&SimNetif.server)))
+    {
+        return &SimNetif.server;
+    }
+
+    /** Everything else addressed to the server goes out of the station */
+    if (ip4_addr_cmp(dest, netif_ip4_addr(&SimNetif.server)))
+    {
+        return SimNetif.sta;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief netif init callback for both ends of the wire.
+ * @param netif The netif being added.
+ * @return err_t ERR_OK.
+ */
+static err_t _simnetif_init_netif(struct netif *netif)
+{
+    netif->output = _simnetif_output;
+    netif->mtu = SIMNETIF_MTU;
+
+    return ERR_OK;
+}
+
+/**
+ * @brief netif output callback, puts a copy of the packet on the wire towards the other netif.
+ * @param netif The netif sending the packet.
+ * @param p The packet.
+ * @param ipaddr Next hop, unused on a point to point wire.
+ * @return err_t ERR_OK, a packet that cannot be queued is dropped like on a real link.
+ */
+static err_t _simnetif_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr)
+{
+    LWIP_UNUSED_ARG(ipaddr);
+
+    SimWire_t *wire = netif == SimNetif.sta ? &SimNetif.up : &SimNetif.down;
+
+    if (!SimNetif.link_up || wire->count >= SIMNETIF_QUEUE_LEN)
+    {
+        return ERR_OK;
+    }
+
+    if (wire == &SimNetif.up)
+    {
+        SimNetif.sent++;
+        if (SimNetif.loss > 0 && get_rand_32() % 100 < SimNetif.loss)
+        {
+            SimNetif.lost++;
+            return ERR_OK;
+        }
+    }
+
+    absolute_time_t now = get_absolute_time();
+    absolute_time_t deliver_at[SIMNETIF_FILTER_COPIES] = {now};
+    uint32_t copies = 1;
+    if (SimNetif.filter != NULL)
+    {
+        copies = SimNetif.filter(SimNetif.filter_arg, wire == &SimNetif.up ? SIMNETIF_UP : SIMNETIF_DOWN,
+                                 p->tot_len, now, deliver_at);
+        copies = LWIP_MIN(copies, SIMNETIF_FILTER_COPIES);
+    }
+
+    for (uint32_t i = 0; i < copies && wire->count < SIMNETIF_QUEUE_LEN; i++)
+    {
+        /** The caller keeps ownership of p, the wire needs its own copy */
+        struct pbuf *q = pbuf_clone(PBUF_RAW, PBUF_RAM, p);
+        if (q == NULL)
+        {
+            return ERR_MEM;
+        }
+
+        absolute_time_t at = deliver_at[i];
+        if (wire == &SimNetif.down && SimNetif.ps &&
+            absolute_time_diff_us(SimNetif.ps_last_active, at) >= (int64_t)SimNetif.ps_sleep_after_ms * 1000)
+        {
+            /** The station is dozing, the access point holds the packet until the next beacon */
+            uint64_t wake_us = (uint64_t)SimNetif.ps_wake_ms * 1000;
+            at = (at / wake_us + 1) * wake_us;
+        }
+        SimNetif.ps_last_active = at;
+
+        _simnetif_wire_insert(wire, q, at);
+    }
+
+    return ERR_OK;
+}
+
+/**
+ * @brief Queue a packet on one direction of the wire, in the order of the delivery times.
+ * @param wire The wire direction, not full.
+ * @param p The packet, owned by the wire from now on.
+ * @param deliver_at Time the packet arrives.
+ * @return None.
+ * @note Packets due at the same time keep the order they were sent in.
+ */
+static void _simnetif_wire_insert(SimWire_t *wire, struct pbuf *p, absolute_time_t deliver_at)
+{
+    uint16_t i = wire->count;
+
+    /** Packets due later move back a place, usually none without a filter */
+    while (i > 0)
+    {
+        SimPacket_t *prev = &wire->packets[(wire->head + i - 1) % SIMNETIF_QUEUE_LEN];
+        if (prev->deliver_at <= deliver_at)
+        {
+            break;
+        }
+        wire->packets[(wire->head + i) % SIMNETIF_QUEUE_LEN] = *prev;
+        i--;
+    }
+
+    SimPacket_t *packet = &wire->packets[(wire->head + i) % SIMNETIF_QUEUE_LEN];
+    packet->p = p;
+    packet->deliver_at = deliver_at;
+    wire->count++;
+}
+
+/**
+ * @brief Drop every packet on one direction of the wire.
+ * @param wire The wire direction.
+ * @return None.
+ */
+static void _simnetif_wire_flush(SimWire_t *wire)
+{
+    while (wire->count > 0)
+    {
+        pbuf_free(wire->packets[wire->head].p);
+        wire->head = (wire->head + 1) % SIMNETIF_QUEUE_LEN;
+        wire->count--;
+    }
+}
+
+/**
+ * @brief Deliver the packets that are due on one direction of the wire.
+ * @param wire The wire direction.
+ * @param now Current time.
+ * @return int Number of packets delivered.
+ * @note Only packets queued before this call are delivered, replies wait for the next poll.
+ */
+static int _simnetif_wire_poll(SimWire_t *wire, absolute_time_t now)
+{
+    int delivered = 0;
+    uint16_t budget = wire->count;
+
+    while (budget-- > 0 && wire->count > 0)
+    {
+        SimPacket_t *packet = &wire->packets[wire->head];
+        if (packet->deliver_at > now)
+        {
+            break;
+        }
+
+        struct pbuf *p = packet->p;
+        wire->head = (wire->head + 1) % SIMNETIF_QUEUE_LEN;
+        wire->count--;
+
+        if (wire->to->input(p, wire->to) != ERR_OK)
+        {
+            pbuf_free(p);
+        }
+        delivered++;
+    }
+
+    return delivered;
+}
@@ -0,0 +1,129 @@
+#ifndef _SIMNETIF_H_
+#define _SIMNETIF_H_
+/** Includes *************************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+#include "lwip/netif.h"
+/** Defines **************************************************************************************/
+/** Address of the station netif, the one the client uses */
+#define SIMNETIF_STA_IP "10.0.0.2"
+/** Address of the server netif the bundled servers listen on */
+#define SIMNETIF_SERVER_IP "10.0.1.1"
+
+/** Packets that can be in flight on the wire in each direction */
+#ifndef SIMNETIF_QUEUE_LEN
+#define SIMNETIF_QUEUE_LEN 256
+#endif
+
+/** Copies of a packet a filter can deliver, the packet and one duplicate */
+#define SIMNETIF_FILTER_COPIES 2
+
+/** Typedefs *************************************************************************************/
+/** Direction of a packet on the wire */
+typedef enum
+{
+    SIMNETIF_UP = 0,    /** Station to server */
+    SIMNETIF_DOWN,      /** Server to station */
+} simnetif_dir_t;
+
+/**
+ * @brief Filter deciding what becomes of a packet put on the wire.
+ * @param arg Argument given to simnetif_set_filter().
+ * @param dir Direction of the packet.
+ * @param len Length of the packet.
+ * @param now Time the packet was sent.
+ * @param deliver_at Time each copy arrives at the other end, now on entry for the first one.
+ * @return uint32_t Number of copies to deliver, 0 to drop the packet.
+ */
+typedef uint32_t (*simnetif_filter_fn_t)(void *arg, simnetif_dir_t dir, uint32_t len, absolute_time_t now,
+                                         absolute_time_t deliver_at[SIMNETIF_FILTER_COPIES]);
+
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Create the station and server netifs and wire them to each other.
+ *
+ * Both netifs live in the same lwIP instance. Whatever one outputs is queued and handed to the
+ * other one's input on the next simnetif_poll(), so every packet takes the full output/input
+ * path just like it would over the radio.
+ *
+ * @param sta Netif to use as the station interface.
+ * @return int 0 on success, -1 on failure.
+ */
+int simnetif_init(struct netif *sta);
+
+/**
+ * @brief Bring the wire up or down. Packets sent while it is down are dropped.
+ * @param up true to bring the wire up.
+ * @return None.
+ */
+void simnetif_set_link(bool up);
+
+/**
+ * @brief Model the station's radio power save.
+ *
+ * Once the station has neither sent nor received for @p sleep_after_ms, packets to it are held
+ * until the next multiple of @p wake_ms, like an access point buffering them until a beacon.
+ *
+ * @param enabled true to let the station doze.
+ * @param sleep_after_ms Idle time before it dozes, 0 to doze straight after every packet.
+ * @param wake_ms Beacon interval it wakes at.
+ * @return None.
+ */
+void simnetif_set_power_save(bool enabled, uint32_t sleep_after_ms, uint32_t wake_ms);
+
+/**
+ * @brief Run every packet put on the wire through a filter, e.g. to delay, lose or duplicate it.
+ *
+ * Packets are delivered in the order of their delivery times, so a filter that delays some
+ * more than others reorders them. Packets still on the wire when the link goes down are lost.
+ *
+ * @param filter The filter, NULL to deliver every packet straight away.
+ * @param arg Argument for the filter.
+ * @return None.
+ */
+void simnetif_set_filter(simnetif_filter_fn_t filter, void *arg);
+
+/**
+ * @brief Lose a share of the packets the station sends, like frames that fail after all retries.
+ * @param percent Share of the packets lost, 0 for none.
+ * @return None.
+ */
+void simnetif_set_loss(uint32_t percent);
+
+/**
+ * @brief Get the number of packets the station has sent since the start.
+ * @param sent Packets sent, lost ones included.
+ * @param lost Packets lost to simnetif_set_loss().
+ * @return None.
+ */
+void simnetif_counters(uint32_t *sent, uint32_t *lost);
+
+/**
+ * @brief Deliver the packets that are due.
+ * @return int Number of packets delivered.
+ */
+int simnetif_poll(void);
+
+/**
+ * @brief Get the time until the next queued packet is due.
+ * @return int64_t Microseconds until the next delivery, 0 if one is due now, -1 if none is queued.
+ */
+int64_t simnetif_next_event_us(void);
+
+/**
+ * @brief Get the server side netif.
+ * @return struct netif* The server netif.
+ */
+struct netif *simnetif_server(void);
+
+/**
+ * @brief lwIP source routing hook, sends traffic out of the netif it belongs to.
+ * @param src Source address, may be any.
+ * @param dest Destination address.
+ * @return struct netif* The netif to send on, NULL to use normal routing.
+ */
+struct netif *simnetif_route(const ip4_addr_t *src, const ip4_addr_t *dest);
+
+#endif /* _SIMNETIF_H_ */
@@ -0,0 +1,69 @@
+/** Includes *************************************************************************************/
+#include <time.h>
+#include <errno.h>
+#include "pico/stdlib.h"
+#include "lwip/sys.h"
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+const absolute_time_t at_the_end_of_time = INT64_MAX;
+const absolute_time_t nil_time = 0;
+
+/** Monotonic time the process started at, stands in for boot */
+static uint64_t BootNs = 0;
+
+/** Prototypes ***********************************************************************************/
+/** Private Function Prototypes ******************************************************************/
+static uint64_t _time_monotonic_ns(void);
+
+/** Function Definitions *************************************************************************/
+uint64_t time_us_64(void)
+{
+    if (BootNs == 0)
+    {
+        BootNs = _time_monotonic_ns();
+    }
+
+    return (_time_monotonic_ns() - BootNs) / 1000;
+}
+
+void sleep_us(uint64_t us)
+{
+    struct timespec ts = {
+        .tv_sec = (time_t)(us / 1000000),
+        .tv_nsec = (long)(us % 1000000) * 1000,
+    };
+
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+    {
+    }
+}
+
+/** lwIP port functions, the host build is NO_SYS and single threaded ***************************/
+
+u32_t sys_now(void)
+{
+    return to_ms_since_boot(get_absolute_time());
+}
+
+sys_prot_t sys_arch_protect(void)
+{
+    return 0;
+}
+
+void sys_arch_unprotect(sys_prot_t pval)
+{
+    LWIP_UNUSED_ARG(pval);
+}
+
+/**
+ * @brief Read the monotonic clock.
+ * @return uint64_t Nanoseconds.
+ */
+static uint64_t _time_monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
@@ -0,0 +1,50 @@
+#ifndef _BOOT_H_
+#define _BOOT_H_
+/** Includes *************************************************************************************/
+#include "pico/stdlib.h"
+/** Defines **************************************************************************************/
+/** Build with -DPICO_CLIENT_FAST_BOOT=0 for the old fixed wait for a console and a full DHCP exchange */
+#ifndef PICO_CLIENT_FAST_BOOT
+#define PICO_CLIENT_FAST_BOOT 1
+#endif
+
+/** Typedefs *************************************************************************************/
+/** Boot milestones, in the order they are normally reached */
+typedef enum {
+    BOOT_PHASE_STDIO = 0,     /** stdio initialised */
+    BOOT_PHASE_WIFI_INIT,     /** Radio firmware loaded, join started */
+    BOOT_PHASE_CONSOLE,       /** Done waiting for a console */
+    BOOT_PHASE_WIFI_JOINED,   /** Associated with the access point */
+    BOOT_PHASE_WIFI_UP,       /** Address from DHCP */
+    BOOT_PHASE_CONNECTED,     /** First connection to a server */
+    BOOT_PHASE_COUNT,
+} boot_phase_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Record the time a boot milestone was reached, only the first time.
+ *
+ * Reaching BOOT_PHASE_CONNECTED logs the times of all phases. Can be called from either core.
+ *
+ * @param phase The milestone.
+ * @return None.
+ */
+void boot_mark(boot_phase_t phase);
+
+/**
+ * @brief Get the time a boot milestone was reached.
+ * @param phase The milestone.
+ * @return uint32_t Milliseconds since reset, 0 if it has not been reached.
+ */
+uint32_t boot_time_ms(boot_phase_t phase);
+
+/**
+ * @brief Log the times of the milestones reached so far.
+ * @return None.
+ */
+void boot_report(void);
+
+#endif /* _BOOT_H_ */
@@ -1,11 +1,78 @@
-
 #ifndef _CLIENT_H_
 #define _CLIENT_H_
 /** Includes *************************************************************************************/
 #include "pico/cyw43_arch.h"
 #include "lwip/tcp.h"
+#include "lwip/altcp.h"
+#include "lwip/udp.h"
+#include "mempool.h"
 /** Defines **************************************************************************************/
-#define BUF_SIZE 1024
+/** Server port used by client_init() */
+#ifndef CLIENT_SERVER_PORT
+#define CLIENT_SERVER_PORT 4242
+#endif
+
+/** How often client_task() should be run */
+#define CLIENT_TASK_TIMEOUT_MS 100
+
+/** Number of pbuf chains the receive queue holds, TCP data beyond that is chained onto the newest */
+#ifndef CLIENT_RX_QUEUE_DEPTH
+#define CLIENT_RX_QUEUE_DEPTH 16
+#endif
+
+/** Number of writes that can be queued for transmission, including ones waiting to be acked */
+#ifndef CLIENT_TX_QUEUE_DEPTH
+#define CLIENT_TX_QUEUE_DEPTH 16
+#endif
+
+/** Number of MSS-sized staging buffers a client can hold to coalesce small writes into */
+#ifndef CLIENT_TX_STAGE_COUNT
+#define CLIENT_TX_STAGE_COUNT 2
+#endif
+#define CLIENT_TX_STAGE_SIZE TCP_MSS
+
+/** Staging buffers shared by all clients, allocated from a static pool as writes need them */
+#ifndef CLIENT_TX_STAGE_POOL_BLOCKS
+#define CLIENT_TX_STAGE_POOL_BLOCKS 4
+#endif
+
+/** Backoff after the second failed connection attempt, doubled after every further failure */
+#ifndef CLIENT_RECONNECT_MIN_MS
+#define CLIENT_RECONNECT_MIN_MS 500
+#endif
+
+/** Longest backoff between connection attempts */
+#ifndef CLIENT_RECONNECT_MAX_MS
+#define CLIENT_RECONNECT_MAX_MS 30000
+#endif
+
+/**
+ * TCP keepalive, a backstop for a connection that nothing is written on. The application
+ * heartbeat in heartbeat.h notices a dead peer sooner and works over UDP as well.
+ */
+#ifndef CLIENT_KEEPALIVE_IDLE_MS
+#define CLIENT_KEEPALIVE_IDLE_MS 30000
+#endif
+#ifndef CLIENT_KEEPALIVE_INTERVAL_MS
+#define CLIENT_KEEPALIVE_INTERVAL_MS 5000
+#endif
+#ifndef CLIENT_KEEPALIVE_COUNT
+#define CLIENT_KEEPALIVE_COUNT 3
+#endif
+
+/** Transport a client starts with, see client_set_transport() */
+#ifndef CLIENT_TRANSPORT_DEFAULT
+#define CLIENT_TRANSPORT_DEFAULT CLIENT_TRANSPORT_TCP
+#endif
+
+/** Sequence number in front of every datagram in UDP mode, 32 bit big endian */
+#define CLIENT_UDP_HEADER_SIZE 4
+
+/** Largest write in UDP mode, a datagram carries one or more whole writes */
+#define CLIENT_UDP_PAYLOAD_MAX (CLIENT_TX_STAGE_SIZE - CLIENT_UDP_HEADER_SIZE)
+
+/** How far a late datagram can trail the newest one and still be delivered, bits in udp_rx_seen */
+#define CLIENT_UDP_REORDER_WINDOW 32
 
 /** Typedefs *************************************************************************************/
 typedef enum {
@@ -13,12 +80,117 @@ typedef enum {
     CLIENT_CONNECTED = 1,
 } client_state_t;
 
+typedef enum {
+    CLIENT_TRANSPORT_TCP = 0,  /** Reliable byte stream */
+    CLIENT_TRANSPORT_UDP = 1,  /** Sequenced datagrams, lost ones are counted rather than resent */
+    CLIENT_TRANSPORT_TLS = 2,  /** TCP through altcp_tls, needs LWIP_ALTCP_TLS, see tls.h */
+} client_transport_t;
+
+/**
+ * @brief A contiguous view into received data.
+ * @note The memory is owned by a queued pbuf and is only valid until the data is consumed.
+ */
+typedef struct {
+    const uint8_t *data;
+    uint16_t len;
+} client_segment_t;
+
+/**
+ * @brief Called once a buffer passed to client_write_ref() is no longer referenced.
+ * @param arg User argument given to client_write_ref().
+ * @param data The buffer that was queued.
+ * @param len Length of the buffer.
+ * @param err ERR_OK once the data has been acked, otherwise the reason it was dropped.
+ */
+typedef void (*client_tx_done_cb_t)(void *arg, const uint8_t *data, uint16_t len, err_t err);
+
+/** A queued write, either in a staging buffer or in caller-owned memory */
+typedef struct {
+    const uint8_t *data;
+    uint16_t len;
+    uint16_t written;          /** Bytes already handed to altcp_write() */
+    uint32_t end;              /** Stream offset one past the last byte, used to match acks */
+    client_tx_done_cb_t done;
+    void *done_arg;
+    int8_t stage;              /** Staging buffer index, -1 for caller-owned memory */
+} client_tx_desc_t;
+
+/** Connection counters */
+typedef struct {
+    uint32_t connect_attempts;  /** Connections opened */
+    uint32_t connect_successes; /** Connections established */
+    uint32_t connect_failures;  /** Attempts refused, failed or timed out */
+    uint32_t last_connect_ms;   /** Time from losing the connection to being connected again */
+    uint32_t max_connect_ms;    /** Longest time to connected */
+    uint64_t total_connect_ms;  /** Sum of the times to connected, divide by successes for the mean */
+    uint64_t tx_bytes;          /** Bytes acked by the server, or sent in UDP mode */
+    uint64_t rx_bytes;          /** Bytes received */
+} client_stats_t;
+
+/** Datagram counters in UDP mode */
 typedef struct {
-    struct tcp_pcb *tcp_pcb;
+    uint32_t tx_datagrams;   /** Datagrams sent */
+    uint32_t tx_errors;      /** Datagrams lwIP refused, their data is lost */
+    uint32_t rx_datagrams;   /** Datagrams queued for the application */
+    uint32_t rx_lost;        /** Sequence numbers skipped and not filled in by a late datagram */
+    uint32_t rx_gaps;        /** Times the sequence jumped ahead */
+    uint32_t rx_reordered;   /** Datagrams that arrived after a later one, still delivered */
+    uint32_t rx_duplicates;  /** Datagrams dropped as already received */
+    uint32_t rx_resyncs;     /** Times a datagram older than the reorder window restarted the sequence */
+    uint32_t rx_dropped;     /** Datagrams dropped as too short or because the receive queue was full */
+} client_udp_stats_t;
+
+typedef struct {
+    client_transport_t transport;
+    struct altcp_pcb *tcp_pcb;  /** Plain TCP or TLS, the altcp layer hides which */
+    struct udp_pcb *udp_pcb;
     ip_addr_t remote_addr;
-    uint8_t buffer[BUF_SIZE];
-    uint16_t buffer_len;
+    uint16_t remote_port;
+    int8_t resolver_id;   /** Cache entry of the server's host name, -1 if it was given as an address */
+    int8_t tls_id;        /** Session cache slot in TLS mode, -1 until the first TLS connection */
+    /** Receive queue of pbuf chains, held by reference until the application consumes them */
+    struct pbuf *rx_queue[CLIENT_RX_QUEUE_DEPTH];
+    uint8_t rx_head;      /** Index of the oldest queued chain */
+    uint8_t rx_count;     /** Number of queued chains */
+    uint16_t rx_offset;   /** Bytes already consumed from the oldest chain */
+    uint32_t rx_len;      /** Total unconsumed bytes across the queue */
+    /** Receive window flow control */
+    uint32_t rx_credit;   /** Consumed bytes not yet returned to the TCP receive window */
+    uint32_t rx_high_wm;  /** Stop reopening the window at this many queued bytes, 0 to disable */
+    uint32_t rx_low_wm;   /** Start reopening the window again at this many queued bytes */
+    bool rx_throttled;    /** Queued bytes crossed the high watermark and have not dropped below the low one */
+    bool rx_paused;       /** Intake paused by the application */
+    /** Transmit queue, descriptors stay queued until their data has been acked */
+    client_tx_desc_t tx_queue[CLIENT_TX_QUEUE_DEPTH];
+    uint8_t tx_head;      /** Index of the oldest unacked descriptor */
+    uint8_t tx_count;     /** Number of queued descriptors */
+    uint8_t tx_written_count; /** Descriptors from the head that have been fully written */
+    int8_t tx_stage_open; /** Staging buffer still accepting writes, -1 if none */
+    uint32_t tx_queued;   /** Stream offset of the end of the queued data */
+    uint32_t tx_written;  /** Stream offset of the end of the data handed to lwIP */
+    uint32_t tx_acked;    /** Stream offset of the end of the acked data */
+    uint8_t *tx_stage[CLIENT_TX_STAGE_COUNT]; /** Staging buffers held from the shared pool, NULL if free */
     client_state_t state;
+    /** Reconnect policy */
+    bool connecting;                  /** A connection attempt is in progress */
+    uint32_t reconnect_delay_ms;      /** Backoff before the next attempt, 0 to retry immediately */
+    absolute_time_t connect_retry_at; /** Earliest time for the next connection attempt */
+    absolute_time_t connect_deadline; /** Give up on the attempt in progress at this time */
+    absolute_time_t down_since;       /** When the connection was lost, for the time to connected */
+    client_stats_t stats;
+    /** Round trip time, sampled from the handshake and from one write at a time until it is acked */
+    uint32_t rtt_us;                  /** Smoothed round trip time, 0 until the first sample */
+    bool rtt_timing;                  /** A write is being timed */
+    uint32_t rtt_seq;                 /** Stream offset whose ack completes the sample */
+    absolute_time_t rtt_start;        /** When the timed write or the handshake started */
+    /** UDP mode, each datagram is a sequence number followed by one or more whole writes */
+    struct pbuf *udp_batch;           /** Datagram being filled, NULL if none */
+    uint16_t udp_batch_len;           /** Payload bytes in the datagram being filled */
+    uint32_t udp_batch_ms;            /** Longest a write waits for more to share its datagram, 0 to send at once */
+    uint32_t udp_tx_seq;              /** Sequence number of the next datagram sent */
+    uint32_t udp_rx_next;             /** Sequence number after the newest datagram received */
+    uint32_t udp_rx_seen;             /** Bit n set if udp_rx_next - 1 - n has been received, 0 before the first */
+    client_udp_stats_t udp_stats;
 } client_t;
 
 /** Variables ************************************************************************************/
@@ -27,5 +199,219 @@ typedef struct {
 int client_init(client_t *client, const char *ip_address);
 int client_task(client_t *client);
 
+/**
+ * @brief Initialise a client for a server on a given port.
+ *
+ * The server can be given by host name. The name is resolved in the background through the
+ * resolver cache, and every connection attempt uses the cached address, so a reconnect costs
+ * no DNS round trip.
+ *
+ * @param client Pointer to the client structure.
+ * @param ip_address The server IP address or host name.
+ * @param port The server port.
+ * @return int 0 on success, -1 on failure.
+ */
+int client_init_endpoint(client_t *client, const char *ip_address, uint16_t port);
+
+/**
+ * @brief Switch between TCP, UDP and TLS.
+ *
+ * In UDP mode the receive API is unchanged, each datagram is queued as a pbuf with the sequence
+ * number stripped, and gaps, reordering and duplicates are counted in udp_stats. Writes are never
+ * split across datagrams, so a receiver framing messages per write never sees half of one. The
+ * client counts as connected as soon as its pcb is set up, there is no handshake to wait for.
+ * An open connection is closed and the new transport connects on the next client_task().
+ *
+ * TLS runs the same byte stream through mbedTLS. The session of the last handshake is kept and
+ * offered on every reconnect, so a server that still knows it resumes without the certificate
+ * exchange and key agreement. Handshake times and resumptions are counted in tls_stats().
+ *
+ * @param client Pointer to the client structure.
+ * @param transport The transport.
+ * @return int 0 on success, -1 on failure, also for TLS in a build without LWIP_ALTCP_TLS.
+ * @note Must not be called from inside a client callback.
+ */
+int client_set_transport(client_t *client, client_transport_t transport);
+
+/**
+ * @brief Batch writes into shared datagrams in UDP mode.
+ *
+ * A datagram is sent once it is full, on client_flush() or @p max_delay_ms after the first write
+ * went into it, whichever is first. Batching saves the per-datagram header and radio overhead on
+ * high-rate small writes at the cost of up to @p max_delay_ms of latency.
+ *
+ * @param client Pointer to the client structure.
+ * @param max_delay_ms Longest a write waits in a batch, 0 to send every write in its own datagram.
+ * @return int 0 on success, -1 on failure.
+ */
+int client_set_udp_batch(client_t *client, uint32_t max_delay_ms);
+
+/**
+ * @brief Retry the connection straight away and restart the backoff.
+ *
+ * The first attempt after a lost connection is made immediately. Every further failure waits
+ * a random time between half and all of the current backoff, which starts at
+ * CLIENT_RECONNECT_MIN_MS and doubles up to CLIENT_RECONNECT_MAX_MS. Call this when the
+ * network comes back, so a long backoff built up while it was down is not waited out.
+ *
+ * @param client Pointer to the client structure.
+ * @return int 0 on success, -1 on failure.
+ */
+int client_reconnect_reset(client_t *client);
+
+/**
+ * @brief Get the number of received bytes waiting to be consumed.
+ * @param client Pointer to the client structure.
+ * @return uint32_t Number of bytes in the receive queue.
+ */
+uint32_t client_rx_available(const client_t *client);
+
+/**
+ * @brief Describe the received data as a list of contiguous segments without copying it.
+ *
+ * Fills @p segs with up to @p max_segs views into the queued pbufs, starting @p offset bytes
+ * past the first unconsumed byte. The views stay valid until the data is consumed.
+ *
+ * @param client Pointer to the client structure.
+ * @param offset Number of unconsumed bytes to skip before the first segment.
+ * @param segs Array to fill with the segments.
+ * @param max_segs Size of the segs array.
+ * @return int Number of segments filled in, -1 on failure.
+ */
+int client_rx_segments(const client_t *client, uint32_t offset, client_segment_t *segs, int max_segs);
+
+/**
+ * @brief Copy received data into a buffer without consuming it.
+ * @param client Pointer to the client structure.
+ * @param buf Destination buffer.
+ * @param len Maximum number of bytes to copy.
+ * @return int Number of bytes copied, -1 on failure.
+ */
+int client_peek(const client_t *client, void *buf, uint32_t len);
+
+/**
+ * @brief Copy received data into a buffer and consume it.
+ * @param client Pointer to the client structure.
+ * @param buf Destination buffer.
+ * @param len Maximum number of bytes to read.
+ * @return int Number of bytes read, -1 on failure.
+ */
+int client_read(client_t *client, void *buf, uint32_t len);
+
+/**
+ * @brief Consume received data, releasing the pbufs that hold it.
+ * @param client Pointer to the client structure.
+ * @param len Number of bytes to consume. Clamped to the number of bytes available.
+ * @return int Number of bytes consumed, -1 on failure.
+ */
+int client_consume(client_t *client, uint32_t len);
+
+/**
+ * @brief Set the receive watermarks used for backpressure.
+ *
+ * The TCP receive window is only reopened as the application consumes data. Once the number
+ * of queued bytes reaches @p high, consumed bytes are no longer returned to the window until
+ * the queue has drained to @p low, at which point the withheld window is returned in one go.
+ *
+ * @param client Pointer to the client structure.
+ * @param high Queued byte count that throttles intake, 0 to disable the watermarks.
+ * @param low Queued byte count that resumes intake, must not exceed high.
+ * @return int 0 on success, -1 on failure.
+ */
+int client_set_rx_watermarks(client_t *client, uint32_t high, uint32_t low);
+
+/**
+ * @brief Pause intake. Consumed data is no longer returned to the receive window.
+ * @param client Pointer to the client structure.
+ * @return int 0 on success, -1 on failure.
+ */
+int client_rx_pause(client_t *client);
+
+/**
+ * @brief Resume intake and return any withheld receive window to the peer.
+ * @param client Pointer to the client structure.
+ * @return int 0 on success, -1 on failure.
+ */
+int client_rx_resume(client_t *client);
+
+/**
+ * @brief Check if intake is currently held back by the watermarks or by client_rx_pause().
+ * @param client Pointer to the client structure.
+ * @return bool true if the receive window is being withheld.
+ */
+bool client_rx_throttled(const client_t *client);
+
+/**
+ * @brief Queue data for transmission, copying it.
+ *
+ * Small writes are coalesced into MSS-sized staging buffers. A partly filled buffer is sent
+ * straight away when nothing is in flight, otherwise it keeps filling until the outstanding
+ * data is acked, so a stream of small messages does not cost a tcp_output() each.
+ *
+ * @param client Pointer to the client structure.
+ * @param data Data to send.
+ * @param len Length of the data.
+ * @return int 0 on success, -1 if not connected or there is not enough queue space for all of it.
+ */
+int client_write(client_t *client, const void *data, uint32_t len);
+
+/**
+ * @brief Queue several pieces of data for transmission as one write, copying them.
+ *
+ * Either all of the pieces are queued or none of them are, so a header, payload and trailer
+ * built in separate buffers are never sent in part.
+ *
+ * @param client Pointer to the client structure.
+ * @param segs Pieces to send, in order.
+ * @param count Number of pieces.
+ * @return int 0 on success, -1 if not connected or there is not enough queue space for all of it.
+ * @note In UDP mode the pieces together must not exceed CLIENT_UDP_PAYLOAD_MAX.
+ */
+int client_writev(client_t *client, const client_segment_t *segs, int count);
+
+/**
+ * @brief Queue data for transmission without copying it.
+ *
+ * The buffer is handed to altcp_write() without TCP_WRITE_FLAG_COPY, so the caller must keep it
+ * alive and unchanged until @p done is called.
+ *
+ * @param client Pointer to the client structure.
+ * @param data Data to send.
+ * @param len Length of the data.
+ * @param done Called once the data has been acked or dropped, may be NULL.
+ * @param arg User argument passed to @p done.
+ * @return int 0 on success, -1 if not connected or the queue is full.
+ * @note In UDP mode the data is sent in its own datagram straight away and @p done is called
+ *       before this returns.
+ */
+int client_write_ref(client_t *client, const void *data, uint16_t len, client_tx_done_cb_t done, void *arg);
+
+/**
+ * @brief Send any coalesced data now instead of waiting for outstanding data to be acked.
+ * @param client Pointer to the client structure.
+ * @return int 0 on success, -1 on failure.
+ */
+int client_flush(client_t *client);
+
+/**
+ * @brief Get the number of queued bytes that have not been acked yet.
+ * @param client Pointer to the client structure.
+ * @return uint32_t Number of unacked bytes.
+ */
+uint32_t client_tx_pending(const client_t *client);
+
+/**
+ * @brief Get the pool the staging buffers of all clients come from.
+ * @return const mempool_t* The pool, for its counters.
+ */
+const mempool_t *client_tx_stage_pool(void);
+
+/**
+ * @brief Close the connection and drop any received data. client_task() reconnects later.
+ * @param client Pointer to the client structure.
+ * @return int 0 on success, -1 on failure.
+ * @note Must not be called from inside a client callback.
+ */
+int client_close(client_t *client);
 
 #endif /* _CLIENT_H_ */
\ No newline at end of file
@@ -0,0 +1,98 @@
+#ifndef _CLIENT_POOL_H_
+#define _CLIENT_POOL_H_
+/** Includes *************************************************************************************/
+#include "pico/stdlib.h"
+#include "client.h"
+/** Defines **************************************************************************************/
+/** Number of servers a pool can hold */
+#ifndef CLIENT_POOL_MAX
+#define CLIENT_POOL_MAX 4
+#endif
+
+/** A healthy connection only takes over from the active one if its RTT is this much lower, in percent */
+#ifndef CLIENT_POOL_SWITCH_MARGIN_PCT
+#define CLIENT_POOL_SWITCH_MARGIN_PCT 25
+#endif
+
+/** Typedefs *************************************************************************************/
+/** A server the pool connects to */
+typedef struct {
+    const char *ip_address;
+    uint16_t port;
+} client_endpoint_t;
+
+typedef struct {
+    uint32_t failovers;  /** Active connection lost and another one took over */
+    uint32_t switches;   /** Active connection moved to one with a lower RTT */
+} client_pool_stats_t;
+
+/**
+ * @brief A set of connections to different servers, one of which carries the traffic.
+ *
+ * Every member connects, and reconnects, on its own, so all candidates are dialled in parallel
+ * and the first to complete becomes active. The others stay connected as hot standbys, when
+ * the active server drops the healthy one with the lowest RTT takes over straight away.
+ */
+typedef struct {
+    client_t clients[CLIENT_POOL_MAX];
+    uint8_t count;
+    int8_t active;        /** Index of the connection carrying traffic, -1 if none is up */
+    client_pool_stats_t stats;
+} client_pool_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Initialise a pool over a list of servers.
+ * @param pool Pointer to the pool.
+ * @param endpoints Servers to connect to, the ip_address strings must stay valid.
+ * @param count Number of servers, at most CLIENT_POOL_MAX.
+ * @return int 0 on success, -1 on failure.
+ */
+int client_pool_init(client_pool_t *pool, const client_endpoint_t *endpoints, uint8_t count);
+
+/**
+ * @brief Run client_task() for every member and pick the active connection.
+ *
+ * The active connection is only replaced when it drops, or when another one is faster by more
+ * than CLIENT_POOL_SWITCH_MARGIN_PCT and the active one has nothing left unacked, so a message
+ * stream never moves to another server halfway through a write.
+ *
+ * @param pool Pointer to the pool.
+ * @return int 0 on success, -1 on failure.
+ */
+int client_pool_task(client_pool_t *pool);
+
+/**
+ * @brief Get the connection carrying traffic.
+ * @param pool Pointer to the pool.
+ * @return client_t* The active client, NULL if no connection is up.
+ */
+client_t *client_pool_active(client_pool_t *pool);
+
+/**
+ * @brief Close every connection, members reconnect from client_pool_task().
+ * @param pool Pointer to the pool.
+ * @return int 0 on success, -1 on failure.
+ */
+int client_pool_close(client_pool_t *pool);
+
+/**
+ * @brief Retry every member straight away, see client_reconnect_reset().
+ * @param pool Pointer to the pool.
+ * @return int 0 on success, -1 on failure.
+ */
+int client_pool_reconnect_reset(client_pool_t *pool);
+
+/**
+ * @brief Sum the traffic of every member.
+ * @param pool Pointer to the pool.
+ * @param bytes Filled in with the bytes sent and received so far.
+ * @param pending Filled in with the bytes written and not acked yet.
+ * @return int 0 on success, -1 on failure.
+ */
+int client_pool_traffic(const client_pool_t *pool, uint64_t *bytes, uint32_t *pending);
+
+#endif /* _CLIENT_POOL_H_ */
@@ -0,0 +1,155 @@
+#ifndef _FRAME_H_
+#define _FRAME_H_
+/** Includes *************************************************************************************/
+#include "pico/stdlib.h"
+#include "client.h"
+/** Defines **************************************************************************************/
+/**
+ * Wire format of a frame:
+ *
+ *   | length (varint, 1-4 bytes) | type (1 byte) | payload (length bytes) | crc (2 bytes, optional) |
+ *
+ * The length is the payload length, 7 bits per byte, least significant group first, the top bit
+ * set on every byte but the last. Bit 7 of the type byte marks a trailing CRC-16/CCITT over the
+ * length, type and payload bytes, sent least significant byte first.
+ */
+
+/** Largest payload accepted, a complete frame must fit in the client receive queue */
+#ifndef FRAME_MAX_PAYLOAD
+#define FRAME_MAX_PAYLOAD 1024
+#endif
+
+/** Segments a payload can be spread over before it is copied into the decoder scratch buffer */
+#ifndef FRAME_MAX_SEGS
+#define FRAME_MAX_SEGS 8
+#endif
+
+/** Number of message types, the type byte keeps its top bit for the CRC flag */
+#define FRAME_TYPE_COUNT 128
+
+/** Set in the type byte when the frame carries a CRC */
+#define FRAME_FLAG_CRC 0x80
+
+/** Longest length prefix, enough for 2^28 - 1 */
+#define FRAME_LEN_BYTES_MAX 4
+
+/** Longest header, length prefix and type */
+#define FRAME_HEADER_MAX (FRAME_LEN_BYTES_MAX + 1)
+
+/** Size of the optional CRC */
+#define FRAME_CRC_SIZE 2
+
+/** Typedefs *************************************************************************************/
+/**
+ * @brief A decoded frame.
+ * @note The segments point into the client receive queue, or into the decoder scratch buffer
+ *       for a badly fragmented payload, and are only valid until the handler returns.
+ */
+typedef struct {
+    uint8_t type;
+    uint16_t len;
+    const client_segment_t *segs;
+    int seg_count;
+} frame_t;
+
+/**
+ * @brief Called for every complete frame of a registered type.
+ * @param arg User argument given to frame_register().
+ * @param frame The frame.
+ */
+typedef void (*frame_handler_t)(void *arg, const frame_t *frame);
+
+typedef struct {
+    uint32_t frames;       /** Frames dispatched to a handler */
+    uint32_t unhandled;    /** Frames dropped because no handler was registered for the type */
+    uint32_t crc_errors;   /** Frames dropped because the CRC did not match */
+    uint32_t copied;       /** Payloads spread over too many segments, copied into the scratch buffer */
+    uint32_t oversize;     /** Length prefixes above FRAME_MAX_PAYLOAD */
+    uint32_t malformed;    /** Length prefixes longer than FRAME_LEN_BYTES_MAX */
+} frame_stats_t;
+
+typedef struct {
+    struct {
+        frame_handler_t fn;
+        void *arg;
+    } handlers[FRAME_TYPE_COUNT];
+    frame_stats_t stats;
+    uint8_t scratch[FRAME_MAX_PAYLOAD];
+} frame_decoder_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Initialise a decoder with no handlers registered.
+ * @param decoder Pointer to the decoder.
+ * @return int 0 on success, -1 on failure.
+ */
+int frame_decoder_init(frame_decoder_t *decoder);
+
+/**
+ * @brief Register the handler for a message type, replacing any previous one.
+ * @param decoder Pointer to the decoder.
+ * @param type Message type, below FRAME_TYPE_COUNT.
+ * @param fn Handler, NULL to drop frames of this type.
+ * @param arg User argument passed to the handler.
+ * @return int 0 on success, -1 on failure.
+ */
+int frame_register(frame_decoder_t *decoder, uint8_t type, frame_handler_t fn, void *arg);
+
+/**
+ * @brief Dispatch every complete frame waiting in the client receive queue.
+ *
+ * Frames are parsed in place across pbuf boundaries and consumed once their handler returns.
+ * A partial frame is left queued until the rest of it arrives, so this can be called whenever
+ * the core wakes up.
+ *
+ * @param decoder Pointer to the decoder.
+ * @param client Pointer to the client structure.
+ * @return int Number of frames dispatched, -1 if the stream is corrupt and the connection
+ *             should be closed.
+ */
+int frame_poll(frame_decoder_t *decoder, client_t *client);
+
+/**
+ * @brief Copy part of a frame payload into a buffer.
+ * @param frame The frame.
+ * @param offset Offset into the payload.
+ * @param buf Destination buffer.
+ * @param len Maximum number of bytes to copy.
+ * @return int Number of bytes copied, -1 on failure.
+ */
+int frame_copy(const frame_t *frame, uint16_t offset, void *buf, uint16_t len);
+
+/**
+ * @brief Queue a frame for transmission. The frame is queued completely or not at all.
+ * @param client Pointer to the client structure.
+ * @param type Message type, below FRAME_TYPE_COUNT.
+ * @param data Payload, may be NULL if len is 0.
+ * @param len Payload length, at most FRAME_MAX_PAYLOAD.
+ * @param crc true to append a CRC.
+ * @return int 0 on success, -1 if not connected or the transmit queue is full.
+ */
+int frame_send(client_t *client, uint8_t type, const void *data, uint16_t len, bool crc);
+
+/**
+ * @brief Encode the length prefix and type byte, for frames built up in place.
+ * @param hdr Destination, FRAME_HEADER_MAX bytes.
+ * @param type Message type.
+ * @param len Payload length.
+ * @param crc true if a CRC follows the payload.
+ * @return int Header length.
+ */
+int frame_header(uint8_t *hdr, uint8_t type, uint16_t len, bool crc);
+
+/**
+ * @brief Update a CRC-16/CCITT (polynomial 0x1021) with more data.
+ * @param crc CRC so far, 0xFFFF to start.
+ * @param data Data.
+ * @param len Length of the data.
+ * @return uint16_t The updated CRC.
+ */
+uint16_t frame_crc16(uint16_t crc, const uint8_t *data, uint32_t len);
+
+#endif /* _FRAME_H_ */
@@ -0,0 +1,130 @@
+#ifndef _HEARTBEAT_H_
+#define _HEARTBEAT_H_
+/** Includes *************************************************************************************/
+#include "pico/stdlib.h"
+#include "client.h"
+#include "frame.h"
+/** Defines **************************************************************************************/
+/**
+ * The client pings the server on an otherwise quiet connection and the server answers with a
+ * pong carrying the same payload:
+ *
+ *   ping   | seq (4) | time (4) |
+ *   pong   | seq (4) | time (4) |
+ *
+ * Both little endian, time is the client's microsecond clock when the ping was sent. A ping that
+ * is not answered within the retransmission timeout, worked out from the round trip times as TCP
+ * does, is missed and the next one goes out straight away. After HEARTBEAT_MISSES misses in a row
+ * the peer is taken for dead and the connection closed, so a half-open connection is noticed
+ * within HEARTBEAT_INTERVAL_MS + HEARTBEAT_MISSES * HEARTBEAT_TIMEOUT_MAX_MS.
+ */
+
+/** Frame types, distinct from the application's own */
+#ifndef HEARTBEAT_FRAME_PING
+#define HEARTBEAT_FRAME_PING 6
+#endif
+#ifndef HEARTBEAT_FRAME_PONG
+#define HEARTBEAT_FRAME_PONG 7
+#endif
+
+/** Time from one answered ping to the next */
+#ifndef HEARTBEAT_INTERVAL_MS
+#define HEARTBEAT_INTERVAL_MS 5000
+#endif
+
+/** Pings missed in a row before the peer is taken for dead */
+#ifndef HEARTBEAT_MISSES
+#define HEARTBEAT_MISSES 3
+#endif
+
+/** Bounds of the time a ping waits for its pong, also the wait before the first round trip */
+#ifndef HEARTBEAT_TIMEOUT_MIN_MS
+#define HEARTBEAT_TIMEOUT_MIN_MS 250
+#endif
+#ifndef HEARTBEAT_TIMEOUT_MAX_MS
+#define HEARTBEAT_TIMEOUT_MAX_MS 2000
+#endif
+
+/** Typedefs *************************************************************************************/
+/** Counters over all connections, the round trip times in microseconds */
+typedef struct {
+    uint32_t pings;        /** Pings sent */
+    uint32_t pongs;        /** Pongs received */
+    uint32_t late;         /** Pongs that came after their ping was counted as missed */
+    uint32_t missed;       /** Pings not answered in time */
+    uint32_t dead;         /** Connections closed because the peer stopped answering */
+    uint32_t rtt_last_us;  /** Newest round trip */
+    uint32_t rtt_min_us;   /** Shortest round trip, 0 before the first */
+    uint32_t rtt_max_us;   /** Longest round trip */
+    uint64_t rtt_total_us; /** Sum of the round trips, divide by pongs for the mean */
+} heartbeat_stats_t;
+
+typedef struct {
+    uint32_t interval_ms;
+    uint8_t misses;                 /** Misses in a row that end the connection */
+    uint8_t missed;                 /** Misses in a row so far */
+    bool waiting;                   /** A ping is out and not yet answered or missed */
+    uint32_t seq;                   /** Sequence number of the newest ping */
+    uint32_t sent_us;               /** When the newest ping went out */
+    absolute_time_t next_at;        /** When the next ping is due */
+    absolute_time_t deadline;       /** When the ping that is out counts as missed */
+    uint64_t rx_mark;               /** Received bytes when the ping went out, any new data shows the peer is up */
+    const client_t *client;         /** Connection the state below belongs to */
+    uint32_t connection;            /** connect_successes of that client when it was set up */
+    uint32_t srtt_us;               /** Smoothed round trip of the connection, 0 before the first */
+    uint32_t rttvar_us;             /** Mean deviation of the round trip */
+    heartbeat_stats_t stats;
+} heartbeat_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Initialise a heartbeat and register its pong handler.
+ * @param heartbeat Pointer to the heartbeat.
+ * @param decoder Decoder of the connection the pongs arrive on.
+ * @param interval_ms Time between pings while the peer answers, 0 for HEARTBEAT_INTERVAL_MS.
+ * @param misses Pings missed in a row before the connection is closed, 0 for HEARTBEAT_MISSES.
+ * @return int 0 on success, -1 on failure.
+ */
+int heartbeat_init(heartbeat_t *heartbeat, frame_decoder_t *decoder, uint32_t interval_ms, uint8_t misses);
+
+/**
+ * @brief Send a ping when one is due and close the connection once the peer has stopped answering.
+ *
+ * A new connection, or a different client, starts a fresh round trip estimate and pings after
+ * one interval. Data received while a ping is out shows the peer is up as well, so a busy
+ * connection whose pong is held up behind it does not count as a miss.
+ *
+ * @param heartbeat Pointer to the heartbeat.
+ * @param client Connection to watch, NULL if there is none.
+ * @return int 0 on success, -1 if the connection was closed.
+ * @note Run it at least every HEARTBEAT_TIMEOUT_MIN_MS for the timeouts to hold.
+ */
+int heartbeat_task(heartbeat_t *heartbeat, client_t *client);
+
+/**
+ * @brief Take an answer to a ping, for protocols that carry the pong in a frame of their own.
+ * @param heartbeat Pointer to the heartbeat.
+ * @param seq Sequence number of the ping answered.
+ * @param sent_us time_us_32() when the ping was sent.
+ * @return None.
+ */
+void heartbeat_pong(heartbeat_t *heartbeat, uint32_t seq, uint32_t sent_us);
+
+/**
+ * @brief Get the time a ping waits for its pong, the smoothed round trip plus four deviations.
+ * @param heartbeat Pointer to the heartbeat.
+ * @return uint32_t Timeout in milliseconds, between HEARTBEAT_TIMEOUT_MIN_MS and HEARTBEAT_TIMEOUT_MAX_MS.
+ */
+uint32_t heartbeat_timeout_ms(const heartbeat_t *heartbeat);
+
+/**
+ * @brief Log the round trip estimate and the ping counters.
+ * @param heartbeat Pointer to the heartbeat.
+ * @return None.
+ */
+void heartbeat_report(const heartbeat_t *heartbeat);
+
+#endif /* _HEARTBEAT_H_ */
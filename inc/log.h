@@ -0,0 +1,172 @@
+#ifndef _LOG_H_
+#define _LOG_H_
+/** Includes *************************************************************************************/
+#include "pico/stdlib.h"
+/** Defines **************************************************************************************/
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+/** Messages above this level are compiled out */
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+/**
+ * Drain records as text formatted on the device instead of as hex-encoded binary for
+ * tools/log_decode.py. Costs the formatting time in idle, but needs no tool.
+ */
+#ifndef LOG_OUTPUT_TEXT
+#define LOG_OUTPUT_TEXT 0
+#endif
+
+/** Size of the record ring of each core, must be a power of two */
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 4096
+#endif
+
+/** Longest record, a message with more argument bytes is cut short */
+#define LOG_RECORD_MAX 192
+
+/** Longest string argument copied into a record */
+#ifndef LOG_STR_MAX
+#define LOG_STR_MAX 48
+#endif
+
+/** Output written per idle pass when the free space of the USB endpoint cannot be queried */
+#ifndef LOG_DRAIN_BUDGET
+#define LOG_DRAIN_BUDGET 256
+#endif
+
+/** Typedefs *************************************************************************************/
+/** Argument tags, part of the record format read by tools/log_decode.py */
+typedef enum {
+    LOG_ARG_I32 = 1,
+    LOG_ARG_U32 = 2,
+    LOG_ARG_I64 = 3,
+    LOG_ARG_U64 = 4,
+    LOG_ARG_DOUBLE = 5,
+    LOG_ARG_STR = 6,   /** Copied, up to LOG_STR_MAX bytes */
+    LOG_ARG_PTR = 7,
+} log_arg_tag_t;
+
+/** An argument captured at the call site */
+typedef struct {
+    uint8_t tag;
+    union {
+        int32_t i32;
+        uint32_t u32;
+        int64_t i64;
+        uint64_t u64;
+        double d;
+        const char *s;
+        const void *p;
+    };
+} log_arg_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Create the record ring of the calling core. Call once on every core that logs.
+ * @return int 0 on success, -1 on failure.
+ */
+int log_init(void);
+
+/**
+ * @brief Append a record to the ring of the calling core. Use the LOG_* macros instead.
+ * @param level Message level.
+ * @param fmt printf style format, must be a string literal that stays in flash.
+ * @param nargs Number of arguments.
+ * @param args Captured arguments, NULL if there are none.
+ * @return None.
+ */
+void log_write(uint8_t level, const char *fmt, uint8_t nargs, const log_arg_t *args);
+
+/**
+ * @brief Write queued records out, as much as fits without blocking. Called from idle.
+ * @return None.
+ */
+void log_drain(void);
+
+/**
+ * @brief Get the number of records lost because the ring was full.
+ * @return uint32_t Records dropped since boot.
+ */
+uint32_t log_dropped(void);
+
+static inline log_arg_t log_arg_i32(int32_t v) { return (log_arg_t){.tag = LOG_ARG_I32, .i32 = v}; }
+static inline log_arg_t log_arg_u32(uint32_t v) { return (log_arg_t){.tag = LOG_ARG_U32, .u32 = v}; }
+static inline log_arg_t log_arg_i64(int64_t v) { return (log_arg_t){.tag = LOG_ARG_I64, .i64 = v}; }
+static inline log_arg_t log_arg_u64(uint64_t v) { return (log_arg_t){.tag = LOG_ARG_U64, .u64 = v}; }
+static inline log_arg_t log_arg_double(double v) { return (log_arg_t){.tag = LOG_ARG_DOUBLE, .d = v}; }
+static inline log_arg_t log_arg_str(const char *v) { return (log_arg_t){.tag = LOG_ARG_STR, .s = v}; }
+static inline log_arg_t log_arg_ptr(const void *v) { return (log_arg_t){.tag = LOG_ARG_PTR, .p = v}; }
+
+/** Capture an argument with a tag for its type */
+#define LOG_ARG(x) _Generic((x),                                                                   \
+    bool: log_arg_u32, char: log_arg_i32, signed char: log_arg_i32, unsigned char: log_arg_u32,   \
+    short: log_arg_i32, unsigned short: log_arg_u32, int: log_arg_i32, unsigned int: log_arg_u32, \
+    long: log_arg_i64, unsigned long: log_arg_u64,                                               \
+    long long: log_arg_i64, unsigned long long: log_arg_u64,                                     \
+    float: log_arg_double, double: log_arg_double,                                               \
+    char *: log_arg_str, const char *: log_arg_str,                                              \
+    default: log_arg_ptr)(x)
+
+/** Count up to 8 arguments */
+#define LOG_NARGS(...) LOG_NARGS_(__VA_OPT__(__VA_ARGS__, ) 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_NARGS_(_1, _2, _3, _4, _5, _6, _7, _8, N, ...) N
+
+#define LOG_CAT(a, b) LOG_CAT_(a, b)
+#define LOG_CAT_(a, b) a##b
+
+#define LOG_MAP_1(a) LOG_ARG(a)
+#define LOG_MAP_2(a, ...) LOG_ARG(a), LOG_MAP_1(__VA_ARGS__)
+#define LOG_MAP_3(a, ...) LOG_ARG(a), LOG_MAP_2(__VA_ARGS__)
+#define LOG_MAP_4(a, ...) LOG_ARG(a), LOG_MAP_3(__VA_ARGS__)
+#define LOG_MAP_5(a, ...) LOG_ARG(a), LOG_MAP_4(__VA_ARGS__)
+#define LOG_MAP_6(a, ...) LOG_ARG(a), LOG_MAP_5(__VA_ARGS__)
+#define LOG_MAP_7(a, ...) LOG_ARG(a), LOG_MAP_6(__VA_ARGS__)
+#define LOG_MAP_8(a, ...) LOG_ARG(a), LOG_MAP_7(__VA_ARGS__)
+
+/** The captured arguments as an array, NULL if there are none */
+#define LOG_ARGV_0() NULL
+#define LOG_ARGV_N(n, ...) ((const log_arg_t[]){LOG_CAT(LOG_MAP_, n)(__VA_ARGS__)})
+#define LOG_ARGV(...) LOG_CAT(LOG_ARGV_SEL_, LOG_NARGS(__VA_ARGS__))(__VA_ARGS__)
+#define LOG_ARGV_SEL_0() LOG_ARGV_0()
+#define LOG_ARGV_SEL_1(...) LOG_ARGV_N(1, __VA_ARGS__)
+#define LOG_ARGV_SEL_2(...) LOG_ARGV_N(2, __VA_ARGS__)
+#define LOG_ARGV_SEL_3(...) LOG_ARGV_N(3, __VA_ARGS__)
+#define LOG_ARGV_SEL_4(...) LOG_ARGV_N(4, __VA_ARGS__)
+#define LOG_ARGV_SEL_5(...) LOG_ARGV_N(5, __VA_ARGS__)
+#define LOG_ARGV_SEL_6(...) LOG_ARGV_N(6, __VA_ARGS__)
+#define LOG_ARGV_SEL_7(...) LOG_ARGV_N(7, __VA_ARGS__)
+#define LOG_ARGV_SEL_8(...) LOG_ARGV_N(8, __VA_ARGS__)
+
+/**
+ * Record a message. The format string is placed in flash and only its address is stored, the
+ * arguments are stored raw. The dead printf() call lets the compiler check the format.
+ */
+#define LOG_AT(level, fmt, ...)                                                                    \
+    do                                                                                             \
+    {                                                                                              \
+        if (0)                                                                                     \
+        {                                                                                          \
+            printf(fmt __VA_OPT__(, ) __VA_ARGS__);                                                \
+        }                                                                                          \
+        if ((level) <= LOG_LEVEL)                                                                  \
+        {                                                                                          \
+            static const char _log_fmt[] __attribute__((section(".rodata.logstr"))) = fmt;        \
+            log_write((level), _log_fmt, LOG_NARGS(__VA_ARGS__), LOG_ARGV(__VA_ARGS__));           \
+        }                                                                                          \
+    } while (0)
+
+#define LOG_ERROR(fmt, ...) LOG_AT(LOG_LEVEL_ERROR, fmt __VA_OPT__(, ) __VA_ARGS__)
+#define LOG_WARN(fmt, ...) LOG_AT(LOG_LEVEL_WARN, fmt __VA_OPT__(, ) __VA_ARGS__)
+#define LOG_INFO(fmt, ...) LOG_AT(LOG_LEVEL_INFO, fmt __VA_OPT__(, ) __VA_ARGS__)
+#define LOG_DEBUG(fmt, ...) LOG_AT(LOG_LEVEL_DEBUG, fmt __VA_OPT__(, ) __VA_ARGS__)
+
+#endif /* _LOG_H_ */
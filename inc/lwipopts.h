@@ -12,7 +12,13 @@
 #ifndef LWIP_SOCKET
 #define LWIP_SOCKET                 0
 #endif
-#if PICO_CYW43_ARCH_POLL
+#if PICO_CLIENT_STATIC_POOLS
+// The heap is carved from the fixed-size pools in lwippools.h, O(1) with no fragmentation
+#define MEM_LIBC_MALLOC             0
+#define MEM_USE_POOLS               1
+#define MEMP_USE_CUSTOM_POOLS       1
+#define MEM_USE_POOLS_TRY_BIGGER_POOL 1
+#elif PICO_CYW43_ARCH_POLL
 #define MEM_LIBC_MALLOC             1
 #else
 // MEM_LIBC_MALLOC is incompatible with non polling versions
@@ -22,6 +28,15 @@
 #define MEM_SIZE                    4000
 #define MEMP_NUM_TCP_SEG            32
 #define MEMP_NUM_ARP_QUEUE          10
+// Room for the iperf self-test next to the client: its TCP test with both ends of the tradeoff,
+// its UDP server and client, and its pacing, sampling and run timers, see selftest.h.
+// Every client of the pool has a UDP batch timer on top, see client_pool.h
+#ifndef CLIENT_POOL_MAX
+#define CLIENT_POOL_MAX             4
+#endif
+#define MEMP_NUM_TCP_PCB            8
+#define MEMP_NUM_UDP_PCB            6
+#define MEMP_NUM_SYS_TIMEOUT        (LWIP_NUM_SYS_TIMEOUT_INTERNAL + 4 + CLIENT_POOL_MAX)
 #define PBUF_POOL_SIZE              24
 #define LWIP_ARP                    1
 #define LWIP_ETHERNET               1
@@ -35,9 +50,16 @@
 #define LWIP_NETIF_LINK_CALLBACK    1
 #define LWIP_NETIF_HOSTNAME         1
 #define LWIP_NETCONN                0
+#if PICO_CLIENT_STATIC_POOLS
+// Current, high-water and failure counts per pool, see mempool_dump()
+#define LWIP_STATS                  1
+#define MEM_STATS                   1
+#define MEMP_STATS                  1
+#else
 #define MEM_STATS                   0
-#define SYS_STATS                   0
 #define MEMP_STATS                  0
+#endif
+#define SYS_STATS                   0
 #define LINK_STATS                  0
 // #define ETH_PAD_SIZE                2
 #define LWIP_CHKSUM_ALGORITHM       3
@@ -50,6 +72,14 @@
 #define LWIP_NETIF_TX_SINGLE_PBUF   1
 #define DHCP_DOES_ARP_CHECK         0
 #define LWIP_DHCP_DOES_ACD_CHECK    0
+// The client talks through altcp, plain TCP or TLS on top of it, see client_set_transport()
+#define LWIP_ALTCP                  1
+#if PICO_CLIENT_TLS
+#define LWIP_ALTCP_TLS              1
+#define LWIP_ALTCP_TLS_MBEDTLS      1
+// mbedTLS allocates from the C heap, its record buffers are larger than anything in lwIP's heap
+#define ALTCP_MBEDTLS_PLATFORM_ALLOC 0
+#endif
 
 #ifndef NDEBUG
 #define LWIP_DEBUG                  1
@@ -0,0 +1,28 @@
+/**
+ * Fixed-size pools lwIP's heap is carved from when PICO_CLIENT_STATIC_POOLS is on.
+ *
+ * mem_malloc() takes the smallest pool that fits, or the next bigger one if that is empty.
+ * The large pool holds an MSS-sized segment with its headers, which is what tcp_write() with
+ * TCP_WRITE_FLAG_COPY and the single-pbuf transmit path allocate.
+ */
+#if MEM_USE_POOLS
+
+#ifndef LWIP_POOL_SMALL_COUNT
+#define LWIP_POOL_SMALL_COUNT 24
+#endif
+
+#ifndef LWIP_POOL_MEDIUM_COUNT
+#define LWIP_POOL_MEDIUM_COUNT 12
+#endif
+
+#ifndef LWIP_POOL_LARGE_COUNT
+#define LWIP_POOL_LARGE_COUNT 10
+#endif
+
+LWIP_MALLOC_MEMPOOL_START
+LWIP_MALLOC_MEMPOOL(LWIP_POOL_SMALL_COUNT, 64)
+LWIP_MALLOC_MEMPOOL(LWIP_POOL_MEDIUM_COUNT, 256)
+LWIP_MALLOC_MEMPOOL(LWIP_POOL_LARGE_COUNT, 1600)
+LWIP_MALLOC_MEMPOOL_END
+
+#endif /* MEM_USE_POOLS */
@@ -0,0 +1,74 @@
+#ifndef _MBEDTLS_CONFIG_H_
+#define _MBEDTLS_CONFIG_H_
+/**
+ * mbedTLS configuration for the TLS transport, picked up through MBEDTLS_CONFIG_FILE.
+ *
+ * A TLS 1.2 client with ECDHE key exchange and AES-GCM, which every current server offers, and
+ * nothing else, to keep flash and the handshake small. Session tickets and session ids are both
+ * kept so a reconnect can resume, see tls.c.
+ */
+
+/** Platform ************************************************************************************/
+#define MBEDTLS_HAVE_TIME
+#define MBEDTLS_NO_PLATFORM_ENTROPY
+/** mbedtls_hardware_poll() comes from pico_mbedtls, on top of pico_rand */
+#define MBEDTLS_ENTROPY_HARDWARE_ALT
+/** tls.c compares session master secrets to spot a resumption */
+#define MBEDTLS_ALLOW_PRIVATE_ACCESS
+
+/** TLS *****************************************************************************************/
+#define MBEDTLS_SSL_TLS_C
+#define MBEDTLS_SSL_CLI_C
+#define MBEDTLS_SSL_PROTO_TLS1_2
+#define MBEDTLS_SSL_SERVER_NAME_INDICATION
+#define MBEDTLS_SSL_EXTENDED_MASTER_SECRET
+#define MBEDTLS_SSL_ENCRYPT_THEN_MAC
+#define MBEDTLS_SSL_SESSION_TICKETS
+#define MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+/** Writes are at most an MSS staging buffer, incoming records can be full size */
+#define MBEDTLS_SSL_OUT_CONTENT_LEN 2048
+
+/** Key exchange and ciphers ********************************************************************/
+#define MBEDTLS_KEY_EXCHANGE_ECDHE_ECDSA_ENABLED
+#define MBEDTLS_KEY_EXCHANGE_ECDHE_RSA_ENABLED
+#define MBEDTLS_ECP_DP_SECP256R1_ENABLED
+#define MBEDTLS_ECP_DP_SECP384R1_ENABLED
+#define MBEDTLS_ECP_DP_CURVE25519_ENABLED
+#define MBEDTLS_ECP_NIST_OPTIM
+#define MBEDTLS_AES_C
+#define MBEDTLS_GCM_C
+#define MBEDTLS_CIPHER_C
+#define MBEDTLS_ECDH_C
+#define MBEDTLS_ECDSA_C
+#define MBEDTLS_ECP_C
+#define MBEDTLS_BIGNUM_C
+#define MBEDTLS_RSA_C
+#define MBEDTLS_PKCS1_V15
+#define MBEDTLS_MD_C
+#define MBEDTLS_SHA256_C
+#define MBEDTLS_SHA512_C
+#define MBEDTLS_ENTROPY_C
+#define MBEDTLS_CTR_DRBG_C
+
+/** Certificates ********************************************************************************/
+#define MBEDTLS_ASN1_PARSE_C
+#define MBEDTLS_ASN1_WRITE_C
+#define MBEDTLS_OID_C
+#define MBEDTLS_PK_C
+#define MBEDTLS_PK_PARSE_C
+#define MBEDTLS_X509_USE_C
+#define MBEDTLS_X509_CRT_PARSE_C
+#define MBEDTLS_BASE64_C
+#define MBEDTLS_PEM_PARSE_C
+
+/** Hardware acceleration ***********************************************************************/
+/**
+ * SHA-256 on the RP2350 accelerator. With this set pico_mbedtls builds its sha256_alt on top of
+ * pico_sha256, so the handshake transcript, the PRF and the certificate checks hash in hardware.
+ * The RP2040 has no accelerator and keeps the software version.
+ */
+#if LIB_PICO_SHA256
+#define MBEDTLS_SHA256_ALT
+#endif
+
+#endif /* _MBEDTLS_CONFIG_H_ */
@@ -0,0 +1,121 @@
+#ifndef _MEMPOOL_H_
+#define _MEMPOOL_H_
+/** Includes *************************************************************************************/
+#include "pico/stdlib.h"
+/** Defines **************************************************************************************/
+/** Pools that can be registered for mempool_dump() */
+#ifndef MEMPOOL_MAX_POOLS
+#define MEMPOOL_MAX_POOLS 8
+#endif
+
+/**
+ * Block alignment. The RP2350 has no data cache in front of SRAM, so word alignment is all the
+ * DMA engine and the Cortex-M33 need. Raise this for a target with cache lines.
+ */
+#ifndef MEMPOOL_ALIGN
+#define MEMPOOL_ALIGN 4
+#endif
+
+/** Round a block size up to the pool alignment */
+#define MEMPOOL_BLOCK_SIZE(size) (((size) + MEMPOOL_ALIGN - 1) & ~(MEMPOOL_ALIGN - 1))
+
+/**
+ * @brief Define a pool with static storage. Call mempool_init() on it before use.
+ * @param var Name of the mempool_t variable.
+ * @param size Block size in bytes.
+ * @param count Number of blocks.
+ */
+#define MEMPOOL_DEFINE(var, size, count)                                                                \
+    static uint8_t var##_storage[(count) * MEMPOOL_BLOCK_SIZE(size)] __attribute__((aligned(MEMPOOL_ALIGN))); \
+    static mempool_t var = {                                                                            \
+        .storage = var##_storage,                                                                       \
+        .block_size = MEMPOOL_BLOCK_SIZE(size),                                                         \
+        .block_count = (count),                                                                         \
+    }
+
+/** Typedefs *************************************************************************************/
+typedef struct {
+    uint16_t used;        /** Blocks currently allocated */
+    uint16_t high_water;  /** Most blocks ever allocated at once */
+    uint32_t allocs;      /** Successful allocations */
+    uint32_t failures;    /** Allocations refused because the pool was empty */
+} mempool_stats_t;
+
+/**
+ * @brief A pool of fixed-size blocks with O(1) alloc and free.
+ *
+ * Free blocks are kept in a singly linked list threaded through the blocks themselves, so
+ * alloc and free are a pointer swap each and take the same time however full the pool is.
+ * A pool belongs to one core, it has no locking.
+ */
+typedef struct {
+    const char *name;
+    uint8_t *storage;
+    uint16_t block_size;
+    uint16_t block_count;
+    void *free_list;
+    mempool_stats_t stats;
+} mempool_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Initialise a pool defined with MEMPOOL_DEFINE() and register it for mempool_dump().
+ * @param pool Pointer to the pool.
+ * @param name Name shown by mempool_dump(), must stay valid.
+ * @return int 0 on success, -1 on failure.
+ */
+int mempool_init(mempool_t *pool, const char *name);
+
+/**
+ * @brief Take a block from the pool.
+ * @param pool Pointer to the pool.
+ * @return void* The block, NULL if the pool is empty.
+ */
+void *mempool_alloc(mempool_t *pool);
+
+/**
+ * @brief Check that several blocks can be taken before taking the first of them.
+ * @param pool Pointer to the pool.
+ * @param count Number of blocks about to be taken.
+ * @return int 0 if enough blocks are free, -1 otherwise, counted as a failure like an empty pool.
+ */
+int mempool_check(mempool_t *pool, uint16_t count);
+
+/**
+ * @brief Return a block to the pool.
+ * @param pool Pointer to the pool.
+ * @param block Block returned by mempool_alloc(), NULL is ignored.
+ * @return int 0 on success, -1 if the block does not belong to the pool.
+ */
+int mempool_free(mempool_t *pool, void *block);
+
+/**
+ * @brief Get the number of free blocks.
+ * @param pool Pointer to the pool.
+ * @return uint16_t Number of free blocks.
+ */
+uint16_t mempool_available(const mempool_t *pool);
+
+/**
+ * @brief Get the counters of a pool.
+ * @param pool Pointer to the pool.
+ * @return const mempool_stats_t* The counters.
+ */
+const mempool_stats_t *mempool_stats(const mempool_t *pool);
+
+/**
+ * @brief Print the counters of every registered pool, and of lwIP's pools when MEMP_STATS is on.
+ * @return None.
+ */
+void mempool_dump(void);
+
+/**
+ * @brief Log the same counters as mempool_dump() through the deferred log, one line per pool.
+ * @return None.
+ */
+void mempool_log(void);
+
+#endif /* _MEMPOOL_H_ */
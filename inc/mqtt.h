@@ -0,0 +1,253 @@
+#ifndef _MQTT_H_
+#define _MQTT_H_
+/** Includes *************************************************************************************/
+#include "pico/stdlib.h"
+#include "client.h"
+/** Defines **************************************************************************************/
+/**
+ * MQTT 3.1.1 over a client's TCP or TLS stream. The engine follows the client's connection:
+ * every new connection gets a CONNECT without the clean session flag, so the broker keeps the
+ * subscriptions and the QoS 1 messages not yet acknowledged. Publishes that were sent but not
+ * acknowledged are sent again with the DUP flag. Every subscription is sent again on every new
+ * connection until its SUBACK, as the broker may hold a session from before it was added.
+ *
+ * Publishes are not copied. The topic and payload are written to the client by reference, so
+ * they must stay unchanged until the done callback, which for QoS 1 is the PUBACK and for QoS 0
+ * the TCP ack. Up to a window of QoS 1 publishes are sent before the first PUBACK comes back.
+ */
+
+/** Standard port, see client_init_endpoint() */
+#define MQTT_PORT 1883
+
+/** Publishes queued at once, sent or waiting for the window */
+#ifndef MQTT_QUEUE_MAX
+#define MQTT_QUEUE_MAX 16
+#endif
+
+/** Default window, QoS 1 publishes sent and not yet acknowledged */
+#ifndef MQTT_WINDOW_DEFAULT
+#define MQTT_WINDOW_DEFAULT 8
+#endif
+
+/** Subscriptions, and nodes of the topic trie they are matched through, one per filter level */
+#ifndef MQTT_SUBS_MAX
+#define MQTT_SUBS_MAX 8
+#endif
+#ifndef MQTT_TRIE_NODES
+#define MQTT_TRIE_NODES 32
+#endif
+
+/** Received QoS 1 messages whose PUBACK waits for room in the transmit queue, reading stops when full */
+#ifndef MQTT_PUBACKS_MAX
+#define MQTT_PUBACKS_MAX 8
+#endif
+
+/** Largest packet received, a PUBLISH spread over several pbufs is copied into a buffer this size */
+#ifndef MQTT_RX_MAX
+#define MQTT_RX_MAX 1024
+#endif
+
+/** Keepalive sent in CONNECT, a PINGREQ goes out when nothing else has for half of it */
+#ifndef MQTT_KEEPALIVE_S
+#define MQTT_KEEPALIVE_S 60
+#endif
+
+/** Longest wait for a CONNACK or a PINGRESP before the connection is closed */
+#ifndef MQTT_RESPONSE_TIMEOUT_MS
+#define MQTT_RESPONSE_TIMEOUT_MS 10000
+#endif
+
+/** Longest client identifier */
+#define MQTT_CLIENT_ID_MAX 23
+
+/** Typedefs *************************************************************************************/
+typedef enum {
+    MQTT_DISCONNECTED = 0,  /** No connection, or the client is not connected */
+    MQTT_CONNECTING = 1,    /** CONNECT sent, waiting for the CONNACK */
+    MQTT_CONNECTED = 2,     /** Session up, publishes flow */
+} mqtt_state_t;
+
+/**
+ * @brief Called once a publish no longer references its topic and payload.
+ * @param arg User argument given to mqtt_publish().
+ * @param status 0 if delivered, acknowledged for QoS 1, -1 if a QoS 0 publish was lost with the connection.
+ */
+typedef void (*mqtt_done_fn_t)(void *arg, int status);
+
+/**
+ * @brief Called for every received message whose topic matches a subscription.
+ * @param arg User argument given to mqtt_subscribe().
+ * @param topic Topic, not NUL terminated.
+ * @param topic_len Length of the topic.
+ * @param payload Payload, only valid until the callback returns.
+ * @param len Length of the payload.
+ */
+typedef void (*mqtt_message_fn_t)(void *arg, const char *topic, uint16_t topic_len, const uint8_t *payload,
+                                  uint16_t len);
+
+/** Engine counters */
+typedef struct {
+    uint32_t connects;         /** CONNACKs accepted */
+    uint32_t refused;          /** CONNACKs with a return code other than 0 */
+    uint32_t resumed;          /** Connections on which the broker still had the session */
+    uint32_t published;        /** Publishes queued */
+    uint32_t acked;            /** QoS 1 publishes acknowledged */
+    uint32_t resent;           /** Publishes sent again with DUP after a reconnect */
+    uint32_t lost;             /** QoS 0 publishes lost with a connection */
+    uint32_t received;         /** PUBLISH packets received */
+    uint32_t unmatched;        /** Received messages no subscription matched */
+    uint32_t copied;           /** Received packets copied because they were spread over pbufs */
+    uint32_t sub_failures;     /** Subscriptions the broker refused */
+    uint32_t timeouts;         /** Connections closed for a missing CONNACK or PINGRESP */
+    uint32_t ping_rtt_us;      /** Time from the last PINGREQ to its PINGRESP */
+} mqtt_stats_t;
+
+/** A queued publish, holds its header until the topic and payload have been sent */
+typedef struct mqtt_slot {
+    struct mqtt *mqtt;
+    const char *topic;
+    const uint8_t *payload;
+    uint16_t topic_len;
+    uint16_t len;
+    mqtt_done_fn_t done;
+    void *arg;
+    uint16_t id;               /** Packet identifier, QoS 1 only */
+    uint8_t qos;
+    bool retain;
+    bool sent;                 /** Written on the current connection */
+    bool written;              /** Written on any connection, DUP on the next send */
+    bool queued;               /** Still referenced by the client's transmit queue */
+    bool acked;                /** PUBACK received, or for QoS 0 the TCP ack */
+    bool lost;                 /** QoS 0 publish dropped with its connection */
+    uint8_t head[7];           /** Fixed header, remaining length and topic length */
+    uint8_t head_len;
+    uint8_t id_bytes[2];
+} mqtt_slot_t;
+
+/** A level of a topic filter, the children of a node are chained through next */
+typedef struct {
+    const char *level;
+    uint8_t len;
+    int8_t child;              /** First child, -1 if none */
+    int8_t next;               /** Next sibling, -1 if none */
+    int8_t sub;                /** Subscription whose filter ends here, -1 if none */
+} mqtt_node_t;
+
+typedef struct {
+    const char *filter;
+    uint8_t qos;
+    mqtt_message_fn_t fn;
+    void *arg;
+    uint16_t id;               /** Packet identifier of the SUBSCRIBE waiting for its SUBACK, 0 if none */
+    bool subscribed;           /** SUBACK received on the current connection */
+} mqtt_sub_t;
+
+typedef struct mqtt {
+    char client_id[MQTT_CLIENT_ID_MAX + 1];
+    const char *username;
+    const char *password;
+    uint16_t keepalive_s;
+    uint8_t window;
+    mqtt_state_t state;
+    client_t *client;                   /** Connection the state belongs to */
+    uint32_t connection;                /** connect_successes of that client when it was set up */
+    absolute_time_t response_deadline;  /** When the awaited CONNACK or PINGRESP is overdue */
+    bool ping_out;
+    uint32_t ping_sent_us;
+    absolute_time_t last_tx;            /** When a packet last went out, for the keepalive */
+    uint16_t next_id;
+    /** Publishes in the order they were queued */
+    mqtt_slot_t slots[MQTT_QUEUE_MAX];
+    uint8_t slot_head;
+    uint8_t slot_count;
+    /** Subscriptions and the trie they are matched through, node 0 is the root */
+    mqtt_sub_t subs[MQTT_SUBS_MAX];
+    uint8_t sub_count;
+    mqtt_node_t nodes[MQTT_TRIE_NODES];
+    uint8_t node_count;
+    /** Packet identifiers of the PUBACKs still to send, in the order the messages arrived */
+    uint16_t pubacks[MQTT_PUBACKS_MAX];
+    uint8_t puback_count;
+    uint8_t scratch[MQTT_RX_MAX];
+    mqtt_stats_t stats;
+} mqtt_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Initialise an engine.
+ * @param mqtt Pointer to the engine.
+ * @param client_id Client identifier, the broker keeps the session under it, at most MQTT_CLIENT_ID_MAX characters.
+ * @param username User name, NULL for none. Referenced, not copied.
+ * @param password Password, NULL for none. Referenced, not copied.
+ * @return int 0 on success, -1 on failure.
+ */
+int mqtt_init(mqtt_t *mqtt, const char *client_id, const char *username, const char *password);
+
+/**
+ * @brief Set how many QoS 1 publishes can be waiting for their PUBACK at once.
+ * @param mqtt Pointer to the engine.
+ * @param window Publishes, 1 for stop and wait, at most MQTT_QUEUE_MAX.
+ * @return int 0 on success, -1 on failure.
+ */
+int mqtt_set_window(mqtt_t *mqtt, uint8_t window);
+
+/**
+ * @brief Run the session on a connection: connect, receive, send queued publishes and keep alive.
+ *
+ * A new connection, or a different client, starts a new session with a CONNECT. Received
+ * messages are dispatched to their subscriptions from here.
+ *
+ * @param mqtt Pointer to the engine.
+ * @param client Connection to run on, NULL if there is none. TCP or TLS, not UDP.
+ * @return int 0 on success, -1 if the connection was closed.
+ */
+int mqtt_task(mqtt_t *mqtt, client_t *client);
+
+/**
+ * @brief Queue a publish, it is sent straight away if the session is up and the window allows.
+ * @param mqtt Pointer to the engine.
+ * @param topic Topic, NUL terminated, no wildcards. Referenced until done is called.
+ * @param payload Payload, may be NULL if len is 0. Referenced until done is called.
+ * @param len Length of the payload.
+ * @param qos 0 or 1.
+ * @param retain true for the broker to keep the message for later subscribers.
+ * @param done Called once the topic and payload are no longer referenced, may be NULL.
+ * @param arg User argument passed to done.
+ * @return int 0 on success, -1 if the queue is full or the arguments are not valid.
+ */
+int mqtt_publish(mqtt_t *mqtt, const char *topic, const void *payload, uint16_t len, uint8_t qos, bool retain,
+                 mqtt_done_fn_t done, void *arg);
+
+/**
+ * @brief Subscribe to a topic filter, on this session and on every one after it.
+ *
+ * Filters can use + for one level and # for the rest. Received messages are matched against
+ * all filters at once through a trie of their levels, and every matching subscription is called.
+ *
+ * @param mqtt Pointer to the engine.
+ * @param filter Topic filter, NUL terminated. Referenced, not copied.
+ * @param qos Highest QoS to receive, 0 or 1.
+ * @param fn Called for every matching message.
+ * @param arg User argument passed to fn.
+ * @return int 0 on success, -1 if the filter is not valid or there is no room for it.
+ */
+int mqtt_subscribe(mqtt_t *mqtt, const char *filter, uint8_t qos, mqtt_message_fn_t fn, void *arg);
+
+/**
+ * @brief Get the number of queued publishes, sent or not, that still reference their data.
+ * @param mqtt Pointer to the engine.
+ * @return uint32_t Queued publishes.
+ */
+uint32_t mqtt_pending(const mqtt_t *mqtt);
+
+/**
+ * @brief Log the session counters.
+ * @param mqtt Pointer to the engine.
+ * @return None.
+ */
+void mqtt_report(const mqtt_t *mqtt);
+
+#endif /* _MQTT_H_ */
@@ -0,0 +1,68 @@
+#ifndef _NETCORE_H_
+#define _NETCORE_H_
+/** Includes *************************************************************************************/
+#include "pico/stdlib.h"
+#include "client.h"
+#include "wifi.h"
+/** Defines **************************************************************************************/
+/** Size of the ring carrying received data from core 1 to core 0, must be a power of two */
+#ifndef NETCORE_RX_RING_SIZE
+#define NETCORE_RX_RING_SIZE 16384
+#endif
+
+/** Size of the ring carrying outgoing messages from core 0 to core 1, must be a power of two */
+#ifndef NETCORE_TX_RING_SIZE
+#define NETCORE_TX_RING_SIZE 8192
+#endif
+
+/** Largest message that crosses between the cores */
+#define NETCORE_MSG_MAX 2048
+
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Launch the network stack on core 1.
+ *
+ * Core 1 initialises the cyw43 driver and lwIP, then runs wifi_task() and the client_task()
+ * state machine. Received data and outgoing messages cross between the cores through lock-free
+ * single-producer/single-consumer rings, so core 0 never calls into lwIP.
+ *
+ * @param ssid The SSID of the Wi-Fi network to connect to. Must stay valid.
+ * @param password The password of the Wi-Fi network. Must stay valid.
+ * @param ip_address The server IP address. Must stay valid.
+ * @return int 0 on success, -1 on failure.
+ */
+int netcore_start(const char *ssid, const char *password, const char *ip_address);
+
+/**
+ * @brief Take the next chunk of received data. Core 0 only.
+ * @param buf Destination buffer, should hold NETCORE_MSG_MAX bytes.
+ * @param max Size of the destination buffer.
+ * @return int Number of bytes received, 0 if nothing is waiting, -1 on failure.
+ */
+int netcore_recv(void *buf, uint16_t max);
+
+/**
+ * @brief Queue a message to be sent by core 1. Core 0 only.
+ * @param data Message data.
+ * @param len Message length, at most NETCORE_MSG_MAX.
+ * @return int 0 on success, -1 if the ring is full.
+ */
+int netcore_send(const void *data, uint16_t len);
+
+/**
+ * @brief Get the Wi-Fi state last published by core 1.
+ * @return WifiTaskState_t The Wi-Fi state.
+ */
+WifiTaskState_t netcore_wifi_state(void);
+
+/**
+ * @brief Get the client state last published by core 1.
+ * @return client_state_t The client state.
+ */
+client_state_t netcore_client_state(void);
+
+#endif /* _NETCORE_H_ */
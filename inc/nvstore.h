@@ -0,0 +1,79 @@
+#ifndef _NVSTORE_H_
+#define _NVSTORE_H_
+/** Includes *************************************************************************************/
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+/** Defines **************************************************************************************/
+/** Sectors reserved at the end of flash, records move to the other one when one fills up */
+#define NVSTORE_SECTORS 2
+
+/** Flash offset of the first reserved sector, the linker must not place anything from here on */
+#ifndef NVSTORE_FLASH_OFFSET
+#define NVSTORE_FLASH_OFFSET (PICO_FLASH_SIZE_BYTES - NVSTORE_SECTORS * FLASH_SECTOR_SIZE)
+#endif
+
+/** Each record takes one flash page, so a write is a single page program */
+#define NVSTORE_SLOT_SIZE FLASH_PAGE_SIZE
+#define NVSTORE_HEADER_SIZE 16
+#define NVSTORE_DATA_MAX (NVSTORE_SLOT_SIZE - NVSTORE_HEADER_SIZE)
+
+/** Highest key number */
+#define NVSTORE_MAX_KEYS 8
+
+/** Typedefs *************************************************************************************/
+/** Record keys, one per user so they never collide */
+typedef enum {
+    NVSTORE_KEY_WIFI_AP = 1,     /** Access point of the last association, see wifi.c */
+    NVSTORE_KEY_DHCP_LEASE = 2,  /** Address of the last DHCP lease, see wifi.c */
+} nvstore_key_t;
+
+/** Wear counters */
+typedef struct {
+    uint32_t writes;     /** Records programmed */
+    uint32_t skipped;    /** Writes that matched the stored record and were not programmed */
+    uint32_t erases;     /** Sector erases */
+    uint32_t failures;   /** Flash operations that could not be run */
+} nvstore_stats_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Find the newest record of every key in the reserved sectors.
+ * @return int 0 on success, -1 on failure.
+ */
+int nvstore_init(void);
+
+/**
+ * @brief Read the newest record of a key straight from flash.
+ * @param key The key.
+ * @param buf Destination buffer.
+ * @param len Size of the buffer.
+ * @return int Length of the record, -1 if there is none or it does not fit.
+ */
+int nvstore_read(nvstore_key_t key, void *buf, uint16_t len);
+
+/**
+ * @brief Store a record for a key.
+ *
+ * Records are appended to the next erased page, so a sector is only erased after it has taken
+ * FLASH_SECTOR_SIZE / NVSTORE_SLOT_SIZE writes. A record identical to the stored one is not
+ * written at all. Interrupts and the other core are held off while the flash is programmed.
+ *
+ * @param key The key.
+ * @param data Record data.
+ * @param len Length of the data, at most NVSTORE_DATA_MAX.
+ * @return int 0 on success, -1 on failure.
+ * @note Blocks for a page program, about 1 ms, and for a sector erase every few writes, up to
+ *       tens of milliseconds. Do not call from a hot path.
+ */
+int nvstore_write(nvstore_key_t key, const void *data, uint16_t len);
+
+/**
+ * @brief Get the wear counters.
+ * @return const nvstore_stats_t* The counters.
+ */
+const nvstore_stats_t *nvstore_stats(void);
+
+#endif /* _NVSTORE_H_ */
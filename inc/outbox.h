@@ -0,0 +1,125 @@
+#ifndef _OUTBOX_H_
+#define _OUTBOX_H_
+/** Includes *************************************************************************************/
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "client.h"
+#include "frame.h"
+#include "nvstore.h"
+/** Defines **************************************************************************************/
+/**
+ * Messages that cannot be sent right away are appended to a log in flash and replayed once the
+ * client is connected again. Every record is stored exactly as it goes out, a frame with a CRC:
+ *
+ *   record  | length (varint) | OUTBOX_FRAME_RECORD | 0x80 | seq (4) | data | crc (2) |
+ *   ack     | length (varint) | OUTBOX_FRAME_ACK | seq (4) |
+ *
+ * seq counts up by one per message, little endian. The server answers with the newest seq it has
+ * received, which acknowledges that one and everything before it. Messages sent while the link
+ * is up carry a seq as well but are not stored.
+ */
+
+/** Frame types, distinct from the application's own */
+#ifndef OUTBOX_FRAME_RECORD
+#define OUTBOX_FRAME_RECORD 4
+#endif
+#ifndef OUTBOX_FRAME_ACK
+#define OUTBOX_FRAME_ACK 5
+#endif
+
+/** Sectors of the log, used in turn so they wear evenly */
+#ifndef OUTBOX_SECTORS
+#define OUTBOX_SECTORS 16
+#endif
+
+/** Flash offset of the log, right below the nvstore sectors */
+#ifndef OUTBOX_FLASH_OFFSET
+#define OUTBOX_FLASH_OFFSET (NVSTORE_FLASH_OFFSET - OUTBOX_SECTORS * FLASH_SECTOR_SIZE)
+#endif
+
+/** Largest message */
+#ifndef OUTBOX_DATA_MAX
+#define OUTBOX_DATA_MAX 512
+#endif
+
+/** Longest a stored message waits in RAM for the rest of its sector before it is programmed */
+#ifndef OUTBOX_FLUSH_MS
+#define OUTBOX_FLUSH_MS 30000
+#endif
+
+/** Typedefs *************************************************************************************/
+/** Log counters */
+typedef struct {
+    uint32_t stored;          /** Messages appended to the log */
+    uint32_t direct;          /** Messages sent without going through flash */
+    uint32_t replayed;        /** Records sent from flash, resends after a reconnect included */
+    uint32_t acked;           /** Stored records the server acknowledged */
+    uint32_t dropped;         /** Records lost to a full log or a failed program */
+    uint32_t programs;        /** Batched flash programs */
+    uint32_t erases;          /** Sector erases */
+    uint32_t failures;        /** Flash operations that could not be run */
+    uint32_t replay_writes;   /** Zero-copy writes the replayed records went out in */
+    uint64_t replayed_bytes;  /** Bytes sent from flash */
+} outbox_stats_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Find the stored records in flash and register the ack handler.
+ *
+ * Records left from before a reset are replayed on the next connection. Acknowledged records
+ * are only erased with their sector, so the server can see a few of them again after a reset.
+ *
+ * @param decoder Decoder of the connection the acks arrive on.
+ * @return int 0 on success, -1 on failure.
+ */
+int outbox_init(frame_decoder_t *decoder);
+
+/**
+ * @brief Send a message, or store it if it cannot go out now.
+ *
+ * The message goes straight to the client if it is connected and nothing older is waiting.
+ * Otherwise it is appended to a sector sized batch in RAM. A batch is programmed when its
+ * sector is full, after OUTBOX_FLUSH_MS, or before a replay. If the log is full the oldest sector
+ * is dropped to make room.
+ *
+ * @param client Connection to send on, NULL if there is none.
+ * @param data Message.
+ * @param len Length of the message, at most OUTBOX_DATA_MAX.
+ * @return int 0 on success, -1 on failure.
+ * @note Blocks while a full batch is programmed, a few milliseconds per 4 KB, plus a sector erase.
+ */
+int outbox_send(client_t *client, const void *data, uint16_t len);
+
+/**
+ * @brief Replay stored records, trim the acknowledged ones and program a batch that is due.
+ *
+ * On a new connection everything not acknowledged is sent again. Records go out straight from
+ * flash, a run of them in a single write, as fast as the transmit queue takes them.
+ *
+ * @param client Connection to replay on, NULL if there is none.
+ * @return int 0 on success, -1 on failure.
+ */
+int outbox_task(client_t *client);
+
+/**
+ * @brief Program the batch now, e.g. before a planned reset.
+ * @return int 0 on success, -1 on failure.
+ */
+int outbox_flush(void);
+
+/**
+ * @brief Get the number of stored bytes that have not been sent yet.
+ * @return uint32_t Bytes waiting, 0 once new messages can go straight out.
+ */
+uint32_t outbox_backlog(void);
+
+/**
+ * @brief Get the log counters.
+ * @return const outbox_stats_t* The counters.
+ */
+const outbox_stats_t *outbox_stats(void);
+
+#endif /* _OUTBOX_H_ */
@@ -0,0 +1,89 @@
+#ifndef _RESOLVER_H_
+#define _RESOLVER_H_
+/** Includes *************************************************************************************/
+#include "pico/stdlib.h"
+#include "lwip/ip_addr.h"
+/** Defines **************************************************************************************/
+/** Host names that can be cached at once */
+#ifndef RESOLVER_MAX_NAMES
+#define RESOLVER_MAX_NAMES 4
+#endif
+
+/** Longest host name, including the terminator */
+#define RESOLVER_NAME_MAX 64
+
+/** How long an answer counts as fresh */
+#ifndef RESOLVER_TTL_MS
+#define RESOLVER_TTL_MS 300000
+#endif
+
+/** Look a name up again this long before its answer goes stale */
+#ifndef RESOLVER_REFRESH_AHEAD_MS
+#define RESOLVER_REFRESH_AHEAD_MS 30000
+#endif
+
+/** Wait after a failed lookup before trying again */
+#ifndef RESOLVER_RETRY_MS
+#define RESOLVER_RETRY_MS 2000
+#endif
+
+/** Typedefs *************************************************************************************/
+/** Cache counters */
+typedef struct {
+    uint32_t queries;     /** Lookups handed to lwIP */
+    uint32_t answers;     /** Lookups that returned an address */
+    uint32_t failures;    /** Lookups that failed or timed out */
+    uint32_t hits;        /** resolver_get() calls answered with a fresh address */
+    uint32_t stale_hits;  /** resolver_get() calls answered with the last known-good address */
+    uint32_t misses;      /** resolver_get() calls with no address to give yet */
+} resolver_stats_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Add a host name to the cache. It is looked up on the first resolver_refresh().
+ * @param hostname The host name, copied.
+ * @return int Id of the name, the same id if it was already added, -1 on failure.
+ */
+int resolver_add(const char *hostname);
+
+/**
+ * @brief Start a lookup if the name has no answer yet or its answer is about to go stale.
+ *
+ * Never blocks, the answer arrives later through the lwIP DNS callback. Run it regularly
+ * while the network is up, also while connected, so the address is already fresh when it
+ * is needed for a reconnect.
+ *
+ * @param id Id from resolver_add().
+ * @return int 0 on success, -1 on failure.
+ */
+int resolver_refresh(int id);
+
+/**
+ * @brief Get the cached address of a name without waiting for DNS.
+ *
+ * If the answer is stale because the lookups keep failing, the last known-good address is
+ * returned, so a DNS outage does not keep the client off a server that is still up.
+ *
+ * @param id Id from resolver_add().
+ * @param addr Filled in with the address.
+ * @return int 0 if an address was returned, -1 if the name has not been resolved yet.
+ */
+int resolver_get(int id, ip_addr_t *addr);
+
+/**
+ * @brief Get the host name of a cache entry.
+ * @param id Id from resolver_add().
+ * @return const char* The host name, NULL if the id is not in use.
+ */
+const char *resolver_name(int id);
+
+/**
+ * @brief Get the cache counters.
+ * @return const resolver_stats_t* The counters.
+ */
+const resolver_stats_t *resolver_stats(void);
+
+#endif /* _RESOLVER_H_ */
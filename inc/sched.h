@@ -0,0 +1,63 @@
+#ifndef _SCHED_H_
+#define _SCHED_H_
+/** Includes *************************************************************************************/
+#include "pico/stdlib.h"
+/** Defines **************************************************************************************/
+/** Room for every task main() adds with all build options on, and a few spare */
+#ifndef SCHED_MAX_TASKS
+#define SCHED_MAX_TASKS 12
+#endif
+
+/** Typedefs *************************************************************************************/
+/**
+ * @brief A scheduled task.
+ * @param arg User argument given to sched_add().
+ * @return int 0 on success, -1 on failure.
+ */
+typedef int (*sched_fn_t)(void *arg);
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Initialise the scheduler, removing all tasks.
+ * @return int 0 on success, -1 on failure.
+ */
+int sched_init(void);
+
+/**
+ * @brief Add a task.
+ * @param fn Task function.
+ * @param arg User argument passed to fn.
+ * @param period_ms Period in milliseconds. 0 runs the task on every wake-up, that is whenever
+ *                  another task was due or the cyw43 driver signalled work.
+ * @return int Task id on success, -1 if the task table is full.
+ */
+int sched_add(sched_fn_t fn, void *arg, uint32_t period_ms);
+
+/**
+ * @brief Make a task due now. The scheduler does not sleep before running it.
+ * @param id Task id returned by sched_add().
+ * @return int 0 on success, -1 on failure.
+ */
+int sched_wake(int id);
+
+/**
+ * @brief Run all due tasks, then sleep until the next deadline or until the driver has work.
+ *
+ * The core sleeps in __wfe() through cyw43_arch_wait_for_work_until(), which arms a hardware
+ * timer alarm for the next deadline. The driver is serviced with cyw43_arch_poll() on every
+ * wake-up. Call this in a loop.
+ *
+ * @return None.
+ */
+void sched_run(void);
+
+/**
+ * @brief Get the time the core has spent asleep in sched_run(), the rest of the time it was busy.
+ * @return uint64_t Microseconds asleep since sched_init().
+ */
+uint64_t sched_sleep_us(void);
+
+#endif /* _SCHED_H_ */
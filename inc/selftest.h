@@ -0,0 +1,113 @@
+#ifndef _SELFTEST_H_
+#define _SELFTEST_H_
+/** Includes *************************************************************************************/
+#include "pico/stdlib.h"
+#include "lwip/ip_addr.h"
+/** Defines **************************************************************************************/
+/**
+ * Throughput self-test against a stock iperf 2 on the other end, straight on lwIP without the
+ * client in between, so a slow site can be put down to the radio, the lwIP tuning or the client.
+ *
+ *   iperf -s          and selftest_run()   TCP up, then TCP down (iperf's tradeoff, -r)
+ *   iperf -s -u       and selftest_run()   UDP up at SELFTEST_UDP_RATE_BPS, jitter and loss from
+ *                                          the server's report
+ *   iperf -c <pico>   and selftest_serve() TCP down
+ *   iperf -c <pico> -u                     UDP down, jitter and loss measured here
+ *
+ * TCP runs through lwIP's lwiperf, UDP follows iperf 2's datagram and server report formats.
+ * selftest_print() prints a JSON line per finished test with the result, the share of the time
+ * the core was busy and the lwIP settings it ran with:
+ *
+ *   {"test":"tcp_up","profile":"default","status":"ok","bytes":...,"ms":...,"kbps":...,
+ *    "jitter_us":0,"datagrams":0,"lost":0,"out_of_order":0,"cpu":37,
+ *    "lwip":{"tcp_mss":1460,"tcp_wnd":11680,"tcp_snd_buf":11680,"pbuf_pool_size":24}}
+ */
+
+/** iperf's port */
+#define SELFTEST_PORT 5001
+
+/** Name of the lwIP tuning in the results, set it per build to compare profiles */
+#ifndef SELFTEST_PROFILE
+#define SELFTEST_PROFILE "default"
+#endif
+
+/** UDP upload rate and datagram size, iperf's -b and -l */
+#ifndef SELFTEST_UDP_RATE_BPS
+#define SELFTEST_UDP_RATE_BPS 10000000
+#endif
+#ifndef SELFTEST_UDP_LEN
+#define SELFTEST_UDP_LEN 1470
+#endif
+
+/** Length of the UDP upload, lwiperf always runs TCP for iperf's default of 10 s */
+#ifndef SELFTEST_UDP_DURATION_MS
+#define SELFTEST_UDP_DURATION_MS 10000
+#endif
+
+/** Longest a test may take before it is given up, the TCP one is two tests back to back */
+#ifndef SELFTEST_TIMEOUT_MS
+#define SELFTEST_TIMEOUT_MS 30000
+#endif
+
+/** Results kept for selftest_results() */
+#define SELFTEST_RESULTS_MAX 8
+
+/** Typedefs *************************************************************************************/
+typedef struct {
+    const char *test;       /** tcp_up, tcp_down, udp_up or udp_down */
+    int status;             /** 0 if the test ran to the end, -1 if it was aborted or got no report */
+    uint64_t bytes;
+    uint32_t ms;
+    uint32_t kbps;
+    uint32_t jitter_us;     /** UDP only, RFC 1889 interarrival jitter as iperf works it out */
+    uint32_t datagrams;     /** UDP only */
+    uint32_t lost;          /** UDP only */
+    uint32_t out_of_order;  /** UDP only */
+    uint8_t cpu;            /** Percentage of the test the core was not asleep */
+} selftest_result_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Listen for iperf clients, TCP and UDP on SELFTEST_PORT.
+ * @param local Address to listen on, NULL for any.
+ * @return int 0 on success, -1 on failure.
+ * @note A server on any address is stopped while selftest_run() runs, the tradeoff test needs
+ *       the port on the station's own address.
+ */
+int selftest_serve(const ip_addr_t *local);
+
+/**
+ * @brief Run the tests against an iperf server, TCP up and down, then UDP up.
+ *
+ * Returns straight away, the tests run from lwIP's callbacks and timers and keep their
+ * results for selftest_print() as they finish.
+ *
+ * @param server Address of the iperf server, dotted decimal.
+ * @return int 0 on success, -1 if a run is in progress or the address is not valid.
+ */
+int selftest_run(const char *server);
+
+/**
+ * @brief Check whether selftest_run() is still running.
+ * @return bool true until the last test has finished.
+ */
+bool selftest_busy(void);
+
+/**
+ * @brief Get the results of the tests finished so far, oldest first.
+ * @param count Number of results.
+ * @return const selftest_result_t* The results, the oldest are dropped after SELFTEST_RESULTS_MAX.
+ */
+const selftest_result_t *selftest_results(uint32_t *count);
+
+/**
+ * @brief Print the results finished since the last call as JSON lines.
+ * @return int Number of results printed.
+ * @note Call it from a task, not from lwIP's callbacks, printing can block on the console.
+ */
+int selftest_print(void);
+
+#endif /* _SELFTEST_H_ */
@@ -0,0 +1,87 @@
+#ifndef _SPSC_H_
+#define _SPSC_H_
+/** Includes *************************************************************************************/
+#include <stdint.h>
+#include <stdbool.h>
+/** Defines **************************************************************************************/
+/** Size of the length header stored in front of every message */
+#define SPSC_HEADER_SIZE 2
+
+/** Typedefs *************************************************************************************/
+/**
+ * @brief Lock-free single-producer/single-consumer ring of length-prefixed messages.
+ *
+ * One core pushes and the other pops. The producer only writes head and the consumer only
+ * writes tail, so no lock is needed, the indices are published with release/acquire ordering.
+ * Both indices run freely and are masked on access, the buffer size must be a power of two.
+ */
+typedef struct {
+    uint8_t *buf;
+    uint32_t size;
+    uint32_t mask;
+    volatile uint32_t head;  /** Written by the producer only */
+    volatile uint32_t tail;  /** Written by the consumer only */
+} spsc_ring_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Initialise a ring over a caller supplied buffer.
+ * @param ring Pointer to the ring.
+ * @param buf Backing storage.
+ * @param size Size of the backing storage, must be a power of two.
+ * @return int 0 on success, -1 on failure.
+ */
+int spsc_init(spsc_ring_t *ring, uint8_t *buf, uint32_t size);
+
+/**
+ * @brief Push a message. Producer side only.
+ * @param ring Pointer to the ring.
+ * @param data Message data.
+ * @param len Message length, must not be 0.
+ * @return int 0 on success, -1 if there is not enough free space.
+ */
+int spsc_push(spsc_ring_t *ring, const void *data, uint16_t len);
+
+/**
+ * @brief Copy the oldest message out without removing it. Consumer side only.
+ * @param ring Pointer to the ring.
+ * @param buf Destination buffer.
+ * @param max Size of the destination buffer.
+ * @return int Length of the message, 0 if the ring is empty, -1 if the message does not fit in buf.
+ */
+int spsc_peek(spsc_ring_t *ring, void *buf, uint16_t max);
+
+/**
+ * @brief Remove the oldest message. Consumer side only.
+ * @param ring Pointer to the ring.
+ * @return None.
+ */
+void spsc_drop(spsc_ring_t *ring);
+
+/**
+ * @brief Copy the oldest message out and remove it. Consumer side only.
+ * @param ring Pointer to the ring.
+ * @param buf Destination buffer.
+ * @param max Size of the destination buffer.
+ * @return int Length of the message, 0 if the ring is empty, -1 if the message does not fit in buf.
+ */
+int spsc_pop(spsc_ring_t *ring, void *buf, uint16_t max);
+
+/**
+ * @brief Get the number of bytes that can still be pushed, including message headers.
+ * @param ring Pointer to the ring.
+ * @return uint32_t Free space in bytes.
+ */
+uint32_t spsc_free(const spsc_ring_t *ring);
+
+/**
+ * @brief Check if the ring holds no messages.
+ * @param ring Pointer to the ring.
+ * @return bool true if empty.
+ */
+bool spsc_empty(const spsc_ring_t *ring);
+
+#endif /* _SPSC_H_ */
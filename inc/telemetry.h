@@ -0,0 +1,144 @@
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+/** Includes *************************************************************************************/
+#include "pico/stdlib.h"
+#include "client.h"
+#include "frame.h"
+/** Defines **************************************************************************************/
+/**
+ * Telemetry goes out as frames of two types:
+ *
+ *   hello  | version (1) | codecs (1) | channels (1) |
+ *   data   | codecs (1) | samples (varint) | plain length (varint, only with LZ) | body |
+ *
+ * The client sends a hello with the codecs it offers on every new connection, and the server
+ * answers with a hello carrying the ones it accepts. Until then blocks go out plain. The codecs
+ * byte of a data block says how its body is encoded:
+ *
+ *   plain   every value as a 32 bit little endian integer, sample by sample
+ *   DELTA   every value as the zig-zag varint of its difference from the same channel in the
+ *           previous sample, the first sample of a connection from 0
+ *   LZ      the plain or DELTA bytes compressed with LZSS, see below
+ *   KEY     the block does not depend on earlier blocks, set on every block over UDP
+ *
+ * The LZSS bit stream is most significant bit first: 1 and 8 bits for a literal, 0, 8 bits of
+ * distance - 1 and 4 bits of length - 2 for a copy from up to 256 bytes back. The window carries
+ * over from block to block of a connection, so repeats of earlier blocks compress as well.
+ */
+
+/** Frame types, distinct from the application's own */
+#ifndef TELEMETRY_FRAME_HELLO
+#define TELEMETRY_FRAME_HELLO 2
+#endif
+#ifndef TELEMETRY_FRAME_DATA
+#define TELEMETRY_FRAME_DATA 3
+#endif
+
+#define TELEMETRY_VERSION 1
+
+/** Values per sample */
+#ifndef TELEMETRY_MAX_CHANNELS
+#define TELEMETRY_MAX_CHANNELS 8
+#endif
+
+/** Largest block before compression, a sample takes up to 5 bytes per channel with DELTA */
+#ifndef TELEMETRY_BLOCK_MAX
+#define TELEMETRY_BLOCK_MAX 512
+#endif
+
+/** LZSS window and match lengths, part of the wire format */
+#define TELEMETRY_LZ_WINDOW 256
+#define TELEMETRY_LZ_MIN_MATCH 2
+#define TELEMETRY_LZ_MAX_MATCH 17
+
+/** Data block header, codecs, sample count and plain length */
+#define TELEMETRY_HEADER_MAX 7
+
+/** Hash table of the match finder, a power of two */
+#ifndef TELEMETRY_LZ_HASH_SIZE
+#define TELEMETRY_LZ_HASH_SIZE 256
+#endif
+
+/** Candidates the match finder tries per position, more compresses better but costs cycles */
+#ifndef TELEMETRY_LZ_CHAIN_MAX
+#define TELEMETRY_LZ_CHAIN_MAX 16
+#endif
+
+_Static_assert(TELEMETRY_HEADER_MAX + TELEMETRY_BLOCK_MAX <= FRAME_MAX_PAYLOAD, "block does not fit a frame");
+
+/** Typedefs *************************************************************************************/
+typedef enum {
+    TELEMETRY_CODEC_DELTA = 0x01,  /** Zig-zag varint deltas between successive samples */
+    TELEMETRY_CODEC_LZ = 0x02,     /** LZSS with a window kept across the blocks of a connection */
+    TELEMETRY_CODEC_KEY = 0x80,    /** Data blocks only, the block starts from empty history */
+} telemetry_codec_t;
+
+/** Encoder counters, wire_bytes / raw_bytes is the compression ratio */
+typedef struct {
+    uint64_t samples;       /** Samples sent */
+    uint64_t raw_bytes;     /** Size of the sent samples as plain 32 bit values */
+    uint64_t wire_bytes;    /** Size of the data frame payloads that carried them */
+    uint64_t encode_ticks;  /** Time spent encoding, in trace_stamp() ticks, CPU cycles on the RP2350 */
+    uint32_t blocks;        /** Data blocks sent */
+    uint32_t lz_skipped;    /** Blocks sent without LZ because compression did not make them smaller */
+    uint32_t negotiated;    /** Connections the server answered the hello on */
+} telemetry_stats_t;
+
+/** Compressor state, fixed size, no allocation */
+typedef struct {
+    uint8_t buf[TELEMETRY_LZ_WINDOW + TELEMETRY_BLOCK_MAX];  /** Window, then the block being compressed */
+    uint16_t head[TELEMETRY_LZ_HASH_SIZE];                   /** Newest position of every hash, or none */
+    uint16_t prev[TELEMETRY_LZ_WINDOW + TELEMETRY_BLOCK_MAX]; /** Previous position with the same hash */
+    uint16_t history;                                        /** Window bytes at the start of buf */
+} telemetry_lz_t;
+
+typedef struct {
+    uint8_t channels;
+    uint8_t offered;                          /** Codecs this end supports */
+    uint8_t codecs;                           /** Codecs agreed for the current connection */
+    bool hello_sent;
+    const client_t *client;                   /** Connection the state below belongs to */
+    uint32_t connection;                      /** connect_successes of that client when it was set up */
+    int32_t last[TELEMETRY_MAX_CHANNELS];     /** Previous sample, DELTA starts from it */
+    telemetry_lz_t lz;
+    uint8_t out[TELEMETRY_HEADER_MAX + TELEMETRY_BLOCK_MAX];
+    telemetry_stats_t stats;
+} telemetry_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Initialise an encoder and register its hello handler.
+ * @param telemetry Pointer to the encoder.
+ * @param decoder Decoder of the connection the answers arrive on.
+ * @param channels Values per sample, at most TELEMETRY_MAX_CHANNELS.
+ * @param codecs Codecs to offer, TELEMETRY_CODEC_DELTA and TELEMETRY_CODEC_LZ, 0 for plain only.
+ * @return int 0 on success, -1 on failure.
+ */
+int telemetry_init(telemetry_t *telemetry, frame_decoder_t *decoder, uint8_t channels, uint8_t codecs);
+
+/**
+ * @brief Encode a block of samples and queue it as one data frame.
+ *
+ * A new connection, or a different client, restarts the encoder and sends the hello first.
+ * The encoder state only moves on once the frame is queued, so a block refused for lack of
+ * queue space can be sent again or dropped without breaking the stream.
+ *
+ * @param telemetry Pointer to the encoder.
+ * @param client Connection to send on.
+ * @param samples count * channels values, sample by sample.
+ * @param count Number of samples.
+ * @return int 0 on success, -1 if not connected, the queue is full or the block is too large.
+ */
+int telemetry_send(telemetry_t *telemetry, client_t *client, const int32_t *samples, uint16_t count);
+
+/**
+ * @brief Log the compression ratio and the encoding cost per KB of samples.
+ * @param telemetry Pointer to the encoder.
+ * @return None.
+ */
+void telemetry_report(const telemetry_t *telemetry);
+
+#endif /* _TELEMETRY_H_ */
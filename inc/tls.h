@@ -0,0 +1,75 @@
+#ifndef _TLS_H_
+#define _TLS_H_
+/** Includes *************************************************************************************/
+#include "pico/stdlib.h"
+#include "lwip/altcp.h"
+/** Defines **************************************************************************************/
+/** Sessions kept for resumption at once, one per client that has used TLS */
+#ifndef TLS_MAX_SESSIONS
+#define TLS_MAX_SESSIONS 4
+#endif
+
+/** Typedefs *************************************************************************************/
+/** Handshake counters, resumed / offered is the resumption hit rate */
+typedef struct {
+    uint32_t handshakes;         /** Handshakes completed */
+    uint32_t offered;            /** Completed handshakes that offered a saved session */
+    uint32_t resumed;            /** Completed handshakes the server resumed the session on */
+    uint32_t failures;           /** Connections that failed before the handshake completed */
+    uint32_t last_handshake_ms;  /** Time from connecting to the handshake completing */
+    uint64_t total_full_ms;      /** Sum of the full handshake times */
+    uint64_t total_resumed_ms;   /** Sum of the resumed handshake times */
+} tls_stats_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Take a session slot, the client keeps it for all of its connections.
+ * @return int Id of the slot, -1 if they are all taken or TLS is not built in.
+ */
+int tls_session_add(void);
+
+/**
+ * @brief Create a TLS pcb for a new connection and offer the saved session of a slot.
+ *
+ * The client configuration is created on the first call. The server certificate is checked
+ * against TLS_CA_CERT if the build has one, see tls.c.
+ *
+ * @param id Slot from tls_session_add(), -1 to connect without resumption.
+ * @param ip_type IPADDR_TYPE_V4 or IPADDR_TYPE_V6.
+ * @param hostname Server name for SNI and the certificate check, NULL for none.
+ * @return struct altcp_pcb* The pcb, NULL on failure.
+ */
+struct altcp_pcb *tls_new(int id, u8_t ip_type, const char *hostname);
+
+/**
+ * @brief Record a completed handshake and save its session for the next connection.
+ *
+ * A resumption is recognised by the master secret, which the resumed session keeps and a full
+ * handshake always replaces, so it works the same for session tickets and session ids.
+ *
+ * @param id Slot the pcb was created with.
+ * @param pcb The connected pcb.
+ * @return int 1 if the server resumed the offered session, 0 after a full handshake, -1 if the
+ *         server certificate did not verify against TLS_CA_CERT and the pcb must be closed.
+ */
+int tls_connected(int id, struct altcp_pcb *pcb);
+
+/**
+ * @brief Record a connection that failed before the handshake completed.
+ * @param id Slot the pcb was created with.
+ * @return None.
+ * @note The saved session is dropped after a few failures in a row that offered it, so a session
+ *       the server rejects is not offered forever.
+ */
+void tls_failed(int id);
+
+/**
+ * @brief Get the handshake counters.
+ * @return const tls_stats_t* The counters.
+ */
+const tls_stats_t *tls_stats(void);
+
+#endif /* _TLS_H_ */
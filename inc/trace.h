@@ -0,0 +1,105 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+/** Includes *************************************************************************************/
+#include "pico/stdlib.h"
+/** Defines **************************************************************************************/
+/** Build with -DPICO_CLIENT_TRACE=1 to compile the trace points in */
+#ifndef PICO_CLIENT_TRACE
+#define PICO_CLIENT_TRACE 0
+#endif
+
+/** Events kept per core, the oldest are overwritten, must be a power of two */
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE 1024
+#endif
+
+/** Cores that can record events */
+#define TRACE_NUM_CORES 2
+
+/** Typedefs *************************************************************************************/
+/** Trace points, the numbers are part of the dump format read by tools/trace_decode.py */
+typedef enum {
+    TRACE_RX_QUEUED = 1,      /** _client_recv() queued a pbuf chain, arg is its length */
+    TRACE_RX_CONSUMED = 2,    /** Application consumed received data, arg is the length */
+    TRACE_CONNECT_START = 3,  /** _client_open() sent a SYN */
+    TRACE_CONNECTED = 4,      /** _client_connected() ran */
+    TRACE_DISCONNECTED = 5,   /** Connection lost or attempt failed */
+    TRACE_TX_OUTPUT = 6,      /** tcp_output() after writes, arg is the bytes written in the pass */
+    TRACE_TX_ACKED = 7,       /** _client_sent(), arg is the bytes acked */
+    TRACE_WIFI_STATE = 8,     /** wifi_task() changed state, arg is the new WifiTaskState_t */
+    TRACE_SCHED_SLEEP = 9,    /** Scheduler going to sleep */
+    TRACE_SCHED_WAKE = 10,    /** Scheduler woke up */
+    TRACE_FRAME = 11,         /** Frame dispatched to its handler, arg is the type */
+    TRACE_PING = 12,          /** Heartbeat ping queued, arg is the low half of its seq */
+    TRACE_PONG = 13,          /** Heartbeat pong received, arg is the low half of its seq */
+} trace_event_t;
+
+/** A recorded event, 8 bytes */
+typedef struct {
+    uint32_t stamp;   /** Cycle counter, or microseconds where there is none */
+    uint16_t event;
+    uint16_t arg;
+} trace_record_t;
+
+/**
+ * @brief Per-core event ring.
+ *
+ * Only the owning core writes, so recording is a store and an index increment with no lock.
+ * The ring is a flight recorder, once full the oldest events are overwritten. Each core counts
+ * its own cycles, so stages are only timed between events of the same core, which is where
+ * the client and wifi code both run.
+ */
+typedef struct {
+    trace_record_t records[TRACE_RING_SIZE];
+    uint32_t head;           /** Events recorded so far, the next index once masked */
+} trace_ring_t;
+
+/** Variables ************************************************************************************/
+extern trace_ring_t TraceRings[TRACE_NUM_CORES];
+
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Start the timestamp source on the calling core. Call once on every core that traces.
+ * @return int 0 on success, -1 on failure.
+ */
+int trace_init(void);
+
+/**
+ * @brief Read the timestamp source of the calling core.
+ * @return uint32_t Cycles on the Cortex-M33, microseconds elsewhere.
+ */
+uint32_t trace_stamp(void);
+
+/**
+ * @brief Print the rings of both cores, for tools/trace_decode.py.
+ * @return None.
+ */
+void trace_dump(void);
+
+/**
+ * @brief Record an event on the calling core.
+ * @param event Event from trace_event_t.
+ * @param arg Event argument.
+ * @return None.
+ */
+static inline void trace_record(uint16_t event, uint16_t arg)
+{
+    trace_ring_t *ring = &TraceRings[get_core_num()];
+    trace_record_t *record = &ring->records[ring->head & (TRACE_RING_SIZE - 1)];
+
+    record->stamp = trace_stamp();
+    record->event = event;
+    record->arg = arg;
+    ring->head++;
+}
+
+#if PICO_CLIENT_TRACE
+#define TRACE(event, arg) trace_record((event), (uint16_t)(arg))
+#else
+/** Not evaluated, only referenced so locals kept for the trace do not warn */
+#define TRACE(event, arg) ((void)sizeof((event) + (arg)))
+#endif
+
+#endif /* _TRACE_H_ */
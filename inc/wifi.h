@@ -4,6 +4,72 @@
 #include "pico/stdlib.h"
 #include "pico/cyw43_arch.h"
 /** Defines **************************************************************************************/
+/** How often wifi_task() should be run */
+#define WIFI_TASK_INTERVAL_MS 100
+
+/** Security of the network, the mode that worked is cached with the access point */
+#ifndef WIFI_AUTH
+#define WIFI_AUTH CYW43_AUTH_WPA2_AES_PSK
+#endif
+
+/** Give up on the cached access point after this long and scan instead */
+#ifndef WIFI_FAST_JOIN_TIMEOUT_MS
+#define WIFI_FAST_JOIN_TIMEOUT_MS 1500
+#endif
+
+/**
+ * Roaming between access points of the same network while connected. The signal and the share
+ * of frames that fail after all retries are sampled every WIFI_ROAM_SAMPLE_MS. The network is
+ * scanned every WIFI_ROAM_SCAN_INTERVAL_MS, or every WIFI_ROAM_SCAN_WEAK_MS once the link is
+ * weak, and a weak link moves to an access point that is WIFI_ROAM_HYSTERESIS_DB stronger.
+ * The state stays WIFI_TASK_CONNECTED through a roam, so the connections are kept.
+ */
+
+/** Scan for a better access point this often while connected, 0 to not roam */
+#ifndef WIFI_ROAM_SCAN_INTERVAL_MS
+#define WIFI_ROAM_SCAN_INTERVAL_MS 60000
+#endif
+
+/** Scan this often while the link is weak */
+#ifndef WIFI_ROAM_SCAN_WEAK_MS
+#define WIFI_ROAM_SCAN_WEAK_MS 5000
+#endif
+
+/** Sample the signal and the frame counters this often */
+#ifndef WIFI_ROAM_SAMPLE_MS
+#define WIFI_ROAM_SAMPLE_MS 1000
+#endif
+
+/** The link is weak below this smoothed signal, in dBm */
+#ifndef WIFI_ROAM_RSSI_WEAK
+#define WIFI_ROAM_RSSI_WEAK -70
+#endif
+
+/** The link is also weak when this percentage of the frames sent fail after all retries */
+#ifndef WIFI_ROAM_TX_FAIL_PERCENT
+#define WIFI_ROAM_TX_FAIL_PERCENT 10
+#endif
+
+/** Frames needed before the failure percentage is worked out */
+#ifndef WIFI_ROAM_TX_FRAMES
+#define WIFI_ROAM_TX_FRAMES 50
+#endif
+
+/** A candidate must be this much stronger than the current access point, in dB */
+#ifndef WIFI_ROAM_HYSTERESIS_DB
+#define WIFI_ROAM_HYSTERESIS_DB 8
+#endif
+
+/** Stay on an access point at least this long before roaming again */
+#ifndef WIFI_ROAM_HOLD_MS
+#define WIFI_ROAM_HOLD_MS 15000
+#endif
+
+/** Give up on a roam after this long and reconnect from scratch */
+#ifndef WIFI_ROAM_TIMEOUT_MS
+#define WIFI_ROAM_TIMEOUT_MS 3000
+#endif
+
 typedef enum
 {
     WIFI_TASK_DISCONNECTED = 0,
@@ -12,6 +78,25 @@ typedef enum
 } WifiTaskState_t;
 
 /** Typedefs *************************************************************************************/
+/** Join counters */
+typedef struct {
+    uint32_t fast_joins;          /** Joins to the cached access point without a scan */
+    uint32_t scan_joins;          /** Joins that needed a scan */
+    uint32_t fast_join_failures;  /** Cached access point did not answer, fell back to a scan */
+    uint32_t last_join_ms;        /** Time from starting the last successful join to link up */
+    uint32_t lease_requests;      /** Joins that asked for the cached DHCP lease */
+    uint32_t leases_reused;       /** Joins that got the same address as the last time */
+    int32_t rssi;                 /** Smoothed signal of the current access point, in dBm */
+    uint32_t tx_fail_percent;     /** Frames that failed after all retries, over the last WIFI_ROAM_TX_FRAMES */
+    uint32_t scans;               /** Background scans while connected */
+    uint32_t roams;               /** Moves to another access point of the network */
+    uint32_t roam_failures;       /** Roams given up on, followed by a full reconnect */
+    uint32_t roam_address_changes; /** Roams after which the address changed, the connections were reset */
+    uint32_t last_roam_ms;        /** Time from the roam join to link up on the new access point */
+    uint32_t max_roam_ms;         /** Longest roam */
+    uint64_t total_roam_ms;       /** Sum of the roam times, divide by roams for the mean */
+} wifi_stats_t;
+
 /** Variables ************************************************************************************/
 /** Prototypes ***********************************************************************************/
 /** Functions ************************************************************************************/
@@ -29,7 +114,8 @@ int wifi_init(const char *ssid, const char *password);
  * @brief The wifi task is used to handle the wifi connection.
  *
  * The wifi task is used to handle the wifi connection. Connecting and reconnecting
- * as needed. It should be called in a loop to ensure that the wifi connection is maintained.
+ * as needed. It should be run every WIFI_TASK_INTERVAL_MS to ensure that the wifi connection
+ * is maintained, timeouts are tracked against absolute deadlines so late runs are harmless.
  *
  * @return int 0 on success, -1 on failure
  *
@@ -46,4 +132,10 @@ int wifi_task(void);
  */
 WifiTaskState_t wifi_get_state(void);
 
+/**
+ * @brief Get the join and roam counters, and the link quality.
+ * @return const wifi_stats_t* The counters.
+ */
+const wifi_stats_t *wifi_stats(void);
+
 #endif /* _WIFI_H_ */
\ No newline at end of file
@@ -0,0 +1,94 @@
+#ifndef _WIFI_PM_H_
+#define _WIFI_PM_H_
+/** Includes *************************************************************************************/
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+/** Defines **************************************************************************************/
+/** Radio power management while traffic is flowing, stays awake for 20 ms after each packet */
+#ifndef WIFI_PM_PERFORMANCE
+#define WIFI_PM_PERFORMANCE CYW43_PERFORMANCE_PM
+#endif
+
+/** Radio power management while the link is idle, dozes straight after each packet */
+#ifndef WIFI_PM_POWERSAVE
+#define WIFI_PM_POWERSAVE cyw43_pm_value(CYW43_PM1_POWERSAVE_MODE, 10, 1, 1, 10)
+#endif
+
+/** Switch to performance once traffic reaches this many bytes per second */
+#ifndef WIFI_PM_BUSY_BPS
+#define WIFI_PM_BUSY_BPS 2048
+#endif
+
+/** Traffic below this many bytes per second counts as idle */
+#ifndef WIFI_PM_IDLE_BPS
+#define WIFI_PM_IDLE_BPS 256
+#endif
+
+/** Go back to power save after the link has been idle this long */
+#ifndef WIFI_PM_IDLE_HOLD_MS
+#define WIFI_PM_IDLE_HOLD_MS 3000
+#endif
+
+/** Typedefs *************************************************************************************/
+typedef enum {
+    WIFI_PM_MODE_DOWN = 0,     /** Wi-Fi not connected, the driver picks the mode on the next join */
+    WIFI_PM_MODE_POWERSAVE,
+    WIFI_PM_MODE_PERFORMANCE,
+} wifi_pm_mode_t;
+
+/** Policy counters */
+typedef struct {
+    uint64_t down_ms;          /** Time spent without Wi-Fi */
+    uint64_t powersave_ms;     /** Time spent in WIFI_PM_POWERSAVE */
+    uint64_t performance_ms;   /** Time spent in WIFI_PM_PERFORMANCE */
+    uint32_t to_performance;   /** Switches to performance */
+    uint32_t to_powersave;     /** Switches to power save */
+    uint32_t failures;         /** Mode changes the driver refused */
+} wifi_pm_stats_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+/**
+ * @brief Clear the sample and accounting times, wifi_init() does this before the first update.
+ * @return None.
+ * @note The enabled setting is kept, so wifi_pm_set_enabled() may be called before wifi_init().
+ */
+void wifi_pm_init(void);
+
+/**
+ * @brief Pick the radio power mode from the client traffic.
+ *
+ * Run it after every wifi_task(). Traffic at WIFI_PM_BUSY_BPS or more, or any data waiting for
+ * an ack, switches to performance straight away, so a burst is not held up by the radio dozing
+ * between beacons. Power save comes back only once the traffic has stayed under
+ * WIFI_PM_IDLE_BPS for WIFI_PM_IDLE_HOLD_MS, so a request/response exchange with short pauses
+ * does not flip the mode on every message.
+ *
+ * @param bytes Bytes sent and received so far, a running total.
+ * @param pending Bytes written and not acked yet.
+ * @return int 0 on success, -1 if the driver refused a mode change.
+ */
+int wifi_pm_update(uint64_t bytes, uint32_t pending);
+
+/**
+ * @brief Turn the policy on or off. Off leaves the driver's default power management in place.
+ * @param enabled true to adapt the power mode to the traffic.
+ * @return None.
+ */
+void wifi_pm_set_enabled(bool enabled);
+
+/**
+ * @brief Get the mode the radio is in.
+ * @return wifi_pm_mode_t The mode.
+ */
+wifi_pm_mode_t wifi_pm_mode(void);
+
+/**
+ * @brief Get the policy counters, with the time in the current mode added up to now.
+ * @return const wifi_pm_stats_t* The counters.
+ */
+const wifi_pm_stats_t *wifi_pm_stats(void);
+
+#endif /* _WIFI_PM_H_ */
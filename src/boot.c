@@ -0,0 +1,62 @@
+/** Includes *************************************************************************************/
+#include "boot.h"
+#include "log.h"
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+typedef struct
+{
+    uint64_t at_us[BOOT_PHASE_COUNT];   /** Time each phase was reached, 0 if not yet */
+} Boot_t;
+
+/** Variables ************************************************************************************/
+static Boot_t Boot = {0};
+
+static const char *const BootPhaseNames[BOOT_PHASE_COUNT] = {
+    [BOOT_PHASE_STDIO] = "stdio",
+    [BOOT_PHASE_WIFI_INIT] = "wifi_init",
+    [BOOT_PHASE_CONSOLE] = "console",
+    [BOOT_PHASE_WIFI_JOINED] = "wifi_joined",
+    [BOOT_PHASE_WIFI_UP] = "wifi_up",
+    [BOOT_PHASE_CONNECTED] = "connected",
+};
+
+/** Prototypes ***********************************************************************************/
+/** Private Function Prototypes ******************************************************************/
+/** Function Definitions *************************************************************************/
+void boot_mark(boot_phase_t phase)
+{
+    if (phase >= BOOT_PHASE_COUNT || Boot.at_us[phase] != 0)
+    {
+        return;
+    }
+
+    /** Never 0, that means not reached */
+    uint64_t now = time_us_64();
+    Boot.at_us[phase] = now != 0 ? now : 1;
+
+    if (phase == BOOT_PHASE_CONNECTED)
+    {
+        boot_report();
+    }
+}
+
+uint32_t boot_time_ms(boot_phase_t phase)
+{
+    if (phase >= BOOT_PHASE_COUNT)
+    {
+        return 0;
+    }
+
+    return (uint32_t)(Boot.at_us[phase] / 1000);
+}
+
+void boot_report(void)
+{
+    for (int phase = 0; phase < BOOT_PHASE_COUNT; phase++)
+    {
+        if (Boot.at_us[phase] != 0)
+        {
+            LOG_INFO("Boot %s at %lu ms\n", BootPhaseNames[phase], (unsigned long)boot_time_ms(phase));
+        }
+    }
+}
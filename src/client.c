@@ -1,25 +1,57 @@
 /** Includes *************************************************************************************/
+#include "pico/rand.h"
+#include "lwip/timeouts.h"
 #include "client.h"
+#include "trace.h"
+#include "log.h"
+#include "resolver.h"
+#include "boot.h"
+#include "tls.h"
 /** Defines **************************************************************************************/
-#define SERVER_PORT 4242
 #define CLIENT_POLL_TIME_S 10
-#define CLIENT_TASK_TIMEOUT_MS 100
 #define CLIENT_CONNECT_TIMEOUT_MS 4000
 
 /** Typedefs *************************************************************************************/
 /** Variables ************************************************************************************/
+/** Staging buffers, shared so idle and standby clients do not each hold MSS-sized buffers */
+MEMPOOL_DEFINE(TxStagePool, CLIENT_TX_STAGE_SIZE, CLIENT_TX_STAGE_POOL_BLOCKS);
 /** Prototypes ***********************************************************************************/
 int _client_ip_string_to_ip_addr(const char *ip_str, ip_addr_t *ip_addr);
 /** Private Function Prototypes ******************************************************************/
 static int _client_open(client_t *client);
-static err_t _client_poll(void *arg, struct tcp_pcb *tpcb);
-static err_t _client_sent(void *arg, struct tcp_pcb *tpcb, u16_t len);
-static err_t _client_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err);
+static err_t _client_poll(void *arg, struct altcp_pcb *tpcb);
+static err_t _client_sent(void *arg, struct altcp_pcb *tpcb, u16_t len);
+static err_t _client_recv(void *arg, struct altcp_pcb *tpcb, struct pbuf *p, err_t err);
 static void _client_err(void *arg, err_t err);
-static err_t _client_connected(void *arg, struct tcp_pcb *tpcb, err_t err);
+static err_t _client_connected(void *arg, struct altcp_pcb *tpcb, err_t err);
+static void _client_rx_flush(client_t *client);
+static void _client_rx_update_window(client_t *client);
+static bool _client_close(client_t *client);
+static int _client_tx_stage_alloc(client_t *client);
+static void _client_tx_stage_free(client_t *client, int stage);
+static client_tx_desc_t *_client_tx_push(client_t *client, const uint8_t *data, uint16_t len, int8_t stage);
+static void _client_tx_drain(client_t *client, bool force);
+static void _client_tx_reset(client_t *client, err_t err);
+static uint32_t _client_tx_ref_pending(const client_t *client);
+static void _client_disconnected(client_t *client);
+static void _client_rtt_sample(client_t *client);
+static int _client_rx_push(client_t *client, struct pbuf *p);
+static int _client_udp_open(client_t *client);
+static int _client_udp_writev(client_t *client, const client_segment_t *segs, int count, uint32_t len);
+static int _client_udp_write_ref(client_t *client, const void *data, uint16_t len, client_tx_done_cb_t done, void *arg);
+static err_t _client_udp_output(client_t *client, struct pbuf *p, uint16_t len);
+static void _client_udp_send(client_t *client);
+static void _client_udp_batch_timeout(void *arg);
+static void _client_udp_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port);
+static bool _client_udp_sequence(client_t *client, uint32_t seq);
 
 /** Function Definitions *************************************************************************/
 int client_init(client_t *client, const char *ip_address)
+{
+    return client_init_endpoint(client, ip_address, CLIENT_SERVER_PORT);
+}
+
+int client_init_endpoint(client_t *client, const char *ip_address, uint16_t port)
 {
     // Perform initialisation
     if (client == NULL)
@@ -27,66 +59,143 @@ int client_init(client_t *client, const char *ip_address)
         return -1;
     }
 
+    if (TxStagePool.name == NULL)
+    {
+        mempool_init(&TxStagePool, "client tx stage");
+    }
+
     /** Initialise the client structure to empty */
     memset(client, 0, sizeof(client_t));
 
-    /** Initialise client with the server ip address */
-    _client_ip_string_to_ip_addr(ip_address, &client->remote_addr);
+    /** Initialise client with the server ip address, anything that is not an address is a host name */
+    client->resolver_id = -1;
+    client->tls_id = -1;
+    if (_client_ip_string_to_ip_addr(ip_address, &client->remote_addr) != 0)
+    {
+        client->resolver_id = (int8_t)resolver_add(ip_address);
+        if (client->resolver_id < 0)
+        {
+            return -1;
+        }
+    }
+    client->remote_port = port;
 
     /** Initialise the client state */
+    client->transport = CLIENT_TRANSPORT_DEFAULT;
     client->state = CLIENT_DISCONNECTED;
+    client->tx_stage_open = -1;
+    client->connect_retry_at = get_absolute_time();
+    client->down_since = get_absolute_time();
 
     return 0;
 }
 
-int client_task(client_t *client)
+int client_set_transport(client_t *client, client_transport_t transport)
+{
+    if (client == NULL || (transport != CLIENT_TRANSPORT_TCP && transport != CLIENT_TRANSPORT_UDP &&
+                           (transport != CLIENT_TRANSPORT_TLS || !LWIP_ALTCP_TLS)))
+    {
+        return -1;
+    }
+
+    if (client->transport == transport)
+    {
+        return 0;
+    }
+
+    if (client->state == CLIENT_CONNECTED || client->connecting)
+    {
+        client_close(client);
+    }
+
+    client->transport = transport;
+
+    /** Not a failure, connect over the new transport straight away */
+    return client_reconnect_reset(client);
+}
+
+int client_set_udp_batch(client_t *client, uint32_t max_delay_ms)
+{
+    if (client == NULL)
+    {
+        return -1;
+    }
+
+    client->udp_batch_ms = max_delay_ms;
+
+    return 0;
+}
+
+int client_reconnect_reset(client_t *client)
 {
     if (client == NULL)
     {
         return -1;
     }
-    /** Check if it is time to run the client task */
-    static uint32_t timeLastRunMs = 0;
-    uint32_t currentTimeMs = to_ms_since_boot(get_absolute_time());
-    /** time passed */
 
-    // clang-format off
-    uint32_t timePassedMs = currentTimeMs < timeLastRunMs
-                                ? UINT32_MAX - timeLastRunMs + currentTimeMs
-                                : currentTimeMs - timeLastRunMs;
-    // clang-format on
+    client->reconnect_delay_ms = 0;
+    client->connect_retry_at = get_absolute_time();
+
+    return 0;
+}
 
-    if (timePassedMs < CLIENT_TASK_TIMEOUT_MS)
+int client_task(client_t *client)
+{
+    if (client == NULL)
     {
-        return 0;
+        return -1;
     }
-    
-    /** Update the last run time and catch the roll-over */
-    timeLastRunMs = currentTimeMs;
 
     /** poll the cwy43 arch to process any incoming data */
-    // cyw43_arch_poll(); already ran in wifi_task
+    // cyw43_arch_poll(); already ran by the scheduler
+
+    if (client->resolver_id >= 0)
+    {
+        /** Keep the server address fresh in the background, also while connected */
+        resolver_refresh(client->resolver_id);
+    }
 
     /** Run the state machine */
     switch (client->state)
     {
     case CLIENT_DISCONNECTED:
-        static int timeoutMs = 0;
+        if (client->connecting)
+        {
+            if (!time_reached(client->connect_deadline))
+            {
+                return 0;
+            }
+
+            /** No answer from the server, give up on this attempt */
+            LOG_WARN("Connection attempt timed out\n");
+            _client_close(client);
+            _client_disconnected(client);
+        }
+
+        if (!time_reached(client->connect_retry_at))
+        {
+            return 0;
+        }
 
-        if (timeoutMs > 0)
+        if (client->resolver_id >= 0 && resolver_get(client->resolver_id, &client->remote_addr) != 0)
         {
-            timeoutMs -= CLIENT_TASK_TIMEOUT_MS;
+            /** The first lookup has not been answered yet */
             return 0;
         }
-        else if (timeoutMs <= 0)
+
+        client->stats.connect_attempts++;
+        client->connecting = true;
+        client->connect_deadline = make_timeout_time_ms(CLIENT_CONNECT_TIMEOUT_MS);
+        if (_client_open(client) != 0)
         {
-            _client_open(client) != ERR_OK;
-            timeoutMs = CLIENT_CONNECT_TIMEOUT_MS;
+            _client_close(client);
+            _client_disconnected(client);
         }
 
         break;
     case CLIENT_CONNECTED:
-        /** If the client is connected, do nothing */
+        /** Pick up anything that could not be written when the send buffer was full */
+        _client_tx_drain(client, false);
         break;
     default:
         /** Huston we have a problem */
@@ -96,181 +205,1345 @@ int client_task(client_t *client)
     return 0;
 }
 
-/**
- * @brief Opens a TCP connection to the server.
- * @param client Pointer to the client structure.
- * @return int Returns 0 on success, -1 on failure.
- * @note This function creates a new TCP PCB (Protocol Control Block) for the client and sets up the necessary callbacks.
- *       It also initiates the connection to the server.
- *       If the connection is successful, the _client_connected callback will be triggered.
- */
-static int _client_open(client_t *client)
+uint32_t client_rx_available(const client_t *client)
 {
-    /** Check if the client tcp control block is NULL */
-    if (client->tcp_pcb != NULL)
+    if (client == NULL)
+    {
+        return 0;
+    }
+
+    return client->rx_len;
+}
+
+int client_rx_segments(const client_t *client, uint32_t offset, client_segment_t *segs, int max_segs)
+{
+    if (client == NULL || segs == NULL || max_segs <= 0)
+    {
+        return -1;
+    }
+
+    int count = 0;
+    /** The first chain has already been partly consumed */
+    offset += client->rx_offset;
+
+    for (uint8_t i = 0; i < client->rx_count && count < max_segs; i++)
     {
-        /** Abort the existing connection */
-        if (ERR_OK != tcp_close(client->tcp_pcb))
+        const struct pbuf *q = client->rx_queue[(client->rx_head + i) % CLIENT_RX_QUEUE_DEPTH];
+
+        /** Walk the chain, skipping whole pbufs until the offset lands inside one */
+        for (; q != NULL && count < max_segs; q = q->next)
         {
-            printf("Failed to close existing connection\n");
-            return -1;
+            if (offset >= q->len)
+            {
+                offset -= q->len;
+                continue;
+            }
+
+            segs[count].data = (const uint8_t *)q->payload + offset;
+            segs[count].len = q->len - offset;
+            offset = 0;
+            count++;
         }
     }
 
-    /** Create a new TCP PCB (Protocol Control Block) for the client */
-    client->tcp_pcb = tcp_new_ip_type(IP_GET_TYPE(&client->remote_addr));
-    if (client->tcp_pcb == NULL)
+    return count;
+}
+
+int client_peek(const client_t *client, void *buf, uint32_t len)
+{
+    if (client == NULL || buf == NULL)
     {
-        printf("Failed to create new TCP PCB\n");
         return -1;
     }
 
-    if (!client->tcp_pcb)
+    uint8_t *dst = (uint8_t *)buf;
+    uint32_t copied = 0;
+    uint16_t offset = client->rx_offset;
+
+    for (uint8_t i = 0; i < client->rx_count && copied < len; i++)
     {
-        printf("Failed to setup the pcb");
-        return -1;
+        const struct pbuf *p = client->rx_queue[(client->rx_head + i) % CLIENT_RX_QUEUE_DEPTH];
+        uint32_t chunk = LWIP_MIN((uint32_t)(p->tot_len - offset), len - copied);
+
+        copied += pbuf_copy_partial(p, dst + copied, (u16_t)chunk, offset);
+        offset = 0;
     }
 
-    /** Setup the pcb argument as client, and then set the other tcp/ip callbacks */
-    tcp_arg(client->tcp_pcb, client);
-    tcp_poll(client->tcp_pcb, _client_poll, CLIENT_POLL_TIME_S);
-    tcp_sent(client->tcp_pcb, _client_sent);
-    tcp_recv(client->tcp_pcb, _client_recv);
-    tcp_err(client->tcp_pcb, _client_err);
+    return (int)copied;
+}
+
+int client_read(client_t *client, void *buf, uint32_t len)
+{
+    int copied = client_peek(client, buf, len);
+    if (copied <= 0)
+    {
+        return copied;
+    }
+
+    return client_consume(client, (uint32_t)copied);
+}
+
+int client_consume(client_t *client, uint32_t len)
+{
+    if (client == NULL)
+    {
+        return -1;
+    }
 
-    printf("Connecting to %s:%d\n", ipaddr_ntoa(&client->remote_addr), SERVER_PORT);
+    uint32_t consumed = 0;
 
     /**
      * @warning lwip is not thread safe so surround calls into lwip with
      *          cyw43_arch_lwip_begin() and cyw43_arch_lwip_end
      */
-
     cyw43_arch_lwip_begin();
-    /** The function will trigger the _client_connected callback once the client has connected */
-    err_t err = tcp_connect(client->tcp_pcb, &client->remote_addr, SERVER_PORT, _client_connected);
+    while (client->rx_count > 0 && consumed < len)
+    {
+        struct pbuf *p = client->rx_queue[client->rx_head];
+        uint32_t remaining = p->tot_len - client->rx_offset;
+
+        if (len - consumed < remaining)
+        {
+            /** Partly consume the oldest chain */
+            client->rx_offset += (uint16_t)(len - consumed);
+            consumed = len;
+            break;
+        }
+
+        /** The whole chain has been consumed, release it */
+        consumed += remaining;
+        client->rx_queue[client->rx_head] = NULL;
+        client->rx_head = (client->rx_head + 1) % CLIENT_RX_QUEUE_DEPTH;
+        client->rx_count--;
+        client->rx_offset = 0;
+        pbuf_free(p);
+    }
     cyw43_arch_lwip_end();
 
-    return err;
-}
+    TRACE(TRACE_RX_CONSUMED, consumed);
+    client->rx_len -= consumed;
 
-/**
- * @brief Polling function for the client.
- * @param arg Pointer to the client structure.
- * @param tpcb Pointer to the TCP protocol control block.
- * @return err_t Error code.
- * @note This function is called periodically to check the status of the connection.
- */
-static err_t _client_poll(void *arg, struct tcp_pcb *tpcb) { return 0; }
+    /** Reopen the receive window by what was consumed */
+    client->rx_credit += consumed;
+    _client_rx_update_window(client);
 
-/**
- * @brief Callback function for when data is sent to the server.
- * @param arg Pointer to the client structure.
- * @param tpcb Pointer to the TCP protocol control block.
- * @param len Length of the data sent.
- * @return err_t Error code.
- * @note This function is called when data is sent to the server.
- */
-static err_t _client_sent(void *arg, struct tcp_pcb *tpcb, u16_t len) { return 0; }
+    return (int)consumed;
+}
 
-/**
- * @brief Callback function for when data is received from the server.
- * @param arg Pointer to the client structure.
- * @param tpcb Pointer to the TCP protocol control block.
- * @param p Pointer to the received pbuf.
- * @param err Error code.
- * @return err_t Error code.
- * @note This function is called when data is received from the server.
- */
-static err_t _client_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err)
+int client_set_rx_watermarks(client_t *client, uint32_t high, uint32_t low)
 {
-    client_t *client = (client_t *)arg;
-    if (err != ERR_OK)
+    if (client == NULL || low > high)
     {
-        printf("Error receiving data\n");
-        return err;
+        return -1;
     }
 
-    if (p == NULL)
+    client->rx_high_wm = high;
+    client->rx_low_wm = low;
+    client->rx_throttled = false;
+    _client_rx_update_window(client);
+
+    return 0;
+}
+
+int client_rx_pause(client_t *client)
+{
+    if (client == NULL)
     {
-        printf("Connection closed\n");
-        tcp_close(tpcb);
-        client->state = CLIENT_DISCONNECTED;
-        return ERR_ABRT;
+        return -1;
     }
 
-    /**
-     * Print the incoming data to the console.
-     * @note: This is a simple example and should be replaced with your own code to handle the incoming data.
-     *        The payload is a pointer to the data in the pbuf, and the length of the data is in p->len.
-     *        The payload is not null terminated, so you need to handle it accordingly.
-     *
-     * @warning: This will only work well for null terminated strings.
-     *
-     */
-    void *payload = p->payload;
-    uint16_t len = p->len;
-    uint8_t *buffer = client->buffer;     /** Use the client's buffer to store the data. */
-    uint16_t offset = client->buffer_len; /** Offset to write to in the buffer. */
-    if (len > BUF_SIZE - 1)
+    client->rx_paused = true;
+
+    return 0;
+}
+
+int client_rx_resume(client_t *client)
+{
+    if (client == NULL)
     {
-        /** we are full */
-        len = BUF_SIZE - 1; // Ensure we don't overflow the buffer
+        return -1;
     }
-    else if (len > 0)
+
+    client->rx_paused = false;
+    _client_rx_update_window(client);
+
+    return 0;
+}
+
+bool client_rx_throttled(const client_t *client)
+{
+    if (client == NULL)
     {
-        /** Copy the data to the buffer */
-        memcpy(buffer + offset, payload, len);
-        client->buffer_len += len;
+        return false;
     }
 
-    buffer[client->buffer_len] = '\0'; // Null terminate the string
+    return client->rx_paused || client->rx_throttled;
+}
+
+int client_write(client_t *client, const void *data, uint32_t len)
+{
+    if (data == NULL || len > UINT16_MAX)
+    {
+        return -1;
+    }
 
-    /** Free the pbuf */
-    pbuf_free(p);
+    client_segment_t seg = {
+        .data = (const uint8_t *)data,
+        .len = (uint16_t)len,
+    };
 
-    return ERR_OK;
+    return client_writev(client, &seg, 1);
 }
-/**
- * @brief Error callback for the client.
- * @param arg Pointer to the client structure.
- * @param err Error code.
- * @return None.
- * @note This function is called when an error occurs in the client connection.
- */
-static void _client_err(void *arg, err_t err)
+
+int client_writev(client_t *client, const client_segment_t *segs, int count)
 {
-    client_t *client = (client_t *)arg;
-    printf("Error: %d\n", err);
-    // tcp_abort(client->tcp_pcb); /** Abort kept giving recurring err_call with -13 */
-    tcp_close(client->tcp_pcb); /** close the connection */
-    client->state = CLIENT_DISCONNECTED;
+    if (client == NULL || segs == NULL || count <= 0 || client->state != CLIENT_CONNECTED)
+    {
+        return -1;
+    }
+
+    uint32_t len = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (segs[i].data == NULL && segs[i].len > 0)
+        {
+            return -1;
+        }
+        len += segs[i].len;
+    }
+
+    if (client->transport == CLIENT_TRANSPORT_UDP)
+    {
+        return _client_udp_writev(client, segs, count, len);
+    }
+
+    /** Work out if everything fits before copying anything so a message is never half queued */
+    uint32_t space = 0;
+    if (client->tx_stage_open >= 0)
+    {
+        client_tx_desc_t *open = &client->tx_queue[(client->tx_head + client->tx_count - 1) % CLIENT_TX_QUEUE_DEPTH];
+        space = CLIENT_TX_STAGE_SIZE - open->len;
+    }
+
+    uint32_t stages_free = 0;
+    for (int i = 0; i < CLIENT_TX_STAGE_COUNT; i++)
+    {
+        stages_free += client->tx_stage[i] == NULL ? 1 : 0;
+    }
+    stages_free = LWIP_MIN(stages_free, (uint32_t)mempool_available(&TxStagePool));
+
+    if (len > space)
+    {
+        uint32_t stages_needed = (len - space + CLIENT_TX_STAGE_SIZE - 1) / CLIENT_TX_STAGE_SIZE;
+        if (stages_needed > stages_free || stages_needed > (uint32_t)(CLIENT_TX_QUEUE_DEPTH - client->tx_count))
+        {
+            if (stages_needed > stages_free)
+            {
+                /** Counted as a failure when the pool is short, it is sized too small if this happens often */
+                mempool_check(&TxStagePool, (uint16_t)stages_needed);
+            }
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        const uint8_t *src = segs[i].data;
+        uint32_t remaining = segs[i].len;
+
+        while (remaining > 0)
+        {
+            client_tx_desc_t *desc;
+            if (client->tx_stage_open < 0)
+            {
+                int8_t stage = (int8_t)_client_tx_stage_alloc(client);
+                desc = _client_tx_push(client, client->tx_stage[stage], 0, stage);
+                client->tx_stage_open = stage;
+            }
+            else
+            {
+                desc = &client->tx_queue[(client->tx_head + client->tx_count - 1) % CLIENT_TX_QUEUE_DEPTH];
+            }
+
+            /** Append to the open staging buffer */
+            uint16_t chunk = (uint16_t)LWIP_MIN(remaining, (uint32_t)(CLIENT_TX_STAGE_SIZE - desc->len));
+            memcpy(client->tx_stage[desc->stage] + desc->len, src, chunk);
+            desc->len += chunk;
+            desc->end += chunk;
+            client->tx_queued += chunk;
+            src += chunk;
+            remaining -= chunk;
+
+            if (desc->len == CLIENT_TX_STAGE_SIZE)
+            {
+                /** Full segment, stop appending to it */
+                client->tx_stage_open = -1;
+            }
+        }
+    }
+
+    _client_tx_drain(client, false);
+
+    return 0;
 }
 
-/**
- * * @brief Callback function for when the client is connected.
- * * @param arg Pointer to the client structure.
- * * @param tpcb Pointer to the TCP protocol control block.
- * * @param err Error code.
- * * @return err_t Error code.
- * * @note This function is called when the client is connected to the server.
- */
-static err_t _client_connected(void *arg, struct tcp_pcb *tpcb, err_t err)
+int client_write_ref(client_t *client, const void *data, uint16_t len, client_tx_done_cb_t done, void *arg)
 {
-    /** NULL check */
-    if (arg == NULL)
+    if (client == NULL || data == NULL || len == 0 || client->state != CLIENT_CONNECTED)
     {
-        return ERR_ARG;
+        return -1;
     }
 
-    client_t *client = (client_t *)arg;
+    if (client->transport == CLIENT_TRANSPORT_UDP)
+    {
+        return _client_udp_write_ref(client, data, len, done, arg);
+    }
 
-    if (client->state == CLIENT_CONNECTED)
+    if (client->tx_count >= CLIENT_TX_QUEUE_DEPTH)
     {
-        return ERR_OK; // Already connected
+        return -1;
     }
 
-    client->state = CLIENT_CONNECTED;
-    printf("Client connected\n");
+    /** Later small writes must not be coalesced in front of this one */
+    client->tx_stage_open = -1;
+
+    client_tx_desc_t *desc = _client_tx_push(client, (const uint8_t *)data, len, -1);
+    desc->done = done;
+    desc->done_arg = arg;
+
+    _client_tx_drain(client, false);
+
+    return 0;
+}
+
+int client_flush(client_t *client)
+{
+    if (client == NULL || client->state != CLIENT_CONNECTED)
+    {
+        return -1;
+    }
+
+    if (client->transport == CLIENT_TRANSPORT_UDP)
+    {
+        _client_udp_send(client);
+        return 0;
+    }
+
+    _client_tx_drain(client, true);
+
+    return 0;
+}
+
+const mempool_t *client_tx_stage_pool(void)
+{
+    return &TxStagePool;
+}
+
+uint32_t client_tx_pending(const client_t *client)
+{
+    if (client == NULL)
+    {
+        return 0;
+    }
+
+    return client->tx_queued - client->tx_acked;
+}
+
+int client_close(client_t *client)
+{
+    if (client == NULL)
+    {
+        return -1;
+    }
+
+    _client_close(client);
+    _client_rx_flush(client);
+    _client_disconnected(client);
+
+    return 0;
+}
+
+/**
+ * @brief Opens a TCP connection to the server.
+ * @param client Pointer to the client structure.
+ * @return int Returns 0 on success, -1 on failure.
+ * @note This function creates a new TCP PCB (Protocol Control Block) for the client and sets up the necessary callbacks.
+ *       It also initiates the connection to the server.
+ *       If the connection is successful, the _client_connected callback will be triggered.
+ */
+static int _client_open(client_t *client)
+{
+    /** Check if the client tcp control block is NULL */
+    if (client->tcp_pcb != NULL)
+    {
+        /** Close the existing connection */
+        _client_close(client);
+    }
+
+    /** Drop anything left over from the previous connection, the new one starts with a full window */
+    _client_rx_flush(client);
+    client->rx_credit = 0;
+    client->rx_throttled = false;
+    /** The handshake gives the first round trip sample on the new path */
+    client->rtt_us = 0;
+    client->rtt_timing = false;
+    client->rtt_start = get_absolute_time();
+
+    if (client->transport == CLIENT_TRANSPORT_UDP)
+    {
+        return _client_udp_open(client);
+    }
+
+    if (client->transport == CLIENT_TRANSPORT_TLS)
+    {
+        /** The session slot is kept for the life of the client, so every reconnect can resume */
+        if (client->tls_id < 0)
+        {
+            client->tls_id = (int8_t)tls_session_add();
+        }
+        const char *hostname = client->resolver_id >= 0 ? resolver_name(client->resolver_id) : NULL;
+        client->tcp_pcb = tls_new(client->tls_id, IP_GET_TYPE(&client->remote_addr), hostname);
+    }
+    else
+    {
+        /** Create a new TCP PCB (Protocol Control Block) for the client */
+        client->tcp_pcb = altcp_new_ip_type(NULL, IP_GET_TYPE(&client->remote_addr));
+    }
+    if (client->tcp_pcb == NULL)
+    {
+        LOG_ERROR("Failed to create new TCP PCB\n");
+        return -1;
+    }
+
+    if (!client->tcp_pcb)
+    {
+        LOG_ERROR("Failed to setup the pcb\n");
+        return -1;
+    }
+
+    /** Setup the pcb argument as client, and then set the other tcp/ip callbacks */
+    altcp_arg(client->tcp_pcb, client);
+    altcp_poll(client->tcp_pcb, _client_poll, CLIENT_POLL_TIME_S);
+    altcp_sent(client->tcp_pcb, _client_sent);
+    altcp_recv(client->tcp_pcb, _client_recv);
+    altcp_err(client->tcp_pcb, _client_err);
+    altcp_keepalive_enable(client->tcp_pcb, CLIENT_KEEPALIVE_IDLE_MS, CLIENT_KEEPALIVE_INTERVAL_MS,
+                           CLIENT_KEEPALIVE_COUNT);
+
+    LOG_INFO("Connecting to %s:%d\n", ipaddr_ntoa(&client->remote_addr), client->remote_port);
+    TRACE(TRACE_CONNECT_START, client->remote_port);
+
+    /**
+     * @warning lwip is not thread safe so surround calls into lwip with
+     *          cyw43_arch_lwip_begin() and cyw43_arch_lwip_end
+     */
+
+    cyw43_arch_lwip_begin();
+    /** The function will trigger the _client_connected callback once the client has connected */
+    err_t err = altcp_connect(client->tcp_pcb, &client->remote_addr, client->remote_port, _client_connected);
+    cyw43_arch_lwip_end();
+
+    return err;
+}
+
+/**
+ * @brief Polling function for the client.
+ * @param arg Pointer to the client structure.
+ * @param tpcb Pointer to the TCP protocol control block.
+ * @return err_t Error code.
+ * @note This function is called periodically to check the status of the connection.
+ */
+static err_t _client_poll(void *arg, struct altcp_pcb *tpcb)
+{
+    client_t *client = (client_t *)arg;
+    if (client == NULL)
+    {
+        return ERR_OK;
+    }
+
+    /** Retry anything that was refused while the send buffer was full */
+    _client_tx_drain(client, false);
+
+    return ERR_OK;
+}
+
+/**
+ * @brief Callback function for when data is sent to the server.
+ * @param arg Pointer to the client structure.
+ * @param tpcb Pointer to the TCP protocol control block.
+ * @param len Length of the data sent.
+ * @return err_t Error code.
+ * @note This function is called when data is sent to the server. The len bytes have been acked,
+ *       so descriptors that are now fully acked are released and more data is written as
+ *       send buffer space frees up.
+ */
+static err_t _client_sent(void *arg, struct altcp_pcb *tpcb, u16_t len)
+{
+    client_t *client = (client_t *)arg;
+    if (client == NULL)
+    {
+        return ERR_OK;
+    }
+
+    client->tx_acked += len;
+    client->stats.tx_bytes += len;
+    TRACE(TRACE_TX_ACKED, len);
+
+    if (client->rtt_timing && (int32_t)(client->tx_acked - client->rtt_seq) >= 0)
+    {
+        client->rtt_timing = false;
+        _client_rtt_sample(client);
+    }
+
+    /** Release the descriptors covered by the ack, caller-owned buffers can be reused now */
+    while (client->tx_written_count > 0)
+    {
+        client_tx_desc_t *desc = &client->tx_queue[client->tx_head];
+        if ((int32_t)(client->tx_acked - desc->end) < 0)
+        {
+            break;
+        }
+
+        client->tx_head = (client->tx_head + 1) % CLIENT_TX_QUEUE_DEPTH;
+        client->tx_count--;
+        client->tx_written_count--;
+
+        if (desc->done != NULL)
+        {
+            desc->done(desc->done_arg, desc->data, desc->len, ERR_OK);
+        }
+    }
+
+    _client_tx_drain(client, false);
+
+    return ERR_OK;
+}
+
+/**
+ * @brief Callback function for when data is received from the server.
+ * @param arg Pointer to the client structure.
+ * @param tpcb Pointer to the TCP protocol control block.
+ * @param p Pointer to the received pbuf.
+ * @param err Error code.
+ * @return err_t Error code.
+ * @note This function is called when data is received from the server.
+ */
+static err_t _client_recv(void *arg, struct altcp_pcb *tpcb, struct pbuf *p, err_t err)
+{
+    client_t *client = (client_t *)arg;
+    if (err != ERR_OK)
+    {
+        LOG_ERROR("Error receiving data\n");
+        return err;
+    }
+
+    if (p == NULL)
+    {
+        LOG_WARN("Connection closed\n");
+        bool aborted = _client_close(client);
+        _client_disconnected(client);
+        return aborted ? ERR_ABRT : ERR_OK;
+    }
+
+    /**
+     * Queue the pbuf chain by reference, the application reads it through client_read() or
+     * client_rx_segments() and releases it with client_consume().
+     * The window is not reopened here, that happens as the application consumes the data.
+     * If even the newest chain has no room left, returning ERR_MEM makes lwIP hold on to the
+     * data and deliver it again from its timer, so nothing is lost.
+     */
+    if (_client_rx_push(client, p) != 0)
+    {
+        return ERR_MEM;
+    }
+
+    return ERR_OK;
+}
+/**
+ * @brief Error callback for the client.
+ * @param arg Pointer to the client structure.
+ * @param err Error code.
+ * @return None.
+ * @note This function is called when an error occurs in the client connection.
+ */
+static void _client_err(void *arg, err_t err)
+{
+    client_t *client = (client_t *)arg;
+    LOG_ERROR("Error: %d\n", err);
+    /** lwIP has already freed the pcb by the time the error callback runs, so just forget it */
+    client->tcp_pcb = NULL;
+    _client_tx_reset(client, err);
+    _client_disconnected(client);
+}
+
+/**
+ * * @brief Callback function for when the client is connected.
+ * * @param arg Pointer to the client structure.
+ * * @param tpcb Pointer to the TCP protocol control block.
+ * * @param err Error code.
+ * * @return err_t Error code.
+ * * @note This function is called when the client is connected to the server.
+ */
+static err_t _client_connected(void *arg, struct altcp_pcb *tpcb, err_t err)
+{
+    /** NULL check */
+    if (arg == NULL)
+    {
+        return ERR_ARG;
+    }
+
+    client_t *client = (client_t *)arg;
+
+    if (client->state == CLIENT_CONNECTED)
+    {
+        return ERR_OK; // Already connected
+    }
+
+    if (client->transport == CLIENT_TRANSPORT_TLS && tls_connected(client->tls_id, tpcb) < 0)
+    {
+        /** Handshake completed but the server is not who it claims to be */
+        bool aborted = _client_close(client);
+        _client_disconnected(client);
+        return aborted ? ERR_ABRT : ERR_OK;
+    }
+
+    client->state = CLIENT_CONNECTED;
+    client->connecting = false;
+    TRACE(TRACE_CONNECTED, client->remote_port);
+    if (client->transport == CLIENT_TRANSPORT_TCP)
+    {
+        /** The handshake took one round trip, UDP has nothing to time and TLS took several */
+        _client_rtt_sample(client);
+    }
+    /** The next failure after a working connection is retried straight away */
+    client->reconnect_delay_ms = 0;
+
+    uint32_t elapsed_ms = (uint32_t)(absolute_time_diff_us(client->down_since, get_absolute_time()) / 1000);
+    client->stats.connect_successes++;
+    client->stats.last_connect_ms = elapsed_ms;
+    client->stats.total_connect_ms += elapsed_ms;
+    client->stats.max_connect_ms = LWIP_MAX(client->stats.max_connect_ms, elapsed_ms);
+
+    LOG_INFO("Client connected in %u ms\n", (unsigned)elapsed_ms);
+    boot_mark(BOOT_PHASE_CONNECTED);
+
+    return ERR_OK;
+}
+
+/**
+ * @brief Release every pbuf in the receive queue.
+ * @param client Pointer to the client structure.
+ * @return None.
+ */
+static void _client_rx_flush(client_t *client)
+{
+    client_consume(client, client->rx_len);
+}
+
+/**
+ * @brief Return consumed bytes to the TCP receive window unless intake is held back.
+ * @param client Pointer to the client structure.
+ * @return None.
+ * @note The high/low watermarks give hysteresis, once throttled the window stays closed until
+ *       the queue has drained to the low watermark.
+ */
+static void _client_rx_update_window(client_t *client)
+{
+    if (client->rx_high_wm > 0)
+    {
+        if (client->rx_throttled && client->rx_len <= client->rx_low_wm)
+        {
+            client->rx_throttled = false;
+        }
+        else if (!client->rx_throttled && client->rx_len >= client->rx_high_wm)
+        {
+            client->rx_throttled = true;
+        }
+    }
+
+    if (client->rx_throttled || client->rx_paused || client->tcp_pcb == NULL)
+    {
+        return;
+    }
+
+    cyw43_arch_lwip_begin();
+    while (client->rx_credit > 0)
+    {
+        /** altcp_recved() takes a 16 bit length */
+        u16_t len = (u16_t)LWIP_MIN(client->rx_credit, 0xFFFFu);
+        altcp_recved(client->tcp_pcb, len);
+        client->rx_credit -= len;
+    }
+    cyw43_arch_lwip_end();
+}
+
+/**
+ * @brief Close the client connection and drop anything still queued for transmission.
+ * @param client Pointer to the client structure.
+ * @return bool true if the pcb had to be aborted rather than closed.
+ * @note If lwIP still references caller-owned buffers the pcb is aborted, a graceful close would keep
+ *       them in use after their done callbacks have run. Copied data is left for lwIP to deliver.
+ */
+static bool _client_close(client_t *client)
+{
+    bool aborted = false;
+    struct altcp_pcb *pcb = client->tcp_pcb;
+
+    if (pcb != NULL)
+    {
+        /** Detach so the pcb can no longer call back into this client */
+        altcp_arg(pcb, NULL);
+        altcp_poll(pcb, NULL, 0);
+        altcp_sent(pcb, NULL);
+        altcp_recv(pcb, NULL);
+        altcp_err(pcb, NULL);
+
+        if (_client_tx_ref_pending(client) > 0 || altcp_close(pcb) != ERR_OK)
+        {
+            altcp_abort(pcb);
+            aborted = true;
+        }
+        client->tcp_pcb = NULL;
+    }
+
+    if (client->udp_pcb != NULL)
+    {
+        /** A batch that was not sent yet is dropped like unsent TCP data */
+        sys_untimeout(_client_udp_batch_timeout, client);
+        if (client->udp_batch != NULL)
+        {
+            pbuf_free(client->udp_batch);
+            client->udp_batch = NULL;
+        }
+        udp_remove(client->udp_pcb);
+        client->udp_pcb = NULL;
+    }
+
+    _client_tx_reset(client, ERR_CLSD);
+
+    return aborted;
+}
+
+/**
+ * @brief Find a free staging buffer.
+ * @param client Pointer to the client structure.
+ * @return int Index of the staging buffer, -1 if all are in use.
+ */
+static int _client_tx_stage_alloc(client_t *client)
+{
+    for (int i = 0; i < CLIENT_TX_STAGE_COUNT; i++)
+    {
+        if (client->tx_stage[i] == NULL)
+        {
+            client->tx_stage[i] = (uint8_t *)mempool_alloc(&TxStagePool);
+            return client->tx_stage[i] != NULL ? i : -1;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Return a staging buffer to the shared pool.
+ * @param client Pointer to the client structure.
+ * @param stage Staging buffer index.
+ * @return None.
+ */
+static void _client_tx_stage_free(client_t *client, int stage)
+{
+    mempool_free(&TxStagePool, client->tx_stage[stage]);
+    client->tx_stage[stage] = NULL;
+}
+
+/**
+ * @brief Append a descriptor to the transmit queue.
+ * @param client Pointer to the client structure.
+ * @param data Data the descriptor points at.
+ * @param len Length of the data.
+ * @param stage Staging buffer index, -1 for caller-owned memory.
+ * @return client_tx_desc_t* The new descriptor.
+ * @note The caller has checked that there is a free slot.
+ */
+static client_tx_desc_t *_client_tx_push(client_t *client, const uint8_t *data, uint16_t len, int8_t stage)
+{
+    client_tx_desc_t *desc = &client->tx_queue[(client->tx_head + client->tx_count) % CLIENT_TX_QUEUE_DEPTH];
+    client->tx_count++;
+    client->tx_queued += len;
+
+    memset(desc, 0, sizeof(client_tx_desc_t));
+    desc->data = data;
+    desc->len = len;
+    desc->end = client->tx_queued;
+    desc->stage = stage;
+
+    return desc;
+}
+
+/**
+ * @brief Hand as much queued data to lwIP as the send buffer allows.
+ * @param client Pointer to the client structure.
+ * @param force Also write a partly filled staging buffer while data is still in flight.
+ * @return None.
+ * @note All writes of one pass are flagged TCP_WRITE_FLAG_MORE except the last, and go out with a
+ *       single altcp_output().
+ */
+static void _client_tx_drain(client_t *client, bool force)
+{
+    struct altcp_pcb *pcb = client->tcp_pcb;
+    if (pcb == NULL || client->state != CLIENT_CONNECTED)
+    {
+        return;
+    }
+
+    bool wrote = false;
+    uint32_t written = client->tx_written;
+
+    cyw43_arch_lwip_begin();
+    while (client->tx_written_count < client->tx_count)
+    {
+        uint8_t idx = (client->tx_head + client->tx_written_count) % CLIENT_TX_QUEUE_DEPTH;
+        client_tx_desc_t *desc = &client->tx_queue[idx];
+
+        /** Keep coalescing into the open staging buffer while earlier data is unacked */
+        if (desc->stage >= 0 && desc->stage == client->tx_stage_open && !force &&
+            client->tx_written != client->tx_acked)
+        {
+            break;
+        }
+
+        u16_t space = altcp_sndbuf(pcb);
+        if (space == 0 || altcp_sndqueuelen(pcb) >= TCP_SND_QUEUELEN)
+        {
+            /** Send buffer is full, _client_sent() picks up from here */
+            break;
+        }
+
+        u16_t len = (u16_t)LWIP_MIN((u16_t)(desc->len - desc->written), space);
+        u8_t flags = desc->stage >= 0 ? TCP_WRITE_FLAG_COPY : 0;
+        if (desc->written + len < desc->len || client->tx_written_count + 1 < client->tx_count)
+        {
+            flags |= TCP_WRITE_FLAG_MORE;
+        }
+
+        if (altcp_write(pcb, desc->data + desc->written, len, flags) != ERR_OK)
+        {
+            /** Out of segments, try again when something is acked */
+            break;
+        }
+
+        desc->written += len;
+        client->tx_written += len;
+        wrote = true;
+
+        if (desc->written == desc->len)
+        {
+            if (desc->stage >= 0)
+            {
+                /** lwIP holds its own copy, the staging buffer can be reused */
+                if (desc->stage == client->tx_stage_open)
+                {
+                    client->tx_stage_open = -1;
+                }
+                _client_tx_stage_free(client, desc->stage);
+            }
+            client->tx_written_count++;
+        }
+    }
+
+    if (wrote)
+    {
+        if (!client->rtt_timing)
+        {
+            /** Time the last byte written until it is acked */
+            client->rtt_timing = true;
+            client->rtt_seq = client->tx_written;
+            client->rtt_start = get_absolute_time();
+        }
+        altcp_output(pcb);
+        TRACE(TRACE_TX_OUTPUT, client->tx_written - written);
+    }
+    cyw43_arch_lwip_end();
+}
+
+/**
+ * @brief Drop everything in the transmit queue.
+ * @param client Pointer to the client structure.
+ * @param err Reason passed to the done callbacks of caller-owned buffers.
+ * @return None.
+ */
+static void _client_tx_reset(client_t *client, err_t err)
+{
+    while (client->tx_count > 0)
+    {
+        client_tx_desc_t *desc = &client->tx_queue[client->tx_head];
+        client->tx_head = (client->tx_head + 1) % CLIENT_TX_QUEUE_DEPTH;
+        client->tx_count--;
+
+        if (desc->done != NULL)
+        {
+            desc->done(desc->done_arg, desc->data, desc->len, err);
+        }
+    }
+
+    client->tx_head = 0;
+    client->tx_written_count = 0;
+    client->tx_stage_open = -1;
+    client->tx_queued = 0;
+    client->tx_written = 0;
+    client->tx_acked = 0;
+    for (int i = 0; i < CLIENT_TX_STAGE_COUNT; i++)
+    {
+        _client_tx_stage_free(client, i);
+    }
+    client->rtt_timing = false;
+}
+
+/**
+ * @brief Count the bytes lwIP was handed from caller-owned buffers that are not acked yet.
+ * @param client Pointer to the client structure.
+ * @return uint32_t Bytes written by reference, 0 if lwIP only holds its own copies.
+ * @note Descriptors leave the queue once fully acked, so any written one is still referenced.
+ */
+static uint32_t _client_tx_ref_pending(const client_t *client)
+{
+    uint32_t pending = 0;
+
+    for (uint8_t i = 0; i < client->tx_count; i++)
+    {
+        const client_tx_desc_t *desc = &client->tx_queue[(client->tx_head + i) % CLIENT_TX_QUEUE_DEPTH];
+        if (desc->stage < 0)
+        {
+            pending += desc->written;
+        }
+    }
+
+    return pending;
+}
+
+/**
+ * @brief Record a lost connection or a failed attempt and schedule the next attempt.
+ * @param client Pointer to the client structure.
+ * @return None.
+ * @note The first attempt after a working connection is immediate, every further one backs off
+ *       exponentially with jitter, so a dead server is not retried at a fixed rate.
+ */
+static void _client_disconnected(client_t *client)
+{
+    TRACE(TRACE_DISCONNECTED, client->remote_port);
+
+    if (client->state == CLIENT_CONNECTED)
+    {
+        client->down_since = get_absolute_time();
+    }
+    else if (client->connecting)
+    {
+        client->stats.connect_failures++;
+        if (client->transport == CLIENT_TRANSPORT_TLS)
+        {
+            tls_failed(client->tls_id);
+        }
+    }
+
+    client->state = CLIENT_DISCONNECTED;
+    client->connecting = false;
+
+    uint32_t delay_ms = client->reconnect_delay_ms;
+    if (delay_ms > 0)
+    {
+        /** Anywhere between half and all of the backoff, so a fleet does not retry in step */
+        delay_ms = delay_ms / 2 + get_rand_32() % (delay_ms / 2 + 1);
+    }
+    client->connect_retry_at = make_timeout_time_ms(delay_ms);
+
+    client->reconnect_delay_ms = client->reconnect_delay_ms == 0 ? CLIENT_RECONNECT_MIN_MS
+                                 : LWIP_MIN(client->reconnect_delay_ms * 2, (uint32_t)CLIENT_RECONNECT_MAX_MS);
+}
+
+/**
+ * @brief Fold the time since rtt_start into the smoothed round trip time.
+ * @param client Pointer to the client structure.
+ * @return None.
+ * @note Uses the TCP smoothing gain of 1/8. lwIP keeps its own estimate in 500 ms ticks, too
+ *       coarse to rank servers on a LAN.
+ */
+static void _client_rtt_sample(client_t *client)
+{
+    int64_t sample = absolute_time_diff_us(client->rtt_start, get_absolute_time());
+
+    if (client->rtt_us == 0)
+    {
+        client->rtt_us = (uint32_t)sample;
+    }
+    else
+    {
+        client->rtt_us = (uint32_t)((int64_t)client->rtt_us + (sample - (int64_t)client->rtt_us) / 8);
+    }
+
+    if (client->rtt_us == 0)
+    {
+        /** Keep 0 meaning no sample */
+        client->rtt_us = 1;
+    }
+}
+
+/**
+ * @brief Queue a received pbuf chain by reference for the application.
+ *
+ * Once all slots are taken the chain is appended to the newest one. A message that arrives in
+ * more small segments than there are slots then still becomes readable as a whole, instead of
+ * the queue refusing the rest of it while the application waits for it.
+ *
+ * @param client Pointer to the client structure.
+ * @param p The pbuf chain, owned by the queue from here on if queued.
+ * @return int 0 on success, -1 if the newest chain cannot take p either.
+ */
+static int _client_rx_push(client_t *client, struct pbuf *p)
+{
+    if (client->rx_count < CLIENT_RX_QUEUE_DEPTH)
+    {
+        uint8_t tail = (client->rx_head + client->rx_count) % CLIENT_RX_QUEUE_DEPTH;
+        client->rx_queue[tail] = p;
+        client->rx_count++;
+    }
+    else
+    {
+        struct pbuf *tail = client->rx_queue[(client->rx_head + client->rx_count - 1) % CLIENT_RX_QUEUE_DEPTH];
+        if ((uint32_t)tail->tot_len + p->tot_len > 0xFFFF)
+        {
+            /** tot_len is 16 bits, the receive window normally keeps this from happening */
+            return -1;
+        }
+        pbuf_cat(tail, p);
+    }
+    client->rx_len += p->tot_len;
+    client->stats.rx_bytes += p->tot_len;
+    TRACE(TRACE_RX_QUEUED, p->tot_len);
+
+    _client_rx_update_window(client);
+
+    return 0;
+}
+
+/**
+ * @brief Set up the UDP pcb, the client counts as connected as soon as it exists.
+ * @param client Pointer to the client structure.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _client_udp_open(client_t *client)
+{
+    cyw43_arch_lwip_begin();
+    client->udp_pcb = udp_new_ip_type(IP_GET_TYPE(&client->remote_addr));
+    if (client->udp_pcb == NULL)
+    {
+        cyw43_arch_lwip_end();
+        LOG_ERROR("Failed to create new UDP PCB\n");
+        return -1;
+    }
+
+    udp_recv(client->udp_pcb, _client_udp_recv, client);
+    /** Fixes the remote end, datagrams from anywhere else are not delivered */
+    err_t err = udp_connect(client->udp_pcb, &client->remote_addr, client->remote_port);
+    cyw43_arch_lwip_end();
+
+    if (err != ERR_OK)
+    {
+        return -1;
+    }
+
+    LOG_INFO("Sending to %s:%d over UDP\n", ipaddr_ntoa(&client->remote_addr), client->remote_port);
+    TRACE(TRACE_CONNECT_START, client->remote_port);
+
+    /** Every pcb starts a new sequence, the peer resyncs on the jump */
+    client->udp_tx_seq = 0;
+    client->udp_rx_next = 0;
+    client->udp_rx_seen = 0;
+
+    _client_connected(client, NULL, ERR_OK);
+
+    return 0;
+}
+
+/**
+ * @brief Append a write to the datagram being filled, sending it when full or when not batching.
+ * @param client Pointer to the client structure.
+ * @param segs Pieces to send, in order.
+ * @param count Number of pieces.
+ * @param len Total length of the pieces.
+ * @return int 0 on success, -1 if the write is too large or no pbuf is available.
+ */
+static int _client_udp_writev(client_t *client, const client_segment_t *segs, int count, uint32_t len)
+{
+    if (len > CLIENT_UDP_PAYLOAD_MAX)
+    {
+        return -1;
+    }
+
+    /** A write is never split, close the batch if this one does not fit behind it */
+    if (client->udp_batch != NULL &&
+        client->udp_batch_len + len > client->udp_batch->tot_len - CLIENT_UDP_HEADER_SIZE)
+    {
+        _client_udp_send(client);
+    }
+
+    bool opened = false;
+    cyw43_arch_lwip_begin();
+    if (client->udp_batch == NULL)
+    {
+        /** Room for a full datagram only when later writes may join this one */
+        uint16_t size = (uint16_t)(client->udp_batch_ms > 0 ? CLIENT_UDP_PAYLOAD_MAX : len);
+        client->udp_batch = pbuf_alloc(PBUF_TRANSPORT, CLIENT_UDP_HEADER_SIZE + size, PBUF_RAM);
+        if (client->udp_batch == NULL)
+        {
+            cyw43_arch_lwip_end();
+            return -1;
+        }
+        client->udp_batch_len = 0;
+        opened = true;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        pbuf_take_at(client->udp_batch, segs[i].data, segs[i].len, CLIENT_UDP_HEADER_SIZE + client->udp_batch_len);
+        client->udp_batch_len += segs[i].len;
+    }
+    cyw43_arch_lwip_end();
+
+    client->tx_queued += len;
+
+    if (client->udp_batch_ms == 0 || client->udp_batch_len == CLIENT_UDP_PAYLOAD_MAX)
+    {
+        _client_udp_send(client);
+    }
+    else if (opened)
+    {
+        cyw43_arch_lwip_begin();
+        sys_timeout(client->udp_batch_ms, _client_udp_batch_timeout, client);
+        cyw43_arch_lwip_end();
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Send caller-owned data in its own datagram without copying it.
+ * @param client Pointer to the client structure.
+ * @param data Data to send.
+ * @param len Length of the data.
+ * @param done Called before returning, may be NULL.
+ * @param arg User argument passed to @p done.
+ * @return int 0 on success, -1 if the data is too large or no pbuf is available.
+ * @note The driver has copied the frame out by the time udp_send() returns, and lwIP copies
+ *       referenced data it has to queue for ARP, so the buffer is free again straight away.
+ */
+static int _client_udp_write_ref(client_t *client, const void *data, uint16_t len, client_tx_done_cb_t done, void *arg)
+{
+    if (len > CLIENT_UDP_PAYLOAD_MAX)
+    {
+        return -1;
+    }
+
+    /** Keep the datagrams in write order */
+    _client_udp_send(client);
+
+    cyw43_arch_lwip_begin();
+    struct pbuf *header = pbuf_alloc(PBUF_TRANSPORT, CLIENT_UDP_HEADER_SIZE, PBUF_RAM);
+    struct pbuf *payload = pbuf_alloc(PBUF_RAW, len, PBUF_REF);
+    if (header == NULL || payload == NULL)
+    {
+        if (header != NULL)
+        {
+            pbuf_free(header);
+        }
+        if (payload != NULL)
+        {
+            pbuf_free(payload);
+        }
+        cyw43_arch_lwip_end();
+        return -1;
+    }
+
+    payload->payload = (void *)data;
+    pbuf_cat(header, payload);
+    cyw43_arch_lwip_end();
+
+    client->tx_queued += len;
+    err_t err = _client_udp_output(client, header, len);
+
+    if (done != NULL)
+    {
+        done(arg, (const uint8_t *)data, len, err);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Stamp a datagram with the next sequence number and send it.
+ * @param client Pointer to the client structure.
+ * @param p The datagram, with room for the header at the front. Freed here.
+ * @param len Payload length.
+ * @return err_t Result of udp_send().
+ * @note There is no ack, the data counts as acked once it is handed to lwIP.
+ */
+static err_t _client_udp_output(client_t *client, struct pbuf *p, uint16_t len)
+{
+    uint32_t seq = lwip_htonl(client->udp_tx_seq++);
+
+    cyw43_arch_lwip_begin();
+    pbuf_take_at(p, &seq, sizeof(seq), 0);
+    err_t err = client->udp_pcb != NULL ? udp_send(client->udp_pcb, p) : ERR_CONN;
+    pbuf_free(p);
+    cyw43_arch_lwip_end();
+
+    if (err == ERR_OK)
+    {
+        client->udp_stats.tx_datagrams++;
+        client->stats.tx_bytes += len;
+    }
+    else
+    {
+        client->udp_stats.tx_errors++;
+    }
+
+    client->tx_written += len;
+    client->tx_acked += len;
+    TRACE(TRACE_TX_OUTPUT, len);
+
+    return err;
+}
+
+/**
+ * @brief Send the datagram being filled, if any.
+ * @param client Pointer to the client structure.
+ * @return None.
+ */
+static void _client_udp_send(client_t *client)
+{
+    struct pbuf *p = client->udp_batch;
+    if (p == NULL)
+    {
+        return;
+    }
+
+    client->udp_batch = NULL;
+
+    /** Trim the room that was kept for more writes */
+    cyw43_arch_lwip_begin();
+    sys_untimeout(_client_udp_batch_timeout, client);
+    pbuf_realloc(p, CLIENT_UDP_HEADER_SIZE + client->udp_batch_len);
+    cyw43_arch_lwip_end();
+
+    _client_udp_output(client, p, client->udp_batch_len);
+}
+
+/**
+ * @brief lwIP timer callback, the first write in the batch has waited long enough.
+ * @param arg Pointer to the client structure.
+ * @return None.
+ */
+static void _client_udp_batch_timeout(void *arg)
+{
+    _client_udp_send((client_t *)arg);
+}
+
+/**
+ * @brief Receive callback in UDP mode, checks the sequence number and queues the payload.
+ * @param arg Pointer to the client structure.
+ * @param pcb Pointer to the UDP protocol control block.
+ * @param p The datagram.
+ * @param addr Source address, always the server as the pcb is connected.
+ * @param port Source port.
+ * @return None.
+ */
+static void _client_udp_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+{
+    client_t *client = (client_t *)arg;
+    uint32_t seq;
+
+    if (p->tot_len <= CLIENT_UDP_HEADER_SIZE || pbuf_copy_partial(p, &seq, sizeof(seq), 0) != sizeof(seq))
+    {
+        client->udp_stats.rx_dropped++;
+        pbuf_free(p);
+        return;
+    }
+
+    /** Loss on the network is counted before drops for lack of queue space */
+    if (!_client_udp_sequence(client, lwip_ntohl(seq)))
+    {
+        pbuf_free(p);
+        return;
+    }
+
+    /** Datagrams only take free slots, chaining would let a flood grow the queue without bound */
+    if (client->rx_count >= CLIENT_RX_QUEUE_DEPTH || pbuf_remove_header(p, CLIENT_UDP_HEADER_SIZE) != 0)
+    {
+        /** No way to push back on UDP, the application is not keeping up */
+        client->udp_stats.rx_dropped++;
+        pbuf_free(p);
+        return;
+    }
+
+    client->udp_stats.rx_datagrams++;
+    _client_rx_push(client, p);
+}
+
+/**
+ * @brief Track a received sequence number.
+ * @param client Pointer to the client structure.
+ * @param seq Sequence number of the datagram.
+ * @return bool true to deliver the datagram, false if it is a duplicate.
+ * @note A bitmap of the last CLIENT_UDP_REORDER_WINDOW sequence numbers tells a late datagram,
+ *       which fills in a gap counted as lost, from a duplicate. Anything further back is taken
+ *       as the sender starting over, so a restarted sender is never dropped as a duplicate.
+ */
+static bool _client_udp_sequence(client_t *client, uint32_t seq)
+{
+    client_udp_stats_t *stats = &client->udp_stats;
+    int32_t ahead = (int32_t)(seq - client->udp_rx_next);
+    uint32_t behind = client->udp_rx_next - 1 - seq;
+
+    if (client->udp_rx_seen != 0 && ahead < 0 && behind >= CLIENT_UDP_REORDER_WINDOW)
+    {
+        /** Too far back to be late, the sender has started over */
+        stats->rx_resyncs++;
+        client->udp_rx_seen = 0;
+    }
+
+    if (client->udp_rx_seen == 0)
+    {
+        client->udp_rx_next = seq + 1;
+        client->udp_rx_seen = 1;
+        return true;
+    }
+
+    if (ahead >= 0)
+    {
+        if (ahead > 0)
+        {
+            stats->rx_gaps++;
+            stats->rx_lost += (uint32_t)ahead;
+        }
+
+        uint32_t shift = (uint32_t)ahead + 1;
+        client->udp_rx_seen = shift >= CLIENT_UDP_REORDER_WINDOW ? 1 : (client->udp_rx_seen << shift) | 1;
+        client->udp_rx_next = seq + 1;
+        return true;
+    }
+
+    if (client->udp_rx_seen & (1u << behind))
+    {
+        stats->rx_duplicates++;
+        return false;
+    }
+
+    client->udp_rx_seen |= 1u << behind;
+    stats->rx_reordered++;
+    if (stats->rx_lost > 0)
+    {
+        stats->rx_lost--;
+    }
+
+    return true;
 }
 
 /**
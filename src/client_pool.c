@@ -0,0 +1,173 @@
+/** Includes *************************************************************************************/
+#include "client_pool.h"
+#include "log.h"
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Private Function Prototypes ******************************************************************/
+static int _client_pool_fastest(const client_pool_t *pool);
+
+/** Function Definitions *************************************************************************/
+int client_pool_init(client_pool_t *pool, const client_endpoint_t *endpoints, uint8_t count)
+{
+    if (pool == NULL || endpoints == NULL || count == 0 || count > CLIENT_POOL_MAX)
+    {
+        return -1;
+    }
+
+    memset(pool, 0, sizeof(*pool));
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (client_init_endpoint(&pool->clients[i], endpoints[i].ip_address, endpoints[i].port) != 0)
+        {
+            return -1;
+        }
+    }
+
+    pool->count = count;
+    pool->active = -1;
+
+    return 0;
+}
+
+int client_pool_task(client_pool_t *pool)
+{
+    if (pool == NULL)
+    {
+        return -1;
+    }
+
+    int rc = 0;
+    for (uint8_t i = 0; i < pool->count; i++)
+    {
+        if (client_task(&pool->clients[i]) != 0)
+        {
+            rc = -1;
+        }
+    }
+
+    int fastest = _client_pool_fastest(pool);
+
+    if (pool->active >= 0 && pool->clients[pool->active].state != CLIENT_CONNECTED)
+    {
+        /** Active server dropped, move to a standby that is already connected */
+        if (fastest >= 0)
+        {
+            LOG_WARN("Failing over to %s\n", ipaddr_ntoa(&pool->clients[fastest].remote_addr));
+            pool->stats.failovers++;
+        }
+        pool->active = (int8_t)fastest;
+    }
+    else if (pool->active < 0)
+    {
+        /** First connection to complete wins */
+        pool->active = (int8_t)fastest;
+    }
+    else if (fastest >= 0 && fastest != pool->active)
+    {
+        const client_t *active = &pool->clients[pool->active];
+        const client_t *candidate = &pool->clients[fastest];
+
+        if ((uint64_t)candidate->rtt_us * 100 < (uint64_t)active->rtt_us * (100 - CLIENT_POOL_SWITCH_MARGIN_PCT) &&
+            client_tx_pending(active) == 0)
+        {
+            pool->active = (int8_t)fastest;
+            pool->stats.switches++;
+        }
+    }
+
+    return rc;
+}
+
+client_t *client_pool_active(client_pool_t *pool)
+{
+    if (pool == NULL || pool->active < 0)
+    {
+        return NULL;
+    }
+
+    return &pool->clients[pool->active];
+}
+
+int client_pool_close(client_pool_t *pool)
+{
+    if (pool == NULL)
+    {
+        return -1;
+    }
+
+    for (uint8_t i = 0; i < pool->count; i++)
+    {
+        client_t *client = &pool->clients[i];
+        if (client->state == CLIENT_CONNECTED || client->connecting)
+        {
+            client_close(client);
+        }
+    }
+
+    pool->active = -1;
+
+    return 0;
+}
+
+int client_pool_reconnect_reset(client_pool_t *pool)
+{
+    if (pool == NULL)
+    {
+        return -1;
+    }
+
+    for (uint8_t i = 0; i < pool->count; i++)
+    {
+        client_reconnect_reset(&pool->clients[i]);
+    }
+
+    return 0;
+}
+
+int client_pool_traffic(const client_pool_t *pool, uint64_t *bytes, uint32_t *pending)
+{
+    if (pool == NULL || bytes == NULL || pending == NULL)
+    {
+        return -1;
+    }
+
+    *bytes = 0;
+    *pending = 0;
+    for (uint8_t i = 0; i < pool->count; i++)
+    {
+        const client_t *client = &pool->clients[i];
+        *bytes += client->stats.tx_bytes + client->stats.rx_bytes;
+        *pending += client_tx_pending(client);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Find the connected member with the lowest RTT.
+ * @param pool Pointer to the pool.
+ * @return int Index of the member, -1 if none is connected.
+ */
+static int _client_pool_fastest(const client_pool_t *pool)
+{
+    int best = -1;
+
+    for (uint8_t i = 0; i < pool->count; i++)
+    {
+        const client_t *client = &pool->clients[i];
+        if (client->state != CLIENT_CONNECTED)
+        {
+            continue;
+        }
+
+        if (best < 0 || client->rtt_us < pool->clients[best].rtt_us)
+        {
+            best = i;
+        }
+    }
+
+    return best;
+}
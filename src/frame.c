@@ -0,0 +1,312 @@
+/** Includes *************************************************************************************/
+#include "frame.h"
+#include "trace.h"
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** CRC-16/CCITT for one nibble, keeps the table small while avoiding a loop per bit */
+static const uint16_t Crc16Nibble[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+};
+
+/** Prototypes ***********************************************************************************/
+/** Private Function Prototypes ******************************************************************/
+static int _frame_payload_segments(frame_decoder_t *decoder, client_t *client, uint32_t offset, uint16_t len,
+                                   client_segment_t *segs);
+static uint32_t _frame_copy_out(const client_t *client, uint32_t offset, uint8_t *buf, uint32_t len);
+
+/** Function Definitions *************************************************************************/
+int frame_decoder_init(frame_decoder_t *decoder)
+{
+    if (decoder == NULL)
+    {
+        return -1;
+    }
+
+    memset(decoder, 0, sizeof(*decoder));
+
+    return 0;
+}
+
+int frame_register(frame_decoder_t *decoder, uint8_t type, frame_handler_t fn, void *arg)
+{
+    if (decoder == NULL || type >= FRAME_TYPE_COUNT)
+    {
+        return -1;
+    }
+
+    decoder->handlers[type].fn = fn;
+    decoder->handlers[type].arg = arg;
+
+    return 0;
+}
+
+int frame_poll(frame_decoder_t *decoder, client_t *client)
+{
+    if (decoder == NULL || client == NULL)
+    {
+        return -1;
+    }
+
+    int dispatched = 0;
+
+    while (true)
+    {
+        /** Only the header is copied, it is at most a few bytes */
+        uint8_t hdr[FRAME_HEADER_MAX];
+        int n = client_peek(client, hdr, sizeof(hdr));
+        if (n <= 0)
+        {
+            return dispatched;
+        }
+
+        uint32_t len = 0;
+        int i = 0;
+        for (; i < FRAME_LEN_BYTES_MAX; i++)
+        {
+            if (i >= n)
+            {
+                /** Length prefix not complete yet */
+                return dispatched;
+            }
+
+            len |= (uint32_t)(hdr[i] & 0x7f) << (7 * i);
+            if ((hdr[i] & 0x80) == 0)
+            {
+                break;
+            }
+        }
+
+        if (i == FRAME_LEN_BYTES_MAX)
+        {
+            decoder->stats.malformed++;
+            return -1;
+        }
+
+        if (len > FRAME_MAX_PAYLOAD)
+        {
+            /** The frame could never be completed in the receive queue, the stream is lost */
+            decoder->stats.oversize++;
+            return -1;
+        }
+
+        uint32_t hdr_len = (uint32_t)i + 2;
+        if ((uint32_t)n < hdr_len)
+        {
+            return dispatched;
+        }
+
+        uint8_t type = hdr[i + 1];
+        bool crc = (type & FRAME_FLAG_CRC) != 0;
+        uint32_t total = hdr_len + len + (crc ? FRAME_CRC_SIZE : 0);
+
+        if (client_rx_available(client) < total)
+        {
+            /** Wait for the rest of the frame */
+            return dispatched;
+        }
+
+        client_segment_t segs[FRAME_MAX_SEGS];
+        frame_t frame = {
+            .type = type & ~FRAME_FLAG_CRC,
+            .len = (uint16_t)len,
+            .segs = segs,
+            .seg_count = _frame_payload_segments(decoder, client, hdr_len, (uint16_t)len, segs),
+        };
+
+        bool valid = true;
+        if (crc)
+        {
+            uint16_t expected = frame_crc16(0xFFFF, hdr, hdr_len);
+            for (int s = 0; s < frame.seg_count; s++)
+            {
+                expected = frame_crc16(expected, segs[s].data, segs[s].len);
+            }
+
+            uint8_t trailer[FRAME_CRC_SIZE];
+            _frame_copy_out(client, hdr_len + len, trailer, sizeof(trailer));
+            valid = expected == (uint16_t)(trailer[0] | (trailer[1] << 8));
+        }
+
+        frame_handler_t fn = decoder->handlers[frame.type].fn;
+        if (!valid)
+        {
+            decoder->stats.crc_errors++;
+        }
+        else if (fn == NULL)
+        {
+            decoder->stats.unhandled++;
+        }
+        else
+        {
+            TRACE(TRACE_FRAME, frame.type);
+            fn(decoder->handlers[frame.type].arg, &frame);
+            decoder->stats.frames++;
+            dispatched++;
+        }
+
+        /** The length was still good, so a dropped frame does not lose the stream */
+        client_consume(client, total);
+    }
+}
+
+int frame_copy(const frame_t *frame, uint16_t offset, void *buf, uint16_t len)
+{
+    if (frame == NULL || buf == NULL)
+    {
+        return -1;
+    }
+
+    uint8_t *dst = (uint8_t *)buf;
+    uint16_t copied = 0;
+
+    for (int i = 0; i < frame->seg_count && copied < len; i++)
+    {
+        const client_segment_t *seg = &frame->segs[i];
+        if (offset >= seg->len)
+        {
+            offset -= seg->len;
+            continue;
+        }
+
+        uint16_t chunk = (uint16_t)LWIP_MIN((uint32_t)(seg->len - offset), (uint32_t)(len - copied));
+        memcpy(dst + copied, seg->data + offset, chunk);
+        copied += chunk;
+        offset = 0;
+    }
+
+    return copied;
+}
+
+int frame_send(client_t *client, uint8_t type, const void *data, uint16_t len, bool crc)
+{
+    if (client == NULL || type >= FRAME_TYPE_COUNT || len > FRAME_MAX_PAYLOAD || (data == NULL && len > 0))
+    {
+        return -1;
+    }
+
+    uint8_t hdr[FRAME_HEADER_MAX];
+    uint8_t trailer[FRAME_CRC_SIZE];
+    int hdr_len = frame_header(hdr, type, len, crc);
+
+    client_segment_t segs[3] = {
+        {.data = hdr, .len = (uint16_t)hdr_len},
+        {.data = (const uint8_t *)data, .len = len},
+        {.data = trailer, .len = 0},
+    };
+
+    if (crc)
+    {
+        uint16_t value = frame_crc16(frame_crc16(0xFFFF, hdr, hdr_len), (const uint8_t *)data, len);
+        trailer[0] = (uint8_t)value;
+        trailer[1] = (uint8_t)(value >> 8);
+        segs[2].len = sizeof(trailer);
+    }
+
+    return client_writev(client, segs, count_of(segs));
+}
+
+int frame_header(uint8_t *hdr, uint8_t type, uint16_t len, bool crc)
+{
+    int n = 0;
+    uint32_t value = len;
+
+    do
+    {
+        hdr[n] = (uint8_t)(value & 0x7f);
+        value >>= 7;
+        if (value != 0)
+        {
+            hdr[n] |= 0x80;
+        }
+        n++;
+    } while (value != 0);
+
+    hdr[n++] = type | (crc ? FRAME_FLAG_CRC : 0);
+
+    return n;
+}
+
+uint16_t frame_crc16(uint16_t crc, const uint8_t *data, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i++)
+    {
+        crc = (uint16_t)((crc << 4) ^ Crc16Nibble[(crc >> 12) ^ (data[i] >> 4)]);
+        crc = (uint16_t)((crc << 4) ^ Crc16Nibble[(crc >> 12) ^ (data[i] & 0x0f)]);
+    }
+
+    return crc;
+}
+
+/**
+ * @brief Describe a payload as segments of the receive queue.
+ * @param decoder Pointer to the decoder.
+ * @param client Pointer to the client structure.
+ * @param offset Offset of the payload in the receive queue.
+ * @param len Payload length.
+ * @param segs Array of FRAME_MAX_SEGS segments to fill in.
+ * @return int Number of segments.
+ * @note A payload spread over more than FRAME_MAX_SEGS pbufs is copied into the scratch buffer.
+ */
+static int _frame_payload_segments(frame_decoder_t *decoder, client_t *client, uint32_t offset, uint16_t len,
+                                   client_segment_t *segs)
+{
+    if (len == 0)
+    {
+        return 0;
+    }
+
+    int count = client_rx_segments(client, offset, segs, FRAME_MAX_SEGS);
+    uint32_t covered = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (covered + segs[i].len >= len)
+        {
+            /** Trim the last segment to the end of the payload */
+            segs[i].len = (uint16_t)(len - covered);
+            return i + 1;
+        }
+        covered += segs[i].len;
+    }
+
+    decoder->stats.copied++;
+    _frame_copy_out(client, offset, decoder->scratch, len);
+    segs[0].data = decoder->scratch;
+    segs[0].len = len;
+
+    return 1;
+}
+
+/**
+ * @brief Copy bytes out of the receive queue at an offset, without consuming them.
+ * @param client Pointer to the client structure.
+ * @param offset Offset in the receive queue.
+ * @param buf Destination buffer.
+ * @param len Number of bytes to copy.
+ * @return uint32_t Number of bytes copied.
+ */
+static uint32_t _frame_copy_out(const client_t *client, uint32_t offset, uint8_t *buf, uint32_t len)
+{
+    uint32_t copied = 0;
+
+    while (copied < len)
+    {
+        client_segment_t segs[FRAME_MAX_SEGS];
+        int count = client_rx_segments(client, offset + copied, segs, FRAME_MAX_SEGS);
+        if (count <= 0)
+        {
+            break;
+        }
+
+        for (int i = 0; i < count && copied < len; i++)
+        {
+            uint32_t chunk = LWIP_MIN((uint32_t)segs[i].len, len - copied);
+            memcpy(buf + copied, segs[i].data, chunk);
+            copied += chunk;
+        }
+    }
+
+    return copied;
+}
@@ -0,0 +1,243 @@
+/** Includes *************************************************************************************/
+#include <string.h>
+#include "heartbeat.h"
+#include "trace.h"
+#include "log.h"
+/** Defines **************************************************************************************/
+#define HEARTBEAT_PAYLOAD_SIZE 8
+
+/** A pong older than this is from a clock that wrapped or a peer making it up, not a round trip */
+#define HEARTBEAT_RTT_MAX_US 60000000u
+
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Private Function Prototypes ******************************************************************/
+static void _heartbeat_reset(heartbeat_t *heartbeat, const client_t *client);
+static int _heartbeat_ping(heartbeat_t *heartbeat, client_t *client);
+static void _heartbeat_handler(void *arg, const frame_t *frame);
+static void _heartbeat_put32(uint8_t *out, uint32_t value);
+
+/** Function Definitions *************************************************************************/
+int heartbeat_init(heartbeat_t *heartbeat, frame_decoder_t *decoder, uint32_t interval_ms, uint8_t misses)
+{
+    if (heartbeat == NULL || decoder == NULL)
+    {
+        return -1;
+    }
+
+    memset(heartbeat, 0, sizeof(*heartbeat));
+    heartbeat->interval_ms = interval_ms > 0 ? interval_ms : HEARTBEAT_INTERVAL_MS;
+    heartbeat->misses = misses > 0 ? misses : HEARTBEAT_MISSES;
+
+    return frame_register(decoder, HEARTBEAT_FRAME_PONG, _heartbeat_handler, heartbeat);
+}
+
+int heartbeat_task(heartbeat_t *heartbeat, client_t *client)
+{
+    if (heartbeat == NULL || client == NULL || client->state != CLIENT_CONNECTED)
+    {
+        return 0;
+    }
+
+    if (client != heartbeat->client || client->stats.connect_successes != heartbeat->connection)
+    {
+        _heartbeat_reset(heartbeat, client);
+    }
+
+    if (heartbeat->waiting && time_reached(heartbeat->deadline))
+    {
+        heartbeat->waiting = false;
+
+        if (client->stats.rx_bytes != heartbeat->rx_mark)
+        {
+            /** No pong yet, but the peer is sending, try again after the usual interval */
+            heartbeat->missed = 0;
+            heartbeat->next_at = make_timeout_time_ms(heartbeat->interval_ms);
+        }
+        else
+        {
+            heartbeat->missed++;
+            heartbeat->stats.missed++;
+
+            if (heartbeat->missed >= heartbeat->misses)
+            {
+                LOG_WARN("Peer missed %lu heartbeats, reconnecting\n", (unsigned long)heartbeat->missed);
+                heartbeat->stats.dead++;
+                heartbeat->client = NULL;
+                client_close(client);
+                return -1;
+            }
+
+            /** Probe again straight away rather than wait out a whole interval */
+            heartbeat->next_at = get_absolute_time();
+        }
+    }
+
+    if (!heartbeat->waiting && time_reached(heartbeat->next_at))
+    {
+        /** A full transmit queue gets another go on the next run */
+        _heartbeat_ping(heartbeat, client);
+    }
+
+    return 0;
+}
+
+void heartbeat_pong(heartbeat_t *heartbeat, uint32_t seq, uint32_t sent_us)
+{
+    if (heartbeat == NULL || heartbeat->client == NULL)
+    {
+        return;
+    }
+
+    uint32_t rtt = time_us_32() - sent_us;
+    if (rtt > HEARTBEAT_RTT_MAX_US || (int32_t)(heartbeat->seq - seq) < 0)
+    {
+        return;
+    }
+
+    heartbeat_stats_t *stats = &heartbeat->stats;
+    stats->pongs++;
+    stats->rtt_last_us = rtt;
+    stats->rtt_total_us += rtt;
+    stats->rtt_max_us = LWIP_MAX(stats->rtt_max_us, rtt);
+    stats->rtt_min_us = stats->rtt_min_us == 0 ? rtt : LWIP_MIN(stats->rtt_min_us, rtt);
+    TRACE(TRACE_PONG, (uint16_t)seq);
+
+    /** RFC 6298, gains of 1/8 for the mean and 1/4 for the deviation */
+    if (heartbeat->srtt_us == 0)
+    {
+        heartbeat->srtt_us = rtt > 0 ? rtt : 1;
+        heartbeat->rttvar_us = rtt / 2;
+    }
+    else
+    {
+        uint32_t error = rtt > heartbeat->srtt_us ? rtt - heartbeat->srtt_us : heartbeat->srtt_us - rtt;
+        heartbeat->rttvar_us = heartbeat->rttvar_us - heartbeat->rttvar_us / 4 + error / 4;
+        heartbeat->srtt_us = heartbeat->srtt_us - heartbeat->srtt_us / 8 + rtt / 8;
+    }
+
+    /** Any answer shows the peer is up, only the newest ping ends the wait */
+    heartbeat->missed = 0;
+    if (seq != heartbeat->seq || !heartbeat->waiting)
+    {
+        stats->late++;
+        return;
+    }
+
+    heartbeat->waiting = false;
+    heartbeat->next_at = make_timeout_time_ms(heartbeat->interval_ms);
+}
+
+uint32_t heartbeat_timeout_ms(const heartbeat_t *heartbeat)
+{
+    if (heartbeat == NULL || heartbeat->srtt_us == 0)
+    {
+        return HEARTBEAT_TIMEOUT_MAX_MS;
+    }
+
+    uint32_t timeout_ms = (heartbeat->srtt_us + 4 * heartbeat->rttvar_us + 999) / 1000;
+
+    return LWIP_MIN(LWIP_MAX(timeout_ms, HEARTBEAT_TIMEOUT_MIN_MS), HEARTBEAT_TIMEOUT_MAX_MS);
+}
+
+void heartbeat_report(const heartbeat_t *heartbeat)
+{
+    const heartbeat_stats_t *stats = &heartbeat->stats;
+    if (stats->pings == 0)
+    {
+        return;
+    }
+
+    LOG_INFO("Heartbeat rtt %lu us, var %lu us, min %lu us, max %lu us, mean %lu us\n",
+             (unsigned long)heartbeat->srtt_us, (unsigned long)heartbeat->rttvar_us, (unsigned long)stats->rtt_min_us,
+             (unsigned long)stats->rtt_max_us,
+             (unsigned long)(stats->pongs > 0 ? stats->rtt_total_us / stats->pongs : 0));
+    LOG_INFO("Heartbeat %lu pings, %lu pongs, %lu late, %lu missed, %lu dead peers\n", (unsigned long)stats->pings,
+             (unsigned long)stats->pongs, (unsigned long)stats->late, (unsigned long)stats->missed,
+             (unsigned long)stats->dead);
+}
+
+/**
+ * @brief Start over for a new connection, the first ping goes out after one interval.
+ * @param heartbeat Pointer to the heartbeat.
+ * @param client The connection.
+ * @return None.
+ */
+static void _heartbeat_reset(heartbeat_t *heartbeat, const client_t *client)
+{
+    heartbeat->client = client;
+    heartbeat->connection = client->stats.connect_successes;
+    heartbeat->waiting = false;
+    heartbeat->missed = 0;
+    heartbeat->srtt_us = 0;
+    heartbeat->rttvar_us = 0;
+    heartbeat->next_at = make_timeout_time_ms(heartbeat->interval_ms);
+}
+
+/**
+ * @brief Send a ping and start waiting for its pong.
+ * @param heartbeat Pointer to the heartbeat.
+ * @param client The connection.
+ * @return int 0 on success, -1 if the transmit queue is full.
+ */
+static int _heartbeat_ping(heartbeat_t *heartbeat, client_t *client)
+{
+    uint8_t ping[HEARTBEAT_PAYLOAD_SIZE];
+    uint32_t seq = heartbeat->seq + 1;
+    uint32_t now = time_us_32();
+
+    _heartbeat_put32(&ping[0], seq);
+    _heartbeat_put32(&ping[4], now);
+    if (frame_send(client, HEARTBEAT_FRAME_PING, ping, sizeof(ping), false) != 0)
+    {
+        return -1;
+    }
+
+    /** Queued behind other writes it would wait for them, a ping should only wait for the peer */
+    client_flush(client);
+
+    heartbeat->seq = seq;
+    heartbeat->sent_us = now;
+    heartbeat->waiting = true;
+    heartbeat->deadline = make_timeout_time_ms(heartbeat_timeout_ms(heartbeat));
+    heartbeat->rx_mark = client->stats.rx_bytes;
+    heartbeat->stats.pings++;
+    TRACE(TRACE_PING, (uint16_t)seq);
+
+    return 0;
+}
+
+/**
+ * @brief Pong handler.
+ * @param arg Pointer to the heartbeat.
+ * @param frame The frame.
+ * @return None.
+ */
+static void _heartbeat_handler(void *arg, const frame_t *frame)
+{
+    uint8_t pong[HEARTBEAT_PAYLOAD_SIZE];
+
+    if (frame_copy(frame, 0, pong, sizeof(pong)) != sizeof(pong))
+    {
+        return;
+    }
+
+    uint32_t seq = pong[0] | (uint32_t)pong[1] << 8 | (uint32_t)pong[2] << 16 | (uint32_t)pong[3] << 24;
+    uint32_t sent_us = pong[4] | (uint32_t)pong[5] << 8 | (uint32_t)pong[6] << 16 | (uint32_t)pong[7] << 24;
+    heartbeat_pong((heartbeat_t *)arg, seq, sent_us);
+}
+
+/**
+ * @brief Write a 32 bit value, little endian.
+ * @param out Destination, 4 bytes.
+ * @param value The value.
+ * @return None.
+ */
+static void _heartbeat_put32(uint8_t *out, uint32_t value)
+{
+    out[0] = (uint8_t)value;
+    out[1] = (uint8_t)(value >> 8);
+    out[2] = (uint8_t)(value >> 16);
+    out[3] = (uint8_t)(value >> 24);
+}
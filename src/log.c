@@ -0,0 +1,431 @@
+/** Includes *************************************************************************************/
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "log.h"
+#include "spsc.h"
+#if LIB_PICO_STDIO_USB
+#include "pico/stdio_usb.h"
+#include "tusb.h"
+#endif
+/** Defines **************************************************************************************/
+/** Cores that can log */
+#define LOG_NUM_CORES 2
+
+/** Record header: format address, u32 time in us, u8 level, u8 argument count */
+#define LOG_ADDR_SIZE sizeof(uintptr_t)
+#define LOG_HEADER_SIZE (LOG_ADDR_SIZE + 6)
+
+/** Longest line written for a record, a hex line is the longest there is */
+#define LOG_LINE_MAX (2 * LOG_RECORD_MAX + 4)
+
+/** Most _log_output_room() reports, when the output has nothing queued */
+#if LIB_PICO_STDIO_USB
+#define LOG_OUTPUT_ROOM_MAX CFG_TUD_CDC_TX_BUFSIZE
+#else
+#define LOG_OUTPUT_ROOM_MAX LOG_DRAIN_BUDGET
+#endif
+
+/** Typedefs *************************************************************************************/
+typedef struct
+{
+    spsc_ring_t rings[LOG_NUM_CORES];
+    uint8_t bufs[LOG_NUM_CORES][LOG_RING_SIZE];
+    volatile uint32_t dropped[LOG_NUM_CORES];  /** Records lost on each core since boot */
+    uint32_t reported[LOG_NUM_CORES];          /** Drops already announced in the output */
+} Log_t;
+
+/** A line being formatted, text past the end is cut off */
+typedef struct
+{
+    char *buf;
+    uint32_t size;
+    uint32_t len;
+} LogLine_t;
+
+/** Variables ************************************************************************************/
+static Log_t Log = {0};
+
+/** Prototypes ***********************************************************************************/
+/** Private Function Prototypes ******************************************************************/
+static uint32_t _log_output_room(void);
+static uint32_t _log_format(const uint8_t *record, int len, char *buf, uint32_t size);
+#if LOG_OUTPUT_TEXT
+static void _log_format_text(const uint8_t *record, int len, LogLine_t *line);
+static void _log_printf(LogLine_t *line, const char *fmt, ...);
+static void _log_put(LogLine_t *line, const char *text, uint32_t len);
+#endif
+
+/** Function Definitions *************************************************************************/
+int log_init(void)
+{
+    uint core = get_core_num();
+
+    return spsc_init(&Log.rings[core], Log.bufs[core], LOG_RING_SIZE);
+}
+
+void log_write(uint8_t level, const char *fmt, uint8_t nargs, const log_arg_t *args)
+{
+    uint core = get_core_num();
+    spsc_ring_t *ring = &Log.rings[core];
+
+    if (ring->buf == NULL)
+    {
+        /** Logging before log_init() on this core */
+        Log.dropped[core]++;
+        return;
+    }
+
+    /**
+     * Record layout, little endian:
+     *   format address, u32 time in us, u8 level, u8 argument count
+     *   then per argument a u8 tag and the raw value, strings as a u8 length and the bytes
+     */
+    uint8_t record[LOG_RECORD_MAX];
+    uintptr_t addr = (uintptr_t)fmt;
+    uint32_t now = time_us_32();
+    memcpy(&record[0], &addr, LOG_ADDR_SIZE);
+    memcpy(&record[LOG_ADDR_SIZE], &now, sizeof(now));
+    record[LOG_ADDR_SIZE + 4] = level;
+    record[LOG_ADDR_SIZE + 5] = 0;
+
+    uint16_t len = LOG_HEADER_SIZE;
+    for (uint8_t i = 0; i < nargs; i++)
+    {
+        const log_arg_t *arg = &args[i];
+        uint16_t size;
+
+        switch (arg->tag)
+        {
+        case LOG_ARG_I64:
+        case LOG_ARG_U64:
+        case LOG_ARG_DOUBLE:
+            size = 8;
+            break;
+        case LOG_ARG_STR:
+            size = 1 + (arg->s != NULL ? (uint16_t)strnlen(arg->s, LOG_STR_MAX) : 0);
+            break;
+        default:
+            size = 4;
+            break;
+        }
+
+        if (len + 1 + size > LOG_RECORD_MAX)
+        {
+            /** Out of room, the decoder shows the missing arguments as such */
+            break;
+        }
+
+        record[len++] = arg->tag;
+        if (arg->tag == LOG_ARG_STR)
+        {
+            record[len++] = (uint8_t)(size - 1);
+            memcpy(&record[len], arg->s, size - 1);
+            len += size - 1;
+        }
+        else if (arg->tag == LOG_ARG_PTR)
+        {
+            uint32_t value = (uint32_t)(uintptr_t)arg->p;
+            memcpy(&record[len], &value, 4);
+            len += 4;
+        }
+        else
+        {
+            /** The union holds the value in its first bytes */
+            memcpy(&record[len], &arg->u64, size);
+            len += size;
+        }
+        record[LOG_ADDR_SIZE + 5]++;
+    }
+
+    if (spsc_push(ring, record, len) != 0)
+    {
+        Log.dropped[core]++;
+    }
+}
+
+void log_drain(void)
+{
+    uint32_t room = _log_output_room();
+    uint core = get_core_num();
+    spsc_ring_t *ring = &Log.rings[core];
+
+    if (ring->buf == NULL)
+    {
+        return;
+    }
+
+    if (Log.dropped[core] != Log.reported[core] && room > 32)
+    {
+        uint32_t dropped = Log.dropped[core];
+        printf("LOG dropped %lu\n", (unsigned long)(dropped - Log.reported[core]));
+        Log.reported[core] = dropped;
+        room -= 32;
+    }
+
+    uint8_t record[LOG_RECORD_MAX];
+    char line[LOG_LINE_MAX];
+    int len;
+    while ((len = spsc_peek(ring, record, sizeof(record))) > 0)
+    {
+        /** Formatted first, so the record stays queued unless the whole line fits without blocking */
+        uint32_t n = _log_format(record, len, line, sizeof(line));
+        if (n > room && room < LOG_OUTPUT_ROOM_MAX)
+        {
+            /** A line longer than the output can ever hold still goes out, alone once it is empty */
+            break;
+        }
+
+        fwrite(line, 1, n, stdout);
+        room -= n < room ? n : room;
+        spsc_drop(ring);
+    }
+}
+
+uint32_t log_dropped(void)
+{
+    return Log.dropped[0] + Log.dropped[1];
+}
+
+/**
+ * @brief Find how much can be written to stdout without blocking.
+ * @return uint32_t Bytes that can be written.
+ */
+static uint32_t _log_output_room(void)
+{
+#if LIB_PICO_STDIO_USB
+    if (!stdio_usb_connected())
+    {
+        /** Nobody is listening, keep the records until someone is */
+        return 0;
+    }
+
+    return tud_cdc_write_available();
+#else
+    return LOG_DRAIN_BUDGET;
+#endif
+}
+
+/**
+ * @brief Format one record as the line that is written out for it.
+ * @param record The record.
+ * @param len Length of the record.
+ * @param buf Buffer for the line, not terminated.
+ * @param size Size of the buffer, at least LOG_LINE_MAX.
+ * @return uint32_t Length of the line.
+ */
+static uint32_t _log_format(const uint8_t *record, int len, char *buf, uint32_t size)
+{
+#if LOG_OUTPUT_TEXT
+    LogLine_t line = {
+        .buf = buf,
+        .size = size,
+    };
+    _log_format_text(record, len, &line);
+    if (line.len == size - 1 && buf[line.len - 1] != '\n')
+    {
+        /** Cut short, still end the line */
+        buf[line.len++] = '\n';
+    }
+
+    return line.len;
+#else
+    /** One line per record, so records survive stdio line ending translation and mix with text */
+    static const char hex[] = "0123456789abcdef";
+    uint32_t n = 0;
+
+    buf[n++] = 'L';
+    buf[n++] = ' ';
+    for (int i = 0; i < len && n + 3 <= size; i++)
+    {
+        buf[n++] = hex[record[i] >> 4];
+        buf[n++] = hex[record[i] & 0x0f];
+    }
+    buf[n++] = '\n';
+
+    return n;
+#endif
+}
+
+#if LOG_OUTPUT_TEXT
+/**
+ * @brief Format a record as text on the device.
+ * @param record The record.
+ * @param len Length of the record.
+ * @param line The line to append to.
+ * @return None.
+ * @note Each conversion in the format is passed to snprintf() on its own with its argument.
+ */
+static void _log_format_text(const uint8_t *record, int len, LogLine_t *line)
+{
+    const char *fmt;
+    uintptr_t addr;
+    memcpy(&addr, &record[0], LOG_ADDR_SIZE);
+    fmt = (const char *)addr;
+
+    uint8_t nargs = record[LOG_ADDR_SIZE + 5];
+    int offset = LOG_HEADER_SIZE;
+
+    while (*fmt != '\0')
+    {
+        if (*fmt != '%')
+        {
+            const char *end = strchr(fmt, '%');
+            int n = end != NULL ? (int)(end - fmt) : (int)strlen(fmt);
+            _log_put(line, fmt, n);
+            fmt += n;
+            continue;
+        }
+
+        if (fmt[1] == '%')
+        {
+            _log_put(line, "%", 1);
+            fmt += 2;
+            continue;
+        }
+
+        /** Copy one conversion, dropping length modifiers as the value is cast to match below */
+        char spec[16];
+        int n = 0;
+        const char *p = fmt + 1;
+        spec[n++] = '%';
+        while (*p != '\0' && strchr("-+ #0123456789.*", *p) != NULL && n < (int)sizeof(spec) - 4)
+        {
+            spec[n++] = *p++;
+        }
+        while (*p != '\0' && strchr("hlLqjzt", *p) != NULL)
+        {
+            p++;
+        }
+        char conv = *p != '\0' ? *p++ : 'd';
+        fmt = p;
+
+        /** A '*' width or precision consumes an argument of its own */
+        int star = -1;
+        if (memchr(spec, '*', n) != NULL && nargs > 0 && offset + 5 <= len)
+        {
+            memcpy(&star, &record[offset + 1], 4);
+            offset += 5;
+            nargs--;
+        }
+
+        if (nargs == 0 || offset >= len)
+        {
+            _log_printf(line, "<?>");
+            continue;
+        }
+
+        uint8_t tag = record[offset++];
+        nargs--;
+
+        if (tag == LOG_ARG_STR)
+        {
+            uint8_t slen = record[offset++];
+            char str[LOG_STR_MAX + 1];
+            memcpy(str, &record[offset], slen);
+            str[slen] = '\0';
+            offset += slen;
+            spec[n++] = 's';
+            spec[n] = '\0';
+            star >= 0 ? _log_printf(line, spec, star, str) : _log_printf(line, spec, str);
+        }
+        else if (tag == LOG_ARG_I64 || tag == LOG_ARG_U64 || tag == LOG_ARG_DOUBLE)
+        {
+            uint64_t value;
+            memcpy(&value, &record[offset], 8);
+            offset += 8;
+            if (tag == LOG_ARG_DOUBLE)
+            {
+                double d;
+                memcpy(&d, &value, 8);
+                spec[n++] = conv;
+                spec[n] = '\0';
+                star >= 0 ? _log_printf(line, spec, star, d) : _log_printf(line, spec, d);
+            }
+            else if (strchr("uxXo", conv) != NULL)
+            {
+                spec[n++] = 'l';
+                spec[n++] = 'l';
+                spec[n++] = conv;
+                spec[n] = '\0';
+                star >= 0 ? _log_printf(line, spec, star, (unsigned long long)value) : _log_printf(line, spec, (unsigned long long)value);
+            }
+            else
+            {
+                spec[n++] = 'l';
+                spec[n++] = 'l';
+                spec[n++] = conv;
+                spec[n] = '\0';
+                star >= 0 ? _log_printf(line, spec, star, (long long)value) : _log_printf(line, spec, (long long)value);
+            }
+        }
+        else
+        {
+            uint32_t value;
+            memcpy(&value, &record[offset], 4);
+            offset += 4;
+            if (conv == 'p')
+            {
+                _log_printf(line, "0x%08lx", (unsigned long)value);
+                continue;
+            }
+            if (conv == 'c')
+            {
+                /** %lc would take a wint_t, a char goes through as an int */
+                spec[n++] = conv;
+                spec[n] = '\0';
+                star >= 0 ? _log_printf(line, spec, star, (int)value) : _log_printf(line, spec, (int)value);
+            }
+            else if (strchr("uxXo", conv) != NULL)
+            {
+                /** Unsigned conversions of values at or above 2^31 must not be sign extended */
+                spec[n++] = 'l';
+                spec[n++] = conv;
+                spec[n] = '\0';
+                star >= 0 ? _log_printf(line, spec, star, (unsigned long)value) : _log_printf(line, spec, (unsigned long)value);
+            }
+            else
+            {
+                spec[n++] = 'l';
+                spec[n++] = conv;
+                spec[n] = '\0';
+                star >= 0 ? _log_printf(line, spec, star, (long)(int32_t)value) : _log_printf(line, spec, (long)(int32_t)value);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Append formatted text to a line.
+ * @param line The line.
+ * @param fmt printf() format.
+ * @return None.
+ */
+static void _log_printf(LogLine_t *line, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(line->buf + line->len, line->size - line->len, fmt, args);
+    va_end(args);
+
+    if (n > 0)
+    {
+        /** vsnprintf() keeps the last byte for its terminator */
+        line->len += (uint32_t)n < line->size - line->len ? (uint32_t)n : line->size - line->len - 1;
+    }
+}
+
+/**
+ * @brief Append text to a line.
+ * @param line The line.
+ * @param text The text, not terminated.
+ * @param len Length of the text.
+ * @return None.
+ */
+static void _log_put(LogLine_t *line, const char *text, uint32_t len)
+{
+    len = len < line->size - 1 - line->len ? len : line->size - 1 - line->len;
+    memcpy(line->buf + line->len, text, len);
+    line->len += len;
+}
+#endif
@@ -1,10 +1,32 @@
 /** Includes *************************************************************************************/
 #include <stdio.h>
+#include <string.h>
 #include "pico/stdlib.h"
 #include "pico/cyw43_arch.h"
+#include "pico/flash.h"
+#include "hardware/adc.h"
 
 #include "client.h"
+#include "client_pool.h"
 #include "wifi.h"
+#include "wifi_pm.h"
+#include "netcore.h"
+#include "sched.h"
+#include "frame.h"
+#include "mempool.h"
+#include "trace.h"
+#include "log.h"
+#include "boot.h"
+#include "tls.h"
+#include "telemetry.h"
+#include "outbox.h"
+#include "heartbeat.h"
+#include "mqtt.h"
+#include "selftest.h"
+#if LIB_PICO_STDIO_USB
+#include "pico/stdio_usb.h"
+#include "tusb.h"
+#endif
 
 #ifdef CYW43_WL_GPIO_LED_PIN
 #include "pico/cyw43_arch.h"
@@ -15,23 +37,143 @@
 #define LED_DELAY_MS 250
 #endif
 
+/** How often the memory pool counters are printed */
+#ifndef MAIN_STATS_INTERVAL_MS
+#define MAIN_STATS_INTERVAL_MS 60000
+#endif
+
+/** How often the console is checked for commands */
+#ifndef MAIN_CONSOLE_INTERVAL_MS
+#define MAIN_CONSOLE_INTERVAL_MS 100
+#endif
+
+/** Longest wait for a USB host to enumerate the device, none is attached if it has not by then */
+#ifndef MAIN_USB_MOUNT_WAIT_MS
+#define MAIN_USB_MOUNT_WAIT_MS 1000
+#endif
+
+/** Longest wait for a terminal to open the console once a USB host is attached */
+#ifndef MAIN_CONSOLE_WAIT_MS
+#define MAIN_CONSOLE_WAIT_MS 3000
+#endif
+
+/** Message types understood by the application */
+#define MAIN_FRAME_TEXT 1
+
+/** How often the telemetry channels are sampled */
+#ifndef MAIN_TELEMETRY_SAMPLE_MS
+#define MAIN_TELEMETRY_SAMPLE_MS 1000
+#endif
+
+/** Samples sent together in one telemetry block, more gives the encoder more to work with */
+#ifndef MAIN_TELEMETRY_BLOCK
+#define MAIN_TELEMETRY_BLOCK 16
+#endif
+
+/** Codecs offered to the server, 0 sends plain values */
+#ifndef MAIN_TELEMETRY_CODECS
+#define MAIN_TELEMETRY_CODECS (TELEMETRY_CODEC_DELTA | TELEMETRY_CODEC_LZ)
+#endif
+
+/** Die temperature in milli degrees and Wi-Fi RSSI in dBm */
+#define MAIN_TELEMETRY_CHANNELS 2
+
+/** How often the heartbeat is checked, well below HEARTBEAT_TIMEOUT_MIN_MS */
+#ifndef MAIN_HEARTBEAT_TASK_MS
+#define MAIN_HEARTBEAT_TASK_MS 100
+#endif
+
+#if PICO_CLIENT_MQTT
+/** The broker keeps the session under this identifier */
+#ifndef MAIN_MQTT_CLIENT_ID
+#define MAIN_MQTT_CLIENT_ID "pico_client"
+#endif
+#define MAIN_MQTT_TOPIC_TELEMETRY "pico/telemetry"
+#define MAIN_MQTT_TOPIC_COMMAND "pico/command"
+
+/** Telemetry blocks that can be waiting for their PUBACK, each is referenced until then */
+#ifndef MAIN_MQTT_BLOCKS
+#define MAIN_MQTT_BLOCKS 4
+#endif
+#endif
+
+#if PICO_CLIENT_SELFTEST
+/** iperf server the self-test runs against */
+#ifndef SELFTEST_SERVER
+#define SELFTEST_SERVER TCP_SERVER_IP
+#endif
+#endif
+
 /** Typedefs *************************************************************************************/
 /** Variables ************************************************************************************/
+static int ClientTaskId = -1;
+static frame_decoder_t Decoder;
+static client_pool_t Pool;
+static telemetry_t Telemetry;
+static heartbeat_t Heartbeat;
+static int32_t TelemetrySamples[MAIN_TELEMETRY_BLOCK * MAIN_TELEMETRY_CHANNELS];
+static uint16_t TelemetryCount;
+#if PICO_CLIENT_MQTT
+static mqtt_t Mqtt;
+static int32_t MqttBlocks[MAIN_MQTT_BLOCKS][MAIN_TELEMETRY_BLOCK * MAIN_TELEMETRY_CHANNELS];
+static bool MqttBlockBusy[MAIN_MQTT_BLOCKS];
+#endif
+
+/** Servers to connect to, traffic goes to the fastest one that is up */
+static const client_endpoint_t Servers[] = {
+    {TCP_SERVER_IP, CLIENT_SERVER_PORT},
+#ifdef TCP_SERVER_IP_2
+    {TCP_SERVER_IP_2, CLIENT_SERVER_PORT},
+#endif
+#ifdef TCP_SERVER_IP_3
+    {TCP_SERVER_IP_3, CLIENT_SERVER_PORT},
+#endif
+};
+
 /** Prototypes ***********************************************************************************/
 int pico_led_init(void);
 void pico_set_led(bool led_on);
 
 int led_task(void);
 
+/** Private Function Prototypes ******************************************************************/
+static int _main_wifi_task(void *arg);
+static int _main_client_task(void *arg);
+static int _main_led_task(void *arg);
+static int _main_rx_task(void *arg);
+#if !PICO_CLIENT_MQTT
+static int _main_outbox_task(void *arg);
+static int _main_heartbeat_task(void *arg);
+#endif
+static void _main_text_handler(void *arg, const frame_t *frame);
+#if PICO_CLIENT_MQTT
+static void _main_command_handler(void *arg, const char *topic, uint16_t topic_len, const uint8_t *payload,
+                                  uint16_t len);
+static void _main_block_done(void *arg, int status);
+#endif
+static int _main_stats_task(void *arg);
+static int _main_telemetry_task(void *arg);
+static int _main_console_task(void *arg);
+static void _main_wait_for_console(void (*idle)(void));
+#if PICO_CLIENT_DUAL_CORE
+static void _main_console_idle(void);
+#endif
+
 /** Functions ************************************************************************************/
 
 int main()
 {
     /** Initialise the stdio library */
     stdio_init_all();
+    boot_mark(BOOT_PHASE_STDIO);
 
+#if !PICO_CLIENT_FAST_BOOT
     /** Initial sleep to give the user time to plug in an connect to the COM port */
     sleep_ms(5000);
+#endif
+
+    trace_init();
+    log_init();
 
     /** Initialise the LED */
     // TODO: CH - There is a bug in the driver that when running cyw43_arch_init() twice
@@ -43,6 +185,49 @@ int main()
     //     return -1;
     // }
 
+#if PICO_CLIENT_DUAL_CORE
+    /** Let core 1 pause this core while it writes the Wi-Fi cache to flash */
+    flash_safe_execute_core_init();
+
+    /** Hand the network stack to core 1, core 0 only sees the message rings */
+    if (netcore_start(SSID, PASSWORD, TCP_SERVER_IP) != 0)
+    {
+        printf("Failed to start the network core\n");
+        return -1;
+    }
+
+    /** Core 1 is joining the network meanwhile */
+    _main_wait_for_console(_main_console_idle);
+
+    static uint8_t msg[NETCORE_MSG_MAX];
+    while (true)
+    {
+        int len = netcore_recv(msg, sizeof(msg));
+        if (len > 0)
+        {
+            /** Through the log like the single core build, up to LOG_STR_MAX bytes, binary as '.' */
+            char text[LOG_STR_MAX + 1];
+            int n = LWIP_MIN(len, LOG_STR_MAX);
+            for (int i = 0; i < n; i++)
+            {
+                text[i] = msg[i] >= 0x20 && msg[i] < 0x7f ? (char)msg[i] : '.';
+            }
+            text[n] = '\0';
+            LOG_INFO("Received data: %d bytes %s\n", len, text);
+        }
+        else if (_main_console_task(NULL) != 0)
+        {
+            continue;
+        }
+        else
+        {
+            /** Nothing waiting, write out queued log records and sleep until core 1 pushes something */
+            log_drain();
+            best_effort_wfe_or_timeout(make_timeout_time_ms(10));
+        }
+    }
+#endif
+
     /** Initialise and connect to the wifi network with 10sec timeout */
     if (wifi_init(SSID, PASSWORD) != 0)
     {
@@ -50,74 +235,451 @@ int main()
         return -1;
     }
 
-    printf("Wi-Fi initialised\n");
+    LOG_INFO("Wi-Fi initialised\n");
+
+#if PICO_CLIENT_SELFTEST
+    /** iperf clients can test against the board from now on */
+    if (selftest_serve(NULL) != 0)
+    {
+        LOG_WARN("Self-test server unavailable\n");
+    }
+#endif
 
-    /** Initialise the client with the server IP address */
-    client_t client = {0};
-    if (client_init(&client, TCP_SERVER_IP) != 0)
+    /** Initialise a connection to every server */
+    if (client_pool_init(&Pool, Servers, count_of(Servers)) != 0)
     {
         printf("Failed to initialise client\n");
         return -1;
     }
 
-    printf("Client initialised\n");
+    LOG_INFO("Client initialised\n");
+
+    frame_decoder_init(&Decoder);
+    frame_register(&Decoder, MAIN_FRAME_TEXT, _main_text_handler, NULL);
+    telemetry_init(&Telemetry, &Decoder, MAIN_TELEMETRY_CHANNELS, MAIN_TELEMETRY_CODECS);
+    if (outbox_init(&Decoder) != 0)
+    {
+        LOG_WARN("Outbox unavailable, blocks are dropped while offline\n");
+    }
+    heartbeat_init(&Heartbeat, &Decoder, HEARTBEAT_INTERVAL_MS, HEARTBEAT_MISSES);
+#if PICO_CLIENT_MQTT
+    mqtt_init(&Mqtt, MAIN_MQTT_CLIENT_ID, NULL, NULL);
+    mqtt_subscribe(&Mqtt, MAIN_MQTT_TOPIC_COMMAND, 1, _main_command_handler, NULL);
+#endif
+
+    adc_init();
+    adc_set_temp_sensor_enabled(true);
+    adc_select_input(ADC_TEMPERATURE_CHANNEL_NUM);
+
+    /**
+     * Each task runs when its deadline is due, the rx task runs whenever the core wakes up.
+     * In between the core sleeps until the next deadline or until the driver has work.
+     */
+    sched_init();
+    /** sched_add() returns -1 once the table is full, which stays -1 through the ORs */
+    int added = sched_add(_main_wifi_task, &Pool, WIFI_TASK_INTERVAL_MS);
+    ClientTaskId = sched_add(_main_client_task, &Pool, CLIENT_TASK_TIMEOUT_MS);
+    added |= ClientTaskId;
+    added |= sched_add(_main_led_task, NULL, LED_DELAY_MS);
+    added |= sched_add(_main_rx_task, &Pool, 0);
+#if !PICO_CLIENT_MQTT
+    /** Both speak frames, over MQTT the broker's keepalive and the session take their place */
+    added |= sched_add(_main_outbox_task, &Pool, 0);
+    added |= sched_add(_main_heartbeat_task, &Pool, MAIN_HEARTBEAT_TASK_MS);
+#endif
+    added |= sched_add(_main_stats_task, NULL, MAIN_STATS_INTERVAL_MS);
+    added |= sched_add(_main_telemetry_task, &Pool, MAIN_TELEMETRY_SAMPLE_MS);
+    added |= sched_add(_main_console_task, NULL, MAIN_CONSOLE_INTERVAL_MS);
+    if (added < 0)
+    {
+        /** A task left out would never run, without a word */
+        printf("Failed to add tasks, SCHED_MAX_TASKS is %d\n", SCHED_MAX_TASKS);
+        return -1;
+    }
+
+    /** The tasks join the network and connect while waiting for a console */
+    _main_wait_for_console(sched_run);
 
     while (true)
     {
-        /** Run the wifi task to check if we are connected */
-        wifi_task();
+        sched_run();
+    }
+}
 
-        /**
-         * Check if the wifi task state is connected.
-         * LED should be on if connected and blinking if not connected.
-         */
-        if (wifi_get_state() == WIFI_TASK_CONNECTED)
-        {
-            /** Set the LED on if connected */
-            pico_set_led(true);
+/**
+ * @brief Run the wifi task and keep the connections in step with the Wi-Fi state.
+ * @param arg Pointer to the client pool.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _main_wifi_task(void *arg)
+{
+    client_pool_t *pool = (client_pool_t *)arg;
+    WifiTaskState_t previous = wifi_get_state();
 
-            /** Run the client task to check if we are connected */
-            if (client_task(&client) != 0)
-            {
-                printf("Failed to run client task\n");
-            }
+    /** Run the wifi task to check if we are connected */
+    wifi_task();
 
-            /** Check if we have data */
-            if (client.buffer_len > 0)
-            {
-                printf("Received data: %s\n", client.buffer);
-                memset(client.buffer, 0, sizeof(client.buffer)); // Clear the buffer
-                client.buffer_len = 0;                           // Reset the buffer length after processing
-            }
-        }
-        else
+    /** Keep the radio awake while data is flowing */
+    uint64_t bytes;
+    uint32_t pending;
+    client_pool_traffic(pool, &bytes, &pending);
+    wifi_pm_update(bytes, pending);
+
+    if (wifi_get_state() != WIFI_TASK_CONNECTED)
+    {
+        /** Drop the connections, they cannot survive without Wi-Fi */
+        client_pool_close(pool);
+    }
+    else if (previous != WIFI_TASK_CONNECTED)
+    {
+        /** Wi-Fi just came up, connect to the server without waiting out the backoff */
+        client_pool_reconnect_reset(pool);
+        sched_wake(ClientTaskId);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Run the client tasks while Wi-Fi is connected.
+ * @param arg Pointer to the client pool.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _main_client_task(void *arg)
+{
+    client_pool_t *pool = (client_pool_t *)arg;
+
+    if (wifi_get_state() != WIFI_TASK_CONNECTED)
+    {
+        return 0;
+    }
+
+    /** Run the client task to check if we are connected */
+    if (client_pool_task(pool) != 0)
+    {
+        LOG_ERROR("Failed to run client task\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief LED should be on if connected and blinking if not connected.
+ * @param arg Unused.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _main_led_task(void *arg)
+{
+    if (wifi_get_state() == WIFI_TASK_CONNECTED)
+    {
+        /** Set the LED on if connected */
+        pico_set_led(true);
+        return 0;
+    }
+
+    /** Blink the LED if not connected */
+    return led_task();
+}
+
+/**
+ * @brief Dispatch frames received on the active connection as soon as they are complete.
+ * @param arg Pointer to the client pool.
+ * @return int 0 on success, -1 on failure.
+ * @note With PICO_CLIENT_MQTT the connection carries the MQTT session instead.
+ */
+static int _main_rx_task(void *arg)
+{
+    client_t *client = client_pool_active((client_pool_t *)arg);
+#if PICO_CLIENT_MQTT
+    return mqtt_task(&Mqtt, client);
+#else
+    if (client == NULL)
+    {
+        return 0;
+    }
+
+    if (frame_poll(&Decoder, client) < 0)
+    {
+        /** Lost track of the frame boundaries, start over on a new connection */
+        LOG_WARN("Framing error, reconnecting\n");
+        client_close(client);
+        return -1;
+    }
+
+    return 0;
+#endif
+}
+
+#if !PICO_CLIENT_MQTT
+/**
+ * @brief Replay stored messages on the active connection as fast as it takes them.
+ * @param arg Pointer to the client pool.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _main_outbox_task(void *arg)
+{
+    return outbox_task(client_pool_active((client_pool_t *)arg));
+}
+
+/**
+ * @brief Ping the server on the active connection and drop the connection if it stops answering.
+ * @param arg Pointer to the client pool.
+ * @return int 0 on success, -1 if the connection was closed.
+ */
+static int _main_heartbeat_task(void *arg)
+{
+    return heartbeat_task(&Heartbeat, client_pool_active((client_pool_t *)arg));
+}
+#endif
+
+/**
+ * @brief Log a text message straight out of the receive queue.
+ * @param arg Unused.
+ * @param frame The frame.
+ * @return None.
+ */
+static void _main_text_handler(void *arg, const frame_t *frame)
+{
+    /** The log keeps up to LOG_STR_MAX bytes of a string, the rest is cut off */
+    char text[LOG_STR_MAX + 1];
+    int len = frame_copy(frame, 0, text, LOG_STR_MAX);
+
+    text[len > 0 ? len : 0] = '\0';
+    LOG_INFO("Received text: %s\n", text);
+}
+
+#if PICO_CLIENT_MQTT
+/**
+ * @brief Log a message published on the command topic.
+ * @param arg Unused.
+ * @param topic Topic.
+ * @param topic_len Length of the topic.
+ * @param payload Payload.
+ * @param len Length of the payload.
+ * @return None.
+ */
+static void _main_command_handler(void *arg, const char *topic, uint16_t topic_len, const uint8_t *payload,
+                                  uint16_t len)
+{
+    char text[LOG_STR_MAX + 1];
+    len = LWIP_MIN(len, LOG_STR_MAX);
+
+    memcpy(text, payload, len);
+    text[len] = '\0';
+    LOG_INFO("Received command: %s\n", text);
+}
+
+/**
+ * @brief A telemetry block is no longer referenced by its publish.
+ * @param arg Pointer to the busy flag of the block.
+ * @param status Unused, QoS 1 publishes are only done once acknowledged.
+ * @return None.
+ */
+static void _main_block_done(void *arg, int status)
+{
+    *(bool *)arg = false;
+}
+#endif
+
+/**
+ * @brief Log the current, high-water and failure counts of the memory pools and the Wi-Fi state.
+ * @param arg Unused.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _main_stats_task(void *arg)
+{
+    mempool_log();
+
+    const wifi_pm_stats_t *pm = wifi_pm_stats();
+    LOG_INFO("Wi-Fi power save %llu ms, performance %llu ms, %lu switches\n", (unsigned long long)pm->powersave_ms,
+             (unsigned long long)pm->performance_ms, (unsigned long)(pm->to_performance + pm->to_powersave));
+    const wifi_stats_t *wifi = wifi_stats();
+    LOG_INFO("Wi-Fi %ld dBm, %lu%% frames failed, %lu roams in %lu scans, last %lu ms, %lu failed\n",
+             (long)wifi->rssi, (unsigned long)wifi->tx_fail_percent, (unsigned long)wifi->roams,
+             (unsigned long)wifi->scans, (unsigned long)wifi->last_roam_ms, (unsigned long)wifi->roam_failures);
+
+#if LWIP_ALTCP_TLS
+    const tls_stats_t *tls = tls_stats();
+    LOG_INFO("TLS %lu handshakes, %lu of %lu offered sessions resumed, last %lu ms\n", (unsigned long)tls->handshakes,
+             (unsigned long)tls->resumed, (unsigned long)tls->offered, (unsigned long)tls->last_handshake_ms);
+#endif
+
+    telemetry_report(&Telemetry);
+    heartbeat_report(&Heartbeat);
+#if PICO_CLIENT_MQTT
+    mqtt_report(&Mqtt);
+#endif
+
+    const outbox_stats_t *ob = outbox_stats();
+    LOG_INFO("Outbox %lu stored, %lu replayed in %lu writes, %lu acked, %lu dropped, %lu bytes waiting\n",
+             (unsigned long)ob->stored, (unsigned long)ob->replayed, (unsigned long)ob->replay_writes,
+             (unsigned long)ob->acked, (unsigned long)ob->dropped, (unsigned long)outbox_backlog());
+    LOG_INFO("Outbox flash %lu programs, %lu erases, %lu failures\n", (unsigned long)ob->programs,
+             (unsigned long)ob->erases, (unsigned long)ob->failures);
+
+    return 0;
+}
+
+/**
+ * @brief Sample the telemetry channels and send a block once it is full.
+ * @param arg Pointer to the client pool.
+ * @return int 0 on success, -1 on failure.
+ * @note A block that cannot be sent is stored in the outbox as plain samples and replayed once
+ *       the connection is back. Blocks keep going to the outbox until it has caught up, so they
+ *       arrive in order.
+ */
+static int _main_telemetry_task(void *arg)
+{
+    int32_t *sample = &TelemetrySamples[TelemetryCount * MAIN_TELEMETRY_CHANNELS];
+
+    /** 12 bit reading of the sensor, 0.706 V at 27 degrees and -1.721 mV per degree */
+    float volts = adc_read() * 3.3f / (1 << 12);
+    sample[0] = (int32_t)(27000.0f - (volts - 0.706f) * (1000.0f / 0.001721f));
+
+    int32_t rssi = 0;
+    cyw43_wifi_get_rssi(&cyw43_state, &rssi);
+    sample[1] = rssi;
+
+    if (++TelemetryCount < MAIN_TELEMETRY_BLOCK)
+    {
+        return 0;
+    }
+    TelemetryCount = 0;
+
+#if PICO_CLIENT_MQTT
+    LWIP_UNUSED_ARG(arg);
+
+    /** Plain samples at QoS 1, the session holds them across reconnects while a block is free */
+    for (int i = 0; i < MAIN_MQTT_BLOCKS; i++)
+    {
+        if (!MqttBlockBusy[i])
         {
-            /** Set the client task to disconnected */
-            client.state = CLIENT_DISCONNECTED;
-            /** Blink the LED if not connected */
-            led_task();
+            memcpy(MqttBlocks[i], TelemetrySamples, sizeof(TelemetrySamples));
+            MqttBlockBusy[i] = mqtt_publish(&Mqtt, MAIN_MQTT_TOPIC_TELEMETRY, MqttBlocks[i], sizeof(MqttBlocks[i]), 1,
+                                            false, _main_block_done, &MqttBlockBusy[i]) == 0;
+            return MqttBlockBusy[i] ? 0 : -1;
         }
+    }
 
-        /** Sleep for 10ms */
-        sleep_ms(10);
+    LOG_DEBUG("Telemetry block dropped\n");
+    return -1;
+#else
+    client_t *client = client_pool_active((client_pool_t *)arg);
+    if (client != NULL && outbox_backlog() == 0 &&
+        telemetry_send(&Telemetry, client, TelemetrySamples, MAIN_TELEMETRY_BLOCK) == 0)
+    {
+        return 0;
     }
+
+    /** The encoder has not moved on, so the live stream stays decodable */
+    if (outbox_send(client, TelemetrySamples, sizeof(TelemetrySamples)) != 0)
+    {
+        LOG_DEBUG("Telemetry block dropped\n");
+        return -1;
+    }
+
+    return 0;
+#endif
 }
 
 /**
- * @brief A simple LED task to blink the LED on and off every LED_DELAY_MS milliseconds.
- * @return int 0 on success, -1 on failure.
+ * @brief Run single key commands typed on the console.
+ *
+ *  t  Dump the trace rings, for tools/trace_decode.py.
+ *  m  Print the memory pool counters.
+ *  b  Print the boot phase times.
+ *  p  Run the iperf self-test against SELFTEST_SERVER, with PICO_CLIENT_SELFTEST.
+ *
+ * @param arg Unused.
+ * @return int 0 if nothing was typed, 1 if a key was handled.
  */
-int led_task(void)
+static int _main_console_task(void *arg)
 {
-    static bool led_on = false;
-    static uint32_t timeLastRunMs = 0;
-    uint32_t currentTimeMs = to_ms_since_boot(get_absolute_time());
+#if PICO_CLIENT_SELFTEST
+    /** Printed here, the tests finish in lwIP's callbacks where the console must not block */
+    selftest_print();
+#endif
 
-    if (currentTimeMs - timeLastRunMs < LED_DELAY_MS)
+    int key = getchar_timeout_us(0);
+
+    switch (key)
     {
+    case 't':
+        trace_dump();
+        break;
+    case 'm':
+        mempool_dump();
+        break;
+    case 'b':
+        boot_report();
+        break;
+#if PICO_CLIENT_SELFTEST
+    case 'p':
+        if (selftest_run(SELFTEST_SERVER) != 0)
+        {
+            printf("Self-test busy or %s is not an address\n", SELFTEST_SERVER);
+        }
+        break;
+#endif
+    default:
         return 0;
     }
-    timeLastRunMs = currentTimeMs;
+
+    return 1;
+}
+
+/**
+ * @brief Wait a bounded time for a terminal to open the USB console, so printed output is not lost.
+ *
+ * Without a USB host the device never enumerates and the wait ends after MAIN_USB_MOUNT_WAIT_MS.
+ * Log records need no wait, they stay in their ring until a console is open.
+ *
+ * @param idle Run repeatedly while waiting, it should sleep until there is work.
+ * @return None.
+ */
+static void _main_wait_for_console(void (*idle)(void))
+{
+#if PICO_CLIENT_FAST_BOOT && LIB_PICO_STDIO_USB
+    absolute_time_t deadline = make_timeout_time_ms(MAIN_USB_MOUNT_WAIT_MS);
+    while (!tud_mounted() && !time_reached(deadline))
+    {
+        idle();
+    }
+
+    if (tud_mounted())
+    {
+        deadline = make_timeout_time_ms(MAIN_CONSOLE_WAIT_MS);
+        while (!stdio_usb_connected() && !time_reached(deadline))
+        {
+            idle();
+        }
+    }
+#else
+    (void)idle;
+#endif
+
+    boot_mark(BOOT_PHASE_CONSOLE);
+}
+
+#if PICO_CLIENT_DUAL_CORE
+/**
+ * @brief Sleep a little while core 0 waits for a console.
+ * @return None.
+ */
+static void _main_console_idle(void)
+{
+    best_effort_wfe_or_timeout(make_timeout_time_ms(10));
+}
+#endif
+
+/**
+ * @brief A simple LED task to toggle the LED, run it every LED_DELAY_MS milliseconds to blink it.
+ * @return int 0 on success, -1 on failure.
+ */
+int led_task(void)
+{
+    static bool led_on = false;
 
     led_on = !led_on;
     pico_set_led(led_on);
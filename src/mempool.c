@@ -0,0 +1,186 @@
+/** Includes *************************************************************************************/
+#include "lwip/stats.h"
+#include "lwip/memp.h"
+#include "mempool.h"
+#include "log.h"
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+typedef struct
+{
+    mempool_t *pools[MEMPOOL_MAX_POOLS];
+    uint8_t count;
+} MemPool_t;
+
+/** Variables ************************************************************************************/
+static MemPool_t MemPool = {0};
+
+/** Prototypes ***********************************************************************************/
+/** Function Definitions *************************************************************************/
+int mempool_init(mempool_t *pool, const char *name)
+{
+    if (pool == NULL || pool->storage == NULL || pool->block_size < sizeof(void *))
+    {
+        return -1;
+    }
+
+    pool->name = name;
+    pool->free_list = NULL;
+    memset(&pool->stats, 0, sizeof(pool->stats));
+
+    /** Thread the free list through the blocks, lowest address first */
+    for (int i = pool->block_count - 1; i >= 0; i--)
+    {
+        void **block = (void **)(pool->storage + (uint32_t)i * pool->block_size);
+        *block = pool->free_list;
+        pool->free_list = block;
+    }
+
+    for (uint8_t i = 0; i < MemPool.count; i++)
+    {
+        if (MemPool.pools[i] == pool)
+        {
+            return 0;
+        }
+    }
+
+    if (MemPool.count < MEMPOOL_MAX_POOLS)
+    {
+        MemPool.pools[MemPool.count++] = pool;
+    }
+
+    return 0;
+}
+
+void *mempool_alloc(mempool_t *pool)
+{
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+
+    void **block = (void **)pool->free_list;
+    if (block == NULL)
+    {
+        pool->stats.failures++;
+        return NULL;
+    }
+
+    pool->free_list = *block;
+    pool->stats.allocs++;
+    pool->stats.used++;
+    if (pool->stats.used > pool->stats.high_water)
+    {
+        pool->stats.high_water = pool->stats.used;
+    }
+
+    return block;
+}
+
+int mempool_check(mempool_t *pool, uint16_t count)
+{
+    if (pool == NULL)
+    {
+        return -1;
+    }
+
+    if (mempool_available(pool) < count)
+    {
+        pool->stats.failures++;
+        return -1;
+    }
+
+    return 0;
+}
+
+int mempool_free(mempool_t *pool, void *block)
+{
+    if (pool == NULL || block == NULL)
+    {
+        return block == NULL ? 0 : -1;
+    }
+
+    uint8_t *p = (uint8_t *)block;
+    if (p < pool->storage || p >= pool->storage + (uint32_t)pool->block_count * pool->block_size ||
+        (uint32_t)(p - pool->storage) % pool->block_size != 0)
+    {
+        return -1;
+    }
+
+    *(void **)block = pool->free_list;
+    pool->free_list = block;
+    pool->stats.used--;
+
+    return 0;
+}
+
+uint16_t mempool_available(const mempool_t *pool)
+{
+    if (pool == NULL)
+    {
+        return 0;
+    }
+
+    return pool->block_count - pool->stats.used;
+}
+
+const mempool_stats_t *mempool_stats(const mempool_t *pool)
+{
+    if (pool == NULL)
+    {
+        return NULL;
+    }
+
+    return &pool->stats;
+}
+
+void mempool_dump(void)
+{
+    printf("%-16s %6s %6s %6s %10s %8s\n", "pool", "size", "used", "max", "allocs", "fails");
+
+    for (uint8_t i = 0; i < MemPool.count; i++)
+    {
+        const mempool_t *pool = MemPool.pools[i];
+        printf("%-16s %6u %6u %6u %10lu %8lu\n", pool->name, pool->block_size, pool->stats.used,
+               pool->stats.high_water, (unsigned long)pool->stats.allocs, (unsigned long)pool->stats.failures);
+    }
+
+#if MEMP_STATS
+    /** lwIP's own pools, including the heap pools from lwippools.h when MEM_USE_POOLS is on */
+    for (int i = 0; i < MEMP_MAX; i++)
+    {
+        const struct stats_mem *mem = lwip_stats.memp[i];
+        printf("%-16s %6u %6u %6u %10s %8u\n", mem->name, (unsigned)memp_pools[i]->size, (unsigned)mem->used,
+               (unsigned)mem->max, "-", (unsigned)mem->err);
+    }
+#endif
+
+#if MEM_STATS && !MEM_USE_POOLS
+    printf("%-16s %6s %6u %6u %10s %8u\n", "lwip heap", "-", (unsigned)lwip_stats.mem.used,
+           (unsigned)lwip_stats.mem.max, "-", (unsigned)lwip_stats.mem.err);
+#endif
+}
+
+void mempool_log(void)
+{
+    for (uint8_t i = 0; i < MemPool.count; i++)
+    {
+        const mempool_t *pool = MemPool.pools[i];
+        LOG_INFO("Pool %s: %u of %u used, max %u, %lu allocs, %lu fails\n", pool->name, pool->stats.used,
+                 pool->block_count, pool->stats.high_water, (unsigned long)pool->stats.allocs,
+                 (unsigned long)pool->stats.failures);
+    }
+
+#if MEMP_STATS
+    for (int i = 0; i < MEMP_MAX; i++)
+    {
+        const struct stats_mem *mem = lwip_stats.memp[i];
+        LOG_INFO("Pool %s: %u used, max %u, %u fails\n", mem->name, (unsigned)mem->used, (unsigned)mem->max,
+                 (unsigned)mem->err);
+    }
+#endif
+
+#if MEM_STATS && !MEM_USE_POOLS
+    LOG_INFO("Pool lwip heap: %u used, max %u, %u fails\n", (unsigned)lwip_stats.mem.used,
+             (unsigned)lwip_stats.mem.max, (unsigned)lwip_stats.mem.err);
+#endif
+}
@@ -0,0 +1,1001 @@
+/** Includes *************************************************************************************/
+#include <string.h>
+#include "mqtt.h"
+#include "log.h"
+/** Defines **************************************************************************************/
+/** Control packet types, the top nibble of the first byte */
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_PUBACK 0x40
+#define MQTT_SUBSCRIBE 0x82
+#define MQTT_SUBACK 0x90
+#define MQTT_PINGREQ 0xC0
+#define MQTT_PINGRESP 0xD0
+
+/** PUBLISH flags, the bottom nibble */
+#define MQTT_FLAG_DUP 0x08
+#define MQTT_FLAG_RETAIN 0x01
+
+/** CONNECT flags */
+#define MQTT_CONNECT_USERNAME 0x80
+#define MQTT_CONNECT_PASSWORD 0x40
+#define MQTT_CONNECT_CLEAN 0x02
+
+/** Protocol level of 3.1.1 */
+#define MQTT_LEVEL 4
+
+/** Longest remaining length prefix */
+#define MQTT_LEN_BYTES_MAX 4
+
+/** Transmit descriptors of a publish, header, topic, packet identifier and payload */
+#define MQTT_PUBLISH_PIECES 4
+
+/** Typedefs *************************************************************************************/
+/** A received message on its way through the trie */
+typedef struct
+{
+    const char *topic;
+    uint16_t topic_len;
+    const uint8_t *payload;
+    uint16_t len;
+} MqttMessage_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Private Function Prototypes ******************************************************************/
+static void _mqtt_reset(mqtt_t *mqtt, client_t *client);
+static int _mqtt_connect(mqtt_t *mqtt);
+static uint16_t _mqtt_next_id(mqtt_t *mqtt);
+static void _mqtt_subscribe_all(mqtt_t *mqtt);
+static int _mqtt_subscribe_send(mqtt_t *mqtt, mqtt_sub_t *sub);
+static void _mqtt_pubacks_send(mqtt_t *mqtt);
+static int _mqtt_write(mqtt_t *mqtt, const client_segment_t *segs, int count);
+static void _mqtt_send(mqtt_t *mqtt);
+static int _mqtt_publish_send(mqtt_t *mqtt, mqtt_slot_t *slot);
+static void _mqtt_tx_done(void *arg, const uint8_t *data, uint16_t len, err_t err);
+static void _mqtt_release(mqtt_t *mqtt);
+static int _mqtt_receive(mqtt_t *mqtt);
+static int _mqtt_packet(mqtt_t *mqtt, uint8_t type, const uint8_t *body, uint32_t len);
+static int _mqtt_match(mqtt_t *mqtt, int8_t parent, uint16_t pos, const MqttMessage_t *msg);
+static int _mqtt_deliver(mqtt_t *mqtt, int8_t sub, const MqttMessage_t *msg);
+static int8_t _mqtt_node(mqtt_t *mqtt, int8_t parent, const char *level, uint8_t len);
+static int _mqtt_length(uint8_t *out, uint32_t len);
+static uint32_t _mqtt_copy_out(const client_t *client, uint32_t offset, uint8_t *buf, uint32_t len);
+
+/** Function Definitions *************************************************************************/
+int mqtt_init(mqtt_t *mqtt, const char *client_id, const char *username, const char *password)
+{
+    if (mqtt == NULL || client_id == NULL || strlen(client_id) > MQTT_CLIENT_ID_MAX || (password != NULL && username == NULL))
+    {
+        return -1;
+    }
+
+    memset(mqtt, 0, sizeof(*mqtt));
+    strcpy(mqtt->client_id, client_id);
+    mqtt->username = username;
+    mqtt->password = password;
+    mqtt->keepalive_s = MQTT_KEEPALIVE_S;
+    mqtt->window = MQTT_WINDOW_DEFAULT;
+    mqtt->state = MQTT_DISCONNECTED;
+
+    /** The root of the trie, its children are the first levels of the filters */
+    mqtt->nodes[0] = (mqtt_node_t){.level = NULL, .len = 0, .child = -1, .next = -1, .sub = -1};
+    mqtt->node_count = 1;
+
+    return 0;
+}
+
+int mqtt_set_window(mqtt_t *mqtt, uint8_t window)
+{
+    if (mqtt == NULL || window == 0 || window > MQTT_QUEUE_MAX)
+    {
+        return -1;
+    }
+
+    mqtt->window = window;
+
+    return 0;
+}
+
+int mqtt_task(mqtt_t *mqtt, client_t *client)
+{
+    if (mqtt == NULL)
+    {
+        return -1;
+    }
+
+    if (client == NULL || client->state != CLIENT_CONNECTED || client->transport == CLIENT_TRANSPORT_UDP)
+    {
+        mqtt->state = MQTT_DISCONNECTED;
+        return 0;
+    }
+
+    if (client != mqtt->client || client->stats.connect_successes != mqtt->connection)
+    {
+        _mqtt_reset(mqtt, client);
+    }
+
+    if (mqtt->state == MQTT_DISCONNECTED && _mqtt_connect(mqtt) != 0)
+    {
+        /** The transmit queue is full, try again on the next run */
+        return 0;
+    }
+
+    /** PUBACKs that did not fit in the transmit queue before, ahead of anything received since */
+    _mqtt_pubacks_send(mqtt);
+
+    if (_mqtt_receive(mqtt) != 0)
+    {
+        mqtt->state = MQTT_DISCONNECTED;
+        client_close(client);
+        return -1;
+    }
+
+    if ((mqtt->state == MQTT_CONNECTING || mqtt->ping_out) && time_reached(mqtt->response_deadline))
+    {
+        LOG_WARN("MQTT broker did not answer, reconnecting\n");
+        mqtt->stats.timeouts++;
+        mqtt->state = MQTT_DISCONNECTED;
+        client_close(client);
+        return -1;
+    }
+
+    if (mqtt->state == MQTT_CONNECTED)
+    {
+        _mqtt_subscribe_all(mqtt);
+        _mqtt_send(mqtt);
+
+        if (!mqtt->ping_out && mqtt->keepalive_s > 0 &&
+            absolute_time_diff_us(mqtt->last_tx, get_absolute_time()) >= (int64_t)mqtt->keepalive_s * 500000)
+        {
+            uint8_t ping[2] = {MQTT_PINGREQ, 0};
+            client_segment_t seg = {ping, sizeof(ping)};
+            if (_mqtt_write(mqtt, &seg, 1) == 0)
+            {
+                mqtt->ping_out = true;
+                mqtt->ping_sent_us = time_us_32();
+                mqtt->response_deadline = make_timeout_time_ms(MQTT_RESPONSE_TIMEOUT_MS);
+            }
+        }
+    }
+
+    _mqtt_release(mqtt);
+
+    return 0;
+}
+
+int mqtt_publish(mqtt_t *mqtt, const char *topic, const void *payload, uint16_t len, uint8_t qos, bool retain,
+                 mqtt_done_fn_t done, void *arg)
+{
+    if (mqtt == NULL || topic == NULL || (payload == NULL && len > 0) || qos > 1 || mqtt->slot_count >= MQTT_QUEUE_MAX)
+    {
+        return -1;
+    }
+
+    size_t topic_len = strlen(topic);
+    if (topic_len == 0 || topic_len > UINT16_MAX || strpbrk(topic, "+#") != NULL)
+    {
+        return -1;
+    }
+
+    mqtt_slot_t *slot = &mqtt->slots[(mqtt->slot_head + mqtt->slot_count) % MQTT_QUEUE_MAX];
+    *slot = (mqtt_slot_t){
+        .mqtt = mqtt,
+        .topic = topic,
+        .payload = (const uint8_t *)payload,
+        .topic_len = (uint16_t)topic_len,
+        .len = len,
+        .done = done,
+        .arg = arg,
+        .qos = qos,
+        .retain = retain,
+    };
+
+    if (qos > 0)
+    {
+        slot->id = _mqtt_next_id(mqtt);
+        slot->id_bytes[0] = (uint8_t)(slot->id >> 8);
+        slot->id_bytes[1] = (uint8_t)slot->id;
+    }
+
+    mqtt->slot_count++;
+    mqtt->stats.published++;
+
+    if (mqtt->state == MQTT_CONNECTED)
+    {
+        _mqtt_send(mqtt);
+    }
+
+    return 0;
+}
+
+int mqtt_subscribe(mqtt_t *mqtt, const char *filter, uint8_t qos, mqtt_message_fn_t fn, void *arg)
+{
+    if (mqtt == NULL || filter == NULL || fn == NULL || qos > 1)
+    {
+        return -1;
+    }
+
+    size_t len = strlen(filter);
+    if (len == 0 || len > UINT16_MAX)
+    {
+        return -1;
+    }
+
+    for (size_t i = 0; i < len; i++)
+    {
+        bool alone = (i == 0 || filter[i - 1] == '/') && (i + 1 == len || filter[i + 1] == '/');
+        if ((filter[i] == '+' && !alone) || (filter[i] == '#' && (!alone || i + 1 != len)))
+        {
+            /** Wildcards stand for whole levels, and # only for the last one */
+            return -1;
+        }
+    }
+
+    /** Walk down the levels, adding the ones no other filter has */
+    int8_t node = 0;
+    for (size_t start = 0; start <= len;)
+    {
+        size_t end = start;
+        while (end < len && filter[end] != '/')
+        {
+            end++;
+        }
+
+        if (end - start > UINT8_MAX || (node = _mqtt_node(mqtt, node, &filter[start], (uint8_t)(end - start))) < 0)
+        {
+            return -1;
+        }
+        start = end + 1;
+    }
+
+    mqtt_sub_t *sub;
+    if (mqtt->nodes[node].sub >= 0)
+    {
+        /** Same filter again, the new callback replaces the old one */
+        sub = &mqtt->subs[mqtt->nodes[node].sub];
+    }
+    else
+    {
+        if (mqtt->sub_count >= MQTT_SUBS_MAX)
+        {
+            return -1;
+        }
+        mqtt->nodes[node].sub = (int8_t)mqtt->sub_count;
+        sub = &mqtt->subs[mqtt->sub_count++];
+    }
+
+    sub->filter = filter;
+    sub->qos = qos;
+    sub->fn = fn;
+    sub->arg = arg;
+    /** A SUBACK still outstanding is for the old QoS, it no longer counts */
+    sub->id = 0;
+    sub->subscribed = false;
+
+    if (mqtt->state == MQTT_CONNECTED)
+    {
+        _mqtt_subscribe_all(mqtt);
+    }
+
+    return 0;
+}
+
+uint32_t mqtt_pending(const mqtt_t *mqtt)
+{
+    return mqtt != NULL ? mqtt->slot_count : 0;
+}
+
+void mqtt_report(const mqtt_t *mqtt)
+{
+    const mqtt_stats_t *stats = &mqtt->stats;
+    if (stats->connects == 0)
+    {
+        return;
+    }
+
+    LOG_INFO("MQTT %lu connects, %lu resumed, %lu published, %lu acked, %lu resent, %lu lost, %lu queued\n",
+             (unsigned long)stats->connects, (unsigned long)stats->resumed, (unsigned long)stats->published,
+             (unsigned long)stats->acked, (unsigned long)stats->resent, (unsigned long)stats->lost,
+             (unsigned long)mqtt->slot_count);
+    LOG_INFO("MQTT %lu received, %lu unmatched, %lu copied, %lu timeouts, ping %lu us\n",
+             (unsigned long)stats->received, (unsigned long)stats->unmatched, (unsigned long)stats->copied,
+             (unsigned long)stats->timeouts, (unsigned long)stats->ping_rtt_us);
+}
+
+/**
+ * @brief Start a session on a new connection, everything not acknowledged is sent again.
+ * @param mqtt Pointer to the engine.
+ * @param client The connection.
+ * @return None.
+ */
+static void _mqtt_reset(mqtt_t *mqtt, client_t *client)
+{
+    mqtt->client = client;
+    mqtt->connection = client->stats.connect_successes;
+    mqtt->state = MQTT_DISCONNECTED;
+    mqtt->ping_out = false;
+
+    for (int i = 0; i < mqtt->slot_count; i++)
+    {
+        /** Nothing of the old connection references the slots any more */
+        mqtt_slot_t *slot = &mqtt->slots[(mqtt->slot_head + i) % MQTT_QUEUE_MAX];
+        slot->sent = false;
+        slot->queued = false;
+    }
+
+    /** Subscribed again on the new connection, the broker may hold a session without them */
+    for (int i = 0; i < mqtt->sub_count; i++)
+    {
+        mqtt->subs[i].id = 0;
+        mqtt->subs[i].subscribed = false;
+    }
+
+    /** Unacknowledged messages are redelivered by the broker, a late PUBACK would be for the old session */
+    mqtt->puback_count = 0;
+}
+
+/**
+ * @brief Send the CONNECT, asking the broker to keep the session.
+ * @param mqtt Pointer to the engine.
+ * @return int 0 on success, -1 if it could not be queued.
+ */
+static int _mqtt_connect(mqtt_t *mqtt)
+{
+    uint16_t id_len = (uint16_t)strlen(mqtt->client_id);
+    uint16_t user_len = mqtt->username != NULL ? (uint16_t)strlen(mqtt->username) : 0;
+    uint16_t pass_len = mqtt->password != NULL ? (uint16_t)strlen(mqtt->password) : 0;
+
+    uint8_t flags = 0;
+    flags |= mqtt->username != NULL ? MQTT_CONNECT_USERNAME : 0;
+    flags |= mqtt->password != NULL ? MQTT_CONNECT_PASSWORD : 0;
+
+    uint8_t variable[12] = {0, 4, 'M', 'Q', 'T', 'T', MQTT_LEVEL, flags,
+                            (uint8_t)(mqtt->keepalive_s >> 8), (uint8_t)mqtt->keepalive_s,
+                            (uint8_t)(id_len >> 8), (uint8_t)id_len};
+    uint8_t user_hdr[2] = {(uint8_t)(user_len >> 8), (uint8_t)user_len};
+    uint8_t pass_hdr[2] = {(uint8_t)(pass_len >> 8), (uint8_t)pass_len};
+
+    uint32_t remaining = sizeof(variable) + id_len;
+    remaining += mqtt->username != NULL ? 2u + user_len : 0;
+    remaining += mqtt->password != NULL ? 2u + pass_len : 0;
+
+    uint8_t head[1 + MQTT_LEN_BYTES_MAX] = {MQTT_CONNECT};
+    int head_len = 1 + _mqtt_length(&head[1], remaining);
+
+    client_segment_t segs[7] = {
+        {head, (uint16_t)head_len},
+        {variable, sizeof(variable)},
+        {(const uint8_t *)mqtt->client_id, id_len},
+    };
+    int count = 3;
+    if (mqtt->username != NULL)
+    {
+        segs[count++] = (client_segment_t){user_hdr, sizeof(user_hdr)};
+        segs[count++] = (client_segment_t){(const uint8_t *)mqtt->username, user_len};
+    }
+    if (mqtt->password != NULL)
+    {
+        segs[count++] = (client_segment_t){pass_hdr, sizeof(pass_hdr)};
+        segs[count++] = (client_segment_t){(const uint8_t *)mqtt->password, pass_len};
+    }
+
+    if (_mqtt_write(mqtt, segs, count) != 0)
+    {
+        return -1;
+    }
+
+    mqtt->state = MQTT_CONNECTING;
+    mqtt->response_deadline = make_timeout_time_ms(MQTT_RESPONSE_TIMEOUT_MS);
+
+    return 0;
+}
+
+/**
+ * @brief Take the next packet identifier that no QoS 1 publish or SUBSCRIBE is still waiting on.
+ * @param mqtt Pointer to the engine.
+ * @return uint16_t Packet identifier, never 0.
+ */
+static uint16_t _mqtt_next_id(mqtt_t *mqtt)
+{
+    bool taken = true;
+    while (taken)
+    {
+        mqtt->next_id = mqtt->next_id == UINT16_MAX ? 1 : mqtt->next_id + 1;
+        taken = false;
+        for (int i = 0; i < mqtt->slot_count && !taken; i++)
+        {
+            const mqtt_slot_t *other = &mqtt->slots[(mqtt->slot_head + i) % MQTT_QUEUE_MAX];
+            taken = other->qos > 0 && other->id == mqtt->next_id;
+        }
+        for (int i = 0; i < mqtt->sub_count && !taken; i++)
+        {
+            taken = mqtt->subs[i].id == mqtt->next_id;
+        }
+    }
+
+    return mqtt->next_id;
+}
+
+/**
+ * @brief Send a SUBSCRIBE for every filter not yet subscribed on this connection.
+ * @param mqtt Pointer to the engine.
+ * @return None.
+ * @note Stops at the first that does not fit in the transmit queue, the next run carries on.
+ */
+static void _mqtt_subscribe_all(mqtt_t *mqtt)
+{
+    for (int i = 0; i < mqtt->sub_count; i++)
+    {
+        mqtt_sub_t *sub = &mqtt->subs[i];
+        if (!sub->subscribed && sub->id == 0 && _mqtt_subscribe_send(mqtt, sub) != 0)
+        {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Send a SUBSCRIBE for one filter.
+ * @param mqtt Pointer to the engine.
+ * @param sub The subscription, keeps the packet identifier until the SUBACK.
+ * @return int 0 on success, -1 if it could not be queued.
+ */
+static int _mqtt_subscribe_send(mqtt_t *mqtt, mqtt_sub_t *sub)
+{
+    uint16_t len = (uint16_t)strlen(sub->filter);
+    uint16_t id = _mqtt_next_id(mqtt);
+
+    uint8_t head[1 + MQTT_LEN_BYTES_MAX + 4] = {MQTT_SUBSCRIBE};
+    int head_len = 1 + _mqtt_length(&head[1], 2u + 2u + len + 1u);
+    head[head_len++] = (uint8_t)(id >> 8);
+    head[head_len++] = (uint8_t)id;
+    head[head_len++] = (uint8_t)(len >> 8);
+    head[head_len++] = (uint8_t)len;
+
+    client_segment_t segs[3] = {
+        {head, (uint16_t)head_len},
+        {(const uint8_t *)sub->filter, len},
+        {&sub->qos, 1},
+    };
+
+    if (_mqtt_write(mqtt, segs, 3) != 0)
+    {
+        return -1;
+    }
+    sub->id = id;
+
+    return 0;
+}
+
+/**
+ * @brief Send the PUBACKs of received QoS 1 messages, in the order the messages arrived.
+ * @param mqtt Pointer to the engine.
+ * @return None.
+ * @note Those that do not fit in the transmit queue stay queued for the next run.
+ */
+static void _mqtt_pubacks_send(mqtt_t *mqtt)
+{
+    uint8_t sent = 0;
+    while (sent < mqtt->puback_count)
+    {
+        uint16_t id = mqtt->pubacks[sent];
+        uint8_t puback[4] = {MQTT_PUBACK, 2, (uint8_t)(id >> 8), (uint8_t)id};
+        client_segment_t seg = {puback, sizeof(puback)};
+        if (_mqtt_write(mqtt, &seg, 1) != 0)
+        {
+            break;
+        }
+        sent++;
+    }
+
+    mqtt->puback_count -= sent;
+    memmove(mqtt->pubacks, &mqtt->pubacks[sent], mqtt->puback_count * sizeof(mqtt->pubacks[0]));
+}
+
+/**
+ * @brief Queue a packet built from copied pieces.
+ * @param mqtt Pointer to the engine.
+ * @param segs Pieces of the packet.
+ * @param count Number of pieces.
+ * @return int 0 on success, -1 if the transmit queue is full.
+ */
+static int _mqtt_write(mqtt_t *mqtt, const client_segment_t *segs, int count)
+{
+    if (client_writev(mqtt->client, segs, count) != 0)
+    {
+        return -1;
+    }
+
+    client_flush(mqtt->client);
+    mqtt->last_tx = get_absolute_time();
+
+    return 0;
+}
+
+/**
+ * @brief Send the queued publishes in order, as many QoS 1 ones as the window allows.
+ * @param mqtt Pointer to the engine.
+ * @return None.
+ */
+static void _mqtt_send(mqtt_t *mqtt)
+{
+    uint32_t inflight = 0;
+    bool wrote = false;
+
+    for (int i = 0; i < mqtt->slot_count; i++)
+    {
+        mqtt_slot_t *slot = &mqtt->slots[(mqtt->slot_head + i) % MQTT_QUEUE_MAX];
+        if (slot->acked || slot->lost)
+        {
+            continue;
+        }
+
+        if (slot->sent)
+        {
+            inflight += slot->qos > 0 ? 1 : 0;
+            continue;
+        }
+
+        /** Later publishes wait as well, so they reach the broker in the order they were queued */
+        if (slot->queued || (slot->qos > 0 && inflight >= mqtt->window) || _mqtt_publish_send(mqtt, slot) != 0)
+        {
+            break;
+        }
+
+        inflight += slot->qos > 0 ? 1 : 0;
+        wrote = true;
+    }
+
+    if (wrote)
+    {
+        client_flush(mqtt->client);
+        mqtt->last_tx = get_absolute_time();
+    }
+}
+
+/**
+ * @brief Write a publish, the header from the slot and the topic and payload by reference.
+ * @param mqtt Pointer to the engine.
+ * @param slot The publish.
+ * @return int 0 on success, -1 if the transmit queue has no room for all of it.
+ */
+static int _mqtt_publish_send(mqtt_t *mqtt, mqtt_slot_t *slot)
+{
+    client_t *client = mqtt->client;
+    int pieces = 2 + (slot->qos > 0 ? 1 : 0) + (slot->len > 0 ? 1 : 0);
+    if (client->state != CLIENT_CONNECTED || CLIENT_TX_QUEUE_DEPTH - client->tx_count < pieces)
+    {
+        /** The slot stays unsent, it goes out on this connection later or on the next one */
+        return -1;
+    }
+
+    uint8_t flags = (uint8_t)(slot->qos << 1) | (slot->retain ? MQTT_FLAG_RETAIN : 0);
+    flags |= slot->written && slot->qos > 0 ? MQTT_FLAG_DUP : 0;
+    uint32_t remaining = 2u + slot->topic_len + (slot->qos > 0 ? 2u : 0u) + slot->len;
+
+    slot->head[0] = MQTT_PUBLISH | flags;
+    slot->head_len = (uint8_t)(1 + _mqtt_length(&slot->head[1], remaining));
+    slot->head[slot->head_len++] = (uint8_t)(slot->topic_len >> 8);
+    slot->head[slot->head_len++] = (uint8_t)slot->topic_len;
+
+    /** The last piece reports when the client is done with all of them, they are released in order */
+    if (client_write_ref(client, slot->head, slot->head_len, NULL, NULL) != 0 ||
+        client_write_ref(client, slot->topic, slot->topic_len, pieces == 2 ? _mqtt_tx_done : NULL, slot) != 0 ||
+        (slot->qos > 0 &&
+         client_write_ref(client, slot->id_bytes, sizeof(slot->id_bytes), slot->len == 0 ? _mqtt_tx_done : NULL, slot) != 0) ||
+        (slot->len > 0 && client_write_ref(client, slot->payload, slot->len, _mqtt_tx_done, slot) != 0))
+    {
+        /** Part of the packet may be queued, only a new connection gets the stream back in step */
+        LOG_WARN("MQTT publish cut short, reconnecting\n");
+        mqtt->state = MQTT_DISCONNECTED;
+        client_close(client);
+        return -1;
+    }
+
+    if (slot->written)
+    {
+        mqtt->stats.resent++;
+    }
+    slot->sent = true;
+    slot->written = true;
+    slot->queued = true;
+
+    return 0;
+}
+
+/**
+ * @brief Note that the client no longer references a publish, called in send order.
+ * @param arg Pointer to the slot.
+ * @param data Unused.
+ * @param len Unused.
+ * @param err ERR_OK once acked by TCP, otherwise why it was dropped.
+ * @return None.
+ */
+static void _mqtt_tx_done(void *arg, const uint8_t *data, uint16_t len, err_t err)
+{
+    mqtt_slot_t *slot = (mqtt_slot_t *)arg;
+
+    slot->queued = false;
+    if (slot->qos == 0)
+    {
+        /** At most once, a QoS 0 publish is not sent again */
+        slot->acked = err == ERR_OK;
+        slot->lost = err != ERR_OK;
+        slot->mqtt->stats.lost += err != ERR_OK ? 1 : 0;
+    }
+}
+
+/**
+ * @brief Hand finished publishes back to their owners, in the order they were queued.
+ * @param mqtt Pointer to the engine.
+ * @return None.
+ */
+static void _mqtt_release(mqtt_t *mqtt)
+{
+    while (mqtt->slot_count > 0)
+    {
+        mqtt_slot_t *slot = &mqtt->slots[mqtt->slot_head];
+        if ((!slot->acked && !slot->lost) || slot->queued)
+        {
+            return;
+        }
+
+        mqtt_done_fn_t done = slot->done;
+        void *arg = slot->arg;
+        int status = slot->lost ? -1 : 0;
+
+        /** Free before the callback, which may queue the next publish */
+        mqtt->slot_head = (uint8_t)((mqtt->slot_head + 1) % MQTT_QUEUE_MAX);
+        mqtt->slot_count--;
+
+        if (done != NULL)
+        {
+            done(arg, status);
+        }
+    }
+}
+
+/**
+ * @brief Handle every complete packet waiting in the client receive queue.
+ * @param mqtt Pointer to the engine.
+ * @return int 0 on success, -1 if the stream is corrupt or the broker refused the session.
+ */
+static int _mqtt_receive(mqtt_t *mqtt)
+{
+    client_t *client = mqtt->client;
+
+    /** Every packet may need a PUBACK, leave them in the receive queue until there is room */
+    while (mqtt->puback_count < MQTT_PUBACKS_MAX)
+    {
+        uint8_t hdr[1 + MQTT_LEN_BYTES_MAX];
+        int n = client_peek(client, hdr, sizeof(hdr));
+        if (n < 2)
+        {
+            return 0;
+        }
+
+        uint32_t len = 0;
+        int i = 1;
+        for (; i <= MQTT_LEN_BYTES_MAX; i++)
+        {
+            if (i >= n)
+            {
+                return 0;
+            }
+
+            len |= (uint32_t)(hdr[i] & 0x7f) << (7 * (i - 1));
+            if ((hdr[i] & 0x80) == 0)
+            {
+                break;
+            }
+        }
+
+        if (i > MQTT_LEN_BYTES_MAX || len > MQTT_RX_MAX)
+        {
+            LOG_WARN("MQTT packet of %lu bytes cannot be received\n", (unsigned long)len);
+            return -1;
+        }
+
+        uint32_t hdr_len = (uint32_t)i + 1;
+        if (client_rx_available(client) < hdr_len + len)
+        {
+            return 0;
+        }
+
+        /** In place if the pbuf holds all of it, the usual case */
+        const uint8_t *body = mqtt->scratch;
+        client_segment_t seg;
+        if (len > 0 && client_rx_segments(client, hdr_len, &seg, 1) == 1 && seg.len >= len)
+        {
+            body = seg.data;
+        }
+        else if (len > 0)
+        {
+            _mqtt_copy_out(client, hdr_len, mqtt->scratch, len);
+            mqtt->stats.copied++;
+        }
+
+        int rc = _mqtt_packet(mqtt, hdr[0], body, len);
+        client_consume(client, hdr_len + len);
+
+        if (rc != 0)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Handle one packet from the broker.
+ * @param mqtt Pointer to the engine.
+ * @param type First byte, packet type and flags.
+ * @param body Variable header and payload.
+ * @param len Length of the body.
+ * @return int 0 on success, -1 if the session has to end.
+ */
+static int _mqtt_packet(mqtt_t *mqtt, uint8_t type, const uint8_t *body, uint32_t len)
+{
+    switch (type & 0xF0)
+    {
+    case MQTT_CONNACK:
+        if (len < 2 || body[1] != 0)
+        {
+            LOG_WARN("MQTT broker refused the connection, code %u\n", len < 2 ? 0xffu : body[1]);
+            mqtt->stats.refused++;
+            return -1;
+        }
+
+        mqtt->state = MQTT_CONNECTED;
+        mqtt->stats.connects++;
+        mqtt->stats.resumed += (body[0] & 0x01) ? 1 : 0;
+
+        /** Even a resumed session may be missing filters added since it was set up */
+        _mqtt_subscribe_all(mqtt);
+        LOG_INFO("MQTT connected, session %s\n", (body[0] & 0x01) ? "resumed" : "new");
+        return 0;
+
+    case MQTT_PUBACK:
+        if (len >= 2)
+        {
+            uint16_t id = (uint16_t)(body[0] << 8 | body[1]);
+            for (int i = 0; i < mqtt->slot_count; i++)
+            {
+                mqtt_slot_t *slot = &mqtt->slots[(mqtt->slot_head + i) % MQTT_QUEUE_MAX];
+                if (slot->qos > 0 && slot->written && !slot->acked && slot->id == id)
+                {
+                    slot->acked = true;
+                    mqtt->stats.acked++;
+                    break;
+                }
+            }
+        }
+        return 0;
+
+    case MQTT_SUBACK:
+        if (len >= 2)
+        {
+            uint16_t id = (uint16_t)(body[0] << 8 | body[1]);
+            for (int i = 0; i < mqtt->sub_count; i++)
+            {
+                if (mqtt->subs[i].id == id)
+                {
+                    /** Refused filters are not sent again until the next connection either */
+                    mqtt->subs[i].id = 0;
+                    mqtt->subs[i].subscribed = true;
+                }
+            }
+        }
+        for (uint32_t i = 2; i < len; i++)
+        {
+            mqtt->stats.sub_failures += body[i] == 0x80 ? 1 : 0;
+        }
+        return 0;
+
+    case MQTT_PINGRESP:
+        if (mqtt->ping_out)
+        {
+            mqtt->ping_out = false;
+            mqtt->stats.ping_rtt_us = time_us_32() - mqtt->ping_sent_us;
+        }
+        return 0;
+
+    case MQTT_PUBLISH:
+        break;
+
+    default:
+        return 0;
+    }
+
+    /** Subscriptions ask for QoS 1 at most, a broker sending QoS 2 is not following them */
+    uint8_t qos = (type >> 1) & 0x03;
+    uint32_t id_len = qos > 0 ? 2 : 0;
+    if (qos > 1 || len < 2 || len < 2u + (uint32_t)(body[0] << 8 | body[1]) + id_len)
+    {
+        return -1;
+    }
+
+    MqttMessage_t msg = {
+        .topic = (const char *)&body[2],
+        .topic_len = (uint16_t)(body[0] << 8 | body[1]),
+    };
+    const uint8_t *rest = body + 2 + msg.topic_len;
+    msg.payload = rest + id_len;
+    msg.len = (uint16_t)(len - 2 - msg.topic_len - id_len);
+
+    mqtt->stats.received++;
+    if (_mqtt_match(mqtt, 0, 0, &msg) == 0)
+    {
+        mqtt->stats.unmatched++;
+    }
+
+    if (qos > 0)
+    {
+        /** _mqtt_receive() stops reading while there is no room, so this always fits */
+        mqtt->pubacks[mqtt->puback_count++] = (uint16_t)(rest[0] << 8 | rest[1]);
+        _mqtt_pubacks_send(mqtt);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Call every subscription below a node whose filter matches the rest of the topic.
+ * @param mqtt Pointer to the engine.
+ * @param parent Node the previous levels led to.
+ * @param pos Start of the next level in the topic.
+ * @param msg The message.
+ * @return int Number of subscriptions called.
+ */
+static int _mqtt_match(mqtt_t *mqtt, int8_t parent, uint16_t pos, const MqttMessage_t *msg)
+{
+    uint16_t end = pos;
+    while (end < msg->topic_len && msg->topic[end] != '/')
+    {
+        end++;
+    }
+    bool last = end >= msg->topic_len;
+
+    /** Topics starting with $ are the broker's own, wildcards at the first level skip them */
+    bool wildcards = parent != 0 || msg->topic_len == 0 || msg->topic[0] != '$';
+    int matched = 0;
+
+    for (int8_t c = mqtt->nodes[parent].child; c >= 0; c = mqtt->nodes[c].next)
+    {
+        const mqtt_node_t *node = &mqtt->nodes[c];
+        bool plus = node->len == 1 && node->level[0] == '+';
+
+        if (node->len == 1 && node->level[0] == '#')
+        {
+            matched += wildcards ? _mqtt_deliver(mqtt, node->sub, msg) : 0;
+            continue;
+        }
+
+        if (!(plus && wildcards) && (node->len != end - pos || memcmp(node->level, &msg->topic[pos], node->len) != 0))
+        {
+            continue;
+        }
+
+        if (!last)
+        {
+            matched += _mqtt_match(mqtt, c, (uint16_t)(end + 1), msg);
+            continue;
+        }
+
+        /** The last level, a/# matches a as well */
+        matched += _mqtt_deliver(mqtt, node->sub, msg);
+        for (int8_t g = node->child; g >= 0; g = mqtt->nodes[g].next)
+        {
+            if (mqtt->nodes[g].len == 1 && mqtt->nodes[g].level[0] == '#')
+            {
+                matched += _mqtt_deliver(mqtt, mqtt->nodes[g].sub, msg);
+            }
+        }
+    }
+
+    return matched;
+}
+
+/**
+ * @brief Call a subscription with a message.
+ * @param mqtt Pointer to the engine.
+ * @param sub Subscription index, -1 for a node no filter ends at.
+ * @param msg The message.
+ * @return int 1 if a subscription was called, 0 otherwise.
+ */
+static int _mqtt_deliver(mqtt_t *mqtt, int8_t sub, const MqttMessage_t *msg)
+{
+    if (sub < 0)
+    {
+        return 0;
+    }
+
+    mqtt->subs[sub].fn(mqtt->subs[sub].arg, msg->topic, msg->topic_len, msg->payload, msg->len);
+
+    return 1;
+}
+
+/**
+ * @brief Find the child of a node for a filter level, adding it if there is none.
+ * @param mqtt Pointer to the engine.
+ * @param parent The node.
+ * @param level The level, referenced.
+ * @param len Length of the level.
+ * @return int8_t The child, -1 if the trie is full.
+ */
+static int8_t _mqtt_node(mqtt_t *mqtt, int8_t parent, const char *level, uint8_t len)
+{
+    for (int8_t c = mqtt->nodes[parent].child; c >= 0; c = mqtt->nodes[c].next)
+    {
+        if (mqtt->nodes[c].len == len && memcmp(mqtt->nodes[c].level, level, len) == 0)
+        {
+            return c;
+        }
+    }
+
+    if (mqtt->node_count >= MQTT_TRIE_NODES)
+    {
+        return -1;
+    }
+
+    int8_t c = (int8_t)mqtt->node_count++;
+    mqtt->nodes[c] = (mqtt_node_t){.level = level, .len = len, .child = -1, .next = mqtt->nodes[parent].child, .sub = -1};
+    mqtt->nodes[parent].child = c;
+
+    return c;
+}
+
+/**
+ * @brief Write a remaining length, 7 bits per byte, least significant group first.
+ * @param out Destination, up to MQTT_LEN_BYTES_MAX bytes.
+ * @param len The length.
+ * @return int Bytes written.
+ */
+static int _mqtt_length(uint8_t *out, uint32_t len)
+{
+    int n = 0;
+
+    do
+    {
+        out[n] = (uint8_t)(len & 0x7f);
+        len >>= 7;
+        out[n++] |= len > 0 ? 0x80 : 0;
+    } while (len > 0);
+
+    return n;
+}
+
+/**
+ * @brief Copy received data that is spread over several pbufs.
+ * @param client Pointer to the client structure.
+ * @param offset Offset into the unconsumed data.
+ * @param buf Destination buffer.
+ * @param len Number of bytes to copy.
+ * @return uint32_t Bytes copied.
+ */
+static uint32_t _mqtt_copy_out(const client_t *client, uint32_t offset, uint8_t *buf, uint32_t len)
+{
+    uint32_t copied = 0;
+
+    while (copied < len)
+    {
+        client_segment_t segs[4];
+        int count = client_rx_segments(client, offset + copied, segs, 4);
+        if (count <= 0)
+        {
+            break;
+        }
+
+        for (int i = 0; i < count && copied < len; i++)
+        {
+            uint32_t chunk = LWIP_MIN((uint32_t)segs[i].len, len - copied);
+            memcpy(buf + copied, segs[i].data, chunk);
+            copied += chunk;
+        }
+    }
+
+    return copied;
+}
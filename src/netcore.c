@@ -0,0 +1,337 @@
+/** Includes *************************************************************************************/
+#include "pico/multicore.h"
+#include "pico/async_context.h"
+#include "netcore.h"
+#include "spsc.h"
+#include "sched.h"
+#include "trace.h"
+#include "log.h"
+#include "wifi_pm.h"
+/** Defines **************************************************************************************/
+#ifndef LED_DELAY_MS
+#define LED_DELAY_MS 250
+#endif
+
+/** Typedefs *************************************************************************************/
+typedef struct
+{
+    const char *ssid;
+    const char *password;
+    const char *ip_address;
+    volatile WifiTaskState_t wifi_state;
+    volatile client_state_t client_state;
+    volatile bool rx_blocked;  /** Core 1 left data queued because the rx ring was full */
+    client_t client;
+    int client_task_id;
+} NetCore_t;
+
+/** Variables ************************************************************************************/
+static NetCore_t NetCore = {
+    .ssid = NULL,
+    .password = NULL,
+    .ip_address = NULL,
+    .wifi_state = WIFI_TASK_DISCONNECTED,
+    .client_state = CLIENT_DISCONNECTED,
+    .rx_blocked = false,
+    .client = {0},
+    .client_task_id = -1,
+};
+
+/** Received data, produced by core 1 and consumed by core 0 */
+static spsc_ring_t RxRing;
+static uint8_t RxRingBuf[NETCORE_RX_RING_SIZE];
+
+/** Outgoing messages, produced by core 0 and consumed by core 1 */
+static spsc_ring_t TxRing;
+static uint8_t TxRingBuf[NETCORE_TX_RING_SIZE];
+
+/** Lets core 0 wake core 1 out of cyw43_arch_wait_for_work_until() when the rings need service */
+static void _netcore_do_work(async_context_t *context, async_when_pending_worker_t *worker);
+static async_when_pending_worker_t NetCoreWorker = {
+    .do_work = _netcore_do_work,
+};
+
+/** Prototypes ***********************************************************************************/
+/** Implemented in main.c */
+void pico_set_led(bool led_on);
+int led_task(void);
+
+/** Private Function Prototypes ******************************************************************/
+static void _netcore_main(void);
+static int _netcore_wifi_task(void *arg);
+static int _netcore_client_task(void *arg);
+static int _netcore_led_task(void *arg);
+static int _netcore_rings_task(void *arg);
+static void _netcore_pump_rx(client_t *client);
+static void _netcore_pump_tx(client_t *client);
+
+/** Function Definitions *************************************************************************/
+int netcore_start(const char *ssid, const char *password, const char *ip_address)
+{
+    if (ssid == NULL || password == NULL || ip_address == NULL)
+    {
+        return -1;
+    }
+
+    NetCore.ssid = ssid;
+    NetCore.password = password;
+    NetCore.ip_address = ip_address;
+
+    spsc_init(&RxRing, RxRingBuf, sizeof(RxRingBuf));
+    spsc_init(&TxRing, TxRingBuf, sizeof(TxRingBuf));
+
+    multicore_launch_core1(_netcore_main);
+
+    return 0;
+}
+
+int netcore_recv(void *buf, uint16_t max)
+{
+    if (buf == NULL)
+    {
+        return -1;
+    }
+
+    int len = spsc_pop(&RxRing, buf, max);
+
+    if (len > 0 && NetCore.rx_blocked)
+    {
+        /** There is room again, have core 1 move the data it held back */
+        NetCore.rx_blocked = false;
+        async_context_set_work_pending(cyw43_arch_async_context(), &NetCoreWorker);
+    }
+
+    return len;
+}
+
+int netcore_send(const void *data, uint16_t len)
+{
+    if (data == NULL || len == 0 || len > NETCORE_MSG_MAX)
+    {
+        return -1;
+    }
+
+    if (spsc_push(&TxRing, data, len) != 0)
+    {
+        return -1;
+    }
+
+    /** Safe from any core, wakes core 1 to move the message into the client */
+    async_context_set_work_pending(cyw43_arch_async_context(), &NetCoreWorker);
+
+    return 0;
+}
+
+WifiTaskState_t netcore_wifi_state(void)
+{
+    return NetCore.wifi_state;
+}
+
+client_state_t netcore_client_state(void)
+{
+    return NetCore.client_state;
+}
+
+/**
+ * @brief Core 1 entry point, owns the cyw43 driver, lwIP and the client.
+ * @return None.
+ * @note With the poll architecture the driver has to be initialised and polled from the same
+ *       core, so core 1 does both and core 0 never touches the driver, including the LED.
+ */
+static void _netcore_main(void)
+{
+    trace_init();
+    log_init();
+
+    if (wifi_init(NetCore.ssid, NetCore.password) != 0)
+    {
+        printf("Failed to initialise Wi-Fi\n");
+        return;
+    }
+
+    printf("Wi-Fi initialised on core 1\n");
+
+    if (client_init(&NetCore.client, NetCore.ip_address) != 0)
+    {
+        printf("Failed to initialise client\n");
+        return;
+    }
+
+    async_context_add_when_pending_worker(cyw43_arch_async_context(), &NetCoreWorker);
+
+    /** Same tasks as the single core build, the rings are serviced on every wake-up */
+    sched_init();
+    int added = sched_add(_netcore_wifi_task, &NetCore.client, WIFI_TASK_INTERVAL_MS);
+    NetCore.client_task_id = sched_add(_netcore_client_task, &NetCore.client, CLIENT_TASK_TIMEOUT_MS);
+    added |= NetCore.client_task_id;
+    added |= sched_add(_netcore_led_task, NULL, LED_DELAY_MS);
+    added |= sched_add(_netcore_rings_task, &NetCore.client, 0);
+    if (added < 0)
+    {
+        printf("Failed to add tasks, SCHED_MAX_TASKS is %d\n", SCHED_MAX_TASKS);
+        return;
+    }
+
+    while (true)
+    {
+        sched_run();
+    }
+}
+
+/**
+ * @brief Run the wifi task, keep the client in step with it and publish the states to core 0.
+ * @param arg Pointer to the client structure.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _netcore_wifi_task(void *arg)
+{
+    client_t *client = (client_t *)arg;
+    WifiTaskState_t previous = wifi_get_state();
+
+    wifi_task();
+    wifi_pm_update(client->stats.tx_bytes + client->stats.rx_bytes, client_tx_pending(client));
+
+    if (wifi_get_state() != WIFI_TASK_CONNECTED)
+    {
+        if (client->state == CLIENT_CONNECTED || client->connecting)
+        {
+            client_close(client);
+        }
+    }
+    else if (previous != WIFI_TASK_CONNECTED)
+    {
+        client_reconnect_reset(client);
+        sched_wake(NetCore.client_task_id);
+    }
+
+    NetCore.wifi_state = wifi_get_state();
+    NetCore.client_state = client->state;
+
+    return 0;
+}
+
+/**
+ * @brief Run the client task while Wi-Fi is connected.
+ * @param arg Pointer to the client structure.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _netcore_client_task(void *arg)
+{
+    client_t *client = (client_t *)arg;
+
+    if (wifi_get_state() != WIFI_TASK_CONNECTED)
+    {
+        return 0;
+    }
+
+    if (client_task(client) != 0)
+    {
+        LOG_ERROR("Failed to run client task\n");
+        return -1;
+    }
+
+    NetCore.client_state = client->state;
+
+    return 0;
+}
+
+/**
+ * @brief LED should be on if connected and blinking if not connected.
+ * @param arg Unused.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _netcore_led_task(void *arg)
+{
+    if (wifi_get_state() == WIFI_TASK_CONNECTED)
+    {
+        pico_set_led(true);
+        return 0;
+    }
+
+    return led_task();
+}
+
+/**
+ * @brief Service the rings on every wake-up, so data lwIP has just delivered is passed on.
+ * @param arg Pointer to the client structure.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _netcore_rings_task(void *arg)
+{
+    client_t *client = (client_t *)arg;
+
+    _netcore_pump_rx(client);
+    _netcore_pump_tx(client);
+
+    return 0;
+}
+
+/**
+ * @brief Runs on core 1 from cyw43_arch_poll() whenever core 0 has touched the rings.
+ * @param context The cyw43 async context.
+ * @param worker The worker that was made pending.
+ * @return None.
+ */
+static void _netcore_do_work(async_context_t *context, async_when_pending_worker_t *worker)
+{
+    _netcore_pump_rx(&NetCore.client);
+    _netcore_pump_tx(&NetCore.client);
+}
+
+/**
+ * @brief Move received data from the client receive queue into the core 0 ring.
+ * @param client Pointer to the client structure.
+ * @return None.
+ * @note Data that does not fit stays in the client queue, so a slow core 0 closes the TCP
+ *       receive window instead of losing data.
+ */
+static void _netcore_pump_rx(client_t *client)
+{
+    client_segment_t segs[4];
+    int count = client_rx_segments(client, 0, segs, count_of(segs));
+    uint32_t pushed = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        const uint8_t *data = segs[i].data;
+        uint16_t remaining = segs[i].len;
+
+        while (remaining > 0)
+        {
+            uint16_t len = remaining < NETCORE_MSG_MAX ? remaining : NETCORE_MSG_MAX;
+            if (spsc_push(&RxRing, data, len) != 0)
+            {
+                /** Core 0 is behind, leave the rest queued until it makes room */
+                NetCore.rx_blocked = true;
+                client_consume(client, pushed);
+                return;
+            }
+            data += len;
+            remaining -= len;
+            pushed += len;
+        }
+    }
+
+    client_consume(client, pushed);
+}
+
+/**
+ * @brief Move outgoing messages from the core 0 ring into the client transmit queue.
+ * @param client Pointer to the client structure.
+ * @return None.
+ */
+static void _netcore_pump_tx(client_t *client)
+{
+    static uint8_t msg[NETCORE_MSG_MAX];
+    int len;
+
+    while ((len = spsc_peek(&TxRing, msg, sizeof(msg))) > 0)
+    {
+        if (client_write(client, msg, (uint32_t)len) != 0)
+        {
+            /** Transmit queue is full or not connected, retry on the next pass */
+            break;
+        }
+        spsc_drop(&TxRing);
+    }
+}
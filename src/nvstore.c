@@ -0,0 +1,346 @@
+/** Includes *************************************************************************************/
+#include <string.h>
+#include "pico/flash.h"
+#include "nvstore.h"
+#include "frame.h"
+#include "log.h"
+/** Defines **************************************************************************************/
+#define NVSTORE_MAGIC 0x3153564eu  /** "NVS1" */
+#define NVSTORE_ERASED 0xffffffffu
+
+/** Record slots per sector and in total */
+#define NVSTORE_SECTOR_SLOTS (FLASH_SECTOR_SIZE / NVSTORE_SLOT_SIZE)
+#define NVSTORE_TOTAL_SLOTS (NVSTORE_SECTORS * NVSTORE_SECTOR_SLOTS)
+
+/** Longest the other core and interrupts may take to get out of the way of a flash operation */
+#define NVSTORE_SAFE_TIMEOUT_MS 100
+
+/** Typedefs *************************************************************************************/
+/** Start of every slot, the data follows */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t seq;         /** Higher is newer, across both sectors */
+    uint16_t key;
+    uint16_t len;
+    uint16_t crc;         /** CRC-16 of seq, key, len and the data */
+    uint16_t reserved;
+} NvstoreHeader_t;
+
+/** A flash operation run by flash_safe_execute() */
+typedef struct
+{
+    uint32_t offset;
+    const uint8_t *data;  /** Page to program, NULL to erase the sector at offset */
+} NvstoreOp_t;
+
+typedef struct
+{
+    bool initialised;
+    uint8_t active;                        /** Sector new records go to */
+    uint16_t next_slot;                    /** Next slot to try in the active sector */
+    uint32_t seq;                          /** Sequence number of the newest record */
+    int16_t latest[NVSTORE_MAX_KEYS + 1];  /** Slot of the newest record of every key, -1 if none */
+    uint8_t page[NVSTORE_SLOT_SIZE] __attribute__((aligned(4))); /** Flash cannot be read while programming */
+    nvstore_stats_t stats;
+} Nvstore_t;
+
+/** Variables ************************************************************************************/
+static Nvstore_t Nvstore = {0};
+
+/** Prototypes ***********************************************************************************/
+/** Private Function Prototypes ******************************************************************/
+static const uint8_t *_nvstore_slot(int slot);
+static bool _nvstore_valid(const uint8_t *slot);
+static int _nvstore_flash(uint32_t offset, const uint8_t *data);
+static void _nvstore_flash_op(void *param);
+static int _nvstore_append(uint16_t key, const uint8_t *data, uint16_t len);
+static int _nvstore_switch_sector(uint16_t skip_key);
+
+/** Function Definitions *************************************************************************/
+int nvstore_init(void)
+{
+    _Static_assert(sizeof(NvstoreHeader_t) == NVSTORE_HEADER_SIZE, "header size");
+
+    uint32_t newest = 0;
+    memset(Nvstore.latest, 0xff, sizeof(Nvstore.latest));
+    Nvstore.active = 0;
+    Nvstore.seq = 0;
+
+    for (int slot = 0; slot < NVSTORE_TOTAL_SLOTS; slot++)
+    {
+        const uint8_t *p = _nvstore_slot(slot);
+        if (!_nvstore_valid(p))
+        {
+            continue;
+        }
+
+        const NvstoreHeader_t *header = (const NvstoreHeader_t *)p;
+        int16_t *latest = &Nvstore.latest[header->key];
+        if (*latest < 0 || header->seq > ((const NvstoreHeader_t *)_nvstore_slot(*latest))->seq)
+        {
+            *latest = (int16_t)slot;
+        }
+
+        if (header->seq >= newest)
+        {
+            newest = header->seq;
+            Nvstore.active = (uint8_t)(slot / NVSTORE_SECTOR_SLOTS);
+        }
+    }
+    Nvstore.seq = newest;
+
+    /** Records are appended in order, continue after the last slot that is not erased */
+    Nvstore.next_slot = 0;
+    for (int slot = NVSTORE_SECTOR_SLOTS - 1; slot >= 0; slot--)
+    {
+        const uint32_t *magic = (const uint32_t *)_nvstore_slot(Nvstore.active * NVSTORE_SECTOR_SLOTS + slot);
+        if (*magic != NVSTORE_ERASED)
+        {
+            Nvstore.next_slot = (uint16_t)(slot + 1);
+            break;
+        }
+    }
+
+    Nvstore.initialised = true;
+
+    /** A reset during a sector switch leaves records behind in the old sector, finish the copy
+     *  before that sector is erased by the next switch */
+    for (uint16_t key = 1; key <= NVSTORE_MAX_KEYS; key++)
+    {
+        int16_t slot = Nvstore.latest[key];
+        if (slot >= 0 && slot / NVSTORE_SECTOR_SLOTS != Nvstore.active)
+        {
+            const uint8_t *p = _nvstore_slot(slot);
+            if (_nvstore_append(key, p + NVSTORE_HEADER_SIZE, ((const NvstoreHeader_t *)p)->len) != 0)
+            {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int nvstore_read(nvstore_key_t key, void *buf, uint16_t len)
+{
+    if (!Nvstore.initialised || key == 0 || key > NVSTORE_MAX_KEYS || buf == NULL || Nvstore.latest[key] < 0)
+    {
+        return -1;
+    }
+
+    const uint8_t *p = _nvstore_slot(Nvstore.latest[key]);
+    const NvstoreHeader_t *header = (const NvstoreHeader_t *)p;
+    if (header->len > len)
+    {
+        return -1;
+    }
+
+    memcpy(buf, p + NVSTORE_HEADER_SIZE, header->len);
+
+    return header->len;
+}
+
+int nvstore_write(nvstore_key_t key, const void *data, uint16_t len)
+{
+    if (!Nvstore.initialised || key == 0 || key > NVSTORE_MAX_KEYS || (data == NULL && len > 0) ||
+        len > NVSTORE_DATA_MAX)
+    {
+        return -1;
+    }
+
+    /** Rewriting the same value would only wear the flash */
+    if (Nvstore.latest[key] >= 0)
+    {
+        const uint8_t *p = _nvstore_slot(Nvstore.latest[key]);
+        const NvstoreHeader_t *header = (const NvstoreHeader_t *)p;
+        if (header->len == len && memcmp(p + NVSTORE_HEADER_SIZE, data, len) == 0)
+        {
+            Nvstore.stats.skipped++;
+            return 0;
+        }
+    }
+
+    if (Nvstore.next_slot >= NVSTORE_SECTOR_SLOTS && _nvstore_switch_sector(key) != 0)
+    {
+        return -1;
+    }
+
+    return _nvstore_append(key, (const uint8_t *)data, len);
+}
+
+const nvstore_stats_t *nvstore_stats(void)
+{
+    return &Nvstore.stats;
+}
+
+/**
+ * @brief Get a slot through the XIP window.
+ * @param slot Slot index across both sectors.
+ * @return const uint8_t* Start of the slot.
+ */
+static const uint8_t *_nvstore_slot(int slot)
+{
+    return (const uint8_t *)(uintptr_t)(XIP_BASE + NVSTORE_FLASH_OFFSET + (uint32_t)slot * NVSTORE_SLOT_SIZE);
+}
+
+/**
+ * @brief Check that a slot holds a complete record.
+ * @param slot Start of the slot.
+ * @return bool true if the magic, key, length and CRC are good.
+ * @note A record cut short by a reset fails the CRC and is skipped.
+ */
+static bool _nvstore_valid(const uint8_t *slot)
+{
+    const NvstoreHeader_t *header = (const NvstoreHeader_t *)slot;
+
+    if (header->magic != NVSTORE_MAGIC || header->key == 0 || header->key > NVSTORE_MAX_KEYS ||
+        header->len > NVSTORE_DATA_MAX)
+    {
+        return false;
+    }
+
+    uint16_t crc = frame_crc16(0xffff, (const uint8_t *)&header->seq, 8);
+    crc = frame_crc16(crc, slot + NVSTORE_HEADER_SIZE, header->len);
+
+    return crc == header->crc;
+}
+
+/**
+ * @brief Program a page or erase a sector with interrupts and the other core held off.
+ * @param offset Flash offset.
+ * @param data Page to program, NULL to erase the sector.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _nvstore_flash(uint32_t offset, const uint8_t *data)
+{
+    NvstoreOp_t op = {
+        .offset = offset,
+        .data = data,
+    };
+
+    if (flash_safe_execute(_nvstore_flash_op, &op, NVSTORE_SAFE_TIMEOUT_MS) != PICO_OK)
+    {
+        Nvstore.stats.failures++;
+        LOG_ERROR("Flash %s at 0x%x failed\n", data != NULL ? "program" : "erase", (unsigned)offset);
+        return -1;
+    }
+
+    if (data == NULL)
+    {
+        Nvstore.stats.erases++;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Run a flash operation, called by flash_safe_execute().
+ * @param param Pointer to the operation.
+ * @return None.
+ */
+static void _nvstore_flash_op(void *param)
+{
+    const NvstoreOp_t *op = (const NvstoreOp_t *)param;
+
+    if (op->data == NULL)
+    {
+        flash_range_erase(op->offset, FLASH_SECTOR_SIZE);
+    }
+    else
+    {
+        flash_range_program(op->offset, op->data, NVSTORE_SLOT_SIZE);
+    }
+}
+
+/**
+ * @brief Program a record into the next erased slot of the active sector.
+ * @param key The key.
+ * @param data Record data, may point into flash.
+ * @param len Length of the data.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _nvstore_append(uint16_t key, const uint8_t *data, uint16_t len)
+{
+    NvstoreHeader_t header = {
+        .magic = NVSTORE_MAGIC,
+        .seq = Nvstore.seq + 1,
+        .key = key,
+        .len = len,
+        .reserved = 0xffff,
+    };
+
+    /** Build the page in RAM first, data read from flash is not readable while programming */
+    memset(Nvstore.page, 0xff, sizeof(Nvstore.page));
+    memcpy(Nvstore.page + NVSTORE_HEADER_SIZE, data, len);
+    header.crc = frame_crc16(0xffff, (const uint8_t *)&header.seq, 8);
+    header.crc = frame_crc16(header.crc, Nvstore.page + NVSTORE_HEADER_SIZE, len);
+    memcpy(Nvstore.page, &header, sizeof(header));
+
+    while (Nvstore.next_slot < NVSTORE_SECTOR_SLOTS)
+    {
+        int slot = Nvstore.active * NVSTORE_SECTOR_SLOTS + Nvstore.next_slot++;
+        const uint8_t *p = _nvstore_slot(slot);
+
+        /** Skip a slot left half-written by a reset, programming can only clear bits */
+        bool erased = true;
+        for (int i = 0; i < NVSTORE_SLOT_SIZE && erased; i++)
+        {
+            erased = p[i] == 0xff;
+        }
+        if (!erased)
+        {
+            continue;
+        }
+
+        if (_nvstore_flash(NVSTORE_FLASH_OFFSET + (uint32_t)slot * NVSTORE_SLOT_SIZE, Nvstore.page) != 0 ||
+            !_nvstore_valid(p))
+        {
+            return -1;
+        }
+
+        Nvstore.seq = header.seq;
+        Nvstore.latest[key] = (int16_t)slot;
+        Nvstore.stats.writes++;
+        return 0;
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Move the newest record of every key to the other sector once the active one is full.
+ * @param skip_key Key about to be rewritten, not worth copying.
+ * @return int 0 on success, -1 on failure.
+ * @note The full sector is left as it is until the next switch, so a reset part way through
+ *       loses nothing, the copies have higher sequence numbers and win on the next init.
+ */
+static int _nvstore_switch_sector(uint16_t skip_key)
+{
+    uint8_t target = Nvstore.active ^ 1;
+
+    if (_nvstore_flash(NVSTORE_FLASH_OFFSET + target * FLASH_SECTOR_SIZE, NULL) != 0)
+    {
+        return -1;
+    }
+
+    Nvstore.active = target;
+    Nvstore.next_slot = 0;
+
+    for (uint16_t key = 1; key <= NVSTORE_MAX_KEYS; key++)
+    {
+        if (key == skip_key || Nvstore.latest[key] < 0)
+        {
+            continue;
+        }
+
+        const uint8_t *p = _nvstore_slot(Nvstore.latest[key]);
+        const NvstoreHeader_t *header = (const NvstoreHeader_t *)p;
+        if (_nvstore_append(key, p + NVSTORE_HEADER_SIZE, header->len) != 0)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,724 @@
+/** Includes *************************************************************************************/
+#include <string.h>
+#include "pico/flash.h"
+#include "outbox.h"
+#include "log.h"
+/** Defines **************************************************************************************/
+/** Size of the log, positions count up through it and wrap around in flash */
+#define OUTBOX_LOG_SIZE ((uint32_t)OUTBOX_SECTORS * FLASH_SECTOR_SIZE)
+
+/** Longest run of records replayed in one write, it never crosses a sector */
+#define OUTBOX_REPLAY_MAX FLASH_SECTOR_SIZE
+
+/** Longest the other core and interrupts may take to get out of the way of a flash operation */
+#define OUTBOX_SAFE_TIMEOUT_MS 100
+
+_Static_assert(OUTBOX_DATA_MAX + 4 <= FRAME_MAX_PAYLOAD, "record does not fit a frame");
+_Static_assert(OUTBOX_DATA_MAX + 4 < (1 << 14), "record length takes more than two bytes");
+
+/** Typedefs *************************************************************************************/
+/** A flash operation run by flash_safe_execute() */
+typedef struct
+{
+    uint32_t offset;
+    const uint8_t *data;  /** Pages to program, NULL to erase the sector at offset */
+    uint32_t len;
+} OutboxOp_t;
+
+typedef struct
+{
+    bool initialised;
+    uint32_t tail;                 /** Log position of the oldest record not acknowledged */
+    uint32_t sent;                 /** Log position of the next record to replay */
+    uint32_t head;                 /** Log position the batch goes to, page aligned */
+    uint32_t released;             /** Replay writes before this position are no longer referenced */
+    uint16_t refs;                 /** Replay writes the client still sends from flash */
+    uint32_t seq;                  /** Sequence number of the newest message */
+    uint32_t acked;                /** Newest sequence number the server acknowledged */
+    const client_t *client;        /** Connection the replay position belongs to */
+    uint32_t connection;           /** connect_successes of that client when it was set up */
+    uint16_t batch_len;
+    absolute_time_t batch_since;   /** When the first message of the batch was added */
+    uint8_t batch[FLASH_SECTOR_SIZE] __attribute__((aligned(4))); /** Records for the head sector */
+    outbox_stats_t stats;
+} Outbox_t;
+
+/** Variables ************************************************************************************/
+static Outbox_t Outbox = {0};
+
+/** Prototypes ***********************************************************************************/
+/** Private Function Prototypes ******************************************************************/
+static const uint8_t *_outbox_at(uint32_t pos);
+static uint32_t _outbox_record_size(const uint8_t *p, uint32_t room, uint32_t *seq);
+static uint32_t _outbox_next(uint32_t *pos, uint32_t end, uint32_t *seq);
+static bool _outbox_erased(uint32_t pos, uint32_t len);
+static uint16_t _outbox_encode(uint8_t *out, uint32_t seq, const void *data, uint16_t len);
+static int _outbox_append(uint32_t seq, const void *data, uint16_t len);
+static int _outbox_program(void);
+static int _outbox_set_tail(uint32_t pos);
+static int _outbox_drop_oldest(void);
+static void _outbox_trim(void);
+static int _outbox_replay(client_t *client);
+static void _outbox_replay_done(void *arg, const uint8_t *data, uint16_t len, err_t err);
+static void _outbox_ack(void *arg, const frame_t *frame);
+static int _outbox_flash(uint32_t offset, const uint8_t *data, uint32_t len);
+static void _outbox_flash_op(void *param);
+
+/** Function Definitions *************************************************************************/
+int outbox_init(frame_decoder_t *decoder)
+{
+    if (decoder == NULL)
+    {
+        return -1;
+    }
+
+    int tail_sector = -1;
+    int head_sector = -1;
+    uint32_t tail_seq = 0;
+    uint32_t head_seq = 0;
+    uint32_t newest = 0;
+
+    /** Every sector starts with a record, the one with the oldest first record is the tail */
+    for (int sector = 0; sector < OUTBOX_SECTORS; sector++)
+    {
+        uint32_t pos = (uint32_t)sector * FLASH_SECTOR_SIZE;
+        uint32_t end = pos + FLASH_SECTOR_SIZE;
+        uint32_t seq;
+        uint32_t size;
+        bool found = false;
+
+        while ((size = _outbox_next(&pos, end, &seq)) > 0)
+        {
+            if (!found)
+            {
+                if (tail_sector < 0 || (int32_t)(seq - tail_seq) < 0)
+                {
+                    tail_sector = sector;
+                    tail_seq = seq;
+                }
+                if (head_sector < 0 || (int32_t)(seq - head_seq) > 0)
+                {
+                    head_sector = sector;
+                    head_seq = seq;
+                }
+                found = true;
+            }
+            if ((int32_t)(seq - newest) > 0)
+            {
+                newest = seq;
+            }
+            pos += size;
+        }
+    }
+
+    memset(Outbox.batch, 0xff, sizeof(Outbox.batch));
+    Outbox.batch_len = 0;
+    Outbox.tail = 0;
+    Outbox.head = 0;
+    Outbox.seq = newest;
+    Outbox.acked = newest;
+
+    if (tail_sector >= 0)
+    {
+        /** Batches are programmed in whole pages, the next one goes after the last page in use */
+        uint32_t used = FLASH_SECTOR_SIZE;
+        while (used > 0 && _outbox_erased((uint32_t)head_sector * FLASH_SECTOR_SIZE + used - FLASH_PAGE_SIZE,
+                                          FLASH_PAGE_SIZE))
+        {
+            used -= FLASH_PAGE_SIZE;
+        }
+
+        Outbox.tail = (uint32_t)tail_sector * FLASH_SECTOR_SIZE;
+        Outbox.head = Outbox.tail +
+                      (uint32_t)((head_sector - tail_sector + OUTBOX_SECTORS) % OUTBOX_SECTORS) * FLASH_SECTOR_SIZE +
+                      used;
+        Outbox.acked = tail_seq - 1;
+
+        LOG_INFO("Outbox holds %lu bytes from before the reset\n", (unsigned long)(Outbox.head - Outbox.tail));
+    }
+
+    Outbox.sent = Outbox.tail;
+    Outbox.released = Outbox.tail;
+    Outbox.refs = 0;
+    Outbox.client = NULL;
+    Outbox.initialised = true;
+
+    return frame_register(decoder, OUTBOX_FRAME_ACK, _outbox_ack, NULL);
+}
+
+int outbox_send(client_t *client, const void *data, uint16_t len)
+{
+    if (!Outbox.initialised || data == NULL || len == 0 || len > OUTBOX_DATA_MAX)
+    {
+        return -1;
+    }
+
+    uint32_t seq = Outbox.seq + 1;
+
+    /** Nothing older is waiting on this connection, the message can go straight out */
+    if (client != NULL && client->state == CLIENT_CONNECTED && client == Outbox.client &&
+        client->stats.connect_successes == Outbox.connection && Outbox.sent >= Outbox.head && Outbox.batch_len == 0)
+    {
+        uint16_t size = _outbox_encode(Outbox.batch, seq, data, len);
+        bool sent = client_write(client, Outbox.batch, size) == 0;
+        memset(Outbox.batch, 0xff, size);
+
+        if (sent)
+        {
+            Outbox.seq = seq;
+            Outbox.stats.direct++;
+            return 0;
+        }
+    }
+
+    if (_outbox_append(seq, data, len) != 0)
+    {
+        Outbox.stats.dropped++;
+        return -1;
+    }
+
+    Outbox.seq = seq;
+    Outbox.stats.stored++;
+
+    return 0;
+}
+
+int outbox_task(client_t *client)
+{
+    if (!Outbox.initialised)
+    {
+        return -1;
+    }
+
+    if (client == NULL || client->state != CLIENT_CONNECTED)
+    {
+        /** Offline, keep the batch in RAM until its sector is full, but not for too long */
+        if (Outbox.batch_len > 0 &&
+            absolute_time_diff_us(Outbox.batch_since, get_absolute_time()) >= (int64_t)OUTBOX_FLUSH_MS * 1000)
+        {
+            return _outbox_program();
+        }
+        return 0;
+    }
+
+    if (client != Outbox.client || client->stats.connect_successes != Outbox.connection)
+    {
+        /** A new connection, whatever was not acknowledged may not have arrived */
+        Outbox.client = client;
+        Outbox.connection = client->stats.connect_successes;
+        Outbox.sent = Outbox.tail;
+        Outbox.released = Outbox.tail;
+
+        /** The batch follows the records in flash, so it is programmed to be replayed after them */
+        if (_outbox_program() != 0)
+        {
+            return -1;
+        }
+
+        if (Outbox.head > Outbox.tail)
+        {
+            LOG_INFO("Outbox replaying %lu bytes\n", (unsigned long)(Outbox.head - Outbox.tail));
+        }
+    }
+
+    _outbox_trim();
+
+    return _outbox_replay(client);
+}
+
+int outbox_flush(void)
+{
+    if (!Outbox.initialised)
+    {
+        return -1;
+    }
+
+    return _outbox_program();
+}
+
+uint32_t outbox_backlog(void)
+{
+    return Outbox.head - Outbox.sent + Outbox.batch_len;
+}
+
+const outbox_stats_t *outbox_stats(void)
+{
+    return &Outbox.stats;
+}
+
+/**
+ * @brief Get a log position through the XIP window.
+ * @param pos Log position.
+ * @return const uint8_t* The byte at that position.
+ */
+static const uint8_t *_outbox_at(uint32_t pos)
+{
+    return (const uint8_t *)(uintptr_t)(XIP_BASE + OUTBOX_FLASH_OFFSET + pos % OUTBOX_LOG_SIZE);
+}
+
+/**
+ * @brief Check that a complete record starts here.
+ * @param p Start of the record.
+ * @param room Bytes that may belong to it.
+ * @param seq Sequence number of the record, may be NULL.
+ * @return uint32_t Size of the record, 0 if there is none.
+ * @note Erased flash and a record cut short by a reset fail the type or the CRC check.
+ */
+static uint32_t _outbox_record_size(const uint8_t *p, uint32_t room, uint32_t *seq)
+{
+    uint32_t len = 0;
+    uint32_t n = 0;
+
+    do
+    {
+        if (n >= 2 || n >= room)
+        {
+            return 0;
+        }
+        len |= (uint32_t)(p[n] & 0x7f) << (7 * n);
+    } while (p[n++] & 0x80);
+
+    uint32_t size = n + 1 + len + FRAME_CRC_SIZE;
+    if (len < 4 || len > OUTBOX_DATA_MAX + 4 || size > room || p[n] != (OUTBOX_FRAME_RECORD | FRAME_FLAG_CRC))
+    {
+        return 0;
+    }
+
+    uint16_t crc = frame_crc16(0xffff, p, size - FRAME_CRC_SIZE);
+    if (p[size - 2] != (uint8_t)crc || p[size - 1] != (uint8_t)(crc >> 8))
+    {
+        return 0;
+    }
+
+    if (seq != NULL)
+    {
+        const uint8_t *s = p + n + 1;
+        *seq = s[0] | (uint32_t)s[1] << 8 | (uint32_t)s[2] << 16 | (uint32_t)s[3] << 24;
+    }
+
+    return size;
+}
+
+/**
+ * @brief Find the next record at or after a position.
+ * @param pos Log position, moved to the record, or to end if there is none.
+ * @param end Log position to stop at.
+ * @param seq Sequence number of the record, may be NULL.
+ * @return uint32_t Size of the record, 0 if there is none before end.
+ */
+static uint32_t _outbox_next(uint32_t *pos, uint32_t end, uint32_t *seq)
+{
+    while (*pos < end)
+    {
+        uint32_t room = FLASH_SECTOR_SIZE - *pos % FLASH_SECTOR_SIZE;
+        uint32_t size = _outbox_record_size(_outbox_at(*pos), LWIP_MIN(room, end - *pos), seq);
+        if (size > 0)
+        {
+            return size;
+        }
+
+        /** Erased space after a batch, or a page cut short by a reset, records go on at the next page */
+        *pos = (*pos / FLASH_PAGE_SIZE + 1) * FLASH_PAGE_SIZE;
+    }
+
+    *pos = end;
+
+    return 0;
+}
+
+/**
+ * @brief Check that part of the log is erased.
+ * @param pos Log position, word aligned.
+ * @param len Length, a multiple of 4, not crossing the end of the log.
+ * @return bool true if every byte is 0xff.
+ */
+static bool _outbox_erased(uint32_t pos, uint32_t len)
+{
+    const uint32_t *word = (const uint32_t *)_outbox_at(pos);
+
+    for (uint32_t i = 0; i < len / 4; i++)
+    {
+        if (word[i] != 0xffffffffu)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Build a record, which is the frame that goes out.
+ * @param out Destination.
+ * @param seq Sequence number.
+ * @param data Message.
+ * @param len Length of the message.
+ * @return uint16_t Size of the record.
+ */
+static uint16_t _outbox_encode(uint8_t *out, uint32_t seq, const void *data, uint16_t len)
+{
+    uint16_t n = (uint16_t)frame_header(out, OUTBOX_FRAME_RECORD, (uint16_t)(len + 4), true);
+
+    out[n++] = (uint8_t)seq;
+    out[n++] = (uint8_t)(seq >> 8);
+    out[n++] = (uint8_t)(seq >> 16);
+    out[n++] = (uint8_t)(seq >> 24);
+    memcpy(&out[n], data, len);
+    n += len;
+
+    uint16_t crc = frame_crc16(0xffff, out, n);
+    out[n++] = (uint8_t)crc;
+    out[n++] = (uint8_t)(crc >> 8);
+
+    return n;
+}
+
+/**
+ * @brief Add a record to the batch, programming the batch first if the record does not fit.
+ * @param seq Sequence number.
+ * @param data Message.
+ * @param len Length of the message.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _outbox_append(uint32_t seq, const void *data, uint16_t len)
+{
+    uint32_t size = (len + 4 < 0x80 ? 1u : 2u) + 1 + 4 + len + FRAME_CRC_SIZE;
+
+    if (Outbox.head % FLASH_SECTOR_SIZE + Outbox.batch_len + size > FLASH_SECTOR_SIZE)
+    {
+        /** Records do not cross sectors, the rest of this one stays erased */
+        if (_outbox_program() != 0)
+        {
+            return -1;
+        }
+        Outbox.head = (Outbox.head + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE * FLASH_SECTOR_SIZE;
+    }
+
+    if (Outbox.head % FLASH_SECTOR_SIZE == 0 && Outbox.batch_len == 0)
+    {
+        /** Starting on a sector, the oldest one goes if the log is full */
+        while (Outbox.head + FLASH_SECTOR_SIZE > Outbox.tail / FLASH_SECTOR_SIZE * FLASH_SECTOR_SIZE + OUTBOX_LOG_SIZE)
+        {
+            if (_outbox_drop_oldest() != 0)
+            {
+                return -1;
+            }
+        }
+    }
+
+    if (Outbox.batch_len == 0)
+    {
+        Outbox.batch_since = get_absolute_time();
+    }
+    Outbox.batch_len += _outbox_encode(&Outbox.batch[Outbox.batch_len], seq, data, len);
+
+    return 0;
+}
+
+/**
+ * @brief Program the batch at the head in one go.
+ * @return int 0 on success, -1 on failure.
+ * @note A batch that does not read back is given up and its pages skipped, programming the same
+ *       pages again could not clear the bad bits.
+ */
+static int _outbox_program(void)
+{
+    if (Outbox.batch_len == 0)
+    {
+        return 0;
+    }
+
+    uint32_t offset = OUTBOX_FLASH_OFFSET + Outbox.head % OUTBOX_LOG_SIZE;
+    uint32_t len = (Outbox.batch_len + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE * FLASH_PAGE_SIZE;
+
+    if (Outbox.head % FLASH_SECTOR_SIZE == 0 && !_outbox_erased(Outbox.head, FLASH_SECTOR_SIZE) &&
+        _outbox_flash(offset - offset % FLASH_SECTOR_SIZE, NULL, FLASH_SECTOR_SIZE) != 0)
+    {
+        return -1;
+    }
+
+    if (_outbox_flash(offset, Outbox.batch, len) != 0)
+    {
+        return -1;
+    }
+
+    int rc = 0;
+    if (memcmp(_outbox_at(Outbox.head), Outbox.batch, Outbox.batch_len) != 0)
+    {
+        uint32_t lost = 0;
+        uint32_t pos = 0;
+        uint32_t size;
+        while ((size = _outbox_record_size(&Outbox.batch[pos], Outbox.batch_len - pos, NULL)) > 0)
+        {
+            pos += size;
+            lost++;
+        }
+
+        Outbox.stats.dropped += lost;
+        Outbox.stats.failures++;
+        LOG_ERROR("Outbox program at 0x%x did not verify, %lu records lost\n", (unsigned)offset, (unsigned long)lost);
+        rc = -1;
+    }
+
+    Outbox.head += len;
+    Outbox.stats.programs++;
+    memset(Outbox.batch, 0xff, len);
+    Outbox.batch_len = 0;
+
+    return rc;
+}
+
+/**
+ * @brief Move the tail on, erasing every sector it leaves behind.
+ * @param pos New tail position.
+ * @return int 0 on success, -1 if a sector is still being sent from or could not be erased.
+ */
+static int _outbox_set_tail(uint32_t pos)
+{
+    for (uint32_t sector = Outbox.tail / FLASH_SECTOR_SIZE * FLASH_SECTOR_SIZE; sector + FLASH_SECTOR_SIZE <= pos;
+         sector += FLASH_SECTOR_SIZE)
+    {
+        if (Outbox.refs > 0 && Outbox.released < sector + FLASH_SECTOR_SIZE)
+        {
+            return -1;
+        }
+
+        uint32_t offset = OUTBOX_FLASH_OFFSET + sector % OUTBOX_LOG_SIZE;
+        if (!_outbox_erased(sector, FLASH_SECTOR_SIZE) && _outbox_flash(offset, NULL, FLASH_SECTOR_SIZE) != 0)
+        {
+            return -1;
+        }
+        Outbox.tail = sector + FLASH_SECTOR_SIZE;
+    }
+
+    Outbox.tail = pos;
+    if (Outbox.sent < pos)
+    {
+        Outbox.sent = pos;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Drop the oldest sector to make room, newer data is worth more than old.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _outbox_drop_oldest(void)
+{
+    uint32_t next = (Outbox.tail / FLASH_SECTOR_SIZE + 1) * FLASH_SECTOR_SIZE;
+    uint32_t pos = Outbox.tail;
+    uint32_t lost = 0;
+    uint32_t size;
+
+    while ((size = _outbox_next(&pos, LWIP_MIN(next, Outbox.head), NULL)) > 0)
+    {
+        pos += size;
+        lost++;
+    }
+
+    if (_outbox_set_tail(next) != 0)
+    {
+        return -1;
+    }
+
+    Outbox.stats.dropped += lost;
+    LOG_WARN("Outbox full, dropped %lu records\n", (unsigned long)lost);
+
+    return 0;
+}
+
+/**
+ * @brief Move the tail past the records the server acknowledged.
+ * @return None.
+ * @note Retried on the next run if a sector to erase is still being sent from.
+ */
+static void _outbox_trim(void)
+{
+    uint32_t pos = Outbox.tail;
+    uint32_t count = 0;
+    uint32_t seq;
+    uint32_t size;
+
+    while ((size = _outbox_next(&pos, Outbox.sent, &seq)) > 0 && (int32_t)(seq - Outbox.acked) <= 0)
+    {
+        pos += size;
+        count++;
+    }
+
+    if (pos != Outbox.tail && _outbox_set_tail(pos) == 0)
+    {
+        Outbox.stats.acked += count;
+    }
+}
+
+/**
+ * @brief Send stored records as far as the transmit queue takes them.
+ * @param client Pointer to the connected client.
+ * @return int 0 on success, -1 on failure.
+ * @note Records written one after the other in flash form a run, which goes out in one zero-copy
+ *       write of up to a sector, so a backlog drains at link rate rather than record by record.
+ */
+static int _outbox_replay(client_t *client)
+{
+    uint32_t max = client->transport == CLIENT_TRANSPORT_UDP ? CLIENT_UDP_PAYLOAD_MAX : OUTBOX_REPLAY_MAX;
+    bool wrote = false;
+
+    while (Outbox.sent < Outbox.head)
+    {
+        uint32_t start = Outbox.sent;
+        uint32_t size = _outbox_next(&start, Outbox.head, NULL);
+        Outbox.sent = start;
+        if (size == 0)
+        {
+            break;
+        }
+
+        uint32_t end = start + size;
+        uint32_t count = 1;
+        while (end % FLASH_SECTOR_SIZE != 0 && end < Outbox.head)
+        {
+            uint32_t room = LWIP_MIN(FLASH_SECTOR_SIZE - end % FLASH_SECTOR_SIZE, Outbox.head - end);
+            size = _outbox_record_size(_outbox_at(end), room, NULL);
+            if (size == 0 || end + size - start > max)
+            {
+                break;
+            }
+            end += size;
+            count++;
+        }
+
+        /** Counted first, over UDP the write is done before it returns */
+        Outbox.refs++;
+        if (client_write_ref(client, _outbox_at(start), (uint16_t)(end - start), _outbox_replay_done, NULL) != 0)
+        {
+            Outbox.refs--;
+            break;
+        }
+
+        Outbox.sent = end;
+        Outbox.stats.replayed += count;
+        Outbox.stats.replayed_bytes += end - start;
+        Outbox.stats.replay_writes++;
+        wrote = true;
+    }
+
+    if (Outbox.sent >= Outbox.head && Outbox.batch_len > 0)
+    {
+        /** Caught up, messages stored during the replay go from RAM without being programmed */
+        uint16_t done = 0;
+        while (done < Outbox.batch_len)
+        {
+            uint16_t size = (uint16_t)_outbox_record_size(&Outbox.batch[done], Outbox.batch_len - done, NULL);
+            if (client_write(client, &Outbox.batch[done], size) != 0)
+            {
+                break;
+            }
+            done += size;
+            Outbox.stats.direct++;
+            wrote = true;
+        }
+
+        memmove(Outbox.batch, &Outbox.batch[done], Outbox.batch_len - done);
+        memset(&Outbox.batch[Outbox.batch_len - done], 0xff, done);
+        Outbox.batch_len -= done;
+    }
+
+    if (wrote)
+    {
+        client_flush(client);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Note that the client no longer sends from a replayed run, called in send order.
+ * @param arg Unused.
+ * @param data Start of the run in flash.
+ * @param len Length of the run.
+ * @param err ERR_OK once acked, otherwise why it was dropped.
+ * @return None.
+ */
+static void _outbox_replay_done(void *arg, const uint8_t *data, uint16_t len, err_t err)
+{
+    /** Runs complete in order, each one starts less than the log size after the last */
+    uint32_t offset = (uint32_t)((uintptr_t)data - (XIP_BASE + OUTBOX_FLASH_OFFSET));
+    uint32_t base = Outbox.released - Outbox.released % OUTBOX_LOG_SIZE;
+    uint32_t pos = base + offset < Outbox.released ? base + OUTBOX_LOG_SIZE + offset : base + offset;
+
+    Outbox.released = pos + len;
+    Outbox.refs--;
+}
+
+/**
+ * @brief Ack handler, the server has everything up to a sequence number.
+ * @param arg Unused.
+ * @param frame The frame.
+ * @return None.
+ * @note Only noted here, the tail moves and sectors are erased from outbox_task().
+ */
+static void _outbox_ack(void *arg, const frame_t *frame)
+{
+    uint8_t ack[4];
+
+    if (frame_copy(frame, 0, ack, sizeof(ack)) != sizeof(ack))
+    {
+        return;
+    }
+
+    uint32_t seq = ack[0] | (uint32_t)ack[1] << 8 | (uint32_t)ack[2] << 16 | (uint32_t)ack[3] << 24;
+    if ((int32_t)(seq - Outbox.acked) > 0)
+    {
+        Outbox.acked = seq;
+    }
+}
+
+/**
+ * @brief Program pages or erase a sector with interrupts and the other core held off.
+ * @param offset Flash offset.
+ * @param data Pages to program, NULL to erase the sector.
+ * @param len Length, a multiple of FLASH_PAGE_SIZE.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _outbox_flash(uint32_t offset, const uint8_t *data, uint32_t len)
+{
+    OutboxOp_t op = {
+        .offset = offset,
+        .data = data,
+        .len = len,
+    };
+
+    if (flash_safe_execute(_outbox_flash_op, &op, OUTBOX_SAFE_TIMEOUT_MS) != PICO_OK)
+    {
+        Outbox.stats.failures++;
+        LOG_ERROR("Outbox flash %s at 0x%x failed\n", data != NULL ? "program" : "erase", (unsigned)offset);
+        return -1;
+    }
+
+    if (data == NULL)
+    {
+        Outbox.stats.erases++;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Run a flash operation, called by flash_safe_execute().
+ * @param param Pointer to the operation.
+ * @return None.
+ */
+static void _outbox_flash_op(void *param)
+{
+    const OutboxOp_t *op = (const OutboxOp_t *)param;
+
+    if (op->data == NULL)
+    {
+        flash_range_erase(op->offset, FLASH_SECTOR_SIZE);
+    }
+    else
+    {
+        flash_range_program(op->offset, op->data, op->len);
+    }
+}
@@ -0,0 +1,171 @@
+/** Includes *************************************************************************************/
+#include <string.h>
+#include "pico/cyw43_arch.h"
+#include "lwip/dns.h"
+#include "resolver.h"
+#include "log.h"
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+typedef struct
+{
+    char name[RESOLVER_NAME_MAX];
+    ip_addr_t addr;               /** Last known-good address */
+    bool valid;                   /** addr holds an answer */
+    bool pending;                 /** A lookup is in flight */
+    absolute_time_t refresh_at;   /** Start the next lookup at this time */
+    absolute_time_t stale_at;     /** The answer is older than RESOLVER_TTL_MS from this time */
+} ResolverEntry_t;
+
+typedef struct
+{
+    ResolverEntry_t entries[RESOLVER_MAX_NAMES];
+    uint8_t count;
+    resolver_stats_t stats;
+} Resolver_t;
+
+/** Variables ************************************************************************************/
+static Resolver_t Resolver = {0};
+
+/** Prototypes ***********************************************************************************/
+/** Private Function Prototypes ******************************************************************/
+static void _resolver_found(const char *name, const ip_addr_t *ipaddr, void *arg);
+
+/** Function Definitions *************************************************************************/
+int resolver_add(const char *hostname)
+{
+    if (hostname == NULL || strlen(hostname) >= RESOLVER_NAME_MAX)
+    {
+        return -1;
+    }
+
+    for (uint8_t i = 0; i < Resolver.count; i++)
+    {
+        if (strcmp(Resolver.entries[i].name, hostname) == 0)
+        {
+            return i;
+        }
+    }
+
+    if (Resolver.count >= RESOLVER_MAX_NAMES)
+    {
+        return -1;
+    }
+
+    ResolverEntry_t *entry = &Resolver.entries[Resolver.count];
+    memset(entry, 0, sizeof(*entry));
+    strcpy(entry->name, hostname);
+    entry->refresh_at = get_absolute_time();
+
+    return Resolver.count++;
+}
+
+int resolver_refresh(int id)
+{
+    if (id < 0 || id >= Resolver.count)
+    {
+        return -1;
+    }
+
+    ResolverEntry_t *entry = &Resolver.entries[id];
+    if (entry->pending || !time_reached(entry->refresh_at))
+    {
+        return 0;
+    }
+
+    /**
+     * lwIP keeps its own table of answers and their record TTLs but does not expose the TTL.
+     * Asking it again is answered from that table while the record is valid, and only goes to
+     * the network once the record has expired, so the server's TTL is still honoured.
+     */
+    ip_addr_t addr;
+    entry->pending = true;
+    Resolver.stats.queries++;
+
+    cyw43_arch_lwip_begin();
+    err_t err = dns_gethostbyname(entry->name, &addr, _resolver_found, entry);
+    cyw43_arch_lwip_end();
+
+    if (err == ERR_OK)
+    {
+        _resolver_found(entry->name, &addr, entry);
+    }
+    else if (err != ERR_INPROGRESS)
+    {
+        /** No DNS server yet or out of table entries, the callback will not run */
+        _resolver_found(entry->name, NULL, entry);
+    }
+
+    return 0;
+}
+
+int resolver_get(int id, ip_addr_t *addr)
+{
+    if (id < 0 || id >= Resolver.count || addr == NULL)
+    {
+        return -1;
+    }
+
+    ResolverEntry_t *entry = &Resolver.entries[id];
+    if (!entry->valid)
+    {
+        Resolver.stats.misses++;
+        return -1;
+    }
+
+    if (time_reached(entry->stale_at))
+    {
+        Resolver.stats.stale_hits++;
+    }
+    else
+    {
+        Resolver.stats.hits++;
+    }
+
+    ip_addr_copy(*addr, entry->addr);
+
+    return 0;
+}
+
+const char *resolver_name(int id)
+{
+    if (id < 0 || id >= Resolver.count)
+    {
+        return NULL;
+    }
+
+    return Resolver.entries[id].name;
+}
+
+const resolver_stats_t *resolver_stats(void)
+{
+    return &Resolver.stats;
+}
+
+/**
+ * @brief DNS callback, stores the answer or schedules a retry.
+ * @param name The host name that was looked up.
+ * @param ipaddr The address, NULL if the lookup failed.
+ * @param arg Pointer to the cache entry.
+ * @return None.
+ * @note A failed lookup leaves the last known-good address in place.
+ */
+static void _resolver_found(const char *name, const ip_addr_t *ipaddr, void *arg)
+{
+    ResolverEntry_t *entry = (ResolverEntry_t *)arg;
+    entry->pending = false;
+
+    if (ipaddr == NULL)
+    {
+        Resolver.stats.failures++;
+        entry->refresh_at = make_timeout_time_ms(RESOLVER_RETRY_MS);
+        LOG_WARN("DNS lookup of %s failed%s\n", name, entry->valid ? ", keeping the last address" : "");
+        return;
+    }
+
+    Resolver.stats.answers++;
+    ip_addr_copy(entry->addr, *ipaddr);
+    entry->valid = true;
+    entry->stale_at = make_timeout_time_ms(RESOLVER_TTL_MS);
+    entry->refresh_at = make_timeout_time_ms(RESOLVER_TTL_MS - RESOLVER_REFRESH_AHEAD_MS);
+    LOG_DEBUG("Resolved %s to %s\n", name, ipaddr_ntoa(ipaddr));
+}
@@ -0,0 +1,118 @@
+/** Includes *************************************************************************************/
+#include "pico/cyw43_arch.h"
+#include "sched.h"
+#include "trace.h"
+#include "log.h"
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+typedef struct
+{
+    sched_fn_t fn;
+    void *arg;
+    uint32_t period_ms;
+    absolute_time_t due;
+} SchedTask_t;
+
+typedef struct
+{
+    SchedTask_t tasks[SCHED_MAX_TASKS];
+    uint8_t count;
+    bool woken;   /** A task was made due while running, skip the next sleep */
+    uint64_t sleep_us;  /** Time spent waiting for work since sched_init() */
+} Sched_t;
+
+/** Variables ************************************************************************************/
+static Sched_t Sched = {0};
+
+/** Prototypes ***********************************************************************************/
+/** Functions ************************************************************************************/
+
+int sched_init(void)
+{
+    memset(&Sched, 0, sizeof(Sched));
+
+    return 0;
+}
+
+int sched_add(sched_fn_t fn, void *arg, uint32_t period_ms)
+{
+    if (fn == NULL || Sched.count >= SCHED_MAX_TASKS)
+    {
+        return -1;
+    }
+
+    SchedTask_t *task = &Sched.tasks[Sched.count];
+    task->fn = fn;
+    task->arg = arg;
+    task->period_ms = period_ms;
+    /** Run on the first pass */
+    task->due = get_absolute_time();
+
+    return Sched.count++;
+}
+
+int sched_wake(int id)
+{
+    if (id < 0 || id >= Sched.count)
+    {
+        return -1;
+    }
+
+    Sched.tasks[id].due = get_absolute_time();
+    Sched.woken = true;
+
+    return 0;
+}
+
+void sched_run(void)
+{
+    absolute_time_t next = at_the_end_of_time;
+
+    Sched.woken = false;
+
+    for (uint8_t i = 0; i < Sched.count; i++)
+    {
+        SchedTask_t *task = &Sched.tasks[i];
+
+        if (task->period_ms == 0 || time_reached(task->due))
+        {
+            /** Deadlines are absolute, a late run does not shift the following ones */
+            absolute_time_t now = get_absolute_time();
+            task->due = delayed_by_ms(task->due, task->period_ms);
+            if (absolute_time_diff_us(now, task->due) <= 0)
+            {
+                /** Fell more than a period behind, don't try to catch up with a burst */
+                task->due = delayed_by_ms(now, task->period_ms);
+            }
+
+            task->fn(task->arg);
+        }
+
+        if (task->period_ms > 0 && absolute_time_diff_us(task->due, next) > 0)
+        {
+            next = task->due;
+        }
+    }
+
+    /** Re-check deadlines that a task moved forward with sched_wake() */
+    if (Sched.woken)
+    {
+        return;
+    }
+
+    /** Write out queued log records while there is nothing else to do */
+    log_drain();
+
+    /** Sleep until the next deadline or until the driver signals work */
+    TRACE(TRACE_SCHED_SLEEP, 0);
+    uint64_t start = time_us_64();
+    cyw43_arch_wait_for_work_until(next);
+    Sched.sleep_us += time_us_64() - start;
+    TRACE(TRACE_SCHED_WAKE, 0);
+    cyw43_arch_poll();
+}
+
+uint64_t sched_sleep_us(void)
+{
+    return Sched.sleep_us;
+}
@@ -0,0 +1,714 @@
+/** Includes *************************************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include "lwip/udp.h"
+#include "lwip/timeouts.h"
+#include "lwip/apps/lwiperf.h"
+#include "pico/cyw43_arch.h"
+#include "selftest.h"
+#include "sched.h"
+#include "log.h"
+/** Defines **************************************************************************************/
+/** iperf 2 datagram header, then the server report that answers the last datagram */
+#define SELFTEST_UDP_HEADER 12
+#define SELFTEST_UDP_REPORT 40
+#define SELFTEST_REPORT_VERSION1 0x80000000u
+
+/** Smallest datagram, iperf reads its client header behind the datagram header */
+#define SELFTEST_UDP_LEN_MIN 64
+_Static_assert(SELFTEST_UDP_LEN >= SELFTEST_UDP_LEN_MIN, "SELFTEST_UDP_LEN below iperf's smallest datagram");
+
+/** How often datagrams due are sent, and the most sent at once so the pbuf pool keeps up */
+#define SELFTEST_UDP_TICK_MS 1
+#define SELFTEST_UDP_BURST_MAX 8
+
+/** Last datagram sent again until the report comes back, as iperf does */
+#define SELFTEST_UDP_FIN_MS 250
+#define SELFTEST_UDP_FIN_TRIES 10
+
+/** Busy time is sampled this often, far enough back to cover the longest test */
+#define SELFTEST_CPU_SAMPLE_MS 250
+#define SELFTEST_CPU_SAMPLES 64
+
+/** Typedefs *************************************************************************************/
+typedef enum
+{
+    SELFTEST_IDLE = 0,
+    SELFTEST_TCP,      /** Waiting for the up and the down report */
+    SELFTEST_UDP_UP,   /** Sending datagrams */
+    SELFTEST_UDP_FIN,  /** Waiting for the server report */
+} SelfTestPhase_t;
+
+typedef struct
+{
+    uint64_t at_us;
+    uint64_t sleep_us;
+} SelfTestCpu_t;
+
+/** Datagrams received from one iperf client */
+typedef struct
+{
+    bool active;
+    ip_addr_t peer;
+    u16_t peer_port;
+    uint64_t start_us;
+    uint64_t last_us;
+    uint64_t bytes;
+    uint32_t datagrams;
+    int32_t expected;      /** Next datagram id */
+    uint32_t lost;
+    uint32_t out_of_order;
+    int64_t transit_us;    /** Transit time of the last datagram, the clocks need not agree */
+    uint32_t jitter_us16;  /** Jitter in sixteenths of a microsecond */
+    uint8_t report[SELFTEST_UDP_HEADER + SELFTEST_UDP_REPORT];
+    bool reported;         /** report holds the answer to the client's last datagram */
+} SelfTestUdpRx_t;
+
+typedef struct
+{
+    /** Servers started by selftest_serve() */
+    void *tcp_server;
+    struct udp_pcb *udp_server;
+    ip_addr_t serve_addr;
+    bool serving;
+    SelfTestUdpRx_t rx;
+    /** Run started by selftest_run() */
+    SelfTestPhase_t phase;
+    ip_addr_t server;
+    void *tcp_session;
+    bool tcp_up_done;
+    struct udp_pcb *udp_client;
+    uint64_t udp_start_us;
+    uint32_t udp_sent;
+    uint64_t udp_bytes;
+    uint8_t fin_tries;
+    absolute_time_t deadline;
+    /** Busy time history */
+    SelfTestCpu_t cpu[SELFTEST_CPU_SAMPLES];
+    uint8_t cpu_next;
+    bool sampling;
+    selftest_result_t results[SELFTEST_RESULTS_MAX];
+    uint32_t result_count;
+    uint32_t unprinted;    /** Newest results not printed by selftest_print() yet */
+} SelfTest_t;
+
+/** Variables ************************************************************************************/
+static SelfTest_t SelfTest;
+
+/** Payload of every datagram sent, behind the header, iperf takes zeros as no options */
+static uint8_t SelfTestPayload[SELFTEST_UDP_LEN - SELFTEST_UDP_HEADER];
+
+/** Prototypes ***********************************************************************************/
+/** Private Function Prototypes ******************************************************************/
+static void _selftest_tcp_report(void *arg, enum lwiperf_report_type type, const ip_addr_t *local_addr, u16_t local_port,
+                                 const ip_addr_t *remote_addr, u16_t remote_port, u32_t bytes, u32_t ms, u32_t kbps);
+static void _selftest_udp_start(void);
+static void _selftest_udp_tick(void *arg);
+static int _selftest_udp_send(int32_t id);
+static void _selftest_udp_client_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port);
+static void _selftest_udp_server_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port);
+static void _selftest_udp_finish(SelfTestUdpRx_t *rx, const uint8_t *header);
+static void _selftest_finish(void);
+static void _selftest_timeout(void *arg);
+static void _selftest_cpu_sample(void *arg);
+static uint8_t _selftest_cpu(uint32_t ms);
+static void _selftest_result(const selftest_result_t *result);
+static void _selftest_print(const selftest_result_t *result);
+static uint32_t _selftest_get32(const uint8_t *in);
+static void _selftest_put32(uint8_t *out, uint32_t value);
+
+/** Function Definitions *************************************************************************/
+int selftest_serve(const ip_addr_t *local)
+{
+    if (SelfTest.serving)
+    {
+        return 0;
+    }
+
+    ip_addr_copy(SelfTest.serve_addr, local != NULL ? *local : *IP_ADDR_ANY);
+
+    SelfTest.udp_server = udp_new_ip_type(IPADDR_TYPE_V4);
+    if (SelfTest.udp_server == NULL || udp_bind(SelfTest.udp_server, &SelfTest.serve_addr, SELFTEST_PORT) != ERR_OK)
+    {
+        if (SelfTest.udp_server != NULL)
+        {
+            udp_remove(SelfTest.udp_server);
+            SelfTest.udp_server = NULL;
+        }
+        return -1;
+    }
+    udp_recv(SelfTest.udp_server, _selftest_udp_server_recv, &SelfTest.rx);
+
+    SelfTest.tcp_server = lwiperf_start_tcp_server(&SelfTest.serve_addr, SELFTEST_PORT, _selftest_tcp_report, NULL);
+    SelfTest.serving = true;
+    _selftest_cpu_sample(NULL);
+
+    return SelfTest.tcp_server != NULL ? 0 : -1;
+}
+
+int selftest_run(const char *server)
+{
+    if (SelfTest.phase != SELFTEST_IDLE || server == NULL || !ipaddr_aton(server, &SelfTest.server))
+    {
+        return -1;
+    }
+
+    SelfTest.result_count = 0;
+    SelfTest.tcp_up_done = false;
+    _selftest_cpu_sample(NULL);
+
+    /** The tradeoff test listens on the station's address, a server on any address is in its way */
+    if (SelfTest.tcp_server != NULL && ip_addr_isany(&SelfTest.serve_addr))
+    {
+        lwiperf_abort(SelfTest.tcp_server);
+        SelfTest.tcp_server = NULL;
+    }
+
+    /** Up, then the server connects back for down, each for iperf's default 10 s */
+    SelfTest.tcp_session = lwiperf_start_tcp_client(&SelfTest.server, SELFTEST_PORT, LWIPERF_TRADEOFF,
+                                                    _selftest_tcp_report, &SelfTest);
+    SelfTest.phase = SELFTEST_TCP;
+    sys_timeout(SELFTEST_TIMEOUT_MS, _selftest_timeout, NULL);
+
+    if (SelfTest.tcp_session == NULL)
+    {
+        LOG_WARN("Self-test could not start TCP\n");
+        _selftest_udp_start();
+    }
+
+    return 0;
+}
+
+bool selftest_busy(void)
+{
+    return SelfTest.phase != SELFTEST_IDLE;
+}
+
+const selftest_result_t *selftest_results(uint32_t *count)
+{
+    *count = SelfTest.result_count;
+
+    return SelfTest.results;
+}
+
+int selftest_print(void)
+{
+    int printed = 0;
+
+    while (true)
+    {
+        /** Copied out under the lock, the tests add results from lwIP's context */
+        selftest_result_t result;
+        cyw43_arch_lwip_begin();
+        bool pending = SelfTest.unprinted > 0;
+        if (pending)
+        {
+            result = SelfTest.results[SelfTest.result_count - SelfTest.unprinted];
+            SelfTest.unprinted--;
+        }
+        cyw43_arch_lwip_end();
+
+        if (!pending)
+        {
+            return printed;
+        }
+
+        _selftest_print(&result);
+        printed++;
+    }
+}
+
+/**
+ * @brief lwiperf report, for the run's TCP tests and for clients of the server.
+ * @param arg Pointer to the self-test for the run, NULL for the server.
+ * @param type How the test ended.
+ * @param bytes Bytes moved.
+ * @param ms Length of the test.
+ * @param kbps Throughput.
+ * @return None.
+ */
+static void _selftest_tcp_report(void *arg, enum lwiperf_report_type type, const ip_addr_t *local_addr, u16_t local_port,
+                                 const ip_addr_t *remote_addr, u16_t remote_port, u32_t bytes, u32_t ms, u32_t kbps)
+{
+    bool run = arg != NULL && SelfTest.phase == SELFTEST_TCP;
+    bool up = run ? !SelfTest.tcp_up_done : type == LWIPERF_TCP_DONE_CLIENT;
+
+    selftest_result_t result = {
+        .test = up ? "tcp_up" : "tcp_down",
+        .status = type == LWIPERF_TCP_DONE_CLIENT || type == LWIPERF_TCP_DONE_SERVER ? 0 : -1,
+        .bytes = bytes,
+        .ms = ms,
+        .kbps = kbps,
+        .cpu = _selftest_cpu(ms),
+    };
+    _selftest_result(&result);
+
+    if (!run)
+    {
+        return;
+    }
+
+    /** The down test follows the up one, the run goes on to UDP after it or after a failure */
+    SelfTest.tcp_up_done = true;
+    if (!up || result.status != 0)
+    {
+        if (result.status != 0 && SelfTest.tcp_session != NULL)
+        {
+            lwiperf_abort(SelfTest.tcp_session);
+        }
+        SelfTest.tcp_session = NULL;
+        _selftest_udp_start();
+    }
+}
+
+/**
+ * @brief Start sending datagrams to the server at the configured rate.
+ * @return None.
+ */
+static void _selftest_udp_start(void)
+{
+    SelfTest.udp_client = udp_new_ip_type(IPADDR_TYPE_V4);
+    if (SelfTest.udp_client == NULL || udp_connect(SelfTest.udp_client, &SelfTest.server, SELFTEST_PORT) != ERR_OK)
+    {
+        selftest_result_t result = {.test = "udp_up", .status = -1};
+        _selftest_result(&result);
+        _selftest_finish();
+        return;
+    }
+    udp_recv(SelfTest.udp_client, _selftest_udp_client_recv, NULL);
+
+    SelfTest.phase = SELFTEST_UDP_UP;
+    SelfTest.udp_start_us = time_us_64();
+    SelfTest.udp_sent = 0;
+    SelfTest.udp_bytes = 0;
+    SelfTest.fin_tries = 0;
+    sys_untimeout(_selftest_timeout, NULL);
+    sys_timeout(SELFTEST_UDP_DURATION_MS + SELFTEST_UDP_FIN_MS * (SELFTEST_UDP_FIN_TRIES + 1), _selftest_timeout, NULL);
+    sys_timeout(SELFTEST_UDP_TICK_MS, _selftest_udp_tick, NULL);
+}
+
+/**
+ * @brief Send the datagrams that are due, then the last one until the server reports.
+ * @param arg Unused.
+ * @return None.
+ */
+static void _selftest_udp_tick(void *arg)
+{
+    if (SelfTest.phase == SELFTEST_UDP_FIN)
+    {
+        /** The report came back or the run timed out in between */
+        if (++SelfTest.fin_tries > SELFTEST_UDP_FIN_TRIES)
+        {
+            _selftest_timeout(NULL);
+            return;
+        }
+        _selftest_udp_send(-(int32_t)SelfTest.udp_sent);
+        sys_timeout(SELFTEST_UDP_FIN_MS, _selftest_udp_tick, NULL);
+        return;
+    }
+
+    uint64_t elapsed_us = time_us_64() - SelfTest.udp_start_us;
+    if (elapsed_us >= (uint64_t)SELFTEST_UDP_DURATION_MS * 1000)
+    {
+        /** iperf marks the last datagram with a negative id */
+        SelfTest.phase = SELFTEST_UDP_FIN;
+        _selftest_udp_send(-(int32_t)SelfTest.udp_sent);
+        sys_timeout(SELFTEST_UDP_FIN_MS, _selftest_udp_tick, NULL);
+        return;
+    }
+
+    /** Catch up with the rate, the tick is coarser than the gap between datagrams */
+    uint64_t due = elapsed_us * SELFTEST_UDP_RATE_BPS / (8ull * SELFTEST_UDP_LEN * 1000000ull) + 1;
+    for (int i = 0; i < SELFTEST_UDP_BURST_MAX && SelfTest.udp_sent < due; i++)
+    {
+        if (_selftest_udp_send((int32_t)SelfTest.udp_sent) != 0)
+        {
+            break;
+        }
+        SelfTest.udp_sent++;
+        SelfTest.udp_bytes += SELFTEST_UDP_LEN;
+    }
+
+    sys_timeout(SELFTEST_UDP_TICK_MS, _selftest_udp_tick, NULL);
+}
+
+/**
+ * @brief Send a datagram, the header in front of the shared payload.
+ * @param id Datagram id, negative for the last one.
+ * @return int 0 on success, -1 if no pbuf was free or the datagram could not be sent.
+ */
+static int _selftest_udp_send(int32_t id)
+{
+    struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, SELFTEST_UDP_HEADER, PBUF_RAM);
+    struct pbuf *payload = pbuf_alloc(PBUF_RAW, sizeof(SelfTestPayload), PBUF_REF);
+    if (p == NULL || payload == NULL)
+    {
+        if (p != NULL)
+        {
+            pbuf_free(p);
+        }
+        if (payload != NULL)
+        {
+            pbuf_free(payload);
+        }
+        return -1;
+    }
+
+    uint64_t now = time_us_64();
+    uint8_t *header = (uint8_t *)p->payload;
+    _selftest_put32(&header[0], (uint32_t)id);
+    _selftest_put32(&header[4], (uint32_t)(now / 1000000));
+    _selftest_put32(&header[8], (uint32_t)(now % 1000000));
+    payload->payload = SelfTestPayload;
+    pbuf_cat(p, payload);
+
+    err_t err = udp_send(SelfTest.udp_client, p);
+    pbuf_free(p);
+
+    return err == ERR_OK ? 0 : -1;
+}
+
+/**
+ * @brief Server report for the upload.
+ */
+static void _selftest_udp_client_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+{
+    uint8_t in[SELFTEST_UDP_HEADER + SELFTEST_UDP_REPORT];
+
+    if (SelfTest.phase != SELFTEST_UDP_FIN || pbuf_copy_partial(p, in, sizeof(in), 0) != sizeof(in) ||
+        (_selftest_get32(&in[SELFTEST_UDP_HEADER]) & SELFTEST_REPORT_VERSION1) == 0)
+    {
+        pbuf_free(p);
+        return;
+    }
+    pbuf_free(p);
+
+    const uint8_t *report = &in[SELFTEST_UDP_HEADER];
+    uint64_t bytes = (uint64_t)_selftest_get32(&report[4]) << 32 | _selftest_get32(&report[8]);
+    uint32_t ms = _selftest_get32(&report[12]) * 1000 + _selftest_get32(&report[16]) / 1000;
+
+    selftest_result_t result = {
+        .test = "udp_up",
+        .status = 0,
+        .bytes = bytes,
+        .ms = ms,
+        .kbps = ms > 0 ? (uint32_t)(bytes * 8 / ms) : 0,
+        .jitter_us = _selftest_get32(&report[32]) * 1000000 + _selftest_get32(&report[36]),
+        .lost = _selftest_get32(&report[20]),
+        .out_of_order = _selftest_get32(&report[24]),
+        .datagrams = _selftest_get32(&report[28]),
+        .cpu = _selftest_cpu(SELFTEST_UDP_DURATION_MS),
+    };
+    _selftest_result(&result);
+    _selftest_finish();
+}
+
+/**
+ * @brief Datagrams from an iperf client, counted and timed until its last one.
+ */
+static void _selftest_udp_server_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *addr, u16_t port)
+{
+    SelfTestUdpRx_t *rx = (SelfTestUdpRx_t *)arg;
+    uint8_t header[SELFTEST_UDP_HEADER];
+    uint64_t now = time_us_64();
+    u16_t len = p->tot_len;
+
+    if (pbuf_copy_partial(p, header, sizeof(header), 0) != sizeof(header))
+    {
+        pbuf_free(p);
+        return;
+    }
+    pbuf_free(p);
+
+    int32_t id = (int32_t)_selftest_get32(&header[0]);
+    bool same = rx->peer_port == port && ip_addr_cmp(&rx->peer, addr);
+
+    if (id < 0 && !rx->active)
+    {
+        /** The client did not get the report and sent its last datagram again */
+        if (same && rx->reported)
+        {
+            struct pbuf *out = pbuf_alloc(PBUF_TRANSPORT, sizeof(rx->report), PBUF_RAM);
+            if (out != NULL)
+            {
+                pbuf_take(out, rx->report, sizeof(rx->report));
+                udp_sendto(pcb, out, addr, port);
+                pbuf_free(out);
+            }
+        }
+        return;
+    }
+
+    if (!rx->active || !same)
+    {
+        /** A new client, the one before is forgotten */
+        memset(rx, 0, sizeof(*rx));
+        rx->active = true;
+        ip_addr_copy(rx->peer, *addr);
+        rx->peer_port = port;
+        rx->start_us = now;
+    }
+
+    rx->last_us = now;
+    rx->bytes += len;
+    rx->datagrams++;
+
+    int32_t seq = id < 0 ? -id : id;
+    if (seq < rx->expected)
+    {
+        /** Counted as lost when the ones after it came */
+        rx->out_of_order++;
+        rx->lost -= rx->lost > 0 ? 1 : 0;
+    }
+    else
+    {
+        rx->lost += (uint32_t)(seq - rx->expected);
+        rx->expected = seq + 1;
+    }
+
+    /** RFC 1889, the change in transit time, smoothed with a gain of 1/16 */
+    uint64_t sent_us = (uint64_t)_selftest_get32(&header[4]) * 1000000 + _selftest_get32(&header[8]);
+    int64_t transit = (int64_t)(now - sent_us);
+    if (rx->datagrams > 1)
+    {
+        int64_t d = transit - rx->transit_us;
+        uint32_t delta = (uint32_t)(d < 0 ? -d : d);
+        rx->jitter_us16 += delta - ((rx->jitter_us16 + 8) >> 4);
+    }
+    rx->transit_us = transit;
+
+    if (id < 0)
+    {
+        _selftest_udp_finish(rx, header);
+        struct pbuf *out = pbuf_alloc(PBUF_TRANSPORT, sizeof(rx->report), PBUF_RAM);
+        if (out != NULL)
+        {
+            pbuf_take(out, rx->report, sizeof(rx->report));
+            udp_sendto(pcb, out, addr, port);
+            pbuf_free(out);
+        }
+    }
+}
+
+/**
+ * @brief Report a finished download and build the answer iperf waits for.
+ * @param rx The download.
+ * @param header Header of the client's last datagram, sent back in front of the report.
+ * @return None.
+ */
+static void _selftest_udp_finish(SelfTestUdpRx_t *rx, const uint8_t *header)
+{
+    uint64_t us = rx->last_us - rx->start_us;
+    uint32_t jitter_us = (rx->jitter_us16 + 8) >> 4;
+
+    selftest_result_t result = {
+        .test = "udp_down",
+        .status = 0,
+        .bytes = rx->bytes,
+        .ms = (uint32_t)(us / 1000),
+        .kbps = us > 0 ? (uint32_t)(rx->bytes * 8000 / us) : 0,
+        .jitter_us = jitter_us,
+        .datagrams = rx->datagrams,
+        .lost = rx->lost,
+        .out_of_order = rx->out_of_order,
+        .cpu = _selftest_cpu((uint32_t)(us / 1000)),
+    };
+    _selftest_result(&result);
+
+    uint8_t *report = &rx->report[SELFTEST_UDP_HEADER];
+    memcpy(rx->report, header, SELFTEST_UDP_HEADER);
+    _selftest_put32(&report[0], SELFTEST_REPORT_VERSION1);
+    _selftest_put32(&report[4], (uint32_t)(rx->bytes >> 32));
+    _selftest_put32(&report[8], (uint32_t)rx->bytes);
+    _selftest_put32(&report[12], (uint32_t)(us / 1000000));
+    _selftest_put32(&report[16], (uint32_t)(us % 1000000));
+    _selftest_put32(&report[20], rx->lost);
+    _selftest_put32(&report[24], rx->out_of_order);
+    _selftest_put32(&report[28], (uint32_t)rx->expected);
+    _selftest_put32(&report[32], jitter_us / 1000000);
+    _selftest_put32(&report[36], jitter_us % 1000000);
+
+    rx->active = false;
+    rx->reported = true;
+}
+
+/**
+ * @brief End the run and start the server again if it had to make way.
+ * @return None.
+ */
+static void _selftest_finish(void)
+{
+    sys_untimeout(_selftest_timeout, NULL);
+    sys_untimeout(_selftest_udp_tick, NULL);
+
+    if (SelfTest.udp_client != NULL)
+    {
+        udp_remove(SelfTest.udp_client);
+        SelfTest.udp_client = NULL;
+    }
+
+    if (SelfTest.serving && SelfTest.tcp_server == NULL)
+    {
+        SelfTest.tcp_server = lwiperf_start_tcp_server(&SelfTest.serve_addr, SELFTEST_PORT, _selftest_tcp_report, NULL);
+    }
+
+    SelfTest.phase = SELFTEST_IDLE;
+}
+
+/**
+ * @brief A test took too long, record it as failed and go on with the next one.
+ * @param arg Unused.
+ * @return None.
+ */
+static void _selftest_timeout(void *arg)
+{
+    if (SelfTest.phase == SELFTEST_TCP)
+    {
+        LOG_WARN("Self-test TCP timed out\n");
+        selftest_result_t result = {.test = SelfTest.tcp_up_done ? "tcp_down" : "tcp_up", .status = -1};
+        _selftest_result(&result);
+        if (SelfTest.tcp_session != NULL)
+        {
+            lwiperf_abort(SelfTest.tcp_session);
+            SelfTest.tcp_session = NULL;
+        }
+        _selftest_udp_start();
+        return;
+    }
+
+    if (SelfTest.phase == SELFTEST_UDP_UP || SelfTest.phase == SELFTEST_UDP_FIN)
+    {
+        /** No report, only what was sent is known */
+        LOG_WARN("Self-test got no UDP report\n");
+        uint32_t ms = (uint32_t)((time_us_64() - SelfTest.udp_start_us) / 1000);
+        selftest_result_t result = {
+            .test = "udp_up",
+            .status = -1,
+            .bytes = SelfTest.udp_bytes,
+            .ms = SELFTEST_UDP_DURATION_MS,
+            .kbps = (uint32_t)(SelfTest.udp_bytes * 8 / SELFTEST_UDP_DURATION_MS),
+            .datagrams = SelfTest.udp_sent,
+            .cpu = _selftest_cpu(ms),
+        };
+        _selftest_result(&result);
+        _selftest_finish();
+    }
+}
+
+/**
+ * @brief Remember how long the core has slept so far, for the busy share of a test.
+ * @param arg Unused.
+ * @return None.
+ */
+static void _selftest_cpu_sample(void *arg)
+{
+    if (arg == NULL && SelfTest.sampling)
+    {
+        return;
+    }
+
+    SelfTest.cpu[SelfTest.cpu_next] = (SelfTestCpu_t){time_us_64(), sched_sleep_us()};
+    SelfTest.cpu_next = (uint8_t)((SelfTest.cpu_next + 1) % SELFTEST_CPU_SAMPLES);
+    SelfTest.sampling = true;
+
+    sys_timeout(SELFTEST_CPU_SAMPLE_MS, _selftest_cpu_sample, &SelfTest);
+}
+
+/**
+ * @brief Work out the share of time the core was busy over the last part of the history.
+ * @param ms How far back to look.
+ * @return uint8_t Percentage busy.
+ */
+static uint8_t _selftest_cpu(uint32_t ms)
+{
+    uint64_t now = time_us_64();
+    uint64_t sleep = sched_sleep_us();
+    uint64_t from = now - LWIP_MIN((uint64_t)ms * 1000, now);
+
+    /** The newest sample taken before the test started, or the oldest there is */
+    const SelfTestCpu_t *start = NULL;
+    for (int i = 1; i <= SELFTEST_CPU_SAMPLES; i++)
+    {
+        const SelfTestCpu_t *sample = &SelfTest.cpu[(SelfTest.cpu_next + SELFTEST_CPU_SAMPLES - i) % SELFTEST_CPU_SAMPLES];
+        if (sample->at_us == 0)
+        {
+            break;
+        }
+        start = sample;
+        if (sample->at_us <= from)
+        {
+            break;
+        }
+    }
+
+    if (start == NULL || now <= start->at_us)
+    {
+        return 0;
+    }
+
+    uint64_t elapsed = now - start->at_us;
+    uint64_t slept = LWIP_MIN(sleep - start->sleep_us, elapsed);
+
+    return (uint8_t)(100 - slept * 100 / elapsed);
+}
+
+/**
+ * @brief Keep a result for selftest_results() and selftest_print().
+ * @param result The result.
+ * @return None.
+ */
+static void _selftest_result(const selftest_result_t *result)
+{
+    if (SelfTest.result_count == SELFTEST_RESULTS_MAX)
+    {
+        memmove(&SelfTest.results[0], &SelfTest.results[1], sizeof(SelfTest.results) - sizeof(SelfTest.results[0]));
+        SelfTest.result_count--;
+    }
+    SelfTest.results[SelfTest.result_count++] = *result;
+
+    if (SelfTest.unprinted < SelfTest.result_count)
+    {
+        SelfTest.unprinted++;
+    }
+}
+
+/**
+ * @brief Print a result as a JSON line.
+ * @param result The result.
+ * @return None.
+ */
+static void _selftest_print(const selftest_result_t *result)
+{
+    /** Straight to stdout, the log would cut the line short */
+    printf("{\"test\":\"%s\",\"profile\":\"%s\",\"status\":\"%s\",\"bytes\":%llu,\"ms\":%lu,\"kbps\":%lu,"
+           "\"jitter_us\":%lu,\"datagrams\":%lu,\"lost\":%lu,\"out_of_order\":%lu,\"cpu\":%u,"
+           "\"lwip\":{\"tcp_mss\":%u,\"tcp_wnd\":%u,\"tcp_snd_buf\":%u,\"pbuf_pool_size\":%u}}\n",
+           result->test, SELFTEST_PROFILE, result->status == 0 ? "ok" : "failed", (unsigned long long)result->bytes,
+           (unsigned long)result->ms, (unsigned long)result->kbps, (unsigned long)result->jitter_us,
+           (unsigned long)result->datagrams, (unsigned long)result->lost, (unsigned long)result->out_of_order,
+           result->cpu, (unsigned)TCP_MSS, (unsigned)TCP_WND, (unsigned)TCP_SND_BUF, (unsigned)PBUF_POOL_SIZE);
+}
+
+/**
+ * @brief Read a 32 bit value, big endian as iperf sends it.
+ * @param in Source, 4 bytes.
+ * @return uint32_t The value.
+ */
+static uint32_t _selftest_get32(const uint8_t *in)
+{
+    return (uint32_t)in[0] << 24 | (uint32_t)in[1] << 16 | (uint32_t)in[2] << 8 | in[3];
+}
+
+/**
+ * @brief Write a 32 bit value, big endian.
+ * @param out Destination, 4 bytes.
+ * @param value The value.
+ * @return None.
+ */
+static void _selftest_put32(uint8_t *out, uint32_t value)
+{
+    out[0] = (uint8_t)(value >> 24);
+    out[1] = (uint8_t)(value >> 16);
+    out[2] = (uint8_t)(value >> 8);
+    out[3] = (uint8_t)value;
+}
@@ -0,0 +1,151 @@
+/** Includes *************************************************************************************/
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "spsc.h"
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Private Function Prototypes ******************************************************************/
+static void _spsc_copy_in(spsc_ring_t *ring, uint32_t pos, const void *data, uint32_t len);
+static void _spsc_copy_out(const spsc_ring_t *ring, uint32_t pos, void *data, uint32_t len);
+
+/** Function Definitions *************************************************************************/
+int spsc_init(spsc_ring_t *ring, uint8_t *buf, uint32_t size)
+{
+    if (ring == NULL || buf == NULL || size == 0 || (size & (size - 1)) != 0)
+    {
+        return -1;
+    }
+
+    ring->buf = buf;
+    ring->size = size;
+    ring->mask = size - 1;
+    ring->head = 0;
+    ring->tail = 0;
+
+    return 0;
+}
+
+int spsc_push(spsc_ring_t *ring, const void *data, uint16_t len)
+{
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    /** Empty messages are not allowed, a zero length reads back as an empty ring */
+    if (len == 0 || ring->size - (head - tail) < (uint32_t)len + SPSC_HEADER_SIZE)
+    {
+        return -1;
+    }
+
+    uint8_t header[SPSC_HEADER_SIZE] = {len & 0xFF, len >> 8};
+    _spsc_copy_in(ring, head, header, SPSC_HEADER_SIZE);
+    _spsc_copy_in(ring, head + SPSC_HEADER_SIZE, data, len);
+
+    /** Publish the message, then wake the other core if it is waiting in __wfe() */
+    __atomic_store_n(&ring->head, head + SPSC_HEADER_SIZE + len, __ATOMIC_RELEASE);
+    __sev();
+
+    return 0;
+}
+
+int spsc_peek(spsc_ring_t *ring, void *buf, uint16_t max)
+{
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if (head == tail)
+    {
+        return 0;
+    }
+
+    uint8_t header[SPSC_HEADER_SIZE];
+    _spsc_copy_out(ring, tail, header, SPSC_HEADER_SIZE);
+    uint16_t len = (uint16_t)(header[0] | (header[1] << 8));
+
+    if (len > max)
+    {
+        return -1;
+    }
+
+    _spsc_copy_out(ring, tail + SPSC_HEADER_SIZE, buf, len);
+
+    return len;
+}
+
+void spsc_drop(spsc_ring_t *ring)
+{
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if (head == tail)
+    {
+        return;
+    }
+
+    uint8_t header[SPSC_HEADER_SIZE];
+    _spsc_copy_out(ring, tail, header, SPSC_HEADER_SIZE);
+    uint16_t len = (uint16_t)(header[0] | (header[1] << 8));
+
+    /** Hand the space back to the producer and wake it in case it is waiting for room */
+    __atomic_store_n(&ring->tail, tail + SPSC_HEADER_SIZE + len, __ATOMIC_RELEASE);
+    __sev();
+}
+
+int spsc_pop(spsc_ring_t *ring, void *buf, uint16_t max)
+{
+    int len = spsc_peek(ring, buf, max);
+    if (len > 0)
+    {
+        spsc_drop(ring);
+    }
+
+    return len;
+}
+
+uint32_t spsc_free(const spsc_ring_t *ring)
+{
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    return ring->size - (ring->head - tail);
+}
+
+bool spsc_empty(const spsc_ring_t *ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Copy data into the ring, wrapping around the end of the buffer.
+ * @param ring Pointer to the ring.
+ * @param pos Free running position to write at.
+ * @param data Data to copy.
+ * @param len Length of the data.
+ * @return None.
+ */
+static void _spsc_copy_in(spsc_ring_t *ring, uint32_t pos, const void *data, uint32_t len)
+{
+    uint32_t offset = pos & ring->mask;
+    uint32_t first = ring->size - offset < len ? ring->size - offset : len;
+
+    memcpy(ring->buf + offset, data, first);
+    memcpy(ring->buf, (const uint8_t *)data + first, len - first);
+}
+
+/**
+ * @brief Copy data out of the ring, wrapping around the end of the buffer.
+ * @param ring Pointer to the ring.
+ * @param pos Free running position to read from.
+ * @param data Destination buffer.
+ * @param len Number of bytes to copy.
+ * @return None.
+ */
+static void _spsc_copy_out(const spsc_ring_t *ring, uint32_t pos, void *data, uint32_t len)
+{
+    uint32_t offset = pos & ring->mask;
+    uint32_t first = ring->size - offset < len ? ring->size - offset : len;
+
+    memcpy(data, ring->buf + offset, first);
+    memcpy((uint8_t *)data + first, ring->buf, len - first);
+}
@@ -0,0 +1,412 @@
+/** Includes *************************************************************************************/
+#include <string.h>
+#include "telemetry.h"
+#include "trace.h"
+#include "log.h"
+/** Defines **************************************************************************************/
+#define TELEMETRY_LZ_NONE 0xffff
+
+/** Typedefs *************************************************************************************/
+/** Bits not yet written out, most significant first */
+typedef struct
+{
+    uint8_t *out;
+    uint16_t len;
+    uint16_t max;
+    uint32_t acc;
+    uint8_t bits;
+} TelemetryBits_t;
+
+/** Variables ************************************************************************************/
+/** Prototypes ***********************************************************************************/
+/** Private Function Prototypes ******************************************************************/
+static void _telemetry_reset(telemetry_t *telemetry, const client_t *client);
+static void _telemetry_hello(void *arg, const frame_t *frame);
+static int _telemetry_varint(uint8_t *out, uint32_t value);
+static int _telemetry_encode(telemetry_t *telemetry, const int32_t *samples, uint16_t count, uint8_t *out);
+static int _telemetry_lz_compress(telemetry_lz_t *lz, uint16_t len, uint8_t *out, uint16_t max);
+static void _telemetry_lz_insert(telemetry_lz_t *lz, uint16_t pos, uint16_t end);
+static void _telemetry_lz_commit(telemetry_lz_t *lz, uint16_t len);
+static bool _telemetry_bits_put(TelemetryBits_t *bits, uint32_t value, uint8_t count);
+
+/** Function Definitions *************************************************************************/
+int telemetry_init(telemetry_t *telemetry, frame_decoder_t *decoder, uint8_t channels, uint8_t codecs)
+{
+    if (telemetry == NULL || decoder == NULL || channels == 0 || channels > TELEMETRY_MAX_CHANNELS)
+    {
+        return -1;
+    }
+
+    memset(telemetry, 0, sizeof(*telemetry));
+    telemetry->channels = channels;
+    telemetry->offered = codecs & (TELEMETRY_CODEC_DELTA | TELEMETRY_CODEC_LZ);
+
+    return frame_register(decoder, TELEMETRY_FRAME_HELLO, _telemetry_hello, telemetry);
+}
+
+int telemetry_send(telemetry_t *telemetry, client_t *client, const int32_t *samples, uint16_t count)
+{
+    if (telemetry == NULL || client == NULL || samples == NULL || count == 0)
+    {
+        return -1;
+    }
+
+    if (client != telemetry->client || client->stats.connect_successes != telemetry->connection)
+    {
+        _telemetry_reset(telemetry, client);
+    }
+
+    if (client->state != CLIENT_CONNECTED)
+    {
+        return -1;
+    }
+
+    if (!telemetry->hello_sent)
+    {
+        uint8_t hello[3] = {TELEMETRY_VERSION, telemetry->offered, telemetry->channels};
+        if (frame_send(client, TELEMETRY_FRAME_HELLO, hello, sizeof(hello), false) != 0)
+        {
+            return -1;
+        }
+        telemetry->hello_sent = true;
+    }
+
+    uint32_t start = trace_stamp();
+
+    /** Datagrams can be lost or reordered, so over UDP every block stands on its own */
+    uint8_t codecs = telemetry->codecs;
+    if (client->transport == CLIENT_TRANSPORT_UDP)
+    {
+        codecs |= TELEMETRY_CODEC_KEY;
+        memset(telemetry->last, 0, sizeof(telemetry->last));
+        telemetry->lz.history = 0;
+    }
+
+    /** Encode straight behind the compressor window, so the block is already in place for it */
+    uint8_t *plain = telemetry->lz.buf + telemetry->lz.history;
+    int32_t last[TELEMETRY_MAX_CHANNELS];
+    memcpy(last, telemetry->last, sizeof(last));
+    int plain_len = _telemetry_encode(telemetry, samples, count, plain);
+    if (plain_len < 0)
+    {
+        return -1;
+    }
+
+    uint8_t *out = telemetry->out;
+    int len = 1;
+    len += _telemetry_varint(&out[len], count);
+
+    int packed = -1;
+    if (codecs & TELEMETRY_CODEC_LZ)
+    {
+        int hdr = _telemetry_varint(&out[len], (uint32_t)plain_len);
+        packed = _telemetry_lz_compress(&telemetry->lz, (uint16_t)plain_len, &out[len + hdr], (uint16_t)plain_len);
+        if (packed >= 0)
+        {
+            len += hdr + packed;
+        }
+        else
+        {
+            /** Sent plain, the window still takes the block so both ends stay in step */
+            codecs &= (uint8_t)~TELEMETRY_CODEC_LZ;
+            telemetry->stats.lz_skipped++;
+        }
+    }
+    if (packed < 0)
+    {
+        memcpy(&out[len], plain, (size_t)plain_len);
+        len += plain_len;
+    }
+    out[0] = codecs;
+
+    if (frame_send(client, TELEMETRY_FRAME_DATA, out, (uint16_t)len, false) != 0)
+    {
+        /** Nothing was committed, the previous sample and the window are as they were */
+        memcpy(telemetry->last, last, sizeof(last));
+        return -1;
+    }
+
+    _telemetry_lz_commit(&telemetry->lz, (uint16_t)plain_len);
+
+    telemetry->stats.encode_ticks += trace_stamp() - start;
+    telemetry->stats.samples += count;
+    telemetry->stats.raw_bytes += (uint32_t)count * telemetry->channels * sizeof(int32_t);
+    telemetry->stats.wire_bytes += (uint32_t)len;
+    telemetry->stats.blocks++;
+
+    return 0;
+}
+
+void telemetry_report(const telemetry_t *telemetry)
+{
+    const telemetry_stats_t *stats = &telemetry->stats;
+    if (stats->raw_bytes == 0)
+    {
+        return;
+    }
+
+    LOG_INFO("Telemetry %lu blocks, %llu of %llu bytes, %lu%% of plain, %lu ticks/KB, codecs 0x%x\n",
+             (unsigned long)stats->blocks, (unsigned long long)stats->wire_bytes, (unsigned long long)stats->raw_bytes,
+             (unsigned long)(stats->wire_bytes * 100 / stats->raw_bytes),
+             (unsigned long)(stats->encode_ticks * 1024 / stats->raw_bytes), telemetry->codecs);
+}
+
+/**
+ * @brief Start over for a new connection, plain until the server answers the hello.
+ * @param telemetry Pointer to the encoder.
+ * @param client The connection.
+ * @return None.
+ */
+static void _telemetry_reset(telemetry_t *telemetry, const client_t *client)
+{
+    telemetry->client = client;
+    telemetry->connection = client->stats.connect_successes;
+    telemetry->codecs = 0;
+    telemetry->hello_sent = false;
+    memset(telemetry->last, 0, sizeof(telemetry->last));
+    telemetry->lz.history = 0;
+}
+
+/**
+ * @brief Hello handler, takes the codecs the server accepts.
+ * @param arg Pointer to the encoder.
+ * @param frame The frame.
+ * @return None.
+ * @note Applies from the next block on, the server knows the codecs of each block from its
+ *       codecs byte.
+ */
+static void _telemetry_hello(void *arg, const frame_t *frame)
+{
+    telemetry_t *telemetry = (telemetry_t *)arg;
+    uint8_t hello[2];
+
+    if (frame_copy(frame, 0, hello, sizeof(hello)) != sizeof(hello) || hello[0] != TELEMETRY_VERSION)
+    {
+        LOG_WARN("Telemetry hello not understood\n");
+        return;
+    }
+
+    telemetry->codecs = hello[1] & telemetry->offered;
+    telemetry->stats.negotiated++;
+    LOG_INFO("Telemetry codecs 0x%x\n", telemetry->codecs);
+}
+
+/**
+ * @brief Write a varint, 7 bits per byte, least significant group first.
+ * @param out Destination, up to 5 bytes.
+ * @param value The value.
+ * @return int Bytes written.
+ */
+static int _telemetry_varint(uint8_t *out, uint32_t value)
+{
+    int n = 0;
+
+    while (value >= 0x80)
+    {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+
+    return n;
+}
+
+/**
+ * @brief Encode samples as plain values or as zig-zag varint deltas.
+ * @param telemetry Pointer to the encoder, last is moved on to the final sample either way, so
+ *                  DELTA can take over from a plain block.
+ * @param samples count * channels values.
+ * @param count Number of samples.
+ * @param out Destination, TELEMETRY_BLOCK_MAX bytes.
+ * @return int Bytes written, -1 if the block does not fit.
+ * @note Slow changing telemetry gives small deltas, and zig-zag keeps small negative ones short,
+ *       so most values take one byte.
+ */
+static int _telemetry_encode(telemetry_t *telemetry, const int32_t *samples, uint16_t count, uint8_t *out)
+{
+    uint32_t values = (uint32_t)count * telemetry->channels;
+    int len = 0;
+
+    if (!(telemetry->codecs & TELEMETRY_CODEC_DELTA))
+    {
+        if (values * sizeof(int32_t) > TELEMETRY_BLOCK_MAX)
+        {
+            return -1;
+        }
+
+        for (uint32_t i = 0; i < values; i++)
+        {
+            uint32_t value = (uint32_t)samples[i];
+            telemetry->last[i % telemetry->channels] = samples[i];
+            out[len++] = (uint8_t)value;
+            out[len++] = (uint8_t)(value >> 8);
+            out[len++] = (uint8_t)(value >> 16);
+            out[len++] = (uint8_t)(value >> 24);
+        }
+
+        return len;
+    }
+
+    for (uint32_t i = 0; i < values; i++)
+    {
+        int32_t *last = &telemetry->last[i % telemetry->channels];
+        int32_t delta = (int32_t)((uint32_t)samples[i] - (uint32_t)*last);
+        *last = samples[i];
+
+        if (len + 5 > TELEMETRY_BLOCK_MAX)
+        {
+            return -1;
+        }
+        len += _telemetry_varint(&out[len], ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+    }
+
+    return len;
+}
+
+/**
+ * @brief Compress the block that follows the window in lz->buf.
+ * @param lz Compressor state.
+ * @param len Length of the block.
+ * @param out Destination.
+ * @param max Give up once the output would reach this many bytes.
+ * @return int Bytes written, -1 if the output is not smaller than max.
+ * @note Positions are found through hash chains on the next two bytes, at most
+ *       TELEMETRY_LZ_CHAIN_MAX candidates deep, so the cost per byte is bounded.
+ */
+static int _telemetry_lz_compress(telemetry_lz_t *lz, uint16_t len, uint8_t *out, uint16_t max)
+{
+    uint16_t end = lz->history + len;
+    TelemetryBits_t bits = {
+        .out = out,
+        .max = max,
+    };
+
+    memset(lz->head, 0xff, sizeof(lz->head));
+    for (uint16_t pos = 0; pos < lz->history; pos++)
+    {
+        _telemetry_lz_insert(lz, pos, end);
+    }
+
+    uint16_t pos = lz->history;
+    while (pos < end)
+    {
+        uint16_t best_len = 0;
+        uint16_t best_dist = 0;
+        uint16_t longest = (uint16_t)LWIP_MIN(TELEMETRY_LZ_MAX_MATCH, end - pos);
+
+        if (longest >= TELEMETRY_LZ_MIN_MATCH)
+        {
+            uint16_t hash = (uint16_t)((lz->buf[pos] * 33u + lz->buf[pos + 1]) & (TELEMETRY_LZ_HASH_SIZE - 1));
+            uint16_t candidate = lz->head[hash];
+
+            for (int depth = 0; depth < TELEMETRY_LZ_CHAIN_MAX && candidate != TELEMETRY_LZ_NONE &&
+                                pos - candidate <= TELEMETRY_LZ_WINDOW;
+                 depth++, candidate = lz->prev[candidate])
+            {
+                uint16_t n = 0;
+                while (n < longest && lz->buf[candidate + n] == lz->buf[pos + n])
+                {
+                    n++;
+                }
+
+                if (n > best_len)
+                {
+                    best_len = n;
+                    best_dist = pos - candidate;
+                    if (n == longest)
+                    {
+                        break;
+                    }
+                }
+            }
+        }
+
+        bool ok;
+        if (best_len >= TELEMETRY_LZ_MIN_MATCH)
+        {
+            ok = _telemetry_bits_put(&bits, 0, 1) && _telemetry_bits_put(&bits, best_dist - 1u, 8) &&
+                 _telemetry_bits_put(&bits, best_len - (uint32_t)TELEMETRY_LZ_MIN_MATCH, 4);
+        }
+        else
+        {
+            best_len = 1;
+            ok = _telemetry_bits_put(&bits, 0x100u | lz->buf[pos], 9);
+        }
+        if (!ok)
+        {
+            return -1;
+        }
+
+        for (uint16_t i = 0; i < best_len; i++, pos++)
+        {
+            _telemetry_lz_insert(lz, pos, end);
+        }
+    }
+
+    /** Pad the last byte, the decoder stops at the plain length */
+    if (bits.bits > 0 && !_telemetry_bits_put(&bits, 0, (uint8_t)(8 - bits.bits)))
+    {
+        return -1;
+    }
+
+    return bits.len;
+}
+
+/**
+ * @brief Add a position to the hash chains.
+ * @param lz Compressor state.
+ * @param pos Position in lz->buf.
+ * @param end End of the data in lz->buf, a position needs two bytes to hash.
+ * @return None.
+ */
+static void _telemetry_lz_insert(telemetry_lz_t *lz, uint16_t pos, uint16_t end)
+{
+    if (pos + 1 >= end)
+    {
+        return;
+    }
+
+    uint16_t hash = (uint16_t)((lz->buf[pos] * 33u + lz->buf[pos + 1]) & (TELEMETRY_LZ_HASH_SIZE - 1));
+    lz->prev[pos] = lz->head[hash];
+    lz->head[hash] = pos;
+}
+
+/**
+ * @brief Slide the window over a block that was sent.
+ * @param lz Compressor state.
+ * @param len Length of the block that followed the window.
+ * @return None.
+ */
+static void _telemetry_lz_commit(telemetry_lz_t *lz, uint16_t len)
+{
+    uint16_t total = lz->history + len;
+    uint16_t keep = (uint16_t)LWIP_MIN(total, TELEMETRY_LZ_WINDOW);
+
+    memmove(lz->buf, lz->buf + total - keep, keep);
+    lz->history = keep;
+}
+
+/**
+ * @brief Append bits to the output, most significant first.
+ * @param bits Bit writer.
+ * @param value The bits, right aligned.
+ * @param count Number of bits, at most 16.
+ * @return bool false if the output is full.
+ */
+static bool _telemetry_bits_put(TelemetryBits_t *bits, uint32_t value, uint8_t count)
+{
+    bits->acc = (bits->acc << count) | (value & ((1u << count) - 1));
+    bits->bits += count;
+
+    while (bits->bits >= 8)
+    {
+        if (bits->len >= bits->max)
+        {
+            return false;
+        }
+        bits->bits -= 8;
+        bits->out[bits->len++] = (uint8_t)(bits->acc >> bits->bits);
+    }
+
+    return true;
+}
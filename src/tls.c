@@ -0,0 +1,253 @@
+/** Includes *************************************************************************************/
+#include <string.h>
+#include "tls.h"
+#include "log.h"
+#if LWIP_ALTCP_TLS
+#include "lwip/altcp_tls.h"
+#include "altcp_tls_mbedtls_structs.h"
+#include "mbedtls/ssl.h"
+/** PEM of the CA that signed the server certificate, written by CMake from PICO_CLIENT_TLS_CA */
+#if __has_include("tls_ca.h")
+#include "tls_ca.h"
+#endif
+#endif
+/** Defines **************************************************************************************/
+/** Session fields are private from mbedTLS 3 on, unless MBEDTLS_ALLOW_PRIVATE_ACCESS is set */
+#ifndef MBEDTLS_PRIVATE
+#define MBEDTLS_PRIVATE(member) member
+#endif
+
+#define TLS_MASTER_SIZE 48
+
+/** Drop a saved session after this many failed connections in a row that offered it */
+#define TLS_OFFER_FAILURES_MAX 2
+
+/** Typedefs *************************************************************************************/
+#if LWIP_ALTCP_TLS
+typedef struct
+{
+    bool used;
+    bool valid;                       /** session holds a session to offer */
+    bool offered;                     /** The connection in progress offered it */
+    uint8_t offer_failures;           /** Failed connections in a row that offered it */
+    uint8_t master[TLS_MASTER_SIZE];  /** Master secret of the offered session, a resumption keeps it */
+    absolute_time_t start;            /** When the connection in progress was started */
+    struct altcp_tls_session session;
+} TlsSession_t;
+
+typedef struct
+{
+    struct altcp_tls_config *config;
+    TlsSession_t sessions[TLS_MAX_SESSIONS];
+    tls_stats_t stats;
+} Tls_t;
+#else
+typedef struct
+{
+    tls_stats_t stats;
+} Tls_t;
+#endif
+
+/** Variables ************************************************************************************/
+static Tls_t Tls = {0};
+
+/** Prototypes ***********************************************************************************/
+/** Private Function Prototypes ******************************************************************/
+#if LWIP_ALTCP_TLS
+static TlsSession_t *_tls_session(int id);
+static void _tls_session_drop(TlsSession_t *slot);
+#endif
+
+/** Function Definitions *************************************************************************/
+#if LWIP_ALTCP_TLS
+int tls_session_add(void)
+{
+    for (int id = 0; id < TLS_MAX_SESSIONS; id++)
+    {
+        TlsSession_t *slot = &Tls.sessions[id];
+        if (!slot->used)
+        {
+            memset(slot, 0, sizeof(*slot));
+            slot->used = true;
+            altcp_tls_init_session(&slot->session);
+            return id;
+        }
+    }
+
+    return -1;
+}
+
+struct altcp_pcb *tls_new(int id, u8_t ip_type, const char *hostname)
+{
+    if (Tls.config == NULL)
+    {
+#ifdef TLS_CA_CERT
+        static const char ca[] = TLS_CA_CERT;
+        Tls.config = altcp_tls_create_config_client((const u8_t *)ca, sizeof(ca));
+#else
+        LOG_WARN("No CA certificate built in, the server is not authenticated\n");
+        Tls.config = altcp_tls_create_config_client(NULL, 0);
+#endif
+        if (Tls.config == NULL)
+        {
+            LOG_ERROR("Failed to create the TLS configuration\n");
+            return NULL;
+        }
+    }
+
+    struct altcp_pcb *pcb = altcp_tls_new(Tls.config, ip_type);
+    if (pcb == NULL)
+    {
+        return NULL;
+    }
+
+    mbedtls_ssl_context *ssl = (mbedtls_ssl_context *)altcp_tls_context(pcb);
+    if (hostname != NULL && mbedtls_ssl_set_hostname(ssl, hostname) != 0)
+    {
+        altcp_abort(pcb);
+        return NULL;
+    }
+
+    TlsSession_t *slot = _tls_session(id);
+    if (slot != NULL)
+    {
+        slot->start = get_absolute_time();
+        slot->offered = false;
+
+        /** Offered in the ClientHello, a ticket if the server issued one, otherwise the session id */
+        if (slot->valid && altcp_tls_set_session(pcb, &slot->session) == ERR_OK)
+        {
+            slot->offered = true;
+            memcpy(slot->master, slot->session.data.MBEDTLS_PRIVATE(master), TLS_MASTER_SIZE);
+        }
+    }
+
+    return pcb;
+}
+
+int tls_connected(int id, struct altcp_pcb *pcb)
+{
+    const mbedtls_ssl_context *ssl = (const mbedtls_ssl_context *)altcp_tls_context(pcb);
+    TlsSession_t *slot = _tls_session(id);
+
+#ifdef TLS_CA_CERT
+    /** lwIP verifies optionally so the handshake completes, the verdict is enforced here */
+    uint32_t flags = mbedtls_ssl_get_verify_result(ssl);
+    if (flags != 0)
+    {
+        LOG_ERROR("Server certificate rejected, flags 0x%lx\n", (unsigned long)flags);
+        tls_failed(id);
+        return -1;
+    }
+#else
+    LWIP_UNUSED_ARG(ssl);
+#endif
+
+    Tls.stats.handshakes++;
+    if (slot == NULL)
+    {
+        return 0;
+    }
+
+    uint32_t elapsed_ms = (uint32_t)(absolute_time_diff_us(slot->start, get_absolute_time()) / 1000);
+    Tls.stats.last_handshake_ms = elapsed_ms;
+
+    /** Save the new session, a full handshake replaces the offered one and a resumption refreshes it */
+    _tls_session_drop(slot);
+    if (altcp_tls_get_session(pcb, &slot->session) == ERR_OK)
+    {
+        slot->valid = true;
+    }
+
+    /** A resumed session keeps its master secret, a full handshake always derives a new one */
+    bool resumed = slot->offered && slot->valid &&
+                   memcmp(slot->master, slot->session.data.MBEDTLS_PRIVATE(master), TLS_MASTER_SIZE) == 0;
+    if (slot->offered)
+    {
+        Tls.stats.offered++;
+    }
+    slot->offer_failures = 0;
+
+    if (resumed)
+    {
+        Tls.stats.resumed++;
+        Tls.stats.total_resumed_ms += elapsed_ms;
+    }
+    else
+    {
+        Tls.stats.total_full_ms += elapsed_ms;
+    }
+
+    LOG_INFO("TLS %s handshake in %u ms\n", resumed ? "resumed" : "full", (unsigned)elapsed_ms);
+
+    return resumed ? 1 : 0;
+}
+
+void tls_failed(int id)
+{
+    Tls.stats.failures++;
+
+    /** An unreachable server fails the same way, so one failure is not held against the session */
+    TlsSession_t *slot = _tls_session(id);
+    if (slot != NULL && slot->offered && ++slot->offer_failures >= TLS_OFFER_FAILURES_MAX)
+    {
+        _tls_session_drop(slot);
+        slot->offer_failures = 0;
+    }
+}
+#else
+int tls_session_add(void)
+{
+    return -1;
+}
+
+struct altcp_pcb *tls_new(int id, u8_t ip_type, const char *hostname)
+{
+    return NULL;
+}
+
+int tls_connected(int id, struct altcp_pcb *pcb)
+{
+    return -1;
+}
+
+void tls_failed(int id)
+{
+    Tls.stats.failures++;
+}
+#endif
+
+const tls_stats_t *tls_stats(void)
+{
+    return &Tls.stats;
+}
+
+#if LWIP_ALTCP_TLS
+/**
+ * @brief Get a session slot by id.
+ * @param id Slot id.
+ * @return TlsSession_t* The slot, NULL if the id is not a slot in use.
+ */
+static TlsSession_t *_tls_session(int id)
+{
+    if (id < 0 || id >= TLS_MAX_SESSIONS || !Tls.sessions[id].used)
+    {
+        return NULL;
+    }
+
+    return &Tls.sessions[id];
+}
+
+/**
+ * @brief Forget the saved session of a slot.
+ * @param slot The slot.
+ * @return None.
+ * @note The session owns a copy of the ticket on the heap, it is freed here.
+ */
+static void _tls_session_drop(TlsSession_t *slot)
+{
+    altcp_tls_free_session(&slot->session);
+    altcp_tls_init_session(&slot->session);
+    slot->valid = false;
+}
+#endif
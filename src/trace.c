@@ -0,0 +1,66 @@
+/** Includes *************************************************************************************/
+#include "trace.h"
+#if PICO_RP2350 && !defined(__riscv)
+#include "hardware/structs/m33.h"
+#include "hardware/clocks.h"
+#define TRACE_USE_CYCLES 1
+#else
+#define TRACE_USE_CYCLES 0
+#endif
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+/** Variables ************************************************************************************/
+trace_ring_t TraceRings[TRACE_NUM_CORES];
+
+/** Prototypes ***********************************************************************************/
+/** Function Definitions *************************************************************************/
+int trace_init(void)
+{
+#if TRACE_USE_CYCLES
+    /** Each core has its own DWT, enable the cycle counter on this one */
+    m33_hw->demcr |= M33_DEMCR_TRCENA_BITS;
+    m33_hw->dwt_cyccnt = 0;
+    m33_hw->dwt_ctrl |= M33_DWT_CTRL_CYCCNTENA_BITS;
+#endif
+
+    TraceRings[get_core_num()].head = 0;
+
+    return 0;
+}
+
+uint32_t trace_stamp(void)
+{
+#if TRACE_USE_CYCLES
+    return m33_hw->dwt_cyccnt;
+#else
+    return time_us_32();
+#endif
+}
+
+void trace_dump(void)
+{
+#if TRACE_USE_CYCLES
+    uint32_t ticks_per_us = clock_get_hz(clk_sys) / 1000000;
+#else
+    uint32_t ticks_per_us = 1;
+#endif
+
+    for (uint32_t core = 0; core < TRACE_NUM_CORES; core++)
+    {
+        const trace_ring_t *ring = &TraceRings[core];
+        /** The other core may still be recording, the oldest few events can be torn */
+        uint32_t head = ring->head;
+        uint32_t count = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+
+        printf("TRACE core=%lu ticks_per_us=%lu count=%lu\n", (unsigned long)core, (unsigned long)ticks_per_us,
+               (unsigned long)count);
+
+        for (uint32_t i = head - count; i != head; i++)
+        {
+            const trace_record_t *record = &ring->records[i & (TRACE_RING_SIZE - 1)];
+            printf("T %08lx %u %u\n", (unsigned long)record->stamp, record->event, record->arg);
+        }
+    }
+
+    printf("TRACE end\n");
+}
@@ -1,29 +1,98 @@
 /** Includes *************************************************************************************/
+#include "lwip/dhcp.h"
 #include "wifi.h"
+#include "wifi_pm.h"
+#include "nvstore.h"
+#include "boot.h"
+#include "trace.h"
+#include "log.h"
 /** Defines **************************************************************************************/
 #define WIFI_CONNECTION_TIMEOUT_MS 5000
-#define WIFI_TASK_INTERVAL_MS 100
 #define WIFI_SSID_MAX_LENGTH 32
 #define WIFI_PASSWORD_MAX_LENGTH 64
 
+/** Packet counters of the firmware, WLC_GET_PKTCNTS, which the driver has no name for */
+#define WIFI_IOCTL_GET_PKTCNTS 0x13a
+
 /** Typedefs *************************************************************************************/
+/** Access point of the last association, as stored under NVSTORE_KEY_WIFI_AP */
+typedef struct
+{
+    uint8_t bssid[6];
+    uint16_t reserved;
+    uint32_t channel;
+    uint32_t auth;
+} WifiAp_t;
+
+/** Roaming while connected */
+typedef struct
+{
+    absolute_time_t next_sample;
+    absolute_time_t next_scan;
+    absolute_time_t hold_until;  /** No roam before this, the last one was recent */
+    absolute_time_t start;       /** Start of the roam in progress */
+    absolute_time_t deadline;    /** Give up on the roam in progress */
+    bool scanning;
+    bool joining;                /** Roam in progress, the link may be down */
+    bool rssi_valid;
+    int32_t rssi4;               /** Smoothed signal, scaled by 4 */
+    bool counts_valid;
+    uint32_t tx_good;            /** Frame counters at the start of the failure window */
+    uint32_t tx_bad;
+    bool candidate_valid;        /** The scan found another access point of the network */
+    WifiAp_t candidate;
+    int32_t candidate_rssi;
+    uint32_t lease;              /** Address before the roam */
+} WifiRoam_t;
+
 typedef struct
 {
     WifiTaskState_t state;
-    uint32_t last_run_ms;
+    absolute_time_t connect_deadline;
+    absolute_time_t connect_start;
     char ssid[WIFI_SSID_MAX_LENGTH];
     char pw[WIFI_PASSWORD_MAX_LENGTH];
+    WifiAp_t ap;             /** Cached access point */
+    bool ap_valid;           /** ap holds an access point that was joined before */
+    bool fast_join;          /** The join in progress targets the cached access point */
+    bool fast_join_failed;   /** Scan on the next attempt, the cached access point did not answer */
+    uint32_t lease;          /** Address of the last DHCP lease, 0 if none */
+    WifiRoam_t roam;
+    wifi_stats_t stats;
 } WifiTask_t;
 
 /** Variables ************************************************************************************/
 static WifiTask_t WifiTask = {
     .state = WIFI_TASK_DISCONNECTED,
-    .last_run_ms = 0,
+    .connect_deadline = 0,
+    .connect_start = 0,
     .ssid = {0},
     .pw = {0},
+    .ap = {{0}},
+    .ap_valid = false,
+    .fast_join = false,
+    .fast_join_failed = false,
+    .lease = 0,
+    .roam = {0},
+    .stats = {0},
 };
 
 /** Prototypes ***********************************************************************************/
+/** Private Function Prototypes ******************************************************************/
+static void _wifi_set_state(WifiTaskState_t state);
+static void _wifi_connect(void);
+static void _wifi_join_failed(void);
+static void _wifi_store_ap(void);
+static void _wifi_reuse_lease(void);
+static void _wifi_store_lease(void);
+static void _wifi_roam_reset(void);
+static void _wifi_roam_task(void);
+static void _wifi_roam_sample(void);
+static bool _wifi_roam_weak(void);
+static int _wifi_roam_scan_result(void *env, const cyw43_ev_scan_result_t *result);
+static void _wifi_roam_start(void);
+static void _wifi_roam_check(int status);
+
 /** Functions ************************************************************************************/
 
 int wifi_init(const char *ssid, const char *password)
@@ -39,59 +108,52 @@ int wifi_init(const char *ssid, const char *password)
     memcpy(WifiTask.pw, password, strlen(password) + 1);
     WifiTask.pw[strlen(password)] = '\0';
 
-    printf("Initialising Wi-Fi with SSID: %s and password: %s\n", WifiTask.ssid, WifiTask.pw);
+    LOG_INFO("Initialising Wi-Fi with SSID: %s and password: %s\n", WifiTask.ssid, WifiTask.pw);
+    wifi_pm_init();
 
     /** Initialise the Wi-Fi chip */
     int rc = cyw43_arch_init();
     if (rc != 0)
     {
-        printf("Wi-Fi init failed with rc \n", rc);
+        LOG_ERROR("Wi-Fi init failed with rc %d\n", rc);
         return -1;
     }
 
     /** Enable wifi station */
     cyw43_arch_enable_sta_mode();
 
+    /** Pick up the access point of the last association, so the first join can skip the scan */
+    if (nvstore_init() == 0 && nvstore_read(NVSTORE_KEY_WIFI_AP, &WifiTask.ap, sizeof(WifiTask.ap)) ==
+                                   (int)sizeof(WifiTask.ap))
+    {
+        WifiTask.ap_valid = true;
+        LOG_INFO("Cached access point %02x:%02x:%02x:%02x:%02x:%02x channel %lu\n", WifiTask.ap.bssid[0],
+                 WifiTask.ap.bssid[1], WifiTask.ap.bssid[2], WifiTask.ap.bssid[3], WifiTask.ap.bssid[4],
+                 WifiTask.ap.bssid[5], (unsigned long)WifiTask.ap.channel);
+    }
+    if (nvstore_read(NVSTORE_KEY_DHCP_LEASE, &WifiTask.lease, sizeof(WifiTask.lease)) != (int)sizeof(WifiTask.lease))
+    {
+        WifiTask.lease = 0;
+    }
+
+    boot_mark(BOOT_PHASE_WIFI_INIT);
+
     return 0;
 }
 
 int wifi_task(void)
 {
-
-    /** Check if the task should run */
-    static uint32_t timeLastRunMs = 0;
-    uint32_t currentTimeMs = to_ms_since_boot(get_absolute_time());
-
-    // clang-format off
-    uint32_t timePassedMs = currentTimeMs < timeLastRunMs
-                            ? UINT32_MAX - timeLastRunMs + currentTimeMs
-                            : currentTimeMs - timeLastRunMs;
-    // clang-format on
-
-    if (timePassedMs < WIFI_TASK_INTERVAL_MS)
-    {
-        return 0;
-    }
-
-    /** Time to run. Update last run */
-    timeLastRunMs = currentTimeMs;
-
     /** Run poll to check if there is new info on the lower driver */
     cyw43_arch_poll();
 
     /** Get the current wifi status */
     int currentWifiStatus = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
 
-    /** Keep track of connection timeout */
-    static uint32_t connectionTimeoutMs = 0;
-
     switch (WifiTask.state)
     {
 
     case WIFI_TASK_DISCONNECTED:
         /** WiFi is disconnected let's reconnect */
-        char *ssid = WifiTask.ssid;
-        char *pw = WifiTask.pw;
 
         /** Enable station mode again */
         cyw43_arch_enable_sta_mode();
@@ -99,63 +161,89 @@ int wifi_task(void)
         if (currentWifiStatus != CYW43_LINK_UP)
         {
             /** Try to connect */
-            connectionTimeoutMs = WIFI_CONNECTION_TIMEOUT_MS;
-            cyw43_arch_wifi_connect_bssid_async(ssid, NULL, pw, CYW43_AUTH_WPA2_AES_PSK);
-            printf("Connecting to Wi-Fi\n");
-            WifiTask.state = WIFI_TASK_CONNECTING;
+            _wifi_connect();
+            _wifi_set_state(WIFI_TASK_CONNECTING);
         }
 
         break;
 
     case WIFI_TASK_CONNECTING:
         /** Check if connected */
-        if (currentWifiStatus == CYW43_LINK_UP)
+        if (currentWifiStatus == CYW43_LINK_NOIP)
+        {
+            /** Associated, waiting for DHCP */
+            boot_mark(BOOT_PHASE_WIFI_JOINED);
+        }
+        else if (currentWifiStatus == CYW43_LINK_UP)
         {
             /** WiFi is connected */
             uint8_t *ip_address = (uint8_t *)&(cyw43_state.netif[0].ip_addr.addr);
-            printf("Connected to Wi-Fi\n");
-            printf("IP address %d.%d.%d.%d\n", ip_address[0], ip_address[1], ip_address[2], ip_address[3]);
+            LOG_INFO("Connected to Wi-Fi\n");
+            LOG_INFO("IP address %d.%d.%d.%d\n", ip_address[0], ip_address[1], ip_address[2], ip_address[3]);
+
+            WifiTask.stats.last_join_ms = (uint32_t)(absolute_time_diff_us(WifiTask.connect_start,
+                                                                           get_absolute_time()) / 1000);
+            if (WifiTask.fast_join)
+            {
+                WifiTask.stats.fast_joins++;
+            }
+            else
+            {
+                WifiTask.stats.scan_joins++;
+            }
+            WifiTask.fast_join_failed = false;
+            _wifi_store_ap();
+            _wifi_store_lease();
+            _wifi_roam_reset();
+            boot_mark(BOOT_PHASE_WIFI_JOINED);
+            boot_mark(BOOT_PHASE_WIFI_UP);
+
             /** Set the state to connected */
-            WifiTask.state = WIFI_TASK_CONNECTED;
+            _wifi_set_state(WIFI_TASK_CONNECTED);
         }
         else if (currentWifiStatus == CYW43_LINK_FAIL)
         {
             // Failed to connect
-            printf("Failed to connect to Wi-Fi\n");
+            LOG_WARN("Failed to connect to Wi-Fi\n");
+            _wifi_join_failed();
             cyw43_arch_disable_sta_mode();
-            WifiTask.state = WIFI_TASK_DISCONNECTED;
+            _wifi_set_state(WIFI_TASK_DISCONNECTED);
         }
         else if (currentWifiStatus == CYW43_LINK_BADAUTH)
         {
             /** Bad authentication */
-            printf("Bad auth\n");
+            LOG_WARN("Bad auth\n");
+            _wifi_join_failed();
             cyw43_arch_disable_sta_mode();
-            WifiTask.state = WIFI_TASK_DISCONNECTED;
+            _wifi_set_state(WIFI_TASK_DISCONNECTED);
         }
-
-        /** Reduce the timeout */
-        if (connectionTimeoutMs > 0)
-        {
-            connectionTimeoutMs -= WIFI_TASK_INTERVAL_MS;
-        }
-        else
+        else if (time_reached(WifiTask.connect_deadline))
         {
             /** Timeout reached */
-            printf("Connection timeout\n");
+            LOG_WARN("Connection timeout\n");
+            _wifi_join_failed();
             /** Reset station mode just incase it gets locked up */
             cyw43_arch_disable_sta_mode();
-            WifiTask.state = WIFI_TASK_DISCONNECTED;
+            _wifi_set_state(WIFI_TASK_DISCONNECTED);
         }
         break;
 
     case WIFI_TASK_CONNECTED:
-        /** Check if we are still connected */
-        if (currentWifiStatus != CYW43_LINK_UP)
+        if (WifiTask.roam.joining)
+        {
+            /** Moving to another access point, the link is down until it is there */
+            _wifi_roam_check(currentWifiStatus);
+        }
+        else if (currentWifiStatus != CYW43_LINK_UP)
         {
             /** Disconnected */
-            printf("Disconnected from Wi-Fi\n");
+            LOG_WARN("Disconnected from Wi-Fi\n");
             cyw43_arch_disable_sta_mode();
-            WifiTask.state = WIFI_TASK_DISCONNECTED;
+            _wifi_set_state(WIFI_TASK_DISCONNECTED);
+        }
+        else
+        {
+            _wifi_roam_task();
         }
         break;
 
@@ -171,3 +259,409 @@ WifiTaskState_t wifi_get_state(void)
 {
     return WifiTask.state;
 }
+
+const wifi_stats_t *wifi_stats(void)
+{
+    return &WifiTask.stats;
+}
+
+/**
+ * @brief Change state, recording the transition in the trace.
+ * @param state The new state.
+ * @return None.
+ */
+static void _wifi_set_state(WifiTaskState_t state)
+{
+    WifiTask.state = state;
+    TRACE(TRACE_WIFI_STATE, state);
+}
+
+/**
+ * @brief Start a join, straight to the cached access point if there is one, else with a scan.
+ * @return None.
+ */
+static void _wifi_connect(void)
+{
+    const char *ssid = WifiTask.ssid;
+    const char *pw = WifiTask.pw;
+
+    WifiTask.connect_start = get_absolute_time();
+    WifiTask.fast_join = WifiTask.ap_valid && !WifiTask.fast_join_failed;
+
+    if (WifiTask.fast_join)
+    {
+        _wifi_reuse_lease();
+
+        /** A known BSSID and channel skip the scan of every channel, the slowest part of a join */
+        WifiTask.connect_deadline = make_timeout_time_ms(WIFI_FAST_JOIN_TIMEOUT_MS);
+        cyw43_wifi_join(&cyw43_state, strlen(ssid), (const uint8_t *)ssid, strlen(pw), (const uint8_t *)pw,
+                        WifiTask.ap.auth, WifiTask.ap.bssid, WifiTask.ap.channel);
+        LOG_INFO("Connecting to Wi-Fi on channel %lu\n", (unsigned long)WifiTask.ap.channel);
+    }
+    else
+    {
+        WifiTask.connect_deadline = make_timeout_time_ms(WIFI_CONNECTION_TIMEOUT_MS);
+        cyw43_arch_wifi_connect_bssid_async(ssid, NULL, pw, WIFI_AUTH);
+        LOG_INFO("Connecting to Wi-Fi\n");
+    }
+}
+
+/**
+ * @brief Fall back to a scan on the next attempt if the cached access point did not answer.
+ * @return None.
+ * @note A failed scan join goes back to the cached access point, it is the most likely one
+ *       to come back if the network is down for a while.
+ */
+static void _wifi_join_failed(void)
+{
+    if (WifiTask.fast_join)
+    {
+        WifiTask.stats.fast_join_failures++;
+        WifiTask.fast_join_failed = true;
+    }
+    else
+    {
+        WifiTask.fast_join_failed = false;
+    }
+}
+
+/**
+ * @brief Store the access point just joined, the flash is only written if it changed.
+ * @return None.
+ */
+static void _wifi_store_ap(void)
+{
+    WifiAp_t ap = {
+        .reserved = 0,
+        .auth = WifiTask.fast_join ? WifiTask.ap.auth : WIFI_AUTH,
+    };
+    uint32_t channel[3] = {0};
+
+    if (cyw43_wifi_get_bssid(&cyw43_state, ap.bssid) != 0 ||
+        cyw43_ioctl(&cyw43_state, CYW43_IOCTL_GET_CHANNEL, sizeof(channel), (uint8_t *)channel, CYW43_ITF_STA) != 0)
+    {
+        return;
+    }
+    ap.channel = channel[0];
+
+    WifiTask.ap = ap;
+    WifiTask.ap_valid = true;
+
+    if (nvstore_write(NVSTORE_KEY_WIFI_AP, &ap, sizeof(ap)) != 0)
+    {
+        LOG_WARN("Could not store the access point\n");
+    }
+}
+
+/**
+ * @brief Ask for the address of the last lease when the link comes up, instead of discovering.
+ *
+ * The station netif waits in DHCP INIT until the link is up and then runs whatever its DHCP
+ * state calls for. Moved to REBOOTING with the old address, lwIP sends a single REQUEST for it
+ * (RFC 2131 INIT-REBOOT), which saves the DISCOVER/OFFER round trip. A NAK, or no answer after
+ * two tries, falls back to a normal DISCOVER.
+ *
+ * @return None.
+ * @note Only done when rejoining the cached access point, so the lease belongs to that network.
+ */
+static void _wifi_reuse_lease(void)
+{
+#if LWIP_DHCP && PICO_CLIENT_FAST_BOOT
+    struct netif *sta = &cyw43_state.netif[CYW43_ITF_STA];
+
+    if (WifiTask.lease == 0)
+    {
+        return;
+    }
+
+    cyw43_arch_lwip_begin();
+    struct dhcp *dhcp = netif_dhcp_data(sta);
+    if (dhcp != NULL && dhcp->state == DHCP_STATE_INIT && !netif_is_link_up(sta))
+    {
+        ip_addr_set_ip4_u32(&dhcp->offered_ip_addr, WifiTask.lease);
+        dhcp->state = DHCP_STATE_REBOOTING;
+        dhcp->tries = 0;
+        WifiTask.stats.lease_requests++;
+    }
+    cyw43_arch_lwip_end();
+#endif
+}
+
+/**
+ * @brief Store the address DHCP gave us, the flash is only written if it changed.
+ * @return None.
+ */
+static void _wifi_store_lease(void)
+{
+#if LWIP_DHCP
+    struct netif *sta = &cyw43_state.netif[CYW43_ITF_STA];
+
+    if (!dhcp_supplied_address(sta))
+    {
+        return;
+    }
+
+    uint32_t lease = ip4_addr_get_u32(netif_ip4_addr(sta));
+    if (lease == WifiTask.lease)
+    {
+        WifiTask.stats.leases_reused++;
+    }
+    WifiTask.lease = lease;
+
+    if (nvstore_write(NVSTORE_KEY_DHCP_LEASE, &lease, sizeof(lease)) != 0)
+    {
+        LOG_WARN("Could not store the DHCP lease\n");
+    }
+#endif
+}
+
+/**
+ * @brief Start over with the link quality and the scan timer, on a new access point.
+ * @return None.
+ */
+static void _wifi_roam_reset(void)
+{
+    WifiRoam_t *roam = &WifiTask.roam;
+    absolute_time_t now = get_absolute_time();
+
+    roam->next_sample = now;
+    roam->next_scan = delayed_by_ms(now, WIFI_ROAM_SCAN_INTERVAL_MS);
+    roam->hold_until = delayed_by_ms(now, WIFI_ROAM_HOLD_MS);
+    roam->scanning = false;
+    roam->joining = false;
+    roam->rssi_valid = false;
+    roam->counts_valid = false;
+    WifiTask.stats.tx_fail_percent = 0;
+}
+
+/**
+ * @brief Sample the link, scan when it is time and roam when the scan found a better access point.
+ * @return None.
+ */
+static void _wifi_roam_task(void)
+{
+    WifiRoam_t *roam = &WifiTask.roam;
+
+    if (WIFI_ROAM_SCAN_INTERVAL_MS == 0)
+    {
+        return;
+    }
+
+    if (time_reached(roam->next_sample))
+    {
+        roam->next_sample = make_timeout_time_ms(WIFI_ROAM_SAMPLE_MS);
+        _wifi_roam_sample();
+
+        /** A link that just went weak does not wait out the long interval */
+        absolute_time_t weak_scan = make_timeout_time_ms(WIFI_ROAM_SCAN_WEAK_MS);
+        if (_wifi_roam_weak() && absolute_time_diff_us(weak_scan, roam->next_scan) > 0)
+        {
+            roam->next_scan = weak_scan;
+        }
+    }
+
+    if (roam->scanning)
+    {
+        if (cyw43_wifi_scan_active(&cyw43_state))
+        {
+            return;
+        }
+        roam->scanning = false;
+
+        /** Only a weak link moves, and only to an access point clearly stronger than this one */
+        if (roam->candidate_valid && _wifi_roam_weak() && time_reached(roam->hold_until) &&
+            roam->candidate_rssi >= WifiTask.stats.rssi + WIFI_ROAM_HYSTERESIS_DB)
+        {
+            _wifi_roam_start();
+        }
+        return;
+    }
+
+    if (!time_reached(roam->next_scan))
+    {
+        return;
+    }
+    roam->next_scan = make_timeout_time_ms(_wifi_roam_weak() ? WIFI_ROAM_SCAN_WEAK_MS : WIFI_ROAM_SCAN_INTERVAL_MS);
+
+    /** An active scan for our network only, the radio returns to its channel between the others */
+    cyw43_wifi_scan_options_t opts = {0};
+    size_t ssid_len = strlen(WifiTask.ssid);
+    opts.ssid_len = (uint32_t)ssid_len;
+    memcpy(opts.ssid, WifiTask.ssid, ssid_len);
+
+    roam->candidate_valid = false;
+    if (cyw43_wifi_scan(&cyw43_state, &opts, &WifiTask, _wifi_roam_scan_result) == 0)
+    {
+        roam->scanning = true;
+        WifiTask.stats.scans++;
+    }
+}
+
+/**
+ * @brief Sample the signal and the frames that failed after all retries.
+ * @return None.
+ */
+static void _wifi_roam_sample(void)
+{
+    WifiRoam_t *roam = &WifiTask.roam;
+    int32_t rssi;
+
+    if (cyw43_wifi_get_rssi(&cyw43_state, &rssi) == 0)
+    {
+        /** A quarter of each new sample, enough to ride out a single fade */
+        roam->rssi4 = roam->rssi_valid ? roam->rssi4 + rssi - roam->rssi4 / 4 : rssi * 4;
+        roam->rssi_valid = true;
+        WifiTask.stats.rssi = roam->rssi4 / 4;
+    }
+
+    /** rx good, rx bad, tx good, tx bad, rx other cast, counted since the firmware started */
+    uint32_t counts[5] = {0};
+    if (cyw43_ioctl(&cyw43_state, WIFI_IOCTL_GET_PKTCNTS, sizeof(counts), (uint8_t *)counts, CYW43_ITF_STA) != 0)
+    {
+        return;
+    }
+
+    uint32_t good = counts[2] - roam->tx_good;
+    uint32_t bad = counts[3] - roam->tx_bad;
+    if (!roam->counts_valid || good + bad >= WIFI_ROAM_TX_FRAMES)
+    {
+        /** A window only closes once it has enough frames, an idle link keeps the last figure */
+        if (roam->counts_valid)
+        {
+            WifiTask.stats.tx_fail_percent = bad * 100 / (good + bad);
+        }
+        roam->tx_good = counts[2];
+        roam->tx_bad = counts[3];
+        roam->counts_valid = true;
+    }
+}
+
+/**
+ * @brief Check whether the link is weak enough to look for another access point.
+ * @return bool true if the signal or the frame failures are past their limits.
+ */
+static bool _wifi_roam_weak(void)
+{
+    return (WifiTask.roam.rssi_valid && WifiTask.stats.rssi < WIFI_ROAM_RSSI_WEAK) ||
+           WifiTask.stats.tx_fail_percent >= WIFI_ROAM_TX_FAIL_PERCENT;
+}
+
+/**
+ * @brief Scan result callback, keeps the strongest other access point of the network.
+ * @param env Pointer to the task state.
+ * @param result One access point heard, the same one may be reported more than once.
+ * @return int 0 to carry on scanning.
+ */
+static int _wifi_roam_scan_result(void *env, const cyw43_ev_scan_result_t *result)
+{
+    WifiTask_t *task = (WifiTask_t *)env;
+    WifiRoam_t *roam = &task->roam;
+
+    /** Only our own network, a hidden one reports no SSID and is never a candidate */
+    if (result->ssid_len != strlen(task->ssid) || memcmp(result->ssid, task->ssid, result->ssid_len) != 0)
+    {
+        return 0;
+    }
+
+    if (memcmp(result->bssid, task->ap.bssid, sizeof(task->ap.bssid)) == 0)
+    {
+        return 0;
+    }
+
+    if (!roam->candidate_valid || result->rssi > roam->candidate_rssi)
+    {
+        memcpy(roam->candidate.bssid, result->bssid, sizeof(roam->candidate.bssid));
+        roam->candidate.reserved = 0;
+        roam->candidate.channel = result->channel;
+        roam->candidate.auth = task->ap.auth;
+        roam->candidate_rssi = result->rssi;
+        roam->candidate_valid = true;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Join the candidate access point without leaving station mode.
+ *
+ * The firmware reassociates, and the driver takes the link down and up again. The netif keeps
+ * its address, DHCP confirms it when the link is back, so TCP connections carry on once their
+ * retransmissions get through.
+ *
+ * @return None.
+ */
+static void _wifi_roam_start(void)
+{
+    WifiRoam_t *roam = &WifiTask.roam;
+    const uint8_t *bssid = roam->candidate.bssid;
+
+    LOG_INFO("Roaming from %ld dBm to %ld dBm\n", (long)WifiTask.stats.rssi, (long)roam->candidate_rssi);
+    LOG_INFO("Roaming to %02x:%02x:%02x:%02x:%02x:%02x channel %lu\n", bssid[0], bssid[1], bssid[2], bssid[3],
+             bssid[4], bssid[5], (unsigned long)roam->candidate.channel);
+
+    roam->lease = ip4_addr_get_u32(netif_ip4_addr(&cyw43_state.netif[CYW43_ITF_STA]));
+    roam->start = get_absolute_time();
+    roam->deadline = make_timeout_time_ms(WIFI_ROAM_TIMEOUT_MS);
+    roam->hold_until = delayed_by_ms(roam->start, WIFI_ROAM_HOLD_MS);
+
+    if (cyw43_wifi_join(&cyw43_state, strlen(WifiTask.ssid), (const uint8_t *)WifiTask.ssid, strlen(WifiTask.pw),
+                        (const uint8_t *)WifiTask.pw, roam->candidate.auth, roam->candidate.bssid,
+                        roam->candidate.channel) != 0)
+    {
+        LOG_WARN("Roam join refused\n");
+        WifiTask.stats.roam_failures++;
+        return;
+    }
+
+    roam->joining = true;
+}
+
+/**
+ * @brief Follow a roam, done once the link is up on the candidate access point.
+ * @param status Link status of the station.
+ * @return None.
+ * @note A roam that fails or times out ends in a full reconnect, to the cached access point
+ *       first, which is the one just left.
+ */
+static void _wifi_roam_check(int status)
+{
+    WifiRoam_t *roam = &WifiTask.roam;
+    uint8_t bssid[6];
+
+    if (status == CYW43_LINK_UP && cyw43_wifi_get_bssid(&cyw43_state, bssid) == 0 &&
+        memcmp(bssid, roam->candidate.bssid, sizeof(bssid)) == 0)
+    {
+        uint32_t ms = (uint32_t)(absolute_time_diff_us(roam->start, get_absolute_time()) / 1000);
+        wifi_stats_t *stats = &WifiTask.stats;
+
+        stats->roams++;
+        stats->last_roam_ms = ms;
+        stats->max_roam_ms = ms > stats->max_roam_ms ? ms : stats->max_roam_ms;
+        stats->total_roam_ms += ms;
+
+        /** Connections bound to the old address were reset by lwIP, the client reconnects them */
+        if (ip4_addr_get_u32(netif_ip4_addr(&cyw43_state.netif[CYW43_ITF_STA])) != roam->lease)
+        {
+            stats->roam_address_changes++;
+            LOG_WARN("Address changed while roaming\n");
+        }
+        LOG_INFO("Roamed in %lu ms\n", (unsigned long)ms);
+
+        /** The new access point is the one to come back to after a reset */
+        WifiTask.fast_join = true;
+        _wifi_store_ap();
+        _wifi_store_lease();
+        _wifi_roam_reset();
+        return;
+    }
+
+    if (status == CYW43_LINK_FAIL || status == CYW43_LINK_NONET || status == CYW43_LINK_BADAUTH ||
+        time_reached(roam->deadline))
+    {
+        LOG_WARN("Roam failed with status %d\n", status);
+        WifiTask.stats.roam_failures++;
+        roam->joining = false;
+        cyw43_arch_disable_sta_mode();
+        _wifi_set_state(WIFI_TASK_DISCONNECTED);
+    }
+}
@@ -0,0 +1,175 @@
+/** Includes *************************************************************************************/
+#include "wifi_pm.h"
+#include "wifi.h"
+#include "log.h"
+/** Defines **************************************************************************************/
+/** Typedefs *************************************************************************************/
+typedef struct
+{
+    bool disabled;
+    wifi_pm_mode_t mode;
+    uint64_t last_bytes;           /** Traffic total at the last update */
+    absolute_time_t last_sample;   /** Time of the last update */
+    absolute_time_t last_update;   /** Time accounted up to here */
+    absolute_time_t last_busy;     /** Last time the traffic was not idle */
+    wifi_pm_stats_t stats;
+} WifiPm_t;
+
+/** Variables ************************************************************************************/
+static WifiPm_t WifiPm = {0};
+
+/** Prototypes ***********************************************************************************/
+/** Private Function Prototypes ******************************************************************/
+static void _wifi_pm_account(void);
+static int _wifi_pm_set_mode(wifi_pm_mode_t mode);
+
+/** Function Definitions *************************************************************************/
+void wifi_pm_init(void)
+{
+    /** Nothing sampled or accounted yet, the first update only starts the clocks */
+    WifiPm.last_sample = nil_time;
+    WifiPm.last_update = nil_time;
+    WifiPm.last_busy = nil_time;
+}
+
+int wifi_pm_update(uint64_t bytes, uint32_t pending)
+{
+    absolute_time_t now = get_absolute_time();
+    int64_t elapsed_us = !is_nil_time(WifiPm.last_sample) ? absolute_time_diff_us(WifiPm.last_sample, now) : 0;
+    uint64_t delta = bytes - WifiPm.last_bytes;
+
+    _wifi_pm_account();
+    WifiPm.last_bytes = bytes;
+    WifiPm.last_sample = now;
+
+    if (WifiPm.disabled)
+    {
+        return 0;
+    }
+
+    if (wifi_get_state() != WIFI_TASK_CONNECTED)
+    {
+        /** Rejoining resets the driver to its default mode, pick again once the link is back */
+        WifiPm.mode = WIFI_PM_MODE_DOWN;
+        return 0;
+    }
+
+    uint32_t rate_bps = elapsed_us > 0 ? (uint32_t)(delta * 1000000 / (uint64_t)elapsed_us) : 0;
+    bool busy = pending > 0 || rate_bps >= WIFI_PM_BUSY_BPS;
+
+    if (busy || rate_bps >= WIFI_PM_IDLE_BPS)
+    {
+        WifiPm.last_busy = now;
+    }
+
+    wifi_pm_mode_t mode = WifiPm.mode;
+    if (busy)
+    {
+        mode = WIFI_PM_MODE_PERFORMANCE;
+    }
+    else if (mode == WIFI_PM_MODE_DOWN ||
+             absolute_time_diff_us(WifiPm.last_busy, now) >= (int64_t)WIFI_PM_IDLE_HOLD_MS * 1000)
+    {
+        mode = WIFI_PM_MODE_POWERSAVE;
+    }
+
+    if (mode == WifiPm.mode)
+    {
+        return 0;
+    }
+
+    return _wifi_pm_set_mode(mode);
+}
+
+void wifi_pm_set_enabled(bool enabled)
+{
+    if (!enabled && WifiPm.mode != WIFI_PM_MODE_DOWN)
+    {
+        /** Hand back to the driver's default */
+        cyw43_arch_lwip_begin();
+        cyw43_wifi_pm(&cyw43_state, CYW43_DEFAULT_PM);
+        cyw43_arch_lwip_end();
+        _wifi_pm_account();
+        WifiPm.mode = WIFI_PM_MODE_DOWN;
+    }
+
+    WifiPm.disabled = !enabled;
+}
+
+wifi_pm_mode_t wifi_pm_mode(void)
+{
+    return WifiPm.mode;
+}
+
+const wifi_pm_stats_t *wifi_pm_stats(void)
+{
+    _wifi_pm_account();
+
+    return &WifiPm.stats;
+}
+
+/**
+ * @brief Add the time since the last call to the current mode.
+ * @return None.
+ */
+static void _wifi_pm_account(void)
+{
+    absolute_time_t now = get_absolute_time();
+
+    if (!is_nil_time(WifiPm.last_update) && !WifiPm.disabled)
+    {
+        uint64_t elapsed_ms = (uint64_t)absolute_time_diff_us(WifiPm.last_update, now) / 1000;
+
+        switch (WifiPm.mode)
+        {
+        case WIFI_PM_MODE_POWERSAVE:
+            WifiPm.stats.powersave_ms += elapsed_ms;
+            break;
+        case WIFI_PM_MODE_PERFORMANCE:
+            WifiPm.stats.performance_ms += elapsed_ms;
+            break;
+        default:
+            WifiPm.stats.down_ms += elapsed_ms;
+            break;
+        }
+
+        /** Keep the remainder, so frequent calls do not lose time */
+        now = delayed_by_ms(WifiPm.last_update, (uint32_t)elapsed_ms);
+    }
+
+    WifiPm.last_update = now;
+}
+
+/**
+ * @brief Tell the driver to change the power mode.
+ * @param mode WIFI_PM_MODE_POWERSAVE or WIFI_PM_MODE_PERFORMANCE.
+ * @return int 0 on success, -1 on failure.
+ */
+static int _wifi_pm_set_mode(wifi_pm_mode_t mode)
+{
+    uint32_t pm = mode == WIFI_PM_MODE_PERFORMANCE ? WIFI_PM_PERFORMANCE : WIFI_PM_POWERSAVE;
+
+    cyw43_arch_lwip_begin();
+    int rc = cyw43_wifi_pm(&cyw43_state, pm);
+    cyw43_arch_lwip_end();
+
+    if (rc != 0)
+    {
+        WifiPm.stats.failures++;
+        LOG_WARN("Wi-Fi power mode change failed with rc %d\n", rc);
+        return -1;
+    }
+
+    if (mode == WIFI_PM_MODE_PERFORMANCE)
+    {
+        WifiPm.stats.to_performance++;
+    }
+    else
+    {
+        WifiPm.stats.to_powersave++;
+    }
+    WifiPm.mode = mode;
+    LOG_DEBUG("Wi-Fi power mode %s\n", mode == WIFI_PM_MODE_PERFORMANCE ? "performance" : "power save");
+
+    return 0;
+}
@@ -0,0 +1,169 @@
+#!/usr/bin/env python3
+"""Expand the binary log records printed by the firmware into text.
+
+Each record only holds the address of its format string, so the ELF the firmware was built
+from is needed to look the strings up. Save the console output and pass both in:
+
+    tools/log_decode.py build/pico_client.elf capture.txt
+
+Lines that are not records are passed through unchanged, so a whole terminal log can be
+decoded. The record layout and argument tags match log_write() and log_arg_tag_t in inc/log.h.
+"""
+import argparse
+import re
+import struct
+import sys
+
+LEVELS = {1: "E", 2: "W", 3: "I", 4: "D"}
+
+ARG_I32 = 1
+ARG_U32 = 2
+ARG_I64 = 3
+ARG_U64 = 4
+ARG_DOUBLE = 5
+ARG_STR = 6
+ARG_PTR = 7
+
+# A printf conversion: flags, width, precision, length modifier and conversion
+SPEC = re.compile(r"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d+))?(hh|h|ll|l|L|q|j|z|t)?([diouxXeEfFgGaAcspn%])")
+
+
+class Image:
+    """The loadable segments of a 32-bit little endian ELF file."""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            data = f.read()
+        if data[:4] != b"\x7fELF" or data[4] != 1 or data[5] != 1:
+            raise ValueError("{} is not a 32-bit little endian ELF file".format(path))
+
+        self.data = data
+        self.segments = []
+        phoff, = struct.unpack_from("<I", data, 28)
+        phentsize, phnum = struct.unpack_from("<HH", data, 42)
+        for i in range(phnum):
+            p_type, p_offset, p_vaddr, p_paddr, p_filesz = struct.unpack_from("<IIIII", data, phoff + i * phentsize)
+            if p_type == 1 and p_filesz > 0:
+                # Strings are read at their load address, which is the flash address for XIP
+                self.segments.append((p_paddr, p_offset, p_filesz))
+                if p_vaddr != p_paddr:
+                    self.segments.append((p_vaddr, p_offset, p_filesz))
+
+    def string(self, address):
+        for base, offset, size in self.segments:
+            if base <= address < base + size:
+                start = offset + address - base
+                end = self.data.index(b"\0", start, offset + size)
+                return self.data[start:end].decode("utf-8", errors="replace")
+        return None
+
+
+def parse_args(record, offset, count):
+    """Return the arguments of a record as Python values."""
+    args = []
+    for _ in range(count):
+        tag = record[offset]
+        offset += 1
+        if tag == ARG_I32:
+            args.append(struct.unpack_from("<i", record, offset)[0])
+            offset += 4
+        elif tag in (ARG_U32, ARG_PTR):
+            args.append(struct.unpack_from("<I", record, offset)[0])
+            offset += 4
+        elif tag == ARG_I64:
+            args.append(struct.unpack_from("<q", record, offset)[0])
+            offset += 8
+        elif tag == ARG_U64:
+            args.append(struct.unpack_from("<Q", record, offset)[0])
+            offset += 8
+        elif tag == ARG_DOUBLE:
+            args.append(struct.unpack_from("<d", record, offset)[0])
+            offset += 8
+        elif tag == ARG_STR:
+            length = record[offset]
+            args.append(record[offset + 1:offset + 1 + length].decode("utf-8", errors="replace"))
+            offset += 1 + length
+        else:
+            raise ValueError("unknown argument tag {}".format(tag))
+    return args
+
+
+def expand(fmt, args):
+    """Format like printf, a missing argument shows as <?>."""
+    args = list(args)
+
+    def take():
+        return args.pop(0) if args else None
+
+    def convert(match):
+        flags, width, precision, _, conv = match.groups()
+        if conv == "%":
+            return "%"
+        if width == "*":
+            width = take()
+            width = "" if width is None else str(width)
+        if precision == "*":
+            precision = take()
+            precision = None if precision is None else str(precision)
+        value = take()
+        if value is None:
+            return "<?>"
+
+        spec = "%" + flags + (width or "") + ("." + precision if precision is not None else "")
+        if conv == "p":
+            return "0x{:08x}".format(value)
+        if conv in "diu":
+            return (spec + "d") % value
+        if conv == "c":
+            return (spec + "c") % chr(value & 0xFF)
+        if conv in "oxX":
+            # Negative values print as the 32 or 64-bit two's complement, like printf
+            if value < 0:
+                value += 1 << (64 if value < -(1 << 31) else 32)
+            return (spec + conv) % value
+        if conv == "s":
+            return (spec + "s") % value
+        if conv in "aA":
+            return float(value).hex()
+        if conv == "n":
+            return ""
+        return (spec + conv) % value
+
+    return SPEC.sub(convert, fmt)
+
+
+def decode(image, hexdata):
+    record = bytes.fromhex(hexdata)
+    address, stamp, level, count = struct.unpack_from("<IIBB", record, 0)
+    fmt = image.string(address)
+    if fmt is None:
+        return "[{:12.6f}] ? <unknown format 0x{:08x}, wrong ELF?>\n".format(stamp / 1e6, address)
+
+    text = expand(fmt, parse_args(record, 10, count))
+    if not text.endswith("\n"):
+        text += "\n"
+    return "[{:12.6f}] {} {}".format(stamp / 1e6, LEVELS.get(level, level), text)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("elf", help="firmware ELF file the records came from")
+    parser.add_argument("capture", nargs="?", help="saved console output, stdin if omitted")
+    args = parser.parse_args()
+
+    image = Image(args.elf)
+    lines = open(args.capture, errors="replace") if args.capture else sys.stdin
+
+    for line in lines:
+        fields = line.split()
+        if len(fields) == 2 and fields[0] == "L":
+            try:
+                sys.stdout.write(decode(image, fields[1]))
+                continue
+            except (ValueError, struct.error, IndexError):
+                pass
+        sys.stdout.write(line)
+
+
+if __name__ == "__main__":
+    main()
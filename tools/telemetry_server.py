@@ -0,0 +1,228 @@
+#!/usr/bin/env python3
+"""Reference server for the client's telemetry stream, see inc/telemetry.h for the format.
+
+Answers the hello of every connection with the codecs it accepts, decodes the data blocks and
+prints one line per sample, with a summary of the compression per block. Blocks the client kept
+in its outbox while offline arrive as records, see inc/outbox.h, and are acknowledged. Heartbeat
+pings are answered, see inc/heartbeat.h:
+
+    tools/telemetry_server.py --port 4242
+    tools/telemetry_server.py --codecs delta        # refuse LZ, for comparison
+    tools/telemetry_server.py --quiet               # block summaries only
+
+The firmware sends the die temperature in milli degrees and the Wi-Fi RSSI in dBm.
+"""
+import argparse
+import socket
+import struct
+import threading
+
+FRAME_FLAG_CRC = 0x80
+
+FRAME_HELLO = 2
+FRAME_DATA = 3
+FRAME_RECORD = 4
+FRAME_ACK = 5
+FRAME_PING = 6
+FRAME_PONG = 7
+
+VERSION = 1
+CODEC_DELTA = 0x01
+CODEC_LZ = 0x02
+CODEC_KEY = 0x80
+
+LZ_WINDOW = 256
+LZ_MIN_MATCH = 2
+
+CODECS = {"plain": 0, "delta": CODEC_DELTA, "lz": CODEC_LZ, "delta_lz": CODEC_DELTA | CODEC_LZ}
+
+
+def varint(data, pos):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        if not byte & 0x80:
+            return value, pos
+        shift += 7
+
+
+def encode_varint(value):
+    out = bytearray()
+    while value >= 0x80:
+        out.append((value & 0x7F) | 0x80)
+        value >>= 7
+    out.append(value)
+    return bytes(out)
+
+
+def crc16(data, crc=0xFFFF):
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021 if crc & 0x8000 else crc << 1) & 0xFFFF
+    return crc
+
+
+class Decoder:
+    """Decoder state of one connection, the previous sample and the LZ window."""
+
+    def __init__(self, channels):
+        self.channels = channels
+        self.last = [0] * channels
+        self.window = b""
+
+    def lz_expand(self, data, pos, plain_len):
+        out = bytearray(self.window)
+        start = len(out)
+        bits = int.from_bytes(data[pos:], "big")
+        nbits = (len(data) - pos) * 8
+        at = 0
+
+        def take(count):
+            nonlocal at
+            if at + count > nbits:
+                raise ValueError("LZ stream ends early")
+            at += count
+            return (bits >> (nbits - at)) & ((1 << count) - 1)
+
+        while len(out) - start < plain_len:
+            if take(1):
+                out.append(take(8))
+                continue
+            dist = take(8) + 1
+            length = take(4) + LZ_MIN_MATCH
+            if dist > len(out):
+                raise ValueError("LZ copy before the window")
+            for _ in range(length):
+                out.append(out[-dist])
+        if len(out) - start != plain_len:
+            raise ValueError("LZ copy past the block")
+        return bytes(out[start:])
+
+    def decode(self, data):
+        codecs = data[0]
+        count, pos = varint(data, 1)
+        if codecs & CODEC_KEY:
+            self.last = [0] * self.channels
+            self.window = b""
+
+        if codecs & CODEC_LZ:
+            plain_len, pos = varint(data, pos)
+            plain = self.lz_expand(data, pos, plain_len)
+        else:
+            plain = bytes(data[pos:])
+        self.window = (self.window + plain)[-LZ_WINDOW:]
+
+        samples = []
+        at = 0
+        for _ in range(count):
+            sample = []
+            for ch in range(self.channels):
+                if codecs & CODEC_DELTA:
+                    zz, at = varint(plain, at)
+                    delta = (zz >> 1) ^ -(zz & 1)
+                    value = (self.last[ch] + delta + 2**31) % 2**32 - 2**31
+                else:
+                    (value,) = struct.unpack_from("<i", plain, at)
+                    at += 4
+                self.last[ch] = value
+                sample.append(value)
+            samples.append(sample)
+        if at != len(plain):
+            raise ValueError("{} bytes left over in the block".format(len(plain) - at))
+        return codecs, samples
+
+
+def frames(conn):
+    buf = bytearray()
+    while True:
+        try:
+            length, pos = varint(buf, 0)
+            end = pos + 1 + length + (2 if len(buf) > pos and buf[pos] & FRAME_FLAG_CRC else 0)
+            if len(buf) >= end:
+                ftype = buf[pos]
+                payload = bytes(buf[pos + 1:pos + 1 + length])
+                if ftype & FRAME_FLAG_CRC:
+                    crc = buf[end - 2] | buf[end - 1] << 8
+                    if crc != crc16(buf[:end - 2]):
+                        raise ValueError("frame CRC mismatch")
+                del buf[:end]
+                yield ftype & ~FRAME_FLAG_CRC, payload
+                continue
+        except IndexError:
+            pass
+        data = conn.recv(4096)
+        if not data:
+            return
+        buf += data
+
+
+def print_samples(channels, payload):
+    for at in range(0, len(payload) - channels * 4 + 1, channels * 4):
+        print("    " + " ".join(str(value) for value in struct.unpack_from("<{}i".format(channels), payload, at)))
+
+
+def serve(conn, addr, accept, quiet, outbox):
+    decoder = None
+    try:
+        for ftype, payload in frames(conn):
+            if ftype == FRAME_HELLO:
+                version, offered, channels = payload[:3]
+                if version != VERSION:
+                    print("{}: unknown telemetry version {}".format(addr[0], version))
+                    return
+                codecs = offered & accept
+                decoder = Decoder(channels)
+                reply = bytes([VERSION, codecs, channels])
+                conn.sendall(encode_varint(len(reply)) + bytes([FRAME_HELLO]) + reply)
+                print("{}: {} channels, offered 0x{:x}, accepted 0x{:x}".format(addr[0], channels, offered, codecs))
+            elif ftype == FRAME_DATA and decoder is not None:
+                codecs, samples = decoder.decode(payload)
+                raw = len(samples) * decoder.channels * 4
+                print("{}: block of {} samples, codecs 0x{:02x}, {} of {} bytes, {:.0f}%".format(
+                    addr[0], len(samples), codecs, len(payload), raw, 100.0 * len(payload) / max(raw, 1)))
+                if not quiet:
+                    for sample in samples:
+                        print("    " + " ".join(str(value) for value in sample))
+            elif ftype == FRAME_PING:
+                conn.sendall(encode_varint(len(payload)) + bytes([FRAME_PONG]) + payload)
+            elif ftype == FRAME_RECORD and len(payload) >= 4:
+                # Records are plain samples, sent again after a reconnect until acknowledged
+                (seq,) = struct.unpack_from("<I", payload)
+                with outbox["lock"]:
+                    fresh = seq > outbox["seq"]
+                    outbox["seq"] = max(outbox["seq"], seq)
+                conn.sendall(encode_varint(4) + bytes([FRAME_ACK]) + struct.pack("<I", seq))
+                print("{}: record {}{}, {} bytes".format(addr[0], seq, "" if fresh else " again", len(payload) - 4))
+                if fresh and not quiet and decoder is not None:
+                    print_samples(decoder.channels, payload[4:])
+    except (ValueError, OSError) as err:
+        print("{}: {}".format(addr[0], err))
+    finally:
+        conn.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="0.0.0.0", help="address to listen on")
+    parser.add_argument("--port", type=int, default=4242, help="port to listen on, CLIENT_SERVER_PORT")
+    parser.add_argument("--codecs", choices=CODECS, default="delta_lz", help="codecs to accept")
+    parser.add_argument("--quiet", action="store_true", help="print block summaries only")
+    args = parser.parse_args()
+
+    # Newest outbox record seen, shared by the connections so a replay after a reconnect is spotted
+    outbox = {"seq": 0, "lock": threading.Lock()}
+
+    with socket.create_server((args.host, args.port), reuse_port=True) as sock:
+        print("Listening on {}:{}".format(args.host, args.port))
+        while True:
+            conn, addr = sock.accept()
+            threading.Thread(target=serve, args=(conn, addr, CODECS[args.codecs], args.quiet, outbox),
+                             daemon=True).start()
+
+
+if __name__ == "__main__":
+    main()
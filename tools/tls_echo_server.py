@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+"""Stand-in TLS server for trying the client's TLS transport on a LAN.
+
+Echoes whatever it receives, like the plain test server, and reports for every connection
+whether the client resumed its session or needed a full handshake:
+
+    openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:prime256v1 -nodes \\
+        -keyout server.key -out server.pem -days 365 -subj /CN=192.168.137.1 \\
+        -addext subjectAltName=IP:192.168.137.1
+    tools/tls_echo_server.py --cert server.pem --key server.key
+
+Build the firmware with -DPICO_CLIENT_TLS=ON -DPICO_CLIENT_TLS_CA=server.pem so the client
+checks the certificate. The server speaks TLS 1.2 only, as configured in inc/mbedtls_config.h,
+and issues session tickets, so a reconnect within the ticket lifetime should show up as resumed.
+"""
+import argparse
+import socket
+import ssl
+import threading
+import time
+
+
+def serve(conn, addr, stats, lock):
+    start = time.monotonic()
+    try:
+        conn.do_handshake()
+    except (ssl.SSLError, OSError) as err:
+        print("{}: handshake failed: {}".format(addr[0], err))
+        conn.close()
+        return
+
+    elapsed_ms = (time.monotonic() - start) * 1000
+    with lock:
+        stats["handshakes"] += 1
+        stats["resumed"] += conn.session_reused
+        print("{}: {} handshake in {:.1f} ms, {} resumed of {}".format(
+            addr[0], "resumed" if conn.session_reused else "full", elapsed_ms, stats["resumed"], stats["handshakes"]))
+
+    try:
+        while True:
+            data = conn.recv(4096)
+            if not data:
+                break
+            conn.sendall(data)
+    except (ssl.SSLError, OSError):
+        pass
+    finally:
+        conn.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--cert", required=True, help="server certificate, PEM")
+    parser.add_argument("--key", required=True, help="server private key, PEM")
+    parser.add_argument("--host", default="0.0.0.0", help="address to listen on")
+    parser.add_argument("--port", type=int, default=4242, help="port to listen on, CLIENT_SERVER_PORT")
+    parser.add_argument("--no-tickets", action="store_true", help="resume from the session cache only")
+    args = parser.parse_args()
+
+    context = ssl.SSLContext(ssl.PROTOCOL_TLS_SERVER)
+    context.minimum_version = ssl.TLSVersion.TLSv1_2
+    context.maximum_version = ssl.TLSVersion.TLSv1_2
+    context.load_cert_chain(args.cert, args.key)
+    if args.no_tickets:
+        context.options |= ssl.OP_NO_TICKET
+
+    stats = {"handshakes": 0, "resumed": 0}
+    lock = threading.Lock()
+
+    with socket.create_server((args.host, args.port), reuse_port=True) as sock:
+        print("Listening on {}:{}".format(args.host, args.port))
+        while True:
+            raw, addr = sock.accept()
+            conn = context.wrap_socket(raw, server_side=True, do_handshake_on_connect=False)
+            threading.Thread(target=serve, args=(conn, addr, stats, lock), daemon=True).start()
+
+
+if __name__ == "__main__":
+    main()
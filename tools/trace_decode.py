@@ -0,0 +1,164 @@
+#!/usr/bin/env python3
+"""Turn a trace dump into per-stage latency histograms.
+
+Build with -DPICO_CLIENT_TRACE=ON, press 't' on the console and save the output, then:
+
+    tools/trace_decode.py capture.txt
+
+Lines outside the dump are ignored, so a whole terminal log can be passed in. The event
+numbers match trace_event_t in inc/trace.h.
+"""
+import argparse
+import collections
+import sys
+
+RX_QUEUED = 1
+RX_CONSUMED = 2
+CONNECT_START = 3
+CONNECTED = 4
+DISCONNECTED = 5
+TX_OUTPUT = 6
+TX_ACKED = 7
+WIFI_STATE = 8
+SCHED_SLEEP = 9
+SCHED_WAKE = 10
+FRAME = 11
+PING = 12
+PONG = 13
+
+WIFI_STATES = {0: "DISCONNECTED", 1: "CONNECTING", 2: "CONNECTED"}
+
+
+def parse(lines):
+    """Yield (core, ticks_per_us, [(stamp, event, arg), ...]) for every core in the dump."""
+    core = None
+    for line in lines:
+        fields = line.split()
+        if not fields:
+            continue
+        if fields[0] == "TRACE":
+            if core is not None:
+                yield core
+            core = None
+            if fields[1] != "end":
+                info = dict(f.split("=", 1) for f in fields[1:])
+                core = (int(info["core"]), int(info["ticks_per_us"]), [])
+        elif fields[0] == "T" and core is not None and len(fields) == 4:
+            core[2].append((int(fields[1], 16), int(fields[2]), int(fields[3])))
+    if core is not None:
+        yield core
+
+
+def unwrap(records, ticks_per_us):
+    """Convert the 32-bit stamps to microseconds from the first event."""
+    events = []
+    elapsed = 0
+    previous = None
+    for stamp, event, arg in records:
+        if previous is not None:
+            elapsed += (stamp - previous) & 0xFFFFFFFF
+        previous = stamp
+        events.append((elapsed / ticks_per_us, event, arg))
+    return events
+
+
+def match_bytes(events, start, end, stages, name):
+    """Time each chunk from its start event until the end events have covered all its bytes."""
+    pending = collections.deque()
+    for t, event, arg in events:
+        if event == start:
+            pending.append([t, arg])
+        elif event == end:
+            remaining = arg
+            while remaining > 0 and pending:
+                chunk = pending[0]
+                used = min(chunk[1], remaining)
+                chunk[1] -= used
+                remaining -= used
+                if chunk[1] == 0:
+                    stages[name].append(t - chunk[0])
+                    pending.popleft()
+        elif event == DISCONNECTED:
+            pending.clear()
+
+
+def collect(events, stages):
+    match_bytes(events, RX_QUEUED, RX_CONSUMED, stages, "rx queued -> consumed")
+    match_bytes(events, TX_OUTPUT, TX_ACKED, stages, "tx output -> acked")
+
+    connect_start = {}
+    ping_at = {}
+    sleep_at = None
+    wake_at = None
+    wifi_at = None
+    wifi_state = None
+    for t, event, arg in events:
+        if event == CONNECT_START:
+            connect_start[arg] = t
+        elif event == CONNECTED and arg in connect_start:
+            stages["connect start -> connected"].append(t - connect_start.pop(arg))
+        elif event == DISCONNECTED and arg in connect_start:
+            stages["connect start -> failed"].append(t - connect_start.pop(arg))
+        elif event == PING:
+            ping_at[arg] = t
+        elif event == PONG and arg in ping_at:
+            stages["heartbeat ping -> pong"].append(t - ping_at.pop(arg))
+        elif event == WIFI_STATE:
+            if wifi_at is not None:
+                name = "wifi {} -> {}".format(WIFI_STATES.get(wifi_state, wifi_state), WIFI_STATES.get(arg, arg))
+                stages[name].append(t - wifi_at)
+            wifi_at, wifi_state = t, arg
+        elif event == SCHED_SLEEP:
+            if wake_at is not None:
+                stages["sched busy"].append(t - wake_at)
+            sleep_at = t
+        elif event == SCHED_WAKE:
+            if sleep_at is not None:
+                stages["sched sleep"].append(t - sleep_at)
+            wake_at = t
+
+
+def percentile(values, pct):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(round(pct / 100.0 * (len(ordered) - 1))))]
+
+
+def histogram(name, values, out):
+    out.write("{}: n={} p50={:.1f}us p99={:.1f}us max={:.1f}us\n".format(
+        name, len(values), percentile(values, 50), percentile(values, 99), max(values)))
+
+    # Power of two buckets in microseconds
+    buckets = collections.Counter()
+    for value in values:
+        bucket = 1
+        while bucket < value:
+            bucket *= 2
+        buckets[bucket] += 1
+
+    widest = max(buckets.values())
+    for bucket in sorted(buckets):
+        bar = "#" * max(1, buckets[bucket] * 40 // widest)
+        out.write("  <= {:>9}us {:>6} {}\n".format(bucket, buckets[bucket], bar))
+    out.write("\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("capture", nargs="?", help="saved console output, stdin if omitted")
+    args = parser.parse_args()
+
+    lines = open(args.capture, errors="replace") if args.capture else sys.stdin
+
+    for core, ticks_per_us, records in parse(lines):
+        stages = collections.defaultdict(list)
+        events = unwrap(records, ticks_per_us)
+        collect(events, stages)
+
+        frames = sum(1 for _, event, _ in events if event == FRAME)
+        sys.stdout.write("core {}: {} events, {} frames dispatched\n\n".format(core, len(events), frames))
+        for name in sorted(stages):
+            histogram(name, stages[name], sys.stdout)
+
+
+if __name__ == "__main__":
+    main()